@@ -0,0 +1,351 @@
+/*
+ * AssetLoader.cpp
+ *
+ *  Asynchronous asset loading with staged, budgeted GL uploads
+ */
+
+/* Header Inclusions */
+#include "AssetLoader.h"
+#include "Headless.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std; // standard namespace
+
+#define STAGING_ALIGNMENT 16 // every copy starts on a boundary that suits both buffer copies and pixel rows
+
+AssetLoader::AssetLoader(const AssetLoaderOptions &options)
+	: options(options), start(chrono::steady_clock::now())
+{
+	// worker 0 is the GL thread, which only helps out in finish(); the rest decode in the background
+	pool.reset(new TaskPool(options.async ? max(1u, options.threads) + 1 : 1));
+}
+
+AssetLoader::~AssetLoader()
+{
+	pool->wait(group); // a decode may still reference its asset
+
+	if (staging != 0)
+		glDeleteBuffers(1, &staging);
+}
+
+void AssetLoader::load(const string &name, UAssetDecodeFunc decode, UAssetReadyFunc ready)
+{
+	assets.push_back(unique_ptr<Asset>(new Asset));
+	Asset *asset = assets.back().get();
+	asset->name = name;
+	asset->decode = decode;
+	asset->ready = ready;
+
+	pool->submit(group, [asset]
+				 { asset->state = asset->decode(asset->payload) ? ASSET_DECODED : ASSET_FAILED; });
+
+	if (!options.async)
+		finish();
+}
+
+void AssetLoader::pump()
+{
+	upload(options.uploadBudget);
+}
+
+void AssetLoader::finish()
+{
+	pool->wait(group);
+	upload(SIZE_MAX);
+}
+
+void AssetLoader::endFrame()
+{
+	frames++;
+
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+
+	if (!firstFrameLogged)
+	{
+		cout << "First frame after " << elapsed.count() << " ms, " << resident << " of " << assets.size() << " assets resident" << endl;
+		firstFrameLogged = true;
+	}
+
+	if (!loadedLogged && !loading())
+	{
+		cout << "Fully loaded after " << elapsed.count() << " ms, " << frames << " frames, " << uploadedBytes / 1024.0 << " KB uploaded";
+		if (failed > 0)
+			cout << ", " << failed << " assets failed";
+		cout << endl;
+		loadedLogged = true;
+	}
+}
+
+/* Creates the GL objects of a freshly decoded asset with undefined contents */
+void AssetLoader::allocate(Asset &asset)
+{
+	AssetPayload &payload = asset.payload;
+
+	payload.bufferObjects.resize(payload.buffers.size());
+	glGenBuffers((GLsizei)payload.buffers.size(), payload.bufferObjects.data());
+	for (size_t i = 0; i < payload.buffers.size(); i++)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, payload.bufferObjects[i]);
+		glBufferData(GL_COPY_WRITE_BUFFER, payload.bufferSize(i), nullptr, GL_STATIC_DRAW);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	const TextureImage &image = payload.texture;
+	if (image.levels.empty())
+		return;
+
+	GLsizei levels = (GLsizei)image.levels.size();
+	if (payload.generateMips)
+	{
+		levels = 1;
+		for (uint32_t size = max(image.width, image.height); size > 1; size /= 2)
+			levels++;
+	}
+
+	GLenum internalFormat = UTextureInternalFormat(image.format);
+	bool compressed = image.format != TEXTURE_RGBA8;
+
+	glGenTextures(1, &payload.textureObject);
+	glBindTexture(GL_TEXTURE_2D, payload.textureObject);
+
+	if (GLEW_ARB_texture_storage)
+	{
+		glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, image.width, image.height);
+	}
+	else
+	{
+		for (GLint level = 0; level < levels; level++)
+		{
+			GLsizei width = max(1u, image.width >> level), height = max(1u, image.height >> level);
+			if (compressed)
+				glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, (GLsizei)UTextureLevelSize(image.format, width, height), nullptr);
+			else
+				glTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		}
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/* Appends the asset's next copies while the budget lasts, true once the whole asset is planned */
+bool AssetLoader::plan(Asset &asset, size_t &budget, vector<Copy> &copies)
+{
+	AssetPayload &payload = asset.payload;
+	size_t parts = payload.buffers.size() + payload.texture.levels.size();
+
+	auto stagingEnd = [&copies]
+	{
+		if (copies.empty())
+			return (size_t)0;
+		size_t end = copies.back().staging + copies.back().size;
+		return (end + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+	};
+
+	while (asset.part < parts)
+	{
+		if (asset.part < payload.buffers.size())
+		{
+			// buffers split at any byte
+			size_t remaining = payload.bufferSize(asset.part) - asset.offset;
+			size_t size = min(remaining, budget);
+			if (size == 0 && remaining > 0)
+				return false;
+
+			if (size > 0)
+				copies.push_back(Copy{&asset, asset.part, asset.offset, size, stagingEnd(), 0, 0});
+			budget -= size;
+			asset.offset += size;
+		}
+		else
+		{
+			// textures split between rows, of 4x4 blocks when compressed
+			const TextureImage &image = payload.texture;
+			size_t level = asset.part - payload.buffers.size();
+			uint32_t height = max(1u, image.height >> level);
+			uint32_t rows = image.format == TEXTURE_RGBA8 ? height : (height + 3) / 4;
+			size_t rowBytes = image.levels[level].size() / rows;
+			uint32_t firstRow = (uint32_t)(asset.offset / rowBytes);
+
+			// a row larger than the whole budget still goes through on its own
+			uint32_t count = (uint32_t)min<size_t>(rows - firstRow, budget / rowBytes);
+			if (count == 0 && copies.empty())
+				count = 1;
+			if (count == 0)
+				return false;
+
+			copies.push_back(Copy{&asset, asset.part, asset.offset, count * rowBytes, stagingEnd(), count, firstRow});
+			budget -= min(budget, count * rowBytes);
+			asset.offset += count * rowBytes;
+		}
+
+		if (asset.offset == (asset.part < payload.buffers.size() ? payload.bufferSize(asset.part) : payload.texture.levels[asset.part - payload.buffers.size()].size()))
+		{
+			asset.part++;
+			asset.offset = 0;
+		}
+	}
+
+	return true;
+}
+
+/* Moves up to 'budget' bytes of decoded assets into their GL objects through the staging buffer */
+void AssetLoader::upload(size_t budget)
+{
+	UPROFILE_SCOPE("AssetLoader::upload");
+
+	vector<Copy> copies;
+	vector<Asset *> completed;
+
+	for (unique_ptr<Asset> &entry : assets)
+	{
+		Asset &asset = *entry;
+
+		int state = asset.state;
+		if (state == ASSET_FAILED)
+		{
+			cout << "Asset " << asset.name << " failed to load, keeping its placeholder" << endl;
+			asset.state = ASSET_RESIDENT; // reported once, counted as failed
+			failed++;
+			continue;
+		}
+		if (state == ASSET_DECODED)
+		{
+			allocate(asset);
+			asset.state = ASSET_UPLOADING;
+		}
+		else if (state != ASSET_UPLOADING)
+		{
+			continue; // still decoding, or done
+		}
+
+		if (!plan(asset, budget, copies))
+			break; // out of budget, later assets wait their turn
+		completed.push_back(&asset);
+	}
+
+	if (!copies.empty())
+	{
+		size_t total = copies.back().staging + copies.back().size;
+
+		if (staging == 0)
+			glGenBuffers(1, &staging);
+		glBindBuffer(GL_COPY_READ_BUFFER, staging);
+
+		if (total > stagingSize)
+		{
+			stagingSize = max(total, options.uploadBudget + STAGING_ALIGNMENT);
+			glBufferData(GL_COPY_READ_BUFFER, stagingSize, nullptr, GL_STREAM_DRAW);
+		}
+
+		// invalidating lets the driver hand out fresh memory while last frame's copies are still in flight
+		unsigned char *mapped = (unsigned char *)glMapBufferRange(GL_COPY_READ_BUFFER, 0, total, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		for (const Copy &copy : copies)
+		{
+			AssetPayload &payload = copy.asset->payload;
+			const unsigned char *source = copy.part < payload.buffers.size() ? payload.bufferData(copy.part)
+																			: payload.texture.levels[copy.part - payload.buffers.size()].data();
+			memcpy(mapped + copy.staging, source + copy.source, copy.size);
+		}
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+		for (const Copy &copy : copies)
+		{
+			AssetPayload &payload = copy.asset->payload;
+
+			if (copy.part < payload.buffers.size())
+			{
+				glBindBuffer(GL_COPY_WRITE_BUFFER, payload.bufferObjects[copy.part]);
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, copy.staging, copy.source, copy.size);
+				continue;
+			}
+
+			const TextureImage &image = payload.texture;
+			GLint level = (GLint)(copy.part - payload.buffers.size());
+			GLsizei width = max(1u, image.width >> level), height = max(1u, image.height >> level);
+
+			glBindTexture(GL_TEXTURE_2D, payload.textureObject);
+			if (image.format == TEXTURE_RGBA8)
+			{
+				glTexSubImage2D(GL_TEXTURE_2D, level, 0, copy.firstRow, width, copy.rows, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid *)copy.staging);
+			}
+			else
+			{
+				GLint y = copy.firstRow * 4;
+				glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, y, width, min<GLsizei>(copy.rows * 4, height - y),
+										  UTextureInternalFormat(image.format), (GLsizei)copy.size, (GLvoid *)copy.staging);
+			}
+		}
+
+		// later glTexImage2D calls must read client memory again
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		uploadedBytes += total;
+		URecordFrameStat("upload_kb", total / 1024.0);
+	}
+
+	for (Asset *asset : completed)
+		complete(*asset);
+}
+
+/* Finishes the GL side of a fully copied asset and hands it over */
+void AssetLoader::complete(Asset &asset)
+{
+	AssetPayload &payload = asset.payload;
+
+	if (payload.generateMips && payload.textureObject != 0)
+	{
+		glBindTexture(GL_TEXTURE_2D, payload.textureObject);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	asset.ready(payload);
+	asset.state = ASSET_RESIDENT;
+	resident++;
+
+	// the CPU copies are no longer needed, nor what the views borrowed
+	payload.buffers = vector<vector<unsigned char>>();
+	payload.views.clear();
+	payload.viewOwner.reset();
+	payload.texture.levels = vector<vector<unsigned char>>();
+}
+
+/* Parses --sync-load, --upload-budget KB and --loader-threads N */
+bool UParseAssetLoaderArgs(int argc, char *argv[], AssetLoaderOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--sync-load")
+		{
+			options.async = false;
+		}
+		else if (arg == "--upload-budget" && i + 1 < argc)
+		{
+			int kilobytes = atoi(argv[++i]);
+			if (kilobytes <= 0)
+			{
+				cout << "--upload-budget expects a positive size in KB" << endl;
+				return false;
+			}
+			options.uploadBudget = (size_t)kilobytes * 1024;
+		}
+		else if (arg == "--loader-threads" && i + 1 < argc)
+		{
+			options.threads = (unsigned)max(1, atoi(argv[++i]));
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,133 @@
+/*
+ * AssetLoader.h
+ *
+ *  Asynchronous asset loading: file I/O and decode run on loader threads, the results are
+ *  staged through unpack buffers and copied to GL a budgeted number of bytes per frame
+ */
+
+#ifndef ASSETLOADER_H
+#define ASSETLOADER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "TaskPool.h"
+#include "TextureFile.h"
+
+/* Command line options of the loader */
+struct AssetLoaderOptions
+{
+	bool async = true;					 // --sync-load loads everything before the first frame
+	size_t uploadBudget = 1024 * 1024; // --upload-budget KB copied to GL per frame
+	unsigned threads = 1;				 // --loader-threads N
+};
+
+/* Bytes a payload borrows instead of owning */
+struct AssetView
+{
+	const unsigned char *data = nullptr;
+	size_t size = 0;
+};
+
+/* What a loader thread hands over to the GL thread */
+struct AssetPayload
+{
+	std::vector<std::vector<unsigned char>> buffers; // each becomes one GL buffer object, in order
+	std::vector<AssetView> views;					 // when set, buffer i is staged from views[i] instead, without a copy
+	std::shared_ptr<void> viewOwner;				 // keeps the memory of the views alive, e.g. a mapped file, until the asset is resident
+	TextureImage texture;							 // becomes a 2D texture when it has levels
+	bool generateMips = false;						 // allocate the whole chain, upload level 0 and let GL filter the rest
+
+	// filled in by the loader once every byte is resident, the ready callback takes them over
+	std::vector<GLuint> bufferObjects;
+	GLuint textureObject = 0;
+
+	const unsigned char *bufferData(size_t i) const { return i < views.size() && views[i].data ? views[i].data : buffers[i].data(); }
+	size_t bufferSize(size_t i) const { return i < views.size() && views[i].data ? views[i].size : buffers[i].size(); }
+};
+
+typedef std::function<bool(AssetPayload &payload)> UAssetDecodeFunc; // loader thread, must not touch GL
+typedef std::function<void(AssetPayload &payload)> UAssetReadyFunc;	 // GL thread, swaps the real resource in
+
+class AssetLoader
+{
+public:
+	explicit AssetLoader(const AssetLoaderOptions &options); // the clock for the load times starts here
+	~AssetLoader();
+
+	AssetLoader(const AssetLoader &) = delete;
+	AssetLoader &operator=(const AssetLoader &) = delete;
+
+	// queues a decode on a loader thread; with --sync-load it is decoded and uploaded before this returns
+	void load(const std::string &name, UAssetDecodeFunc decode, UAssetReadyFunc ready);
+
+	void pump();	 // GL thread, before drawing: uploads finished decodes within the frame's byte budget
+	void finish();	 // GL thread: waits for every queued asset and uploads it regardless of the budget
+	void endFrame(); // GL thread, after drawing: logs the time to the first frame and to fully loaded
+
+	bool loading() const { return resident + failed < assets.size(); }
+
+private:
+	enum State
+	{
+		ASSET_DECODING,
+		ASSET_DECODED,
+		ASSET_FAILED,
+		ASSET_UPLOADING,
+		ASSET_RESIDENT,
+	};
+
+	struct Asset
+	{
+		std::string name;
+		UAssetDecodeFunc decode;
+		UAssetReadyFunc ready;
+		AssetPayload payload;
+		std::atomic<int> state{ASSET_DECODING};
+
+		// upload cursor: buffers first, then texture levels, rows of texels or 4x4 blocks within a level
+		size_t part = 0;
+		size_t offset = 0;
+	};
+
+	/* One copy out of the staging buffer, planned before the buffer is mapped */
+	struct Copy
+	{
+		Asset *asset;
+		size_t part;
+		size_t source;	// byte offset in the payload part
+		size_t size;	// bytes
+		size_t staging; // byte offset in the staging buffer
+		uint32_t rows;	// texture parts: first row and row count, in texels or blocks
+		uint32_t firstRow;
+	};
+
+	void allocate(Asset &asset);
+	bool plan(Asset &asset, size_t &budget, std::vector<Copy> &copies);
+	void upload(size_t budget);
+	void complete(Asset &asset);
+
+	AssetLoaderOptions options;
+	std::unique_ptr<TaskPool> pool; // its own pool: the render thread never waits on it, so a decode never stalls a frame
+	TaskGroup group;
+	std::vector<std::unique_ptr<Asset>> assets; // in submission order, uploads go first come first served
+	size_t resident = 0, failed = 0;
+
+	GLuint staging = 0; // pixel / copy-read unpack buffer, orphaned every frame
+	size_t stagingSize = 0;
+
+	std::chrono::steady_clock::time_point start;
+	int frames = 0;
+	size_t uploadedBytes = 0;
+	bool firstFrameLogged = false, loadedLogged = false;
+};
+
+bool UParseAssetLoaderArgs(int argc, char *argv[], AssetLoaderOptions &options);
+
+#endif
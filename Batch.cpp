@@ -0,0 +1,325 @@
+/*
+ * Batch.cpp
+ *
+ *  Offline render mode: a job file of camera poses, projections, sizes and output paths
+ *  rendered by a pool of worker processes, each with its own headless context, with a
+ *  JSON manifest of what every job took
+ */
+
+/* Header Inclusions */
+#include "Batch.h"
+#include "Headless.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std; // standard namespace
+
+/* Heads the memory shared with the workers, followed by one setup time per worker and one result per job */
+struct BatchShared
+{
+	atomic<int> nextJob;
+	int64_t startNs; // steady clock at the start of the batch, the same clock in every process
+};
+
+/* Parses --batch file, --batch-workers N and --manifest file */
+bool UParseBatchArgs(int argc, char *argv[], BatchOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--batch")
+		{
+			options.jobPath = i + 1 < argc ? argv[++i] : "";
+			if (options.jobPath.empty())
+			{
+				cout << "--batch expects a job file" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--batch-workers")
+		{
+			options.workers = i + 1 < argc ? atoi(argv[++i]) : -1;
+			if (options.workers < 0)
+			{
+				cout << "--batch-workers expects a process count, 0 for one per hardware thread" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--manifest")
+		{
+			options.manifestPath = i + 1 < argc ? argv[++i] : "";
+			if (options.manifestPath.empty())
+			{
+				cout << "--manifest expects a file name" << endl;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/* Reads the pose, projection and size fields shared by both line forms */
+static bool UReadJobFields(istream &fields, BatchJob &job)
+{
+	string size;
+	if (!(fields >> job.pitch >> job.distance >> job.projection >> size))
+		return false;
+
+	return (job.projection == 'p' || job.projection == 'o') && job.distance > 0.0f &&
+		   sscanf(size.c_str(), "%dx%d", &job.width, &job.height) == 2 && job.width > 0 && job.height > 0;
+}
+
+/*
+ * One job per line, '#' starts a comment:
+ *   yaw pitch distance p|o WIDTHxHEIGHT output.ppm
+ *   turntable count pitch distance p|o WIDTHxHEIGHT prefix   (count stills, yaw in equal steps, prefix_000.ppm ...)
+ */
+bool UReadBatchJobs(const string &path, vector<BatchJob> &jobs)
+{
+	ifstream file(path);
+	if (!file)
+	{
+		cout << "Cannot read job file " << path << endl;
+		return false;
+	}
+
+	string text;
+	for (int line = 1; getline(file, text); line++)
+	{
+		text = text.substr(0, text.find('#'));
+		stringstream fields(text);
+
+		string first;
+		if (!(fields >> first))
+			continue;
+
+		BatchJob job;
+		job.line = line;
+		bool valid;
+
+		if (first == "turntable")
+		{
+			int count = 0;
+			string prefix;
+			valid = (bool)(fields >> count) && count > 0 && UReadJobFields(fields, job) && (bool)(fields >> prefix);
+
+			for (int i = 0; valid && i < count; i++)
+			{
+				char name[16];
+				snprintf(name, sizeof(name), "_%03d.ppm", i);
+
+				BatchJob still = job;
+				still.yaw = 360.0f * i / count;
+				still.output = prefix + name;
+				jobs.push_back(still);
+			}
+		}
+		else
+		{
+			job.yaw = (float)atof(first.c_str());
+			valid = UReadJobFields(fields, job) && (bool)(fields >> job.output);
+			if (valid)
+				jobs.push_back(job);
+		}
+
+		if (!valid)
+		{
+			cout << path << ":" << line << ": expected 'yaw pitch distance p|o WxH output' or 'turntable count pitch distance p|o WxH prefix'" << endl;
+			return false;
+		}
+	}
+
+	if (jobs.empty())
+	{
+		cout << path << " has no jobs" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+static int64_t UBatchClock(void)
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* One worker: sets up its renderer, then claims jobs until none are left */
+static int UBatchWorker(int worker, const vector<BatchJob> &jobs, BatchShared *shared, double *setupMs, BatchResult *results,
+						UBatchSetupFunc setup, UBatchRenderFunc render, UBatchTeardownFunc teardown)
+{
+	int64_t start = UBatchClock();
+	if (!setup(jobs[0]))
+	{
+		cout << "Batch worker " << worker << " could not set up its renderer" << endl;
+		return 1; // no teardown of a renderer that may be half made; the worker is done either way
+	}
+	setupMs[worker] = (UBatchClock() - start) / 1.0e6;
+
+	// jobs are claimed one at a time, so a worker that draws slow stills takes fewer of them
+	for (int job = shared->nextJob.fetch_add(1); job < (int)jobs.size(); job = shared->nextJob.fetch_add(1))
+	{
+		BatchResult result;
+		result.worker = worker;
+		result.startMs = (UBatchClock() - shared->startNs) / 1.0e6;
+		result.written = render(jobs[job], result);
+		results[job] = result;
+
+		if (!result.written)
+			cout << "Job " << job << " (line " << jobs[job].line << ", " << jobs[job].output << ") failed" << endl;
+	}
+
+	teardown();
+	return 0;
+}
+
+static void UWriteManifest(ostream &out, const vector<BatchJob> &jobs, const BatchResult *results,
+						   const double *setupMs, int workers, double seconds, int written, const string &renderer)
+{
+	out << "{\n";
+	out << "  \"renderer\": " << UJsonString(renderer) << ",\n";
+	out << "  \"jobs\": " << jobs.size() << ",\n";
+	out << "  \"written\": " << written << ",\n";
+	out << "  \"workers\": " << workers << ",\n";
+	out << "  \"seconds\": " << seconds << ",\n";
+	out << "  \"images_per_second\": " << (seconds > 0.0 ? written / seconds : 0.0) << ",\n";
+	out << "  \"setup_ms\": [";
+	for (int i = 0; i < workers; i++)
+		out << (i ? ", " : "") << setupMs[i];
+	out << "],\n  \"results\": [";
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		const BatchJob &job = jobs[i];
+		const BatchResult &result = results[i];
+		out << (i ? ",\n" : "\n") << "    {\"output\": " << UJsonString(job.output) << ", \"yaw\": " << job.yaw << ", \"pitch\": " << job.pitch
+			<< ", \"distance\": " << job.distance << ", \"projection\": " << UJsonString(string(1, job.projection)) << ", \"width\": " << job.width
+			<< ", \"height\": " << job.height << ", \"worker\": " << result.worker << ", \"written\": " << (result.written ? "true" : "false")
+			<< ", \"start_ms\": " << result.startMs << ", \"render_ms\": " << result.renderMs << ", \"write_ms\": " << result.writeMs << "}";
+	}
+	out << "\n  ]\n}\n";
+}
+
+/* Runs every job across the worker processes and writes the manifest; non-zero when a job was not written */
+int URunBatch(const BatchOptions &options, const vector<BatchJob> &jobs, UBatchSetupFunc setup, UBatchRenderFunc render,
+			  UBatchTeardownFunc teardown, const string &renderer)
+{
+	int workers = options.workers > 0 ? options.workers : (int)max(1u, thread::hardware_concurrency());
+	workers = min(workers, (int)jobs.size());
+
+#ifdef _WIN32
+	workers = 1; // no fork: the single worker runs in this process
+#endif
+
+	// the queue and the results are shared with the workers, which fill them in place
+	size_t bytes = sizeof(BatchShared) + workers * sizeof(double) + jobs.size() * sizeof(BatchResult);
+#ifdef _WIN32
+	void *memory = calloc(1, bytes);
+#else
+	void *memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+	{
+		cout << "Cannot map the batch queue" << endl;
+		return -1;
+	}
+#endif
+
+	BatchShared *shared = new (memory) BatchShared();
+	double *setupMs = (double *)(shared + 1);
+	BatchResult *results = (BatchResult *)(setupMs + workers);
+	for (size_t i = 0; i < jobs.size(); i++)
+		new (&results[i]) BatchResult();
+	shared->nextJob.store(0);
+	shared->startNs = UBatchClock();
+
+	cout << "[Batch] " << jobs.size() << " jobs from " << options.jobPath << " on " << workers << (workers == 1 ? " worker" : " workers")
+		 << " (" << renderer << ")" << endl;
+
+	if (workers == 1)
+	{
+		UBatchWorker(0, jobs, shared, setupMs, results, setup, render, teardown);
+	}
+#ifndef _WIN32
+	else
+	{
+		// each worker is a process with its own context; nothing GL exists yet, so nothing is shared by accident
+		cout.flush();
+		vector<pid_t> children;
+		for (int worker = 0; worker < workers; worker++)
+		{
+			pid_t child = fork();
+			if (child == 0)
+			{
+				int status = UBatchWorker(worker, jobs, shared, setupMs, results, setup, render, teardown);
+				cout.flush();
+				_exit(status);
+			}
+			if (child < 0)
+			{
+				cout << "Cannot start batch worker " << worker << ", continuing with " << worker << endl;
+				break;
+			}
+			children.push_back(child);
+		}
+
+		for (pid_t child : children)
+			waitpid(child, NULL, 0);
+	}
+#endif
+
+	double seconds = (UBatchClock() - shared->startNs) / 1.0e9;
+
+	int written = 0;
+	vector<double> renderMs;
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		if (!results[i].written)
+			continue;
+		written++;
+		renderMs.push_back(results[i].renderMs);
+	}
+	sort(renderMs.begin(), renderMs.end());
+
+	cout << "[Batch] " << written << " of " << jobs.size() << " images in " << seconds << " s, " << (seconds > 0.0 ? written / seconds : 0.0)
+		 << " images/s";
+	if (!renderMs.empty())
+		cout << ", render ms p50 " << renderMs[(renderMs.size() - 1) / 2] << " max " << renderMs.back();
+	cout << endl;
+
+	bool manifestWritten = false;
+	ofstream file(options.manifestPath);
+	if (file)
+	{
+		UWriteManifest(file, jobs, results, setupMs, workers, seconds, written, renderer);
+		manifestWritten = true;
+		cout << "Manifest written to " << options.manifestPath << endl;
+	}
+	else
+	{
+		cout << "Cannot write " << options.manifestPath << endl;
+	}
+
+	shared->~BatchShared();
+#ifdef _WIN32
+	free(memory);
+#else
+	munmap(memory, bytes);
+#endif
+
+	return manifestWritten && written == (int)jobs.size() ? 0 : -1;
+}
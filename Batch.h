@@ -0,0 +1,53 @@
+/*
+ * Batch.h
+ *
+ *  Offline render mode: a job file of camera poses, projections, sizes and output paths
+ *  rendered by a pool of worker processes, each with its own headless context, with a
+ *  JSON manifest of what every job took
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+
+/* Command line options of the batch mode */
+struct BatchOptions
+{
+	std::string jobPath;						 // --batch jobs.txt renders every job in the file and exits
+	int workers = 0;							 // --batch-workers N processes, 0 uses every hardware thread
+	std::string manifestPath = "manifest.json"; // --manifest file for the per-job timings
+};
+
+/* One still: the camera orbits the chair like the mouse does, looking at the origin */
+struct BatchJob
+{
+	float yaw = 0.0f, pitch = 0.0f; // degrees
+	float distance = 5.0f;			// length of the camera front vector, 5 in the interactive view
+	char projection = 'p';			// 'p' perspective or 'o' orthographic, as currentProjection
+	int width = 1064, height = 800;
+	std::string output; // PPM path
+	int line = 0;		// in the job file, for messages
+};
+
+/* What one job took; kept trivially copyable so workers can fill it in shared memory */
+struct BatchResult
+{
+	int worker = -1;	   // process that rendered it, -1 if no worker got to it
+	bool written = false;  // image rendered and written
+	double startMs = 0.0;  // since the batch started
+	double renderMs = 0.0; // drawing the frame until the renderer finished it
+	double writeMs = 0.0;  // reading it back and writing the file
+};
+
+typedef bool (*UBatchSetupFunc)(const BatchJob &first);						 // once per worker, before its first job
+typedef bool (*UBatchRenderFunc)(const BatchJob &job, BatchResult &result); // renders and writes one job, fills the times
+typedef void (*UBatchTeardownFunc)(void);									 // once per worker, after its last job
+
+bool UParseBatchArgs(int argc, char *argv[], BatchOptions &options);
+bool UReadBatchJobs(const std::string &path, std::vector<BatchJob> &jobs);
+int URunBatch(const BatchOptions &options, const std::vector<BatchJob> &jobs, UBatchSetupFunc setup, UBatchRenderFunc render,
+			  UBatchTeardownFunc teardown, const std::string &renderer);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * CameraSim.cpp
+ *
+ *  Fixed-timestep camera simulation with interpolated rendering
+ */
+
+/* Header Inclusions */
+#include "CameraSim.h"
+#include "FrameTrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std; // standard namespace
+
+#define CAMERA_MAX_CATCH_UP 0.25 // seconds simulated at most per advance, a stalled frame does not snowball
+
+CameraSim::CameraSim(const CameraSimOptions &options)
+	: options(options)
+{
+}
+
+void CameraSim::push(CameraEventType type, unsigned char key, float dx, float dy)
+{
+	CameraEvent event{UCameraClock(), type, key, dx, dy};
+	UTraceEvent(event); // input as it arrived, replays push it stamped
+	push(event);
+}
+
+void CameraSim::push(const CameraEvent &event)
+{
+	events.push_back(event);
+}
+
+void CameraSim::advance(double now)
+{
+	double dt = 1.0 / options.stepHz;
+
+	if (simulated < 0.0)
+		simulated = now;
+
+	if (now - simulated > CAMERA_MAX_CATCH_UP)
+		simulated = now - CAMERA_MAX_CATCH_UP;
+
+	while (simulated + dt <= now)
+	{
+		step(simulated + dt);
+		simulated += dt;
+	}
+
+	alpha = (now - simulated) / dt;
+}
+
+/* One fixed step: events stamped before its end, then the held keys for its duration */
+void CameraSim::step(double stepEnd)
+{
+	float dt = (float)(1.0 / options.stepHz);
+	const glm::vec3 up(0.0f, 1.0f, 0.0f);
+
+	previous = current;
+	stepCount++;
+
+	while (!events.empty() && events.front().time <= stepEnd)
+	{
+		const CameraEvent &event = events.front();
+
+		switch (event.type)
+		{
+		case CAMERA_KEY_DOWN:
+			if (event.key == 'q')
+			{
+				// a reset jumps, it does not glide back
+				current.position = previous.position = glm::vec3(0.0f);
+			}
+			else if (event.key != 0 && strchr("lrud", event.key) && heldKeys.find(event.key) == string::npos)
+			{
+				heldKeys += event.key;
+			}
+			break;
+		case CAMERA_KEY_UP:
+			heldKeys.erase(remove(heldKeys.begin(), heldKeys.end(), event.key), heldKeys.end());
+			break;
+		case CAMERA_ORBIT:
+			current.yaw += event.dx;
+			current.pitch = min(89.0f, max(-89.0f, current.pitch + event.dy)); // maintain a 90 degree pitch for gimbal lock
+			break;
+		case CAMERA_ZOOM:
+			current.position += options.zoomSpeed * event.dy * UCameraFront(current);
+			break;
+		}
+
+		events.pop_front();
+	}
+
+	// pan along the camera's right and up axes at a constant speed, however long the frames take
+	glm::vec3 right = glm::normalize(glm::cross(UCameraFront(current), up));
+	for (char key : heldKeys)
+	{
+		if (key == 'l')
+			current.position -= right * options.panSpeed * dt;
+		else if (key == 'r')
+			current.position += right * options.panSpeed * dt;
+		else if (key == 'u')
+			current.position -= up * options.panSpeed * dt;
+		else if (key == 'd')
+			current.position += up * options.panSpeed * dt;
+	}
+}
+
+CameraState CameraSim::interpolated() const
+{
+	float t = (float)min(1.0, max(0.0, alpha));
+
+	CameraState state;
+	state.position = previous.position + (current.position - previous.position) * t;
+	state.yaw = previous.yaw + (current.yaw - previous.yaw) * t;
+	state.pitch = previous.pitch + (current.pitch - previous.pitch) * t;
+	return state;
+}
+
+bool CameraSim::active() const
+{
+	bool blending = current.position != previous.position || current.yaw != previous.yaw || current.pitch != previous.pitch;
+	return !heldKeys.empty() || !events.empty() || blending;
+}
+
+double UCameraClock(void)
+{
+	static const auto start = chrono::steady_clock::now();
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/* Same radians to vector conversion the mouse callbacks always used */
+glm::vec3 UCameraFront(const CameraState &state)
+{
+	return glm::vec3(5.0f * cos(state.yaw), 5.0f * sin(state.pitch), sin(state.yaw) * cos(state.pitch) * 5.0f);
+}
+
+/* Parses --sim-rate N */
+void UParseCameraSimArgs(int argc, char *argv[], CameraSimOptions &options)
+{
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (string(argv[i]) == "--sim-rate")
+			options.stepHz = max(10.0, atof(argv[++i]));
+	}
+}
@@ -0,0 +1,80 @@
+/*
+ * CameraSim.h
+ *
+ *  Fixed-timestep camera simulation: input callbacks queue timestamped events, the
+ *  simulation consumes them in steps of constant length and the renderer draws a
+ *  blend of the last two steps, so camera motion is independent of the frame rate
+ */
+
+#ifndef CAMERASIM_H
+#define CAMERASIM_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <GL/glm/glm.hpp>
+
+/* What the renderer needs to place the camera */
+struct CameraState
+{
+	glm::vec3 position = glm::vec3(0.0f);
+	float yaw = 0.0f;	// radians
+	float pitch = 0.0f; // radians, clamped to +-89
+};
+
+/* Input as the GLUT callbacks saw it */
+enum CameraEventType
+{
+	CAMERA_KEY_DOWN, // key: pan keys move while held, 'q' resets the position
+	CAMERA_KEY_UP,
+	CAMERA_ORBIT, // dx, dy: yaw and pitch change in radians
+	CAMERA_ZOOM,  // dy: mouse travel in pixels, positive moves towards the target
+};
+
+struct CameraEvent
+{
+	double time; // seconds on the simulation clock
+	CameraEventType type;
+	unsigned char key;
+	float dx, dy;
+};
+
+/* Command line options and tuning of the simulation */
+struct CameraSimOptions
+{
+	double stepHz = 120.0;	 // --sim-rate N fixed steps per second
+	float panSpeed = 0.3f;	 // units per second while a pan key is held
+	float zoomSpeed = 0.001f; // camera front vectors per pixel of mouse travel
+};
+
+class CameraSim
+{
+public:
+	explicit CameraSim(const CameraSimOptions &options = CameraSimOptions());
+
+	void push(CameraEventType type, unsigned char key = 0, float dx = 0.0f, float dy = 0.0f); // stamped with the simulation clock
+	void push(const CameraEvent &event);													  // already stamped, e.g. replayed
+
+	void advance(double now); // runs every whole step up to 'now'
+	CameraState interpolated() const; // between the last two steps, by how far 'now' got into the next one
+
+	bool active() const; // held keys, queued events or a step still being blended in: keep producing frames
+	uint64_t steps() const { return stepCount; }
+
+private:
+	void step(double stepEnd);
+
+	CameraSimOptions options;
+	CameraState previous, current;
+	std::deque<CameraEvent> events;
+	std::string heldKeys;
+	double simulated = -1.0; // simulation clock time of 'current', negative until the first advance
+	double alpha = 0.0;
+	uint64_t stepCount = 0;
+};
+
+double UCameraClock(void); // seconds since the first call, the time base for events
+glm::vec3 UCameraFront(const CameraState &state);
+void UParseCameraSimArgs(int argc, char *argv[], CameraSimOptions &options);
+
+#endif
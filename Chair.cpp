@@ -7,7 +7,12 @@
  */
 
 /* Header Inclusions */
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 
@@ -19,6 +24,71 @@
 /* Soil Image Loader inclusion */
 #include "SOIL2/SOIL2.h"
 
+/* Precompressed DDS / KTX2 textures */
+#include "TextureFile.h"
+
+/* Offscreen benchmark harness */
+#include "Headless.h"
+
+/* Binary mesh files, compressed vertex layouts and levels of detail */
+#include "MeshFile.h"
+#include "VertexFormat.h"
+#include "MeshOptimize.h"
+#include "MeshLod.h"
+
+/* Instanced showroom scene and its frustum and occlusion culling */
+#include "Showroom.h"
+#include "Culling.h"
+#include "Occlusion.h"
+
+/* Background loading with budgeted uploads */
+#include "AssetLoader.h"
+
+/* Checked shader builds with a program binary cache */
+#include "ShaderCache.h"
+
+/* On-demand and capped redraws of the window */
+#include "FramePacer.h"
+
+/* Frame-rate independent camera input */
+#include "CameraSim.h"
+
+/* Input and GL call capture, replayed headless */
+#include "FrameTrace.h"
+
+/* Every frame read back without stalls and streamed to disk */
+#include "FrameRecorder.h"
+
+/* Scoped CPU / GPU timers, console summary and trace export */
+#include "Profiler.h"
+
+/* Tiled SIMD rasterizer for rendering without a GPU */
+#include "SoftRaster.h"
+
+/* Offline stills from a job file on a pool of worker processes */
+#include "Batch.h"
+
+/* Hundreds of local lights through a froxel grid */
+#include "Clustered.h"
+
+/* Baked diffuse light and ambient occlusion for the static chair */
+#include "Lightmap.h"
+
+/* Sorted draw commands and a GL state shadow */
+#include "RenderQueue.h"
+
+/* Frame and object uniform blocks fed from a fenced ring buffer */
+#include "UniformBuffers.h"
+
+/* Transform hierarchy with structure-of-arrays storage */
+#include "SceneGraph.h"
+
+/* Finishes packed into texture array layers */
+#include "Materials.h"
+
+/* Finish mip levels streamed under a memory budget */
+#include "TextureStreamer.h"
+
 using namespace std; // standard namespace
 
 #define WINDOW_TITLE "Hanah Deering | Zig Zag Chair - Designed by Gerrit Rietveld (1934)" // window title macro
@@ -27,13 +97,153 @@ using namespace std; // standard namespace
 #ifndef GLSL
 #define GLSL(Version, Source) "#version " #Version "\n" #Source
 #endif
+#ifndef GLSL_PRELUDE
+#define GLSL_PRELUDE(Source) #Source "\n" // shared declarations, without a #version line
+#endif
 
 /* Variable declarations for shader, window size initialization, buffer and array objects */
 GLint objShaderProgram, lampShaderProgram, WindowWidth = 1064, WindowHeight = 800;
 GLuint ObjVAO, LightVAO, VBO, EBO, texture;
 
-GLfloat cameraSpeed = 0.005f; // movement speed per frame
-GLfloat zoomSpeed = 0.005f;	  // movement speed per frame when using mouse
+// chair geometry: vertex layout, index range and submeshes, built in or from a --mesh file
+string meshPath, exportMeshPath;
+bool optimizeMesh = true; // run the built-in chair through the mesh optimizer, --no-optimize keeps the hand-written order
+vector<MeshAttribute> chairLayout;
+GLsizei chairStride;
+GLsizei chairIndexCount;
+GLenum chairIndexType = GL_UNSIGNED_INT;
+vector<MeshSubmesh> chairSubmeshes;
+vector<MeshLod> chairLods; // empty, or every level of the index buffer with the full detail first
+
+/* Chair geometry as a loader thread prepared it, applied on the GL thread once its buffers are resident */
+struct ChairMesh
+{
+	vector<MeshAttribute> layout;
+	GLsizei stride = 0;
+	GLsizei indexCount = 0;
+	GLenum indexType = GL_UNSIGNED_INT;
+	vector<MeshSubmesh> submeshes;
+	vector<MeshLod> lods;
+	Bounds bounds;
+	VertexDecode decode;
+	string source;		  // "the built-in chair" or the --mesh path, for the console
+	double loadMs = 0.0; // file read, optimization and packing on the loader thread
+	bool lightmapped = false; // unwrapped, with lightmap coordinates in the layout
+	OccluderMesh occluder;	  // for --occlusion, built while the positions are still floats
+};
+
+// wood texture: a precompressed DDS / KTX2 file when one is available, the JPG through SOIL otherwise
+string texturePath;
+size_t textureBytes; // GPU memory taken by the texture and its mip chain
+
+// compressed vertex layout selected on the command line and the constants that undo it in the shaders
+VertexFormatOptions vertexFormat;
+VertexDecode vertexDecode;
+GLsizeiptr vertexBufferBytes, indexBufferBytes; // GPU memory taken by the chair's geometry
+
+// showroom instancing: one draw call for every chair
+GLint objInstancedShaderProgram;
+GLuint ShowroomVAO, InstanceVBO;
+ShowroomOptions showroom;
+vector<ChairInstance> chairInstances;
+
+// showroom culling: BVH over the chairs, the chairs that passed this frame and the chairs that moved
+TaskPool *taskPool;
+Bounds chairBounds;
+Bvh showroomBvh;
+vector<uint32_t> visibleInstances, movedInstances;
+vector<ChairInstance> visibleInstanceData;
+GLfloat sceneTime = 0.0f; // seconds driving the showroom animation
+
+// transform hierarchy: the lamp hangs off the chair, every showroom chair off its spot; only what moves is recomputed
+SceneGraph sceneGraph;
+SceneNode chairNode, lampNode;
+vector<SceneNode> showroomSpots, showroomChairs;
+vector<uint32_t> movingInstances; // the chairs of --moving
+
+// shader programs are reloaded from here when the sources and driver match
+ShaderCacheOptions shaderCache;
+
+// window redraws: every frame, or only when something changed
+FramePacerOptions framePacer;
+
+// asset loading: the chair and its texture start as placeholders and are swapped once uploaded
+AssetLoaderOptions loaderOptions;
+AssetLoader *assetLoader;
+
+// camera input runs through a fixed-timestep simulation, pan and zoom speeds live in its options
+CameraSimOptions cameraOptions;
+CameraSim cameraSim;
+
+// capture and replay: the trace being replayed, its call re-issuer and the frames that issued other calls than captured
+TraceOptions traceOptions;
+TraceFile replayTrace;
+TraceReplayer *traceReplayer;
+vector<int> replayDivergent;
+chrono::steady_clock::time_point replayStart;
+int replayWarmup, replayWarmed; // tagged warm-up frames at the start of the trace, and those replayed so far
+
+// recording: the readback ring and its writer thread, with --record only
+RecorderOptions recorderOptions;
+FrameRecorder *frameRecorder;
+
+// profiler: idle unless --profile or --trace asks for it
+ProfilerOptions profilerOptions;
+
+// software renderer: the chair and its texture in CPU memory, drawn by --soft-raster and checked by --soft-compare
+SoftRasterOptions softRaster;
+SoftMesh softChair;
+SoftTexture softWood;
+SoftRasterizer *softRasterizer;
+SoftFrame softScene;
+
+// batch mode: a job file of stills rendered by worker processes instead of the window
+BatchOptions batchOptions;
+
+// clustered lighting: local lights at rest and as animated this frame, their cluster lists and the programs that read them
+ClusterOptions clusterOptions;
+LightClusters *lightClusters;
+vector<ClusterLight> restLights, sceneLights;
+GLint objClusteredShaderProgram, objInstancedClusteredShaderProgram;
+
+// baked lighting: the lightmap is drawn with only once both it and the unwrapped chair are resident
+LightmapOptions lightmapOptions;
+GLuint lightmapTexture;
+bool chairLightmapped;
+GLint objLightmapShaderProgram, objInstancedLightmapShaderProgram;
+
+// every draw goes through the queue, every bind it makes through the state cache
+RenderQueueOptions renderQueueOptions;
+RenderQueue renderQueue;
+GLStateCache glState;
+
+// uniform blocks: the frame's and every draw's data go through the ring, each program's other uniforms were found at link time
+UniformOptions uniformOptions;
+UniformRing *uniformRing;
+unordered_map<GLuint, ProgramUniforms> programUniforms;
+
+// finishes: one texture array for every chair, or one texture and one instance buffer per finish to compare
+MaterialOptions materialOptions;
+GLuint materialArray;
+vector<GLuint> materialTextures, materialVAOs, materialInstanceVBOs;
+vector<vector<ChairInstance>> materialInstanceData; // the visible chairs of each finish
+GLint objArrayShaderProgram, objInstancedArrayShaderProgram;
+
+// texture streaming: with --texture-stream each finish's texture holds only the mip levels its on-screen size needs
+StreamOptions streamOptions;
+TextureStreamer *textureStreamer;
+
+// levels of detail: every chair draws the coarsest level it can afford, the showroom one instanced draw per level
+LodOptions lodOptions;
+vector<GLuint> lodVAOs;					 // one per level, its instance attributes pointed at the level's run of the instance buffer
+vector<uint32_t> lodFirstInstances, lodInstanceCounts; // this frame's runs; a cross-fading chair is in the runs of both its levels
+vector<LodSelection> lodSelections;		 // of every visible chair
+
+// occlusion culling: the nearest visible chairs are rasterized on the CPU and hide the chairs behind them
+OcclusionOptions occlusionOptions;
+OcclusionBuffer *occlusionBuffer;
+OccluderMesh chairOccluder; // empty until the real chair is resident, the placeholder box would hide too much
+vector<glm::mat4> occluderPlacements;
 
 // keyboard global variables
 GLchar currentKey;				// will store key pressed
@@ -65,9 +275,72 @@ glm::vec3 front;										 // Temporary z unit vector for mouse
 /* Function Prototypes */
 void UResizeWindow(int, int);
 void URenderGraphics(void);
-void UCreateShader(void);
+TraceFrame UFrameInput(double clock, GLfloat time);
+void UInteractiveFrame(const TraceFrame &input);
+void UEndCapturedFrame(void);
+void URecordFrame(void);
+void UCloseWindow(void);
+int URunReplay(const HeadlessOptions &headless);
+int UReplayIndex(int frame);
+void UReplayInput(const TraceFrameData &data);
+void UReplayWait(int frame, int frameCount);
+void UReplayFrame(int frame, int frameCount);
+void UReplayCalls(int frame, int frameCount);
+void UDrawScene(void);
+void UUpdateShowroom(const glm::mat4 &viewProjection);
+void UOcclusionCullShowroom(const glm::mat4 &viewProjection);
+void UUploadMaterialInstances(void);
+uint32_t USelectShowroomLods(const glm::mat4 &view, const glm::mat4 &projection);
+void UBuildSceneGraph(void);
+void UUpdateSceneGraph(void);
+void UCameraPath(int frame, int frameCount);
+void UCameraPose(int frame, int frameCount);
+void UCameraMatrices(glm::mat4 &view, glm::mat4 &projection);
+bool UCreateShader(void);
+bool ULinkUniforms(GLuint program);
 void UCreateBuffers(void);
+void UDestroyBuffers(void);
+bool UReadMeshFile(const string &path, MeshData &mesh, vector<unsigned char> &indexBytes, GLenum &indexType);
+void UCopyMeshView(const MeshView &view, MeshData &mesh, vector<unsigned char> &indexBytes, GLenum &indexType);
+void UReadMeshLayout(const MeshView &view, MeshData &mesh);
+bool UStageMappedMesh(const shared_ptr<MeshView> &view, const VertexFormatOptions &format, int lightmapSize, int lodLevels, bool occluder, ChairMesh &chair, AssetPayload &payload);
+string ULoadChairMeshData(const string &path, MeshData &mesh, vector<unsigned char> &indexBytes, GLenum &indexType);
+bool UUnwrapChairMesh(int lightmapSize, MeshData &mesh, vector<unsigned char> &indexBytes, GLenum &indexType, LightmapStats &stats);
+void UReadIndices(const vector<unsigned char> &indexBytes, GLenum indexType, size_t count, vector<uint32_t> &indices);
+void UWriteIndices(const vector<uint32_t> &indices, GLenum indexType, vector<unsigned char> &indexBytes);
+bool UDecodeChairMesh(const string &path, const VertexFormatOptions &format, int lightmapSize, int lodLevels, bool occluder, ChairMesh &chair, AssetPayload &payload);
+void UUseChairMesh(const ChairMesh &chair, const AssetPayload &payload);
+void UBuildShowroomBvh(void);
+void UBuiltinMeshData(MeshData &mesh);
+void UPlaceholderMeshData(MeshData &mesh);
+int URunVertexBenchmark(const HeadlessOptions &headless);
+bool UCreateSoftAssets(void);
+void USoftScene(SoftFrame &frame);
+void USoftPath(int frame, int frameCount);
+bool USoftDump(const string &path);
+int URunSoftHeadless(const HeadlessOptions &headless);
+int URunSoftCompare(const HeadlessOptions &headless);
+int URunSoftBenchmark(const HeadlessOptions &headless);
+bool UBatchSetup(const BatchJob &first);
+bool UBatchRender(const BatchJob &job, BatchResult &result);
+void UBatchTeardown(void);
+void UCreateSceneLights(void);
+int URunLightBenchmark(const HeadlessOptions &headless);
+int UBakeChairLightmap(void);
+void ULoadLightmap(void);
+void UBindVertexLayout(bool positionOnly);
+void UParseMeshArgs(int argc, char *argv[]);
+bool UExportBuiltinMesh(const string &path);
+glm::mat4 UChairModel(void);
 void UGenerateTexture(void);
+void UCreateMaterials(void);
+void UCreateStreamedMaterials(int count);
+void UStreamMaterials(const glm::mat4 &view, const glm::mat4 &projection);
+void UDestroyMaterials(void);
+int URunMaterialBenchmark(const HeadlessOptions &headless);
+int URunOcclusionBenchmark(const HeadlessOptions &headless);
+bool UReadTextureFile(const string &path, const vector<bool> &supported, TextureImage &image, string &description);
+bool UTextureFormatSupported(TextureFormat format);
 void UKeyboard(unsigned char key, int x, int y);
 void UKeyReleased(unsigned char key, int x, int y);
 void UMouseClick(int button, int state, int x, int y);
@@ -77,27 +350,116 @@ void WireframeModeOn();
 void WireframeModeOff();
 void UControls();
 
+/* Frame Block Source Code: camera, lights and vertex decoding of the frame, the same block in every program (binding FRAME_BLOCK_BINDING) */
+const GLchar *frameBlockSource = GLSL_PRELUDE(
+	layout(std140) uniform Frame {
+		mat4 view;
+		mat4 projection;
+		vec3 viewPosition;
+		vec3 light0Pos;
+		vec3 light0Color;
+		vec3 light1Pos;
+		vec3 light1Color;
+		vec3 positionScale; // dequantization of the compressed vertex layouts (identity for the float layout)
+		vec3 positionOffset;
+		vec2 uvScale;
+		vec2 uvOffset;
+		bool octNormals;
+	};);
+
 /* Object Vertex Shader Source Code */
 const GLchar *objVertexShaderSource = GLSL(
 	330,
 	layout(location = 0) in vec3 position;			 // VAP position 0 for vector position data
 	layout(location = 1) in vec3 normal;			 // VAP position 1 for normals
 	layout(location = 2) in vec2 textureCoordinates; // VAP position 2 for texture
+	layout(location = 8) in vec2 lightmapCoordinates; // VAP position 8 for the lightmap atlas, when the chair is unwrapped
 
 	out vec3 Normal;			   // for outgoing normals to fragment shader
 	out vec3 FragmentPos;		   // for outgoing color / pixels to fragment shader
 	out vec2 objTextureCoordinate; // texture coordinates
+	out vec2 objLightmapCoordinate; // lightmap coordinates
+	out vec4 objMaterial;		   // finish tint (rgb) and specular intensity (a)
+	flat out float objLayer;	   // material array layer of the finish
+	flat out float objFade;		   // level of detail cross-fade share
+
+	// the draw's placement and finish, sub-allocated from the uniform ring (binding OBJECT_BLOCK_BINDING)
+	layout(std140) uniform Object {
+		mat4 model;
+		float layer;
+		float fade;
+	};
+
+	// unfolds an octahedral normal stored in the x and y components
+	vec3 DecodeNormal(vec3 stored) {
+		if (!octNormals)
+			return stored;
+
+		vec3 n = vec3(stored.xy, 1.0f - abs(stored.x) - abs(stored.y));
+		float fold = max(-n.z, 0.0f);
+		n.x += n.x >= 0.0f ? -fold : fold;
+		n.y += n.y >= 0.0f ? -fold : fold;
+		return n;
+	}
+
+	void main() {
+		vec3 objPosition = positionOffset + position * positionScale;		 // position in object space
+		vec2 objUV = uvOffset + textureCoordinates * uvScale;				 // texture coordinate as authored
+
+		gl_Position = projection * view * model * vec4(objPosition, 1.0f); // transforms vertices to clip coordinates
+		FragmentPos = vec3(model * vec4(objPosition, 1.0f));				 // gets fragment / pixel position in world space only (exclude view and projection)
+		Normal = mat3(transpose(inverse(model))) * DecodeNormal(normal);	 // get normal vectors in world space only and exclude normal translation properties
+		objTextureCoordinate = vec2(objUV.x, 1.0f - objUV.y);				 // flips of texture horizontally
+		objLightmapCoordinate = lightmapCoordinates;
+		objMaterial = vec4(1.0f, 1.0f, 1.0f, 0.5f);										// untinted wood with the default specular strength
+		objLayer = layer;
+		objFade = fade;
+	});
+
+/* Instanced Object Vertex Shader Source Code */
+const GLchar *objInstancedVertexShaderSource = GLSL(
+	330,
+	layout(location = 0) in vec3 position;			 // VAP position 0 for vector position data
+	layout(location = 1) in vec3 normal;			 // VAP position 1 for normals
+	layout(location = 2) in vec2 textureCoordinates; // VAP position 2 for texture
+	layout(location = 3) in mat4 instanceModel;		 // VAP positions 3 to 6 for the per-instance model matrix
+	layout(location = 7) in vec4 instanceMaterial;	 // VAP position 7 for the per-instance finish
+	layout(location = 8) in vec2 lightmapCoordinates; // VAP position 8 for the lightmap atlas, when the chair is unwrapped
+	layout(location = 9) in float instanceLayer;	  // VAP position 9 for the per-instance material layer
+	layout(location = 10) in float instanceFade;	  // VAP position 10 for the per-instance level of detail cross-fade
 
-	// global variables for the transform matrices
-	uniform mat4 model;
-	uniform mat4 view;
-	uniform mat4 projection;
+	out vec3 Normal;			   // for outgoing normals to fragment shader
+	out vec3 FragmentPos;		   // for outgoing color / pixels to fragment shader
+	out vec2 objTextureCoordinate; // texture coordinates
+	out vec2 objLightmapCoordinate; // lightmap coordinates
+	out vec4 objMaterial;		   // finish tint (rgb) and specular intensity (a)
+	flat out float objLayer;	   // material array layer of the finish
+	flat out float objFade;		   // level of detail cross-fade share
+
+	// unfolds an octahedral normal stored in the x and y components
+	vec3 DecodeNormal(vec3 stored) {
+		if (!octNormals)
+			return stored;
+
+		vec3 n = vec3(stored.xy, 1.0f - abs(stored.x) - abs(stored.y));
+		float fold = max(-n.z, 0.0f);
+		n.x += n.x >= 0.0f ? -fold : fold;
+		n.y += n.y >= 0.0f ? -fold : fold;
+		return n;
+	}
 
 	void main() {
-		gl_Position = projection * view * model * vec4(position, 1.0f);					// transforms vertices to clip coordinates
-		FragmentPos = vec3(model * vec4(position, 1.0f));								// gets fragment / pixel position in world space only (exclude view and projection)
-		Normal = mat3(transpose(inverse(model))) * normal;								// get normal vectors in world space only and exclude normal translation properties
-		objTextureCoordinate = vec2(textureCoordinates.x, 1.0f - textureCoordinates.y); // flips of texture horizontally
+		vec3 objPosition = positionOffset + position * positionScale; // position in object space
+		vec2 objUV = uvOffset + textureCoordinates * uvScale;		  // texture coordinate as authored
+
+		gl_Position = projection * view * instanceModel * vec4(objPosition, 1.0f);	 // transforms vertices to clip coordinates
+		FragmentPos = vec3(instanceModel * vec4(objPosition, 1.0f));				 // gets fragment / pixel position in world space only
+		Normal = mat3(transpose(inverse(instanceModel))) * DecodeNormal(normal);	 // get normal vectors in world space only
+		objTextureCoordinate = vec2(objUV.x, 1.0f - objUV.y);						 // flips of texture horizontally
+		objLightmapCoordinate = lightmapCoordinates;
+		objMaterial = instanceMaterial;
+		objLayer = instanceLayer;
+		objFade = instanceFade;
 	});
 
 /* Object Fragment Shader Source Code */
@@ -106,16 +468,12 @@ const GLchar *objFragmentShaderSource = GLSL(
 	in vec3 Normal;		 // for incoming normal
 	in vec3 FragmentPos; // for incoming fragment position
 	in vec2 objTextureCoordinate;
+	in vec4 objMaterial; // finish tint and specular intensity
 
 	out vec4 objColor; // Variable to pass phong data to the GPU
 
-	uniform sampler2D uTexture; // useful when working with multiple textures
-
-	// uniform global variables for key and fill light color, key and fill light position, and camera/view position
-	uniform vec3 light0Color;
-	uniform vec3 light1Color;
-	uniform vec3 lightPos;
-	uniform vec3 viewPosition;
+	vec3 MaterialTexel(vec2 uv); // the finish's texel, from the texel shader linked alongside
+	void LodFade();				 // discards this level's share of a cross-fade, from the fade shader linked alongside
 
 	/*--- phong light model calculations to generate ambient, diffuse, and specular components ---*/
 	vec3 LightCalc(vec3 fragPos, vec3 objTex, vec3 norm, vec3 viewDir, vec3 lightColor, vec3 lightPos) {
@@ -133,7 +491,7 @@ const GLchar *objFragmentShaderSource = GLSL(
 		vec3 reflectDir = reflect(-lightDirection, norm); // calculate reflection vector
 
 		// calculate specular component
-		float specularIntensity = 0.5f; // set specular light strength
+		float specularIntensity = objMaterial.a; // set specular light strength from the finish
 		float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
 		vec3 specular = specularIntensity * specularComponent * lightColor;
 
@@ -142,31 +500,209 @@ const GLchar *objFragmentShaderSource = GLSL(
 	}
 
 	void main() {
+		LodFade();
+
 		// properties
-		vec3 objTexture = texture(uTexture, objTextureCoordinate).xyz; // sends texture to the GPU for rendering
+		vec3 objTexture = MaterialTexel(objTextureCoordinate) * objMaterial.rgb; // sends tinted texture to the GPU for rendering
 		vec3 norm = normalize(Normal);								   // normalize vectors to 1 unit
 		vec3 viewDir = normalize(viewPosition - FragmentPos);		   // calculate view direction
 
 		/*--- Calculate Phong Value---*/
 		// light0
-		vec3 phong = LightCalc(FragmentPos, objTexture, norm, viewDir, light0Color, lightPos);
-		phong += LightCalc(FragmentPos, objTexture, norm, viewDir, light1Color, lightPos);
+		vec3 phong = LightCalc(FragmentPos, objTexture, norm, viewDir, light0Color, light0Pos);
+		phong += LightCalc(FragmentPos, objTexture, norm, viewDir, light1Color, light1Pos);
+
+		objColor = vec4(phong, 1.0f); // send lighting results to GPU
+	});
+
+/* Lightmapped Object Fragment Shader Source Code: baked ambient and diffuse, only the specular per pixel */
+const GLchar *objLightmapFragmentShaderSource = GLSL(
+	330,
+	in vec3 Normal;		 // for incoming normal
+	in vec3 FragmentPos; // for incoming fragment position
+	in vec2 objTextureCoordinate;
+	in vec2 objLightmapCoordinate;
+	in vec4 objMaterial; // finish tint and specular intensity
+
+	out vec4 objColor; // Variable to pass phong data to the GPU
+
+	vec3 MaterialTexel(vec2 uv); // the finish's texel, from the texel shader linked alongside
+	void LodFade();				 // discards this level's share of a cross-fade, from the fade shader linked alongside
+	uniform sampler2D lightmap; // ambient and diffuse of both lights with shadows and occlusion, divided by lightmapRange
+	uniform float lightmapRange;
+
+	/*--- the view-dependent part of LightCalc, the rest is in the lightmap ---*/
+	vec3 SpecularCalc(vec3 fragPos, vec3 norm, vec3 viewDir, vec3 lightColor, vec3 lightPos) {
+		vec3 lightDirection = normalize(lightPos - fragPos);
+		vec3 reflectDir = reflect(-lightDirection, norm);
+
+		float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), 16.0f);
+		return objMaterial.a * specularComponent * lightColor;
+	}
+
+	void main() {
+		LodFade();
+
+		// properties
+		vec3 objTexture = MaterialTexel(objTextureCoordinate) * objMaterial.rgb; // sends tinted texture to the GPU for rendering
+		vec3 norm = normalize(Normal);								   // normalize vectors to 1 unit
+		vec3 viewDir = normalize(viewPosition - FragmentPos);		   // calculate view direction
+
+		vec3 light = texture(lightmap, objLightmapCoordinate).rgb * lightmapRange;
+		light += SpecularCalc(FragmentPos, norm, viewDir, light0Color, light0Pos);
+		light += SpecularCalc(FragmentPos, norm, viewDir, light1Color, light1Pos);
+
+		objColor = vec4(light * objTexture, 1.0f); // send lighting results to GPU
+	});
+
+/* Clustered Object Fragment Shader Source Code: the key and fill lights plus the local lights of the fragment's cluster */
+const GLchar *objClusteredFragmentShaderSource = GLSL(
+	330,
+	in vec3 Normal;		 // for incoming normal
+	in vec3 FragmentPos; // for incoming fragment position
+	in vec2 objTextureCoordinate;
+	in vec4 objMaterial; // finish tint and specular intensity
+
+	out vec4 objColor; // Variable to pass phong data to the GPU
+
+	vec3 MaterialTexel(vec2 uv); // the finish's texel, from the texel shader linked alongside
+	void LodFade();				 // discards this level's share of a cross-fade, from the fade shader linked alongside
+
+	// local lights, three texels each: position and radius, color and spot outer cosine, direction and spot inner cosine
+	uniform samplerBuffer lightData;
+	uniform usamplerBuffer clusterRanges;  // first index and light count of every cluster
+	uniform usamplerBuffer clusterIndices; // light indices, cluster after cluster
+	uniform ivec3 clusterGrid;			   // columns, rows and depth slices
+	uniform vec2 clusterTileSize;		   // pixels per column and row
+	uniform vec2 clusterDepth;			   // depth slice = log(view depth) * x + y
+	uniform int lightCount;
+	uniform bool loopAllLights; // every light at every fragment, for comparison
+
+	/*--- phong light model calculations to generate ambient, diffuse, and specular components ---*/
+	vec3 LightCalc(vec3 fragPos, vec3 objTex, vec3 norm, vec3 viewDir, vec3 lightColor, vec3 lightPos) {
+		// calculate ambient lighting
+		float ambientStrength = 0.1f;				 // set ambient or global lighting strength
+		vec3 ambient = ambientStrength * lightColor; // generate ambient light color
+
+		// calculate diffuse lighting
+		vec3 lightDirection = normalize(lightPos - fragPos); // calculate distance (light direction) between light source and fragment/pixels on
+		float impact = max(dot(norm, lightDirection), 0.1);	 // calculate diffuse impact by generating dot product of normal and light
+		vec3 diffuse = impact * lightColor;					 // generate diffuse light color
+
+		// calculate specular lighting
+		float highlightSize = 16.0f;					  // set specular highlight size
+		vec3 reflectDir = reflect(-lightDirection, norm); // calculate reflection vector
+
+		// calculate specular component
+		float specularIntensity = objMaterial.a; // set specular light strength from the finish
+		float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
+		vec3 specular = specularIntensity * specularComponent * lightColor;
+
+		// return calculated value
+		return (ambient + diffuse + specular) * objTex;
+	}
+
+	/*--- diffuse and specular of one local light, fading to nothing at its radius and outside its cone ---*/
+	vec3 LocalLightCalc(int light, vec3 fragPos, vec3 objTex, vec3 norm, vec3 viewDir) {
+		vec4 positionRadius = texelFetch(lightData, 3 * light);
+		vec4 colorOuter = texelFetch(lightData, 3 * light + 1);
+		vec4 directionInner = texelFetch(lightData, 3 * light + 2);
+
+		vec3 toLight = positionRadius.xyz - fragPos;
+		float distance = length(toLight);
+		if (distance >= positionRadius.w)
+			return vec3(0.0f);
+
+		vec3 lightDirection = toLight / distance;
+		float falloff = 1.0f - (distance * distance) / (positionRadius.w * positionRadius.w);
+		float cone = smoothstep(colorOuter.w, directionInner.w, dot(-lightDirection, directionInner.xyz)); // 1 for point lights
+
+		float diffuse = max(dot(norm, lightDirection), 0.0f);
+		float specular = objMaterial.a * pow(max(dot(viewDir, reflect(-lightDirection, norm)), 0.0), 16.0f);
+
+		return (diffuse + specular) * falloff * falloff * cone * colorOuter.rgb * objTex;
+	}
+
+	void main() {
+		LodFade();
+
+		// properties
+		vec3 objTexture = MaterialTexel(objTextureCoordinate) * objMaterial.rgb; // sends tinted texture to the GPU for rendering
+		vec3 norm = normalize(Normal);								   // normalize vectors to 1 unit
+		vec3 viewDir = normalize(viewPosition - FragmentPos);		   // calculate view direction
+
+		/*--- Calculate Phong Value---*/
+		vec3 phong = LightCalc(FragmentPos, objTexture, norm, viewDir, light0Color, light0Pos);
+		phong += LightCalc(FragmentPos, objTexture, norm, viewDir, light1Color, light1Pos);
+
+		if (loopAllLights)
+		{
+			for (int light = 0; light < lightCount; light++)
+				phong += LocalLightCalc(light, FragmentPos, objTexture, norm, viewDir);
+		}
+		else
+		{
+			// the fragment's cluster: screen tile, then exponential depth slice
+			float depth = -(view * vec4(FragmentPos, 1.0f)).z;
+			ivec3 cell = ivec3(ivec2(gl_FragCoord.xy / clusterTileSize), int(floor(log(max(depth, 1e-4f)) * clusterDepth.x + clusterDepth.y)));
+			cell = clamp(cell, ivec3(0), clusterGrid - 1);
+
+			uvec2 range = texelFetch(clusterRanges, (cell.z * clusterGrid.y + cell.y) * clusterGrid.x + cell.x).xy;
+			for (uint i = 0u; i < range.y; i++)
+				phong += LocalLightCalc(int(texelFetch(clusterIndices, int(range.x + i)).x), FragmentPos, objTexture, norm, viewDir);
+		}
 
 		objColor = vec4(phong, 1.0f); // send lighting results to GPU
 	});
 
+/* Material Texel Shader Source Code: linked into every object program next to its fragment shader */
+const GLchar *objTexelShaderSource = GLSL(
+	330,
+	uniform sampler2D uTexture; // useful when working with multiple textures
+
+	vec3 MaterialTexel(vec2 uv) {
+		return texture(uTexture, uv).xyz;
+	});
+
+/* Layered Material Texel Shader Source Code: the same texel from the finish's layer of the material array */
+const GLchar *objArrayTexelShaderSource = GLSL(
+	330,
+	flat in float objLayer;			   // layer of the draw or instance
+	uniform sampler2DArray uMaterials; // every finish, one layer each
+
+	vec3 MaterialTexel(vec2 uv) {
+		return texture(uMaterials, vec3(uv, objLayer)).xyz;
+	});
+
+/* LOD Fade Shader Source Code: while two levels of detail are drawn, each keeps a complementary dithered share of the pixels */
+const GLchar *objFadeShaderSource = GLSL(
+	330,
+	flat in float objFade; // above 0 the share this level gives up, below 0 the share it takes over, 0 no cross-fade
+
+	void LodFade() {
+		float dither = fract(52.9829189f * fract(dot(gl_FragCoord.xy, vec2(0.06711056f, 0.00583715f)))); // interleaved gradient noise
+		if ((objFade > 0.0f && dither < objFade) || (objFade < 0.0f && dither >= -objFade))
+			discard;
+	});
+
+/* Solid Shader Source Code: LodFade without --lod-fade, so the object programs never discard and keep early depth testing */
+const GLchar *objSolidShaderSource = GLSL(
+	330,
+	void LodFade() {
+	});
+
 /* Lamp Shader Source Code */
 const GLchar *lampVertexShaderSource = GLSL(
 	330,
 	layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
 
-	// uniform global variables for the transform matrices
-	uniform mat4 model;
-	uniform mat4 view;
-	uniform mat4 projection;
+	// the draw's placement, sub-allocated from the uniform ring (binding OBJECT_BLOCK_BINDING)
+	layout(std140) uniform Object {
+		mat4 model;
+	};
 
 	void main() {
-		gl_Position = projection * view * model * vec4(position, 1.0f); // transforms vertices into clip coordinates
+		gl_Position = projection * view * model * vec4(positionOffset + position * positionScale, 1.0f); // transforms vertices into clip coordinates
 	});
 
 /* Lamp Fragment Shader Source Code */
@@ -178,9 +714,244 @@ const GLchar *lampFragmentShaderSource = GLSL(
 		color = vec4(1.0f); // set color to white (1.0f, 1.0f, 1.0f) with alpha 1.0
 	});
 
+/* Built-in Zig-Zag chair geometry, used when no --mesh file is given */
+// position, normal and texture coordinate data
+const GLfloat chairVertices[] = {
+	// vertex positions   // normals		  // texture coord
+	0.45f, -0.80f, 0.35f, -1.0f, 1.0f, -1.0f, 1.0f, 0.0f,  // vertex 0
+	0.45f, -0.75f, 0.35f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f,  // vertex 1
+	-0.30f, -0.75f, 0.35f, 1.0f, 1.0f, -1.0f, 0.0f, 1.0f,  // vertex 2
+	-0.35f, -0.70f, 0.35f, 1.0f, 1.0f, -1.0f, 0.0f, 1.0f,  // vertex 3
+	0.50f, 0.20f, 0.45f, -1.0f, -1.0f, -1.0f, 0.0f, 0.0f,  // vertex 4
+	-0.35f, 0.20f, 0.35f, 1.0f, -1.0f, -1.0f, 0.0f, 1.0f,  // vertex 5
+	-0.45f, 0.90f, 0.35f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f,  // vertex 6
+	-0.50f, 0.90f, 0.35f, 1.0f, -1.0f, -1.0f, 0.0f, 1.0f,  // vertex 7
+	-0.40f, 0.15f, 0.35f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f,  // vertex 8
+	0.30f, 0.15f, 0.45f, -1.0f, -1.0f, -1.0f, 1.0f, 0.0f,  // vertex 9
+	0.35f, 0.10f, 0.45f, -1.0f, -1.0f, -1.0f, 0.0f, 0.0f,  // vertex 10
+	-0.50f, -0.80f, 0.35f, 1.0f, 1.0f, -1.0f, 0.0f, 1.0f,  // vertex 11
+	0.45f, -0.80f, -0.35f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f, // vertex 12
+	0.45f, -0.75f, -0.35f, -1.0f, 1.0f, 1.0f, 1.0f, 0.0f,  // vertex 13
+	-0.30f, -0.75f, -0.35f, -1.0f, 1.0f, 1.0f, 1.0f, 1.0f, // vertex 14
+	-0.35f, -0.70f, -0.35f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f,  // vertex 15
+	0.50f, 0.20f, -0.45f, -1.0f, 1.0f, 1.0f, 1.0f, 0.0f,   // vertex 16
+	-0.35f, 0.20f, -0.35f, 1.0f, -1.0f, 1.0f, 1.0f, 1.0f,  // vertex 17
+	-0.45f, 0.90f, -0.35f, 1.0f, -1.0f, 1.0f, 1.0f, 0.0f,  // vertex 18
+	-0.50f, 0.90f, -0.35f, 1.0f, -1.0f, 1.0f, 1.0f, 1.0f,  // vertex 19
+	-0.40f, 0.15f, -0.35f, 1.0f, -1.0f, 1.0f, 0.0f, 1.0f,  // vertex 20
+	0.30f, 0.15f, -0.45f, -1.0f, 1.0f, 1.0f, 0.0f, 0.0f,   // vertex 21
+	0.35f, 0.10f, -0.45f, -1.0f, 1.0f, 1.0f, 1.0f, 0.0f,   // vertex 22
+	-0.50f, -0.80f, -0.35f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f   // vertex 23
+};
+
+// index data to share position data
+const GLuint chairIndices[] = {
+
+	// base
+	0, 1, 13,
+	0, 12, 13,
+	0, 11, 2,
+	0, 1, 2,
+	1, 2, 14,
+	1, 13, 14,
+	12, 23, 14,
+	12, 13, 14,
+	0, 11, 23,
+	0, 12, 23,
+
+	// leg
+	2, 3, 15,
+	2, 14, 15,
+	2, 11, 3,
+	3, 4, 16,
+	3, 15, 16,
+	3, 11, 10,
+	3, 4, 10,
+	4, 9, 10,
+	14, 23, 15,
+	15, 23, 22,
+	15, 16, 22,
+	16, 21, 22,
+	11, 10, 22,
+	11, 23, 22,
+	9, 10, 22,
+	9, 21, 22,
+
+	// seat
+	4, 5, 17,
+	4, 16, 17,
+	4, 5, 8,
+	4, 9, 8,
+	16, 17, 20,
+	16, 21, 20,
+	9, 8, 20,
+	9, 21, 20,
+
+	// chair back
+	5, 6, 18,
+	5, 17, 18,
+	5, 8, 7,
+	5, 6, 7,
+	17, 20, 19,
+	17, 18, 19,
+	8, 20, 19,
+	8, 7, 19,
+	6, 7, 19,
+	6, 18, 19};
+
 /* Main Program */
 int main(int argc, char *argv[])
 {
+	if (!UParseTraceArgs(argc, argv, traceOptions))
+		return -1;
+
+	// a replay builds the scene the capture was started with; options given now come later and win
+	vector<string> replayArguments;
+	vector<char *> replayArgv;
+	if (!traceOptions.replayPath.empty())
+	{
+		if (!UReadTrace(traceOptions.replayPath, replayTrace))
+			return -1;
+
+		replayArguments.push_back(argv[0]);
+		replayArguments.insert(replayArguments.end(), replayTrace.arguments.begin(), replayTrace.arguments.end());
+		replayArguments.insert(replayArguments.end(), argv + 1, argv + argc);
+		for (string &argument : replayArguments)
+			replayArgv.push_back(&argument[0]);
+		replayArgv.push_back(nullptr);
+
+		argc = (int)replayArguments.size();
+		argv = replayArgv.data();
+	}
+
+	HeadlessOptions headless;
+	if (!UParseHeadlessArgs(argc, argv, headless))
+		return -1;
+
+	// replays run offscreen at the size of the first captured frame
+	if (!traceOptions.replayPath.empty())
+	{
+		headless.enabled = true;
+		headless.width = replayTrace.frames[0].frame.width;
+		headless.height = replayTrace.frames[0].frame.height;
+	}
+
+	UParseShowroomArgs(argc, argv, showroom);
+	UParseCameraSimArgs(argc, argv, cameraOptions);
+	cameraSim = CameraSim(cameraOptions);
+	UParseMeshArgs(argc, argv);
+
+	if (!UParseVertexFormatArgs(argc, argv, vertexFormat) || !UParseAssetLoaderArgs(argc, argv, loaderOptions) ||
+		!UParseShaderCacheArgs(argc, argv, shaderCache) || !UParseFramePacerArgs(argc, argv, framePacer) ||
+		!UParseProfilerArgs(argc, argv, profilerOptions) || !UParseSoftRasterArgs(argc, argv, softRaster) ||
+		!UParseBatchArgs(argc, argv, batchOptions) || !UParseClusterArgs(argc, argv, clusterOptions) ||
+		!UParseLightmapArgs(argc, argv, lightmapOptions) || !UParseRenderQueueArgs(argc, argv, renderQueueOptions) ||
+		!UParseUniformArgs(argc, argv, uniformOptions) || !UParseMaterialArgs(argc, argv, materialOptions) ||
+		!UParseLodArgs(argc, argv, lodOptions) || !UParseOcclusionArgs(argc, argv, occlusionOptions) ||
+		!UParseRecorderArgs(argc, argv, recorderOptions) || !UParseStreamArgs(argc, argv, streamOptions))
+		return -1;
+	renderQueue = RenderQueue(renderQueueOptions);
+
+	// the streamer gives every finish a texture of its own, whose resident levels it picks per frame
+	if (streamOptions.enabled)
+	{
+		if (materialOptions.count <= 0)
+		{
+			cout << "--texture-stream streams the finishes of --materials N" << endl;
+			return -1;
+		}
+		materialOptions.separate = true;
+	}
+
+	// write the built-in chair as a mesh file and quit
+	if (!exportMeshPath.empty())
+		return UExportBuiltinMesh(exportMeshPath) ? 0 : -1;
+
+	// render the stills of a job file and quit; each worker creates its own pool, loader and context
+	if (!batchOptions.jobPath.empty())
+	{
+		vector<BatchJob> jobs;
+		if (!UReadBatchJobs(batchOptions.jobPath, jobs))
+			return -1;
+
+		return URunBatch(batchOptions, jobs, UBatchSetup, UBatchRender, UBatchTeardown, softRaster.enabled ? "software rasterizer" : "OpenGL, headless EGL");
+	}
+
+	taskPool = new TaskPool(UParseThreadArgs(argc, argv));
+
+	// bake the chair's lightmap on every core and quit
+	if (!lightmapOptions.bakePath.empty())
+	{
+		int result = UBakeChairLightmap();
+		delete taskPool;
+		return result;
+	}
+
+	assetLoader = new AssetLoader(loaderOptions); // time to first frame counts from here
+
+	// render the scripted benchmark on the CPU, without any GL context
+	if (headless.enabled && (softRaster.enabled || softRaster.benchmark))
+	{
+		WindowWidth = headless.width;
+		WindowHeight = headless.height;
+		UInitProfiler(profilerOptions, false);
+
+		int result = UCreateSoftAssets() ? (softRaster.benchmark ? URunSoftBenchmark(headless) : URunSoftHeadless(headless)) : -1;
+
+		UShutdownProfiler(); // writes the trace
+		delete assetLoader;
+		delete taskPool;
+
+		return result;
+	}
+
+	// render the scripted benchmark offscreen without creating a window
+	if (headless.enabled)
+	{
+		WindowWidth = headless.width;
+		WindowHeight = headless.height;
+
+		if (!UCreateHeadlessContext(WindowWidth, WindowHeight))
+			return -1;
+		UInitProfiler(profilerOptions);
+
+		if (!UCreateShader()) // create shader
+			return -1;
+		UCreateBuffers();	// create buffer
+		UGenerateTexture(); // create texture
+
+		glClearColor(0.9f, 0.9f, 0.9f, 0.5f); // set background color
+
+		if (!traceOptions.capturePath.empty() && !UStartCapture(traceOptions.capturePath, argc, argv, (const char *)glGetString(GL_RENDERER)))
+			return -1;
+		if (!recorderOptions.path.empty())
+			frameRecorder = new FrameRecorder(recorderOptions);
+
+		int result;
+		if (!traceOptions.replayPath.empty())
+			result = URunReplay(headless);
+		else if (softRaster.compare)
+			result = UCreateSoftAssets() ? URunSoftCompare(headless) : -1;
+		else if (clusterOptions.benchmark)
+			result = URunLightBenchmark(headless);
+		else if (materialOptions.benchmark)
+			result = URunMaterialBenchmark(headless);
+		else if (occlusionOptions.benchmark)
+			result = URunOcclusionBenchmark(headless);
+		else
+			result = vertexFormat.benchmark ? URunVertexBenchmark(headless) : URunHeadless(headless, UCameraPath);
+
+		delete frameRecorder; // writes the frames still in flight
+		UStopCapture();
+		UShutdownProfiler(); // writes the trace
+		delete assetLoader;
+		UDestroyBuffers();
+		UDestroyHeadlessContext();
+		delete taskPool;
+
+		return result;
+	}
+
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
 	glutInitWindowSize(WindowWidth, WindowHeight);
@@ -194,9 +965,12 @@ int main(int argc, char *argv[])
 		std::cout << "Failed to initialize GLEW" << std::endl;
 		return -1;
 	}
+	UInitProfiler(profilerOptions);
+	glutCloseFunc(UCloseWindow); // the trace and the recording are written while the window's context is still current
 
 	UControls();		// display user controls on console
-	UCreateShader();	// create shader
+	if (!UCreateShader()) // create shader
+		return -1;
 	UCreateBuffers();	// create buffer
 	UGenerateTexture(); // create texture
 
@@ -212,60 +986,88 @@ int main(int argc, char *argv[])
 	glutPassiveMotionFunc(UMousePers); // detects mouse movement in perspective
 	glutMotionFunc(UMouseOrtho);	   // detects mouse movement in orthographic
 
+	UInitFramePacer(framePacer); // redraw continuously or on demand
+
+	if (!traceOptions.capturePath.empty() && !UStartCapture(traceOptions.capturePath, argc, argv, (const char *)glGetString(GL_RENDERER)))
+		return -1;
+	if (!recorderOptions.path.empty())
+		frameRecorder = new FrameRecorder(recorderOptions);
+
 	glutMainLoop();
 
-	// destroy buffer objects once used
-	glDeleteVertexArrays(1, &ObjVAO);
-	glDeleteVertexArrays(1, &LightVAO);
-	glDeleteBuffers(1, &VBO);
-	glDeleteBuffers(1, &EBO);
+	UStopCapture();
+	delete assetLoader;
+	UDestroyBuffers(); // destroy buffer objects once used
+	delete taskPool;
 
 	return 0;
 }
 
+/* Writes what is still in flight while the window's context is current */
+void UCloseWindow(void)
+{
+	delete frameRecorder;
+	frameRecorder = nullptr;
+	UShutdownProfiler(); // writes the trace
+}
+
 /* Resizes The Window */
 void UResizeWindow(int w, int h)
 {
 	WindowWidth = w;
 	WindowHeight = h;
 	glViewport(0, 0, WindowWidth, WindowHeight);
+	URequestRedraw();
 }
 
 /* Renders Graphics */
 void URenderGraphics(void)
 {
-	glEnable(GL_DEPTH_TEST);							// enable z-depth
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // clears the screen
-	glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);	// really nice perspective calculations
+	UPROFILE_SCOPE("URenderGraphics");
 
-	glBindVertexArray(ObjVAO); // activate the vertex Array Object before rendering and transforming them
+	TraceFrame input = UFrameInput(UCameraClock(), glutGet(GLUT_ELAPSED_TIME) / 1000.0f);
+	UTraceBeginFrame(input);
+	UInteractiveFrame(input);
+	UEndCapturedFrame();
+	URecordFrame(); // the back buffer, before the swap
+	UPrintFrameStats(2.0); // console summary of the per-frame counters
 
-	// object panning left
-	if (currentKey == 'l')
 	{
-		cameraPosition -= glm::normalize(glm::cross(CameraForwardZ, CameraUpY)) * cameraSpeed;
-	}
-	// object panning right
-	if (currentKey == 'r')
-	{
-		cameraPosition += glm::normalize(glm::cross(CameraForwardZ, CameraUpY)) * cameraSpeed;
-	}
-	// object panning up
-	if (currentKey == 'u')
-	{
-		cameraPosition -= CameraUpY * cameraSpeed;
-	}
-	// object panning down
-	if (currentKey == 'd')
-	{
-		cameraPosition += CameraUpY * cameraSpeed;
+		UPROFILE_SCOPE("glutSwapBuffers");
+		glutSwapBuffers(); // flips the back buffer with the front buffer every frame
 	}
+	UPROFILE_FRAME(); // collects this frame's CPU scopes and the previous frame's GPU scopes
 
-	// camera reset
-	if (currentKey == 'q')
-	{
-		cameraPosition = glm::vec3(0.0f, 0.0f, 0.0f);
-	}
+	// camera motion, gliding showroom chairs and assets still streaming in need the next frame too
+	UFrameDone(cameraSim.active() || (showroom.count > 0 && showroom.moving > 0) || clusterOptions.lights > 0 || assetLoader->loading());
+}
+
+/* Input of the frame about to be drawn: the clock and scene time it runs to, the window and the held keys */
+TraceFrame UFrameInput(double clock, GLfloat time)
+{
+	TraceFrame input;
+	input.clock = clock;
+	input.sceneTime = time;
+	input.width = WindowWidth;
+	input.height = WindowHeight;
+	input.currentKey = currentKey;
+	input.currentProjection = currentProjection;
+	input.userSelection = userSelection;
+
+	return input;
+}
+
+/* One interactive frame from its input alone, so a replay draws what the window drew */
+void UInteractiveFrame(const TraceFrame &input)
+{
+	// panning, zoom, orbit and reset run in fixed steps up to now; draw the blend of the last two
+	cameraSim.advance(input.clock);
+	CameraState camera = cameraSim.interpolated();
+
+	cameraPosition = camera.position;
+	yaw = camera.yaw;
+	pitch = camera.pitch;
+	front = UCameraFront(camera);
 
 	// wireframe mode of the object
 	if (currentKey == 'w')
@@ -277,291 +1079,2230 @@ void URenderGraphics(void)
 
 	CameraForwardZ = front; // replaces camera forward vector with Radians normalized as a unit vector
 
-	GLint modelLoc, viewLoc, projLoc, uTextureLoc, viewPositionLoc, light0ColorLoc, light0PositionLoc, light1ColorLoc, light1PositionLoc;
-
-	glm::mat4 model = glm::mat4(1.0);
-	glm::mat4 view;
-	glm::mat4 projection;
-
-	/*** Use the object shader and activate the object VAO for rendering and transforming ***/
-	glUseProgram(objShaderProgram);
-	glBindVertexArray(ObjVAO);
+	sceneTime = input.sceneTime;
 
-	// transforms the object
-	model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));		 // place the object at the center of the viewport
-	model = glm::rotate(model, 180.0f, glm::vec3(0.0f, 1.0f, 0.0f)); // rotate the object 180 degrees on Y axis
-	model = glm::scale(model, glm::vec3(2.0f, 2.0f, 2.0f));			 // increase the object size by a scale of 2
+	UDrawScene();
+}
 
-	// transforms the camera
-	view = glm::lookAt(cameraPosition - CameraForwardZ, cameraPosition, CameraUpY);
+/* Closes the frame's capture, if one is running */
+void UEndCapturedFrame(void)
+{
+	size_t bytes = UTraceEndFrame();
+	if (!traceOptions.capturePath.empty())
+		URecordFrameStat("capture_kb", bytes / 1024.0);
+}
 
-	// creates an orthographic and perspective projection
-	if (currentProjection == 'o' || userSelection == 'o')
-	{
-		// orthographic projection
-		projection = glm::ortho(-3.0f, 3.0f, -3.0f, 3.0f, 0.1f, 100.0f);
-		userSelection = 'o';
-	}
+/* Queues the readback of the frame just drawn, with --record */
+void URecordFrame(void)
+{
+	if (!frameRecorder)
+		return;
 
-	if (currentProjection == 'p' || userSelection == 'p')
-	{
-		// perspective projection
-		projection = glm::perspective(45.0f, (GLfloat)WindowWidth / (GLfloat)WindowHeight, 0.1f, 100.0f);
-		userSelection = 'p';
-	}
+	frameRecorder->capture(WindowWidth, WindowHeight);
 
-	// retrieves and passes transform matrices to the shader program
-	modelLoc = glGetUniformLocation(objShaderProgram, "model");
-	viewLoc = glGetUniformLocation(objShaderProgram, "view");
-	projLoc = glGetUniformLocation(objShaderProgram, "projection");
+	const RecorderStats &stats = frameRecorder->stats();
+	URecordFrameStat("record_ms", stats.captureMs);
+	URecordFrameStat("record_wait_ms", stats.waitMs);
+	URecordFrameStat("record_in_flight", stats.inFlight);
+}
 
-	// pass matrix data to the shader program's matrix uniforms
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+/* Scripted camera path for the headless benchmark: one orbit with a gentle bob and dolly */
+void UCameraPath(int frame, int frameCount)
+{
+	UPROFILE_SCOPE("UCameraPath");
+
+	TraceFrame input = UFrameInput(frame / 60.0, frame / 60.0f);
+	input.pathFrame = frame;
+	input.pathFrames = frameCount;
+	if (UHeadlessWarmup())
+		input.flags |= TRACE_FRAME_WARMUP;
+	UTraceBeginFrame(input);
+
+	UCameraPose(frame, frameCount);
+	UDrawScene();
+	UEndCapturedFrame();
+	URecordFrame();
+}
 
-	// reference matrix uniforms from the pyramid shader program for the pyramid color, light color, light position, and camera position
-	uTextureLoc = glGetUniformLocation(objShaderProgram, "uTexture");
-	light0ColorLoc = glGetUniformLocation(objShaderProgram, "light0Color");
-	light0PositionLoc = glGetUniformLocation(objShaderProgram, "light0Pos");
-	light1ColorLoc = glGetUniformLocation(objShaderProgram, "light1Color");
-	light1PositionLoc = glGetUniformLocation(objShaderProgram, "light1Pos");
-	viewPositionLoc = glGetUniformLocation(objShaderProgram, "viewPosition");
+/* Camera and scene time at frame 'frame' of the scripted path, shared by the GL and software renderers */
+void UCameraPose(int frame, int frameCount)
+{
+	GLfloat t = (GLfloat)frame / (GLfloat)frameCount; // path progress from 0 to 1
 
-	// pass color, light, and camera data to the pyramid shader program's corresponding uniforms
-	glUniform1i(uTextureLoc, 0);
-	glUniform3f(light0ColorLoc, light0Color.r, light0Color.g, light0Color.b);
-	glUniform3f(light0PositionLoc, light0Position.x, light0Position.y, light0Position.z);
-	glUniform3f(light1ColorLoc, light1Color.r, light1Color.g, light1Color.b);
-	glUniform3f(light1PositionLoc, light1Position.x, light1Position.y, light1Position.z);
-	glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+	yaw = t * glm::radians(360.0f);
+	pitch = 0.35f * sin(t * glm::radians(720.0f));
 
-	glBindTexture(GL_TEXTURE_2D, texture); // activate object texture
+	// same radians to vector conversion as the mouse callbacks
+	front.x = 5.0f * cos(yaw);
+	front.y = 5.0f * sin(pitch);
+	front.z = sin(yaw) * cos(pitch) * 5.0f;
+	CameraForwardZ = front;
 
-	glDrawElements(GL_TRIANGLES, 126, GL_UNSIGNED_INT, 0); // draws object triangles
+	cameraPosition = 0.05f * sin(t * glm::radians(360.0f)) * CameraForwardZ;
+	currentProjection = userSelection = 'p';
+	sceneTime = frame / 60.0f; // fixed 60 Hz steps so every run animates identically
+}
 
-	/*** Use the lamps shader and activate the lamp VAO for rendering and transforming ***/
-	glUseProgram(lampShaderProgram);
-	glBindVertexArray(LightVAO);
+/* Headless sweep of the local light count, clustered against every light at every fragment */
+int URunLightBenchmark(const HeadlessOptions &headless)
+{
+	const int counts[] = {0, 16, 64, 256, 1024};
+	const int countTotal = sizeof(counts) / sizeof(counts[0]);
 
-	// transform the smaller object used as a visual que for the key light source
-	model = glm::translate(model, light0Position);
-	model = glm::scale(model, light0Scale);
-	model = glm::translate(model, light1Position);
-	model = glm::scale(model, light1Scale);
+	FrameTimings timings[countTotal][2];
+	assetLoader->finish(); // measure the real chair, not the placeholder
 
-	// reference matrix uniforms from the lamp shader program
-	modelLoc = glGetUniformLocation(lampShaderProgram, "model");
-	viewLoc = glGetUniformLocation(lampShaderProgram, "view");
-	projLoc = glGetUniformLocation(lampShaderProgram, "projection");
+	for (int i = 0; i < countTotal; i++)
+	{
+		for (int loop = 0; loop < 2; loop++)
+		{
+			clusterOptions.lights = counts[i];
+			clusterOptions.loopAll = loop == 1;
+			UCreateSceneLights();
 
-	// pass matrix data to the lamp shader program's matrix uniforms
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+			// every run gets its own report and frame dumps, e.g. report_lights256-clustered.json
+			string name = "lights" + to_string(counts[i]) + (loop ? "-loop" : "-clustered");
+			HeadlessOptions run = UBenchmarkRun(headless, name);
 
-	glDrawElements(GL_TRIANGLES, 126, GL_UNSIGNED_INT, 0); // draws small object triangles
+			if (URunHeadless(run, UCameraPath, &timings[i][loop]) != 0)
+				return -1;
+		}
+	}
 
-	glBindVertexArray(0); // deactivate the VAO
+	cout << "[Local lights] " << clusterOptions.gridX << "x" << clusterOptions.gridY << "x" << clusterOptions.gridZ << " clusters" << endl;
+	for (int i = 0; i < countTotal; i++)
+	{
+		cout << counts[i] << " lights: clustered CPU p50 " << UPercentile(timings[i][0].cpuMs, 50.0) << " ms, GPU p50 "
+			 << UPercentile(timings[i][0].gpuMs, 50.0) << " ms; every light CPU p50 " << UPercentile(timings[i][1].cpuMs, 50.0)
+			 << " ms, GPU p50 " << UPercentile(timings[i][1].gpuMs, 50.0) << " ms" << endl;
+	}
 
-	glutPostRedisplay();
-	glutSwapBuffers(); // flips the back buffer with the front buffer every frame
+	return 0;
 }
 
-/* Creates the Shader Program */
-void UCreateShader(void)
+/* Headless benchmark of the float layout against the compressed ones: same path, fresh buffers per layout */
+int URunVertexBenchmark(const HeadlessOptions &headless)
 {
-	// object vertex shader
-	GLint objVertexShader = glCreateShader(GL_VERTEX_SHADER);		  // creates the vertex shader
-	glShaderSource(objVertexShader, 1, &objVertexShaderSource, NULL); // attaches the vertex shader to the source code
-	glCompileShader(objVertexShader);								  // compiles the vertex shader
-
-	// object fragment shader
-	GLint objFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);		  // creates the fragment shader
-	glShaderSource(objFragmentShader, 1, &objFragmentShaderSource, NULL); // attaches the fragment shader to the source code
-	glCompileShader(objFragmentShader);									  // compiles the fragment shader
+	VertexFormatOptions layouts[3];
+	layouts[1].position = layouts[2].position = POSITION_UNORM16;
+	layouts[1].normal = NORMAL_OCT16;
+	layouts[1].uv = UV_HALF;
+	layouts[2].normal = NORMAL_2_10_10_10;
+	layouts[2].uv = UV_UNORM16;
+
+	FrameTimings timings[3];
+	GLsizeiptr bytes[3];
+	GLsizei strides[3];
+
+	for (int i = 0; i < 3; i++)
+	{
+		vertexFormat = layouts[i];
+		UDestroyBuffers();
+		UCreateBuffers();
+		assetLoader->finish(); // measure the real layout, not the placeholder
 
-	// object shader program
-	objShaderProgram = glCreateProgram();				 // creates the shader program
-	glAttachShader(objShaderProgram, objVertexShader);	 // attach vertex shader to the shader program
-	glAttachShader(objShaderProgram, objFragmentShader); // attach fragment shader to shader program
-	glLinkProgram(objShaderProgram);					 // link vertex and fragment shaders to shader program
+		// every layout gets its own report and frame dumps, e.g. report_unorm16-oct-half.json
+		string name = UVertexFormatName(vertexFormat);
+		replace(name.begin(), name.end(), '/', '-');
 
-	// delete the vertex and fragment shaders once linked
-	glDeleteShader(objVertexShader);
-	glDeleteShader(objFragmentShader);
+		HeadlessOptions run = UBenchmarkRun(headless, name);
 
-	// lamp vertex shader
-	GLint lampVertexShader = glCreateShader(GL_VERTEX_SHADER);			// creates the vertex shader
-	glShaderSource(lampVertexShader, 1, &lampVertexShaderSource, NULL); // attaches the vertex shader to the source code
-	glCompileShader(lampVertexShader);									// compiles the vertex shader
+		if (URunHeadless(run, UCameraPath, &timings[i]) != 0)
+			return -1;
 
-	// lamp fragment shader
-	GLint lampFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);			// creates the fragment shader
-	glShaderSource(lampFragmentShader, 1, &lampFragmentShaderSource, NULL); // attaches the fragment shader to the source code
-	glCompileShader(lampFragmentShader);									// compiles the fragment shader
+		bytes[i] = vertexBufferBytes;
+		strides[i] = chairStride;
+	}
 
-	// lamp shader program
-	lampShaderProgram = glCreateProgram();				   // creates the lamp shader program
-	glAttachShader(lampShaderProgram, lampVertexShader);   // attach vertex shader to the shader program
-	glAttachShader(lampShaderProgram, lampFragmentShader); // attach fragment shader to shader program
-	glLinkProgram(lampShaderProgram);					   // link vertex and fragment shaders to shader program
+	cout << "[Vertex formats]" << endl;
+	for (int i = 0; i < 3; i++)
+	{
+		cout << UVertexFormatName(layouts[i]) << ": " << strides[i] << " bytes per vertex, " << bytes[i] / 1024.0 << " KB ("
+			 << 100.0 * bytes[i] / bytes[0] << "% of float), CPU p50 " << UPercentile(timings[i].cpuMs, 50.0)
+			 << " ms, GPU p50 " << UPercentile(timings[i].gpuMs, 50.0) << " ms" << endl;
+	}
 
-	// delete the vertex and fragment shaders once linked
-	glDeleteShader(lampVertexShader);
-	glDeleteShader(lampFragmentShader);
+	return 0;
 }
 
-void UCreateBuffers(void)
+/* Headless sweep of the finish count, one texture array against a texture and an instanced draw per finish */
+int URunMaterialBenchmark(const HeadlessOptions &headless)
 {
-	// position and color data
-	GLfloat vertices[] = {
-		// vertex positions   // normals		  // texture coord
-		0.45f, -0.80f, 0.35f, -1.0f, 1.0f, -1.0f, 1.0f, 0.0f,  // vertex 0
-		0.45f, -0.75f, 0.35f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f,  // vertex 1
-		-0.30f, -0.75f, 0.35f, 1.0f, 1.0f, -1.0f, 0.0f, 1.0f,  // vertex 2
-		-0.35f, -0.70f, 0.35f, 1.0f, 1.0f, -1.0f, 0.0f, 1.0f,  // vertex 3
-		0.50f, 0.20f, 0.45f, -1.0f, -1.0f, -1.0f, 0.0f, 0.0f,  // vertex 4
-		-0.35f, 0.20f, 0.35f, 1.0f, -1.0f, -1.0f, 0.0f, 1.0f,  // vertex 5
-		-0.45f, 0.90f, 0.35f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f,  // vertex 6
-		-0.50f, 0.90f, 0.35f, 1.0f, -1.0f, -1.0f, 0.0f, 1.0f,  // vertex 7
-		-0.40f, 0.15f, 0.35f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f,  // vertex 8
-		0.30f, 0.15f, 0.45f, -1.0f, -1.0f, -1.0f, 1.0f, 0.0f,  // vertex 9
-		0.35f, 0.10f, 0.45f, -1.0f, -1.0f, -1.0f, 0.0f, 0.0f,  // vertex 10
-		-0.50f, -0.80f, 0.35f, 1.0f, 1.0f, -1.0f, 0.0f, 1.0f,  // vertex 11
-		0.45f, -0.80f, -0.35f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f, // vertex 12
-		0.45f, -0.75f, -0.35f, -1.0f, 1.0f, 1.0f, 1.0f, 0.0f,  // vertex 13
-		-0.30f, -0.75f, -0.35f, -1.0f, 1.0f, 1.0f, 1.0f, 1.0f, // vertex 14
-		-0.35f, -0.70f, -0.35f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f,  // vertex 15
-		0.50f, 0.20f, -0.45f, -1.0f, 1.0f, 1.0f, 1.0f, 0.0f,   // vertex 16
-		-0.35f, 0.20f, -0.35f, 1.0f, -1.0f, 1.0f, 1.0f, 1.0f,  // vertex 17
-		-0.45f, 0.90f, -0.35f, 1.0f, -1.0f, 1.0f, 1.0f, 0.0f,  // vertex 18
-		-0.50f, 0.90f, -0.35f, 1.0f, -1.0f, 1.0f, 1.0f, 1.0f,  // vertex 19
-		-0.40f, 0.15f, -0.35f, 1.0f, -1.0f, 1.0f, 0.0f, 1.0f,  // vertex 20
-		0.30f, 0.15f, -0.45f, -1.0f, 1.0f, 1.0f, 0.0f, 0.0f,   // vertex 21
-		0.35f, 0.10f, -0.45f, -1.0f, 1.0f, 1.0f, 1.0f, 0.0f,   // vertex 22
-		-0.50f, -0.80f, -0.35f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f   // vertex 23
-	};
-
-	// index data to share position data
-	GLuint indices[] = {
-
-		// base
-		0, 1, 13,
-		0, 12, 13,
-		0, 11, 2,
-		0, 1, 2,
-		1, 2, 14,
-		1, 13, 14,
-		12, 23, 14,
-		12, 13, 14,
-		0, 11, 23,
-		0, 12, 23,
-
-		// leg
-		2, 3, 15,
-		2, 14, 15,
-		2, 11, 3,
-		3, 4, 16,
-		3, 15, 16,
-		3, 11, 10,
-		3, 4, 10,
-		4, 9, 10,
-		14, 23, 15,
-		15, 23, 22,
-		15, 16, 22,
-		16, 21, 22,
-		11, 10, 22,
-		11, 23, 22,
-		9, 10, 22,
-		9, 21, 22,
-
-		// seat
-		4, 5, 17,
-		4, 16, 17,
-		4, 5, 8,
-		4, 9, 8,
-		16, 17, 20,
-		16, 21, 20,
-		9, 8, 20,
-		9, 21, 20,
-
-		// chair back
-		5, 6, 18,
-		5, 17, 18,
-		5, 8, 7,
-		5, 6, 7,
-		17, 20, 19,
-		17, 18, 19,
-		8, 20, 19,
-		8, 7, 19,
-		6, 7, 19,
-		6, 18, 19};
+	if (clusterOptions.lights > 0 || !lightmapOptions.path.empty())
+	{
+		cout << "--material-bench compares the plainly lit chairs, leave out --lights and --lightmap" << endl;
+		return -1;
+	}
+
+	const int counts[] = {1, 2, 4, 8, 16, 32};
+	const int countTotal = sizeof(counts) / sizeof(counts[0]);
+
+	FrameTimings timings[countTotal][2];
+	RenderStats frames[countTotal][2];
+
+	// finishes only batch across chairs, so there has to be a showroom
+	if (showroom.count == 0)
+		showroom.count = 1024;
+
+	for (int i = 0; i < countTotal; i++)
+	{
+		for (int separate = 0; separate < 2; separate++)
+		{
+			materialOptions.count = counts[i];
+			materialOptions.separate = separate == 1;
+			UDestroyBuffers();
+			UCreateBuffers();
+			assetLoader->finish(); // measure the real layers and chair, not the placeholders
+
+			// every run gets its own report and frame dumps, e.g. report_materials16-textures.json
+			string name = "materials" + to_string(counts[i]) + (separate ? "-textures" : "-array");
+			HeadlessOptions run = UBenchmarkRun(headless, name);
+
+			if (URunHeadless(run, UCameraPath, &timings[i][separate]) != 0)
+				return -1;
+			frames[i][separate] = glState.stats; // of the last frame
+		}
+	}
+
+	cout << "[Materials] " << showroom.count << " chairs" << (showroom.loop ? ", one draw call each" : "") << endl;
+	for (int i = 0; i < countTotal; i++)
+	{
+		cout << counts[i] << " finishes: array " << frames[i][0].drawCalls << " draws, " << frames[i][0].stateChanges() << " binds, CPU p50 "
+			 << UPercentile(timings[i][0].cpuMs, 50.0) << " ms, GPU p50 " << UPercentile(timings[i][0].gpuMs, 50.0) << " ms; textures "
+			 << frames[i][1].drawCalls << " draws, " << frames[i][1].stateChanges() << " binds, CPU p50 " << UPercentile(timings[i][1].cpuMs, 50.0)
+			 << " ms, GPU p50 " << UPercentile(timings[i][1].gpuMs, 50.0) << " ms" << endl;
+	}
+
+	return 0;
+}
+
+/* Runs the camera path over the showroom culled by the frustum alone, then by the frustum and the occluders */
+int URunOcclusionBenchmark(const HeadlessOptions &headless)
+{
+	if (!showroom.cull || showroom.loop)
+	{
+		cout << "--occlusion-bench compares culled instanced showrooms, leave out --no-cull and --showroom-loop" << endl;
+		return -1;
+	}
+
+	const char *names[] = {"frustum", "occlusion"};
+	FrameTimings timings[2];
+	RenderStats frames[2];
+	size_t visible[2];
+	OcclusionStats occlusion;
+
+	// occluders are chairs, so there has to be a showroom
+	if (showroom.count == 0)
+		showroom.count = 1024;
+
+	for (int occluded = 0; occluded < 2; occluded++)
+	{
+		occlusionOptions.enabled = occluded == 1;
+		UDestroyBuffers();
+		UCreateBuffers();
+		assetLoader->finish(); // the real chair is the occluder, the placeholder culls nothing
+
+		// every run gets its own report and frame dumps, e.g. report_occlusion.json
+		HeadlessOptions run = UBenchmarkRun(headless, names[occluded]);
+
+		if (URunHeadless(run, UCameraPath, &timings[occluded]) != 0)
+			return -1;
+		frames[occluded] = glState.stats; // of the last frame
+		visible[occluded] = visibleInstances.size();
+		if (occlusionBuffer)
+			occlusion = occlusionBuffer->stats();
+	}
+
+	cout << "[Occlusion] " << showroom.count << " chairs, " << occlusionOptions.occluders << " occluders, " << occlusionOptions.width << " columns, "
+		 << taskPool->size() << " threads" << endl;
+	for (int occluded = 0; occluded < 2; occluded++)
+	{
+		cout << names[occluded] << ": " << visible[occluded] << " chairs drawn, " << frames[occluded].triangles << " triangles";
+		if (occluded)
+			cout << ", " << occlusion.occluded << " of " << occlusion.tested << " occluded in " << occlusion.rasterMs + occlusion.testMs << " ms ("
+				 << occlusion.triangles << " occluder triangles)";
+		cout << ", CPU p50 " << UPercentile(timings[occluded].cpuMs, 50.0) << " ms, GPU p50 " << UPercentile(timings[occluded].gpuMs, 50.0) << " ms" << endl;
+	}
+
+	return 0;
+}
+
+/* Replays a capture headless: re-runs its frames through the renderer, or re-issues its GL calls with --replay-calls */
+int URunReplay(const HeadlessOptions &headless)
+{
+	assetLoader->finish(); // captures with --sync-load drew the real chair from the first frame
+
+	cout << "[Replay] " << traceOptions.replayPath << ", " << replayTrace.frames.size() << " frames captured on " << replayTrace.renderer << ", "
+		 << (traceOptions.calls ? "GL calls" : "frames") << " re-issued " << (traceOptions.timing ? "at the captured pace" : "as fast as possible") << endl;
+
+	// the capture's warm-up frames are the replay's, so the timed frames line up with the captured ones
+	replayWarmup = 0;
+	replayWarmed = 0;
+	while (replayWarmup < (int)replayTrace.frames.size() && (replayTrace.frames[replayWarmup].frame.flags & TRACE_FRAME_WARMUP))
+		replayWarmup++;
+	if (replayWarmup == (int)replayTrace.frames.size())
+	{
+		cout << traceOptions.replayPath << " holds only warm-up frames" << endl;
+		return -1;
+	}
+	if (replayWarmup > 0)
+		cout << "[Replay] the first " << replayWarmup << " frames were warm-up frames and are replayed untimed" << endl;
+
+	HeadlessOptions run = headless;
+	run.warmup = replayWarmup;
+	run.frames = (int)replayTrace.frames.size() - replayWarmup;
+
+	if (traceOptions.calls)
+	{
+		traceReplayer = new TraceReplayer();
+		int result = URunHeadless(run, UReplayCalls, nullptr, UReplayWait);
+		delete traceReplayer;
+		traceReplayer = nullptr;
+
+		return result;
+	}
+
+	// the re-run is captured into memory to compare its calls
+	replayDivergent.clear();
+	UStartCapture("", 0, nullptr, "");
+	int result = URunHeadless(run, UReplayFrame, nullptr, UReplayWait);
+	UStopCapture();
+
+	size_t replayed = replayTrace.frames.size(); // the warm-up frames are compared too
+	cout << "[Replay] " << replayed - replayDivergent.size() << " of " << replayed << " frames issued the captured calls";
+	if (!replayDivergent.empty())
+		cout << ", first divergence at frame " << replayDivergent[0];
+	cout << endl;
+
+	return result;
+}
+
+/* Window size, held keys and camera events of a captured frame */
+void UReplayInput(const TraceFrameData &data)
+{
+	if (data.frame.width != WindowWidth || data.frame.height != WindowHeight)
+	{
+		WindowWidth = data.frame.width;
+		WindowHeight = data.frame.height;
+		UResizeHeadlessFramebuffer(WindowWidth, WindowHeight);
+	}
+
+	currentKey = data.frame.currentKey;
+	currentProjection = data.frame.currentProjection;
+	userSelection = data.frame.userSelection;
+
+	for (const CameraEvent &event : data.events)
+		cameraSim.push(event);
+}
+
+/* Trace frame of the replay's frame 'frame': the warm-up frames in turn while warming up, the timed ones after them */
+int UReplayIndex(int frame)
+{
+	return UHeadlessWarmup() ? replayWarmed++ : replayWarmup + frame;
+}
+
+/* With --replay-timing, holds timed frame 'frame' back until as long after the first as it was captured */
+void UReplayWait(int frame, int frameCount)
+{
+	if (frame == 0)
+		replayStart = chrono::steady_clock::now();
+	if (!traceOptions.timing)
+		return;
+
+	double offset = replayTrace.frames[replayWarmup + frame].frame.clock - replayTrace.frames[replayWarmup].frame.clock;
+	this_thread::sleep_until(replayStart + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(offset)));
+}
+
+/* Re-runs captured frame 'frame' through the renderer and checks it issued the same calls */
+void UReplayFrame(int frame, int frameCount)
+{
+	UPROFILE_SCOPE("UReplayFrame");
+
+	int index = UReplayIndex(frame);
+	const TraceFrameData &data = replayTrace.frames[index];
+	UReplayInput(data);
+
+	UTraceBeginFrame(data.frame);
+	if (data.frame.pathFrame >= 0)
+	{
+		UCameraPose(data.frame.pathFrame, data.frame.pathFrames);
+		UDrawScene();
+	}
+	else
+	{
+		UInteractiveFrame(data.frame);
+	}
+	UTraceEndFrame();
+	URecordFrame();
+
+	const vector<unsigned char> &calls = UTraceLastCalls();
+	bool diverged = calls.size() != data.callBytes || memcmp(calls.data(), data.calls, data.callBytes) != 0;
+	if (diverged)
+		replayDivergent.push_back(index);
+	URecordFrameStat("replay_diverged", diverged ? 1.0 : 0.0);
+}
+
+/* Re-issues the GL calls of captured frame 'frame' */
+void UReplayCalls(int frame, int frameCount)
+{
+	UPROFILE_SCOPE("UReplayCalls");
+
+	const TraceFrameData &data = replayTrace.frames[UReplayIndex(frame)];
+	if (data.frame.width != WindowWidth || data.frame.height != WindowHeight)
+	{
+		WindowWidth = data.frame.width;
+		WindowHeight = data.frame.height;
+		UResizeHeadlessFramebuffer(WindowWidth, WindowHeight);
+	}
+
+	traceReplayer->frame(data);
+	URecordFrame();
+	URecordFrameStat("replay_kb", data.callBytes / 1024.0);
+}
+
+/* The chair, its texture and the showroom in CPU memory for the software renderer, read on the calling thread */
+bool UCreateSoftAssets(void)
+{
+	MeshData mesh;
+	vector<unsigned char> indexBytes;
+	GLenum indexType = GL_UNSIGNED_INT;
+	bool loaded = false;
+
+	if (!meshPath.empty() && UReadMeshFile(meshPath, mesh, indexBytes, indexType))
+	{
+		// GL takes the index block as stored, the software renderer always reads 32-bit indices, of the full detail only
+		UReadIndices(indexBytes, indexType, mesh.lods.empty() ? indexBytes.size() / (indexType == GL_UNSIGNED_SHORT ? 2 : 4) : mesh.lods[0].indexCount, mesh.indices);
+
+		loaded = UCreateSoftMesh(mesh, softChair);
+		if (!loaded)
+			cout << meshPath << " is not stored in the float layout, the software renderer draws the built-in chair" << endl;
+	}
+
+	if (!loaded)
+	{
+		mesh = MeshData();
+		UBuiltinMeshData(mesh);
+		if (!UCreateSoftMesh(mesh, softChair))
+			return false;
+	}
+
+	// only the JPG: the block-compressed DDS / KTX2 copies would need a CPU decoder
+	int width, height;
+	unsigned char *image = SOIL_load_image("wood-texture1.jpg", &width, &height, 0, SOIL_LOAD_RGBA);
+	if (image)
+	{
+		UCreateSoftTexture(image, width, height, softWood);
+		SOIL_free_image_data(image);
+	}
+	else
+	{
+		// the same wood-coloured texel the GL path keeps when the texture is missing
+		const unsigned char placeholder[4] = {150, 111, 74, 255};
+		UCreateSoftTexture(placeholder, 1, 1, softWood);
+		width = height = 1;
+	}
+
+	if (showroom.count > 0 && chairInstances.empty())
+		UBuildShowroom(showroom, UChairModel(), chairInstances);
+	UBuildSceneGraph();
+
+	cout << "Software renderer: " << softChair.indices.size() / 3 << " triangles per chair, " << width << "x" << height << " texture, "
+		 << USoftSimdName() << " kernels" << endl;
+	return true;
+}
+
+/* The draws and uniforms UDrawScene would issue, as a frame for the software renderer */
+void USoftScene(SoftFrame &frame)
+{
+	UPROFILE_SCOPE("USoftScene");
+
+	UUpdateSceneGraph();
+	UCameraMatrices(frame.view, frame.projection);
+
+	frame.viewPosition = cameraPosition;
+	frame.lightColor[0] = light0Color;
+	frame.lightColor[1] = light1Color;
+	frame.clearColor = glm::vec4(0.9f, 0.9f, 0.9f, 0.5f);
+
+	// the key and fill lights; the local lights of --lights are left to the GL path
+	frame.lightPosition[0] = light0Position;
+	frame.lightPosition[1] = light1Position;
+
+	frame.draws.clear();
+	if (chairInstances.empty())
+	{
+		frame.draws.push_back({&softChair, &softWood, sceneGraph.world(chairNode), glm::vec4(1.0f, 1.0f, 1.0f, 0.5f)});
+	}
+	else
+	{
+		// every chair is submitted; the bins drop whatever lands off screen
+		for (const ChairInstance &instance : chairInstances)
+			frame.draws.push_back({&softChair, &softWood, instance.model, instance.material});
+	}
+
+	// the lamp, placed as in UDrawScene
+	frame.draws.push_back({&softChair, nullptr, sceneGraph.world(lampNode), glm::vec4(1.0f)});
+}
+
+/* Frame 'frame' of the scripted camera path, drawn by the software renderer */
+void USoftPath(int frame, int frameCount)
+{
+	UPROFILE_SCOPE("USoftPath");
+
+	UCameraPose(frame, frameCount);
+	USoftScene(softScene);
+	softRasterizer->render(softScene);
+}
+
+bool USoftDump(const string &path)
+{
+	return softRasterizer->writePPM(path);
+}
+
+/* --headless --soft-raster: the scripted path on the CPU, with the GL run's report and frame dumps */
+int URunSoftHeadless(const HeadlessOptions &headless)
+{
+	SoftRasterizer rasterizer(*taskPool, headless.width, headless.height, softRaster.tileSize);
+	softRasterizer = &rasterizer;
+
+	string renderer = string("software rasterizer, ") + USoftSimdName() + ", " + to_string(taskPool->size()) + " threads";
+	int result = URunHeadlessCpu(headless, USoftPath, USoftDump, renderer);
+
+	softRasterizer = nullptr;
+	return result;
+}
+
+/* --headless --soft-compare: draws the dumped frames with GL and on the CPU and fails when they disagree */
+int URunSoftCompare(const HeadlessOptions &headless)
+{
+	const int threshold = 16;			 // channel difference that makes a pixel count as differing
+	const double allowedPercent = 2.0; // edge pixels and filtering round differently, a broken image differs far more
+
+	vector<int> frames = headless.dumpFrames;
+	if (frames.empty())
+		frames = {0, headless.frames / 2, headless.frames - 1};
+
+	SoftRasterizer rasterizer(*taskPool, headless.width, headless.height, softRaster.tileSize);
+	softRasterizer = &rasterizer;
+	assetLoader->finish(); // compare against the real chair and texture, not the placeholders
+
+	bool passed = true;
+	vector<unsigned char> gl, soft;
+
+	cout << "[Software renderer against GL] " << headless.width << "x" << headless.height << ", pixels off by more than " << threshold << " levels" << endl;
+	for (int frame : frames)
+	{
+		UCameraPath(frame, headless.frames);
+		glFinish();
+		UReadFramebuffer(headless.width, headless.height, gl);
+
+		USoftPath(frame, headless.frames);
+		rasterizer.readPixels(soft);
+
+		if (!headless.dumpFrames.empty())
+		{
+			UWritePPM(headless.dumpPrefix + "_gl_" + to_string(frame) + ".ppm", headless.width, headless.height);
+			rasterizer.writePPM(headless.dumpPrefix + "_soft_" + to_string(frame) + ".ppm");
+		}
+
+		SoftImageDiff diff = UCompareImages(gl, soft, threshold);
+		passed = passed && diff.differingPercent <= allowedPercent;
+
+		cout << "frame " << frame << ": mean error " << diff.meanError << ", max " << diff.maxError << ", " << diff.differingPercent << "% differing"
+			 << (diff.differingPercent <= allowedPercent ? "" : " FAILED") << endl;
+	}
+
+	softRasterizer = nullptr;
+	return passed ? 0 : -1;
+}
+
+/* --headless --soft-bench: the scripted path at 1, 2, 4 ... threads up to every hardware thread */
+int URunSoftBenchmark(const HeadlessOptions &headless)
+{
+	unsigned hardware = max(1u, thread::hardware_concurrency());
+	vector<unsigned> threadCounts;
+	for (unsigned threads = 1; threads < hardware; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(hardware);
+
+	vector<FrameTimings> timings(threadCounts.size());
+
+	for (size_t i = 0; i < threadCounts.size(); i++)
+	{
+		TaskPool pool(threadCounts[i]);
+		SoftRasterizer rasterizer(pool, headless.width, headless.height, softRaster.tileSize);
+		softRasterizer = &rasterizer;
+
+		// every thread count gets its own report and frame dumps, e.g. report_t4.json
+		string name = "t" + to_string(threadCounts[i]);
+		HeadlessOptions run = UBenchmarkRun(headless, name);
+
+		string renderer = string("software rasterizer, ") + USoftSimdName() + ", " + to_string(threadCounts[i]) + " threads";
+		int result = URunHeadlessCpu(run, USoftPath, USoftDump, renderer, &timings[i]);
+		softRasterizer = nullptr;
+		if (result != 0)
+			return -1;
+	}
+
+	cout << "[Software renderer scaling] " << headless.width << "x" << headless.height << ", " << softRaster.tileSize << " px tiles, " << USoftSimdName() << endl;
+	double single = UPercentile(timings[0].cpuMs, 50.0);
+	for (size_t i = 0; i < threadCounts.size(); i++)
+	{
+		double p50 = UPercentile(timings[i].cpuMs, 50.0);
+		cout << threadCounts[i] << " threads: p50 " << p50 << " ms, p99 " << UPercentile(timings[i].cpuMs, 99.0) << " ms, "
+			 << single / p50 << "x speedup" << endl;
+	}
+
+	return 0;
+}
+
+/* Batch worker: its own renderer, with the chair and texture fully loaded before the first job */
+bool UBatchSetup(const BatchJob &first)
+{
+	WindowWidth = first.width;
+	WindowHeight = first.height;
+
+	// the jobs are spread over processes, so every worker stays on one thread
+	taskPool = new TaskPool(1);
+	assetLoader = new AssetLoader(loaderOptions);
+
+	if (softRaster.enabled)
+	{
+		if (!UCreateSoftAssets())
+			return false;
+		softRasterizer = new SoftRasterizer(*taskPool, WindowWidth, WindowHeight, softRaster.tileSize);
+		return true;
+	}
+
+	if (!UCreateHeadlessContext(WindowWidth, WindowHeight) || !UCreateShader())
+		return false;
+	UCreateBuffers();
+	UGenerateTexture();
+	glClearColor(0.9f, 0.9f, 0.9f, 0.5f);
+
+	assetLoader->finish(); // no still shows the placeholders
+	return true;
+}
+
+/* Batch worker: draws one still from the job's pose and projection and writes it */
+bool UBatchRender(const BatchJob &job, BatchResult &result)
+{
+	auto start = chrono::steady_clock::now();
+
+	if (job.width != WindowWidth || job.height != WindowHeight)
+	{
+		WindowWidth = job.width;
+		WindowHeight = job.height;
+		if (softRaster.enabled)
+		{
+			delete softRasterizer;
+			softRasterizer = new SoftRasterizer(*taskPool, WindowWidth, WindowHeight, softRaster.tileSize);
+		}
+		else
+		{
+			UResizeHeadlessFramebuffer(WindowWidth, WindowHeight);
+		}
+	}
+
+	// same radians to vector conversion as the mouse callbacks, looking at the chair from 'distance' away
+	yaw = glm::radians(job.yaw);
+	pitch = glm::radians(job.pitch);
+	front.x = job.distance * cos(yaw);
+	front.y = job.distance * sin(pitch);
+	front.z = sin(yaw) * cos(pitch) * job.distance;
+	CameraForwardZ = front;
+	cameraPosition = glm::vec3(0.0f);
+	currentProjection = userSelection = job.projection;
+	sceneTime = 0.0f; // showroom chairs at their resting spots
+
+	if (softRaster.enabled)
+	{
+		USoftScene(softScene);
+		softRasterizer->render(softScene);
+	}
+	else
+	{
+		UDrawScene();
+		glFinish();
+	}
+
+	auto rendered = chrono::steady_clock::now();
+	bool written = softRaster.enabled ? softRasterizer->writePPM(job.output) : UWritePPM(job.output, WindowWidth, WindowHeight);
+
+	chrono::duration<double, milli> renderMs = rendered - start, writeMs = chrono::steady_clock::now() - rendered;
+	result.renderMs = renderMs.count();
+	result.writeMs = writeMs.count();
+	return written;
+}
+
+void UBatchTeardown(void)
+{
+	delete assetLoader;
+	if (softRaster.enabled)
+	{
+		delete softRasterizer;
+		softRasterizer = nullptr;
+	}
+	else
+	{
+		UDestroyBuffers();
+		UDestroyHeadlessContext();
+	}
+	delete taskPool;
+}
+
+/* Draws the chair and its lamp with the current camera */
+void UDrawScene(void)
+{
+	UPROFILE_SCOPE("UDrawScene");
+	UPROFILE_GPU_SCOPE("UDrawScene");
+
+	assetLoader->pump(); // swap in whatever finished loading, within this frame's upload budget
+
+	// the levels last frame's chairs asked for, within the texture budget
+	if (textureStreamer)
+	{
+		textureStreamer->update();
+
+		const StreamStats &stats = textureStreamer->stats();
+		URecordFrameStat("stream_resident_mb", stats.residentBytes / (1024.0 * 1024.0));
+		URecordFrameStat("stream_uploaded_kb", stats.uploadedBytes / 1024.0);
+		URecordFrameStat("stream_pending", stats.pending);
+		URecordFrameStat("stream_misses", stats.misses);
+		URecordFrameStat("stream_evictions", stats.evictions);
+		URecordFrameStat("stream_ms", stats.ms);
+	}
+
+	glEnable(GL_DEPTH_TEST);							// enable z-depth
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // clears the screen
+	UTraceEnable(GL_DEPTH_TEST);
+	UTraceClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);	// really nice perspective calculations
+
+	// the loader and the profiler bind between frames, so the cache starts every frame unsure
+	glState.invalidate();
+	glState.stats = RenderStats();
+	renderQueue.clear();
+
+	glm::mat4 view;
+	glm::mat4 projection;
+
+	UUpdateSceneGraph();
+
+	/*** Pick the object shader ***/
+	bool instanced = !(chairInstances.empty() || showroom.loop);
+	bool layered = materialOptions.count > 0 && !materialOptions.separate; // the clustered and lightmap programs were built layered too
+	GLint objProgram = instanced ? objInstancedShaderProgram : objShaderProgram;
+	if (lightClusters)
+		objProgram = instanced ? objInstancedClusteredShaderProgram : objClusteredShaderProgram;
+	else if (lightmapTexture && chairLightmapped)
+		objProgram = instanced ? objInstancedLightmapShaderProgram : objLightmapShaderProgram;
+	else if (layered)
+		objProgram = instanced ? objInstancedArrayShaderProgram : objArrayShaderProgram;
+
+	UCameraMatrices(view, projection);
+
+	if (!chairInstances.empty())
+		UUpdateShowroom(projection * view);
+
+	uint32_t lodFading = 0; // chairs drawn at two levels this frame
+	if (!lodVAOs.empty())
+		lodFading = USelectShowroomLods(view, projection);
+
+	if (textureStreamer)
+		UStreamMaterials(view, projection);
+
+	/*** Write what every program shares into the Frame block, once for the whole frame ***/
+	size_t objects = (showroom.loop ? visibleInstances.size() : 1) * (lodOptions.fade ? 2 : 1) + 1; // the chairs, each at up to two levels, and the lamp
+	uniformRing->begin(uniformRing->aligned(sizeof(FrameUniforms)) + objects * uniformRing->aligned(sizeof(ObjectUniforms)));
+
+	FrameUniforms frame = FrameUniforms();
+	frame.view = view;
+	frame.projection = projection;
+	frame.viewPosition = cameraPosition;
+	frame.light0Position = light0Position;
+	frame.light0Color = light0Color;
+	frame.light1Position = light1Position;
+	frame.light1Color = light1Color;
+	frame.positionScale = vertexDecode.positionScale;
+	frame.positionOffset = vertexDecode.positionOffset;
+	frame.uvScale = vertexDecode.uvScale;
+	frame.uvOffset = vertexDecode.uvOffset;
+	frame.octNormals = vertexDecode.octNormals;
+	glState.bindUniformRange(FRAME_BLOCK_BINDING, uniformRing->buffer(), uniformRing->push(&frame, sizeof(frame)), sizeof(FrameUniforms));
+
+	// local lights move every frame, so their cluster lists are rebuilt every frame
+	if (lightClusters)
+	{
+		UAnimateClusterLights(restLights, sceneTime, sceneLights);
+		lightClusters->update(sceneLights, view, projection, WindowWidth, WindowHeight, *taskPool);
+		glState.useProgram(objProgram);
+		lightClusters->bind(programUniforms[objProgram]);
+
+		const ClusterStats &stats = lightClusters->stats();
+		URecordFrameStat("cluster_ms", stats.buildMs);
+		URecordFrameStat("light_refs", stats.lightRefs);
+		URecordFrameStat("cluster_max_lights", stats.maxLights);
+	}
+
+	if (objProgram == objLightmapShaderProgram || objProgram == objInstancedLightmapShaderProgram)
+		glState.bindTexture(LIGHTMAP_TEXTURE_UNIT, lightmapTexture);
+
+	/*** Record the chairs: the queue sorts them and skips the binds they share ***/
+	RenderCommand chair;
+	chair.program = objProgram;
+	chair.vao = ObjVAO;
+	chair.texture = texture;
+	chair.objectBuffer = uniformRing->buffer();
+	chair.count = chairIndexCount;
+	chair.indexType = chairIndexType;
+
+	if (layered)
+	{
+		chair.texture = materialArray; // every finish is a layer of it, picked per draw or per instance
+		chair.textureTarget = GL_TEXTURE_2D_ARRAY;
+	}
+
+	// with --material-textures the finish decides the texture, and the queue groups the draws by it
+	auto finishTexture = [&](GLfloat layer)
+	{ return materialTextures.empty() ? chair.texture : materialTextures[(int)layer]; };
+
+	auto viewDepth = [&](const glm::mat4 &placement)
+	{ return -(view * placement * glm::vec4(0.5f * (chairBounds.min + chairBounds.max), 1.0f)).z; };
+
+	// a chair drawn on its own records its level, and the next one too while they cross-fade
+	auto pushChair = [&](ObjectUniforms &object)
+	{
+		LodSelection selection;
+		if (chairLods.size() > 1)
+		{
+			float scale = glm::length(glm::vec3(object.model[0])); // the chairs are scaled uniformly
+			float radius = 0.5f * glm::length(chairBounds.max - chairBounds.min) * scale;
+			selection = USelectLod(chairLods, lodOptions, ULodPixelsPerUnit(projection, (float)WindowHeight, chair.depth, radius, scale));
+		}
+		lodFading += selection.fade > 0.0f;
+
+		for (int level = selection.level; level <= selection.level + (selection.fade > 0.0f); level++)
+		{
+			object.fade = level == selection.level ? selection.fade : -selection.fade;
+			chair.firstIndex = chairLods.empty() ? 0 : chairLods[level].firstIndex;
+			chair.count = chairLods.empty() ? chairIndexCount : (GLsizei)chairLods[level].indexCount;
+			chair.objectOffset = uniformRing->push(&object, sizeof(object));
+			renderQueue.push(chair);
+		}
+	};
+
+	ObjectUniforms object = ObjectUniforms();
+	if (chairInstances.empty())
+	{
+		object.model = sceneGraph.world(chairNode);
+		chair.texture = finishTexture(0.0f);
+		chair.depth = viewDepth(object.model);
+		pushChair(object);
+	}
+	else if (showroom.loop)
+	{
+		// one draw call per chair, kept to measure what instancing saves; front to back once sorted
+		for (uint32_t instance : visibleInstances)
+		{
+			object.model = chairInstances[instance].model;
+			object.layer = chairInstances[instance].layer;
+			chair.texture = finishTexture(object.layer);
+			chair.depth = viewDepth(object.model);
+			pushChair(object);
+		}
+	}
+	else if (!materialVAOs.empty())
+	{
+		// one instanced draw per finish, each from the buffer of that finish's visible chairs
+		chair.objectBuffer = 0;
+		for (size_t layer = 0; layer < materialVAOs.size(); layer++)
+		{
+			if (materialInstanceData[layer].empty())
+				continue;
+
+			chair.vao = materialVAOs[layer];
+			chair.texture = materialTextures[layer];
+			chair.instances = (GLsizei)materialInstanceData[layer].size();
+			renderQueue.push(chair);
+		}
+	}
+	else if (!lodVAOs.empty())
+	{
+		// one instanced draw per level, each from the run of the instance buffer its vertex array points at
+		chair.objectBuffer = 0;
+		for (size_t level = 0; level < lodVAOs.size(); level++)
+		{
+			if (lodInstanceCounts[level] == 0)
+				continue;
+
+			chair.vao = lodVAOs[level];
+			chair.firstIndex = chairLods[level].firstIndex;
+			chair.count = (GLsizei)chairLods[level].indexCount;
+			chair.instances = (GLsizei)lodInstanceCounts[level];
+			renderQueue.push(chair);
+		}
+	}
+	else if (!visibleInstances.empty())
+	{
+		chair.vao = ShowroomVAO;
+		chair.objectBuffer = 0; // every chair's placement comes from its instance attributes
+		chair.instances = (GLsizei)visibleInstances.size();
+		renderQueue.push(chair); // draws every visible chair in one call, whatever their finishes
+	}
+
+	/*** Record the lamp ***/
+	object.model = sceneGraph.world(lampNode);
+	object.layer = 0.0f;
+	object.fade = 0.0f;
+
+	RenderCommand lamp;
+	lamp.pass = RENDER_PASS_LAMPS;
+	lamp.program = lampShaderProgram;
+	lamp.vao = LightVAO;
+	lamp.texture = texture; // unused by the lamp shader; keeps the wood bound instead of rebinding it next frame
+	lamp.objectBuffer = uniformRing->buffer();
+	lamp.objectOffset = uniformRing->push(&object, sizeof(object));
+	lamp.count = chairIndexCount;
+	lamp.indexType = chairIndexType;
+	renderQueue.push(lamp); // draws small object triangles
+
+	uniformRing->flush(); // everything the draws read is written
+	renderQueue.submit(glState);
+	uniformRing->end(); // the region is reused once the GPU is past these draws
+
+	glBindVertexArray(0); // deactivate the VAO
+	UTraceBindVertexArray(0);
+	glState.invalidate();
+
+	URecordFrameStat("draw_calls", glState.stats.drawCalls);
+	URecordFrameStat("state_changes", glState.stats.stateChanges());
+	URecordFrameStat("binds_skipped", glState.stats.skipped);
+	URecordFrameStat("triangles", (double)glState.stats.triangles);
+	if (lodOptions.enabled)
+		URecordFrameStat("lod_fading", lodFading);
+	URecordFrameStat("uniform_kb", uniformRing->stats().bytes / 1024.0);
+	URecordFrameStat("uniform_wait_ms", uniformRing->stats().waitMs);
+	if (materialOptions.count > 0)
+		URecordFrameStat("materials", materialOptions.count);
+
+	assetLoader->endFrame();
+}
+
+/* View and projection of the current camera, orthographic or perspective as selected */
+void UCameraMatrices(glm::mat4 &view, glm::mat4 &projection)
+{
+	// transforms the camera
+	view = glm::lookAt(cameraPosition - CameraForwardZ, cameraPosition, CameraUpY);
+
+	// creates an orthographic and perspective projection
+	if (currentProjection == 'o' || userSelection == 'o')
+	{
+		// orthographic projection
+		projection = glm::ortho(-3.0f, 3.0f, -3.0f, 3.0f, 0.1f, 100.0f);
+		userSelection = 'o';
+	}
+
+	if (currentProjection == 'p' || userSelection == 'p')
+	{
+		// perspective projection
+		projection = glm::perspective(45.0f, (GLfloat)WindowWidth / (GLfloat)WindowHeight, 0.1f, 100.0f);
+		userSelection = 'p';
+	}
+}
+
+/* Refits the BVH around the chairs that moved and culls the showroom into the instance VBO */
+void UUpdateShowroom(const glm::mat4 &viewProjection)
+{
+	UPROFILE_SCOPE("UUpdateShowroom");
+
+	if (!showroom.cull)
+	{
+		// everything is submitted, the buffer only changes when chairs move
+		if (!movedInstances.empty() && materialVAOs.empty() && lodVAOs.empty())
+			UUploadInstances(InstanceVBO, chairInstances.data(), (GLsizei)chairInstances.size());
+
+		visibleInstances.resize(chairInstances.size());
+		for (uint32_t i = 0; i < visibleInstances.size(); i++)
+			visibleInstances[i] = i;
+
+		if (!materialVAOs.empty())
+			UUploadMaterialInstances();
+		return;
+	}
+
+	for (uint32_t instance : movedInstances)
+		showroomBvh.bounds[instance] = UTransformBounds(chairBounds, chairInstances[instance].model);
+	URefitBvh(showroomBvh, movedInstances);
+
+	CullStats stats;
+	UCullBvh(showroomBvh, viewProjection, *taskPool, visibleInstances, stats);
+
+	if (occlusionBuffer && !chairOccluder.indices.empty())
+		UOcclusionCullShowroom(viewProjection);
+
+	URecordFrameStat("visible", (double)visibleInstances.size());
+	URecordFrameStat("culled", stats.culled);
+	URecordFrameStat("cull_ms", stats.cullMs);
+
+	if (!materialVAOs.empty())
+	{
+		UUploadMaterialInstances();
+		return;
+	}
+
+	// with levels of detail the visible chairs are uploaded sorted by level, once UDrawScene has picked them
+	if (!lodVAOs.empty())
+		return;
+
+	// gather the visible chairs so the instanced draw only sees them
+	visibleInstanceData.resize(visibleInstances.size());
+	for (size_t i = 0; i < visibleInstances.size(); i++)
+		visibleInstanceData[i] = chairInstances[visibleInstances[i]];
+	UUploadInstances(InstanceVBO, visibleInstanceData.data(), (GLsizei)visibleInstanceData.size());
+}
+
+/* Rasterizes the nearest frustum-visible chairs and drops the chairs hidden behind them from visibleInstances */
+void UOcclusionCullShowroom(const glm::mat4 &viewProjection)
+{
+	UPROFILE_SCOPE("UOcclusionCullShowroom");
+
+	// the nearest chairs cover the most screen, ranked by the clip w of their bounds' centres
+	vector<pair<float, uint32_t>> nearest(visibleInstances.size());
+	for (size_t i = 0; i < visibleInstances.size(); i++)
+	{
+		const Bounds &bounds = showroomBvh.bounds[visibleInstances[i]];
+		nearest[i] = make_pair((viewProjection * glm::vec4(0.5f * (bounds.min + bounds.max), 1.0f)).w, visibleInstances[i]);
+	}
+	size_t occluders = min(nearest.size(), (size_t)occlusionOptions.occluders);
+	nth_element(nearest.begin(), nearest.begin() + occluders, nearest.end());
+
+	occluderPlacements.resize(occluders);
+	for (size_t i = 0; i < occluders; i++)
+		occluderPlacements[i] = chairInstances[nearest[i].second].model;
+
+	occlusionBuffer->render(viewProjection, chairOccluder, occluderPlacements, *taskPool);
+	occlusionBuffer->cull(showroomBvh.bounds, visibleInstances, *taskPool);
+
+	const OcclusionStats &stats = occlusionBuffer->stats();
+	URecordFrameStat("occluded", stats.occluded);
+	URecordFrameStat("occluded_fraction", stats.tested > 0 ? (double)stats.occluded / stats.tested : 0.0);
+	URecordFrameStat("occluder_triangles", stats.triangles);
+	URecordFrameStat("occlusion_ms", stats.rasterMs + stats.testMs);
+}
+
+/* Picks the level of every visible chair and uploads them sorted by level, one run per level; returns how many cross-fade */
+uint32_t USelectShowroomLods(const glm::mat4 &view, const glm::mat4 &projection)
+{
+	UPROFILE_SCOPE("USelectShowroomLods");
+
+	glm::vec3 center = 0.5f * (chairBounds.min + chairBounds.max);
+	float radius = 0.5f * glm::length(chairBounds.max - chairBounds.min);
+	size_t levels = chairLods.size();
+
+	lodSelections.resize(visibleInstances.size());
+	lodInstanceCounts.assign(levels, 0);
+	uint32_t fading = 0;
+	for (size_t i = 0; i < visibleInstances.size(); i++)
+	{
+		const glm::mat4 &model = chairInstances[visibleInstances[i]].model;
+		float scale = glm::length(glm::vec3(model[0]));
+		float depth = -(view * model * glm::vec4(center, 1.0f)).z;
+
+		LodSelection &selection = lodSelections[i];
+		selection = USelectLod(chairLods, lodOptions, ULodPixelsPerUnit(projection, (float)WindowHeight, depth, radius * scale, scale));
+		lodInstanceCounts[selection.level]++;
+		if (selection.fade > 0.0f)
+		{
+			lodInstanceCounts[selection.level + 1]++;
+			fading++;
+		}
+	}
+
+	// counting sort: each level's chairs are one run of the buffer
+	vector<uint32_t> firsts(levels, 0);
+	for (size_t level = 1; level < levels; level++)
+		firsts[level] = firsts[level - 1] + lodInstanceCounts[level - 1];
+
+	vector<uint32_t> fill = firsts;
+	visibleInstanceData.resize(firsts.back() + lodInstanceCounts.back());
+	for (size_t i = 0; i < visibleInstances.size(); i++)
+	{
+		const LodSelection &selection = lodSelections[i];
+		ChairInstance instance = chairInstances[visibleInstances[i]];
+		instance.fade = selection.fade;
+		visibleInstanceData[fill[selection.level]++] = instance;
+		if (selection.fade > 0.0f)
+		{
+			instance.fade = -selection.fade;
+			visibleInstanceData[fill[selection.level + 1]++] = instance;
+		}
+	}
+	UUploadInstances(InstanceVBO, visibleInstanceData.data(), (GLsizei)visibleInstanceData.size());
+
+	// the vertex arrays whose run moved are pointed at its new start
+	lodFirstInstances.resize(levels, ~0u);
+	for (size_t level = 0; level < levels; level++)
+	{
+		if (lodInstanceCounts[level] == 0 || firsts[level] == lodFirstInstances[level])
+			continue;
+
+		glBindVertexArray(lodVAOs[level]);
+		UTraceBindVertexArray(lodVAOs[level]);
+		UEnableInstanceAttributes(InstanceVBO, firsts[level]);
+		lodFirstInstances[level] = firsts[level];
+	}
+	glBindVertexArray(0);
+	UTraceBindVertexArray(0);
+
+	return fading;
+}
+
+/* Sorts the visible chairs into the instance buffers of their finishes, for --material-textures */
+void UUploadMaterialInstances(void)
+{
+	for (vector<ChairInstance> &instances : materialInstanceData)
+		instances.clear();
+	for (uint32_t instance : visibleInstances)
+		materialInstanceData[(int)chairInstances[instance].layer].push_back(chairInstances[instance]);
+
+	for (size_t layer = 0; layer < materialInstanceData.size(); layer++)
+	{
+		if (!materialInstanceData[layer].empty())
+			UUploadInstances(materialInstanceVBOs[layer], materialInstanceData[layer].data(), (GLsizei)materialInstanceData[layer].size());
+	}
+}
+
+/* The chair, its lamp and every showroom chair under its spot; the chair instances take their placement from here */
+void UBuildSceneGraph(void)
+{
+	sceneGraph.clear();
+	showroomSpots.clear();
+	showroomChairs.clear();
+	movingInstances.clear();
+
+	chairNode = sceneGraph.add(SCENE_NO_PARENT, UChairModel());
+
+	// the smaller object used as a visual que for the key light source, placed relative to the chair
+	glm::mat4 lamp = glm::translate(glm::mat4(1.0f), light0Position);
+	lamp = glm::scale(lamp, light0Scale);
+	lamp = glm::translate(lamp, light1Position);
+	lamp = glm::scale(lamp, light1Scale);
+	lampNode = sceneGraph.add(chairNode, lamp);
+
+	for (int i = 0; i < (int)chairInstances.size(); i++)
+	{
+		SceneNode spot = sceneGraph.add(SCENE_NO_PARENT, UShowroomSpot(showroom, i, 0.0f));
+		showroomSpots.push_back(spot);
+		showroomChairs.push_back(sceneGraph.add(spot, UChairModel()));
+
+		if (UIsShowroomMoving(showroom, i))
+			movingInstances.push_back((uint32_t)i);
+	}
+
+	sceneGraph.update(*taskPool);
+	for (size_t i = 0; i < chairInstances.size(); i++)
+		chairInstances[i].model = sceneGraph.world(showroomChairs[i]);
+}
+
+/* Moves the moving chairs to 'sceneTime' and recomputes the subtrees that changed; movedInstances lists those chairs */
+void UUpdateSceneGraph(void)
+{
+	UPROFILE_SCOPE("UUpdateSceneGraph");
+
+	for (uint32_t instance : movingInstances)
+		sceneGraph.setLocal(showroomSpots[instance], UShowroomSpot(showroom, instance, sceneTime));
+	sceneGraph.update(*taskPool);
+
+	movedInstances = movingInstances;
+	for (uint32_t instance : movedInstances)
+		chairInstances[instance].model = sceneGraph.world(showroomChairs[instance]);
+
+	const SceneGraphStats &stats = sceneGraph.stats();
+	URecordFrameStat("scene_nodes_updated", stats.updated);
+	URecordFrameStat("scene_update_ms", stats.updateMs);
+}
+
+/* Creates the Shader Programs, from the program binary cache when the sources and driver are unchanged */
+bool UCreateShader(void)
+{
+	UPROFILE_SCOPE("UCreateShader");
+	auto start = chrono::steady_clock::now();
+	bool cached[3];
+
+	// the finish's texel comes from a second fragment shader: the wood texture, or the material array with --materials
+	bool layered = materialOptions.count > 0 && !materialOptions.separate;
+	const GLchar *texelSource = layered ? objArrayTexelShaderSource : objTexelShaderSource;
+	string texelName = layered ? "-array" : "";
+
+	// and a third decides whether the pixel is drawn at all: the dither of a level of detail cross-fade with --lod-fade
+	const GLchar *fadeSource = lodOptions.fade ? objFadeShaderSource : objSolidShaderSource;
+	string fadeName = lodOptions.fade ? "-fade" : "";
+
+	// object shader program
+	objShaderProgram = UCreateProgram(shaderCache, "object" + fadeName, {{GL_VERTEX_SHADER, objVertexShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, objFragmentShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, objTexelShaderSource}, {GL_FRAGMENT_SHADER, fadeSource}}, &cached[0]);
+
+	// instanced object shader program, sharing the object fragment shader
+	objInstancedShaderProgram = UCreateProgram(shaderCache, "object-instanced" + fadeName, {{GL_VERTEX_SHADER, objInstancedVertexShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, objFragmentShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, objTexelShaderSource}, {GL_FRAGMENT_SHADER, fadeSource}}, &cached[1]);
+
+	// lamp shader program
+	lampShaderProgram = UCreateProgram(shaderCache, "lamp", {{GL_VERTEX_SHADER, lampVertexShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, lampFragmentShaderSource}}, &cached[2]);
+
+	if (objShaderProgram == 0 || objInstancedShaderProgram == 0 || lampShaderProgram == 0)
+		return false;
+
+	int programs = 3, fromCache = cached[0] + cached[1] + cached[2];
+
+	// layered variants of both object programs, only built when there are materials
+	if (materialOptions.count > 0 || materialOptions.benchmark)
+	{
+		objArrayShaderProgram = UCreateProgram(shaderCache, "object-array" + fadeName, {{GL_VERTEX_SHADER, objVertexShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, objFragmentShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, objArrayTexelShaderSource}, {GL_FRAGMENT_SHADER, fadeSource}}, &cached[0]);
+		objInstancedArrayShaderProgram = UCreateProgram(shaderCache, "object-instanced-array" + fadeName, {{GL_VERTEX_SHADER, objInstancedVertexShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, objFragmentShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, objArrayTexelShaderSource}, {GL_FRAGMENT_SHADER, fadeSource}}, &cached[1]);
+
+		if (objArrayShaderProgram == 0 || objInstancedArrayShaderProgram == 0)
+			return false;
+
+		programs += 2;
+		fromCache += cached[0] + cached[1];
+	}
+
+	// clustered variants of both object programs, only built when there are local lights
+	if (clusterOptions.lights > 0 || clusterOptions.benchmark)
+	{
+		objClusteredShaderProgram = UCreateProgram(shaderCache, "object-clustered" + texelName + fadeName, {{GL_VERTEX_SHADER, objVertexShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, objClusteredFragmentShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, texelSource}, {GL_FRAGMENT_SHADER, fadeSource}}, &cached[0]);
+		objInstancedClusteredShaderProgram = UCreateProgram(shaderCache, "object-instanced-clustered" + texelName + fadeName, {{GL_VERTEX_SHADER, objInstancedVertexShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, objClusteredFragmentShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, texelSource}, {GL_FRAGMENT_SHADER, fadeSource}}, &cached[1]);
+
+		if (objClusteredShaderProgram == 0 || objInstancedClusteredShaderProgram == 0)
+			return false;
+
+		programs += 2;
+		fromCache += cached[0] + cached[1];
+	}
+
+	// baked lighting variants, only built when a lightmap is given
+	if (!lightmapOptions.path.empty())
+	{
+		objLightmapShaderProgram = UCreateProgram(shaderCache, "object-lightmap" + texelName + fadeName, {{GL_VERTEX_SHADER, objVertexShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, objLightmapFragmentShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, texelSource}, {GL_FRAGMENT_SHADER, fadeSource}}, &cached[0]);
+		objInstancedLightmapShaderProgram = UCreateProgram(shaderCache, "object-instanced-lightmap" + texelName + fadeName, {{GL_VERTEX_SHADER, objInstancedVertexShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, objLightmapFragmentShaderSource, frameBlockSource}, {GL_FRAGMENT_SHADER, texelSource}, {GL_FRAGMENT_SHADER, fadeSource}}, &cached[1]);
+
+		if (objLightmapShaderProgram == 0 || objInstancedLightmapShaderProgram == 0)
+			return false;
+
+		programs += 2;
+		fromCache += cached[0] + cached[1];
+	}
+
+	// locations and block bindings are looked up once here, never while drawing
+	for (GLint program : {objShaderProgram, objInstancedShaderProgram, lampShaderProgram, objArrayShaderProgram, objInstancedArrayShaderProgram,
+						  objClusteredShaderProgram, objInstancedClusteredShaderProgram, objLightmapShaderProgram, objInstancedLightmapShaderProgram})
+	{
+		if (program != 0 && !ULinkUniforms(program))
+			return false;
+	}
+
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	cout << "Shader programs: " << fromCache << " of " << programs << " from the cache, ready in " << elapsed.count() << " ms" << endl;
+	return true;
+}
+
+/* Reflects a linked program and sets the uniforms that never change: the texture units and the lightmap range */
+bool ULinkUniforms(GLuint program)
+{
+	ProgramUniforms &uniforms = programUniforms[program];
+	if (!UReflectProgram(program, uniforms))
+		return false;
+
+	glUseProgram(program);
+	glUniform1i(uniforms.location("uTexture"), 0);
+	glUniform1i(uniforms.location("uMaterials"), 0); // the layered programs have it instead of uTexture
+	glUniform1i(uniforms.location("lightmap"), LIGHTMAP_TEXTURE_UNIT);
+	glUniform1f(uniforms.location("lightmapRange"), LIGHTMAP_RANGE);
+	glUseProgram(0);
+	return true;
+}
+
+void UCreateBuffers(void)
+{
+	UPROFILE_SCOPE("UCreateBuffers");
+
+	// generate buffer ids
+	glGenVertexArrays(1, &ObjVAO);
+	glGenVertexArrays(1, &LightVAO); // vertex array object for pyramid vertex copies to serve as light source
+	glGenBuffers(1, &VBO);
+	glGenBuffers(1, &EBO);
+
+	// activate the vertex array object before binding and setting any VBOs and vertex attribute pointers
+	glBindVertexArray(ObjVAO);
+
+	// a box the size of the built-in chair is drawn until the real geometry is resident
+	MeshData placeholder;
+	UPlaceholderMeshData(placeholder);
+
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBufferData(GL_ARRAY_BUFFER, placeholder.vertices.size(), placeholder.vertices.data(), GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, placeholder.indices.size() * sizeof(GLuint), placeholder.indices.data(), GL_STATIC_DRAW);
+
+	chairLayout = placeholder.attributes;
+	chairStride = placeholder.vertexStride;
+	chairIndexCount = (GLsizei)placeholder.indices.size();
+	chairIndexType = GL_UNSIGNED_INT;
+	chairSubmeshes = placeholder.submeshes;
+	chairLods.clear();
+	chairBounds.min = glm::vec3(placeholder.boundsMin[0], placeholder.boundsMin[1], placeholder.boundsMin[2]);
+	chairBounds.max = glm::vec3(placeholder.boundsMax[0], placeholder.boundsMax[1], placeholder.boundsMax[2]);
+	vertexDecode = VertexDecode();
+	vertexBufferBytes = placeholder.vertices.size();
+	indexBufferBytes = placeholder.indices.size() * sizeof(GLuint);
+
+	// set attribute pointers 0, 1 and 2 to hold position, normal and texture coordinate data
+	UBindVertexLayout(false);
+
+	// the lamp references the same VBO for its vertices and the same EBO for its indices
+	glBindVertexArray(LightVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO); // core profile drivers have no client-side index fallback
+
+	// set attribute pointer 0 to hold position data (used for the lamp)
+	UBindVertexLayout(true);
+
+	if (showroom.count > 0)
+		UBuildShowroom(showroom, UChairModel(), chairInstances);
+	UAssignMaterials(materialOptions.count, chairInstances);
+	UBuildSceneGraph();
+
+	// showroom instances share the chair's VBO and EBO and add a per-instance attribute buffer
+	if (showroom.count > 0)
+	{
+		UBuildShowroomBvh();
+
+		glGenVertexArrays(1, &ShowroomVAO);
+		glGenBuffers(1, &InstanceVBO);
+
+		glBindVertexArray(ShowroomVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+		UBindVertexLayout(false);
+
+		UUploadInstances(InstanceVBO, chairInstances.data(), (GLsizei)chairInstances.size());
+		UEnableInstanceAttributes(InstanceVBO);
+
+		cout << "Showroom: " << chairInstances.size() << " chairs" << (showroom.loop ? " (one draw call each)" : " (instanced)") << endl;
+
+		// the depth buffer keeps the window's aspect so a texel covers a square of pixels
+		if (occlusionOptions.enabled && showroom.cull)
+		{
+			occlusionBuffer = new OcclusionBuffer;
+			occlusionBuffer->resize(occlusionOptions.width, max(1, occlusionOptions.width * WindowHeight / WindowWidth));
+			cout << "Occlusion culling: " << occlusionOptions.occluders << " occluders into a " << occlusionBuffer->width() << "x"
+				 << occlusionBuffer->height() << " depth buffer" << endl;
+		}
+	}
+
+	// Deactivates the VAO which is good practice
+	glBindVertexArray(0);
+
+	uniformRing = new UniformRing(uniformOptions);
+	cout << "Uniform ring: " << UNIFORM_RING_FRAMES << " regions, " << (uniformRing->persistent() ? "persistently mapped" : "mapped every frame") << endl;
+
+	if (clusterOptions.lights > 0)
+		UCreateSceneLights();
+
+	// read, optimize, unwrap and pack the real chair on a loader thread
+	shared_ptr<ChairMesh> chair(new ChairMesh);
+	string path = meshPath;
+	VertexFormatOptions format = vertexFormat;
+	int lightmapSize = lightmapOptions.path.empty() ? 0 : lightmapOptions.size;
+	int lodLevels = lodOptions.enabled ? lodOptions.levels : 0;
+	bool occluder = occlusionBuffer != nullptr;
+
+	assetLoader->load(
+		path.empty() ? "built-in chair" : path,
+		[chair, path, format, lightmapSize, lodLevels, occluder](AssetPayload &payload)
+		{ return UDecodeChairMesh(path, format, lightmapSize, lodLevels, occluder, *chair, payload); },
+		[chair](AssetPayload &payload)
+		{ UUseChairMesh(*chair, payload); });
+
+	if (!lightmapOptions.path.empty())
+		ULoadLightmap();
+
+	if (materialOptions.count > 0)
+		UCreateMaterials();
+}
+
+/* Queues the baked lightmap; it only applies to a chair unwrapped at the size it was baked for */
+void ULoadLightmap(void)
+{
+	string path = lightmapOptions.path;
+	int size = lightmapOptions.size;
+
+	assetLoader->load(
+		path,
+		[path, size](AssetPayload &payload)
+		{
+			TextureView file;
+			if (!UOpenTexture(path, file))
+				return false;
+
+			if (file.format != TEXTURE_RGBA8 || file.width != (uint32_t)size || file.height != (uint32_t)size)
+			{
+				cout << "Lightmap " << path << " is " << file.width << "x" << file.height << " " << UTextureFormatName(file.format) << ", expected a "
+					 << size << "x" << size << " RGBA8 bake; pass the --lightmap-size it was baked with" << endl;
+				UCloseTexture(file);
+				return false;
+			}
 
-	// generate buffer ids
-	glGenVertexArrays(1, &ObjVAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
+			payload.texture.format = file.format;
+			payload.texture.width = file.width;
+			payload.texture.height = file.height;
+			payload.texture.levels.assign(1, vector<unsigned char>(file.levels[0].data, file.levels[0].data + file.levels[0].size));
+			UCloseTexture(file);
+			return true;
+		},
+		[path](AssetPayload &payload)
+		{
+			// one level, filtered but never mipmapped: charts are packed too tightly for smaller levels
+			lightmapTexture = payload.textureObject;
+			glBindTexture(GL_TEXTURE_2D, lightmapTexture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glBindTexture(GL_TEXTURE_2D, 0);
+
+			cout << "Lightmap " << path << ": baked ambient and diffuse" << (lightClusters ? ", unused next to --lights" : "") << endl;
+		});
+}
 
-	// activate the vertex array object before binding and setting any VBOs and vertex attribute pointers
-	glBindVertexArray(ObjVAO);
+/* Reads a --mesh file out of its memory mapping; touching the pages here keeps the disk reads off the GL thread */
+bool UReadMeshFile(const string &path, MeshData &mesh, vector<unsigned char> &indexBytes, GLenum &indexType)
+{
+	MeshView view;
+	if (!UOpenMesh(path, view))
+		return false;
 
-	// activate the VBO
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW); // copy vertices to VBO
+	UCopyMeshView(view, mesh, indexBytes, indexType);
+	UCloseMesh(view);
+	return true;
+}
 
-	// activate the element buffer object (EOB) / indices
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW); // copy indices to EBO
+/* Copies a mapped mesh out of its mapping, for the paths that change it */
+void UCopyMeshView(const MeshView &view, MeshData &mesh, vector<unsigned char> &indexBytes, GLenum &indexType)
+{
+	UReadMeshLayout(view, mesh);
+	mesh.vertices.assign((const unsigned char *)view.vertices, (const unsigned char *)view.vertices + view.header->vertexSize);
+
+	// the index block is independent of the vertex layout and goes to GL as stored
+	indexBytes.assign((const unsigned char *)view.indices, (const unsigned char *)view.indices + view.header->indexSize);
+	indexType = view.header->indexType;
+}
 
-	// set attribute pointer 0 to hold position data
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid *)0);
-	glEnableVertexAttribArray(0); // Enables vertex attribute
+/* Everything of a mapped mesh but its vertex and index blocks */
+void UReadMeshLayout(const MeshView &view, MeshData &mesh)
+{
+	const MeshHeader &header = *view.header;
+
+	mesh.vertexStride = header.vertexStride;
+	mesh.attributes.assign(header.attributes, header.attributes + header.attributeCount);
+	mesh.submeshes.assign(view.submeshes, view.submeshes + header.submeshCount);
+	mesh.lods.assign(view.lods, view.lods + view.lodCount);
+	copy(header.boundsMin, header.boundsMin + 3, mesh.boundsMin);
+	copy(header.boundsMax, header.boundsMax + 3, mesh.boundsMax);
+}
 
-	// set attribute pointer 1 to hold Normal data
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid *)(3 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(1); // Enables vertex attribute
+/* Stages a mapped mesh straight from its mapping when nothing would change its blocks: no unwrap, no new levels, no occluder, no repacking */
+bool UStageMappedMesh(const shared_ptr<MeshView> &view, const VertexFormatOptions &format, int lightmapSize, int lodLevels, bool occluder, ChairMesh &chair, AssetPayload &payload)
+{
+	bool floatFormat = format.position == POSITION_FLOAT && format.normal == NORMAL_FLOAT && format.uv == UV_FLOAT;
+	if (lightmapSize > 0 || occluder || !floatFormat)
+		return false;
+
+	MeshData mesh;
+	UReadMeshLayout(*view, mesh);
+	if ((lodLevels > 1 && mesh.lods.empty()) || (UIsFloatLayout(mesh) && !UIsPackedFloatLayout(mesh)))
+		return false;
+
+	const MeshHeader &header = *view->header;
+	chair.layout = mesh.attributes;
+	chair.stride = mesh.vertexStride;
+	chair.indexCount = mesh.lods.empty() ? (GLsizei)header.indexCount : (GLsizei)mesh.lods[0].indexCount;
+	chair.indexType = header.indexType;
+	chair.submeshes = mesh.submeshes;
+	chair.lods = mesh.lods;
+	chair.bounds.min = glm::vec3(mesh.boundsMin[0], mesh.boundsMin[1], mesh.boundsMin[2]);
+	chair.bounds.max = glm::vec3(mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2]);
+	chair.decode = VertexDecode();
+
+	payload.buffers.resize(2);
+	payload.views = {AssetView{(const unsigned char *)view->vertices, (size_t)header.vertexSize}, AssetView{(const unsigned char *)view->indices, (size_t)header.indexSize}};
+	payload.viewOwner = view; // unmapped once both blocks are resident
+	return true;
+}
 
-	// set attribute pointer 2 to hold texture coordinate data
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid *)(8 * sizeof(GLfloat)));
-	glEnableVertexAttribArray(2);
+/* The --mesh file, or the built-in chair when there is none or it cannot be read; returns what was loaded, for the console */
+string ULoadChairMeshData(const string &path, MeshData &mesh, vector<unsigned char> &indexBytes, GLenum &indexType)
+{
+	indexType = GL_UNSIGNED_INT;
+	if (!path.empty() && UReadMeshFile(path, mesh, indexBytes, indexType))
+		return path;
 
-	// generate buffer for lamp (smaller pyramid)
-	glGenVertexArrays(1, &LightVAO); // vertex array object for pyramid vertex copies to serve as light source
+	if (!path.empty())
+		cout << "Falling back to the built-in chair" << endl;
 
-	// activate the vertex array object before binding and setting any VBOs and VAPs
-	glBindVertexArray(LightVAO);
+	mesh = MeshData();
+	UBuiltinMeshData(mesh);
+	indexBytes.assign((const unsigned char *)mesh.indices.data(), (const unsigned char *)(mesh.indices.data() + mesh.indices.size()));
+	return "the built-in chair";
+}
 
-	// referencing the same VBO for its vertices
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+/* Splits the chair into lightmap charts; the new index block is 32-bit whatever the file stored */
+bool UUnwrapChairMesh(int lightmapSize, MeshData &mesh, vector<unsigned char> &indexBytes, GLenum &indexType, LightmapStats &stats)
+{
+	if (!UIsFloatLayout(mesh))
+	{
+		cout << "The lightmap needs a float vertex layout" << endl;
+		return false;
+	}
 
-	// set attribute pointer 0 to hold position data (used for the lamp)
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid *)0);
-	glEnableVertexAttribArray(0);
+	// only the full detail is unwrapped; the charts split vertices, so coarser levels are built again from it
+	UReadIndices(indexBytes, indexType, mesh.lods.empty() ? indexBytes.size() / (indexType == GL_UNSIGNED_SHORT ? 2 : 4) : mesh.lods[0].indexCount, mesh.indices);
 
-	// Deactivates the VAO which is good practice
+	MeshData unwrapped;
+	if (!UUnwrapLightmap(mesh, lightmapSize, unwrapped, stats))
+		return false;
+
+	mesh = unwrapped;
+	indexBytes.assign((const unsigned char *)mesh.indices.data(), (const unsigned char *)(mesh.indices.data() + mesh.indices.size()));
+	indexType = GL_UNSIGNED_INT;
+	return true;
+}
+
+/* The first 'count' indices of an index block, widened to 32 bits */
+void UReadIndices(const vector<unsigned char> &indexBytes, GLenum indexType, size_t count, vector<uint32_t> &indices)
+{
+	if (indexType == GL_UNSIGNED_SHORT)
+		indices.assign((const uint16_t *)indexBytes.data(), (const uint16_t *)indexBytes.data() + count);
+	else
+		indices.assign((const uint32_t *)indexBytes.data(), (const uint32_t *)indexBytes.data() + count);
+}
+
+/* 32-bit indices as an index block of 'indexType' */
+void UWriteIndices(const vector<uint32_t> &indices, GLenum indexType, vector<unsigned char> &indexBytes)
+{
+	if (indexType == GL_UNSIGNED_SHORT)
+	{
+		vector<uint16_t> narrow(indices.begin(), indices.end());
+		indexBytes.assign((const unsigned char *)narrow.data(), (const unsigned char *)(narrow.data() + narrow.size()));
+	}
+	else
+	{
+		indexBytes.assign((const unsigned char *)indices.data(), (const unsigned char *)(indices.data() + indices.size()));
+	}
+}
+
+/* Loader thread: the chair's vertex and index bytes in the selected layout, no GL calls */
+bool UDecodeChairMesh(const string &path, const VertexFormatOptions &format, int lightmapSize, int lodLevels, bool occluder, ChairMesh &chair, AssetPayload &payload)
+{
+	UPROFILE_SCOPE("UDecodeChairMesh");
+	auto start = chrono::steady_clock::now();
+
+	shared_ptr<MeshView> view;
+	if (!path.empty())
+	{
+		view.reset(new MeshView, [](MeshView *mapped)
+				   { if (mapped->header) UCloseMesh(*mapped); delete mapped; });
+		if (!UOpenMesh(path, *view))
+			view.reset();
+	}
+
+	if (view && UStageMappedMesh(view, format, lightmapSize, lodLevels, occluder, chair, payload))
+	{
+		chair.source = path;
+		chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+		chair.loadMs = elapsed.count();
+		return true;
+	}
+
+	// the paths below change the data, so they work on copies
+	MeshData mesh;
+	vector<unsigned char> indexBytes;
+	GLenum indexType;
+	if (view)
+	{
+		UCopyMeshView(*view, mesh, indexBytes, indexType);
+		chair.source = path;
+		view.reset();
+	}
+	else
+	{
+		if (!path.empty())
+			cout << "Falling back to the built-in chair" << endl;
+		chair.source = ULoadChairMeshData("", mesh, indexBytes, indexType);
+	}
+
+	// lightmap coordinates before packing, which keeps them as floats
+	LightmapStats lightmapStats;
+	if (lightmapSize > 0)
+		chair.lightmapped = UUnwrapChairMesh(lightmapSize, mesh, indexBytes, indexType, lightmapStats);
+
+	// levels of detail for a mesh that came without them (or lost them to the unwrap), while the positions are floats;
+	// the occluder needs them too, a dense chair rasterized at full detail would cost more than it culls
+	if ((lodLevels > 1 || occluder) && mesh.lods.empty())
+	{
+		UReadIndices(indexBytes, indexType, indexBytes.size() / (indexType == GL_UNSIGNED_SHORT ? 2 : 4), mesh.indices);
+		if (UBuildMeshLods(mesh, lodLevels > 1 ? lodLevels : LOD_MAX_LEVELS))
+			UWriteIndices(mesh.indices, indexType, indexBytes);
+	}
+
+	if (occluder)
+	{
+		if (mesh.indices.empty())
+			UReadIndices(indexBytes, indexType, indexBytes.size() / (indexType == GL_UNSIGNED_SHORT ? 2 : 4), mesh.indices);
+		if (!UBuildOccluderMesh(mesh, chair.occluder))
+			cout << "The chair's positions are not floats, occlusion culling is off" << endl;
+	}
+
+	// pack into the selected layout, keeping whatever layout the mesh came with when it is not float
+	MeshData packed;
+	if (!UPackVertices(mesh, format, packed, chair.decode))
+	{
+		packed.vertexStride = mesh.vertexStride;
+		packed.attributes = mesh.attributes;
+		packed.vertices.swap(mesh.vertices);
+		chair.decode = VertexDecode();
+	}
+
+	chair.layout = packed.attributes;
+	chair.stride = packed.vertexStride;
+	chair.indexCount = mesh.lods.empty() ? (GLsizei)(indexBytes.size() / (indexType == GL_UNSIGNED_SHORT ? 2 : 4)) : (GLsizei)mesh.lods[0].indexCount;
+	chair.indexType = indexType;
+	chair.submeshes = mesh.submeshes;
+	chair.lods = mesh.lods;
+	chair.bounds.min = glm::vec3(mesh.boundsMin[0], mesh.boundsMin[1], mesh.boundsMin[2]);
+	chair.bounds.max = glm::vec3(mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2]);
+
+	payload.buffers.resize(2);
+	payload.buffers[0].swap(packed.vertices);
+	payload.buffers[1].swap(indexBytes);
+
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	chair.loadMs = elapsed.count();
+	return true;
+}
+
+/* GL thread: replaces the current chair buffers with freshly uploaded ones and points every VAO at them */
+void UUseChairMesh(const ChairMesh &chair, const AssetPayload &payload)
+{
+	UPROFILE_SCOPE("UUseChairMesh");
+
+	glDeleteBuffers(1, &VBO);
+	glDeleteBuffers(1, &EBO);
+	VBO = payload.bufferObjects[0];
+	EBO = payload.bufferObjects[1];
+	vertexBufferBytes = payload.bufferSize(0);
+	indexBufferBytes = payload.bufferSize(1);
+
+	chairLayout = chair.layout;
+	chairStride = chair.stride;
+	chairIndexCount = chair.indexCount;
+	chairIndexType = chair.indexType;
+	chairSubmeshes = chair.submeshes;
+	chairLods = chair.lods;
+	chairBounds = chair.bounds;
+	vertexDecode = chair.decode;
+	chairLightmapped = chair.lightmapped;
+	chairOccluder = chair.occluder;
+
+	vector<GLuint> vaos = {ObjVAO, LightVAO};
+	if (showroom.count > 0)
+		vaos.push_back(ShowroomVAO);
+	vaos.insert(vaos.end(), materialVAOs.begin(), materialVAOs.end()); // one per finish with --material-textures
+
+	// the instanced showroom draws each level from its own vertex array; --material-textures keeps to the full detail
+	glDeleteVertexArrays((GLsizei)lodVAOs.size(), lodVAOs.data());
+	lodVAOs.clear();
+	lodFirstInstances.clear();
+	if (lodOptions.enabled && chairLods.size() > 1 && showroom.count > 0 && !showroom.loop && materialVAOs.empty())
+	{
+		lodVAOs.resize(chairLods.size());
+		glGenVertexArrays((GLsizei)lodVAOs.size(), lodVAOs.data());
+		vaos.insert(vaos.end(), lodVAOs.begin(), lodVAOs.end());
+	}
+
+	for (GLuint vao : vaos)
+	{
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		UBindVertexLayout(vao == LightVAO);
+	}
+	for (GLuint vao : lodVAOs)
+	{
+		glBindVertexArray(vao);
+		UEnableInstanceAttributes(InstanceVBO);
+	}
 	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// the culling boxes follow the real bounds
+	if (showroom.count > 0)
+		UBuildShowroomBvh();
+
+	cout << "Loaded " << chair.source << ": " << chair.indexCount / 3 << " triangles, read and packed in " << chair.loadMs << " ms" << endl;
+	if (chairLods.size() > 1)
+		cout << "Levels of detail: " << chairLods.size() << ", down to " << chairLods.back().indexCount / 3 << " triangles at an error of " << chairLods.back().error
+			 << (lodOptions.enabled ? "" : " (unused without --lod)") << endl;
+	cout << "Vertex layout " << UVertexFormatName(vertexFormat) << ": " << chairStride << " bytes per vertex, "
+		 << vertexBufferBytes / 1024.0 << " KB vertices + " << indexBufferBytes / 1024.0 << " KB indices" << endl;
+}
+
+/* Rebuilds the showroom BVH around the chair bounds at every instance's current placement */
+void UBuildShowroomBvh(void)
+{
+	vector<Bounds> instanceBounds(chairInstances.size());
+	for (size_t i = 0; i < chairInstances.size(); i++)
+		instanceBounds[i] = UTransformBounds(chairBounds, chairInstances[i].model);
+	UBuildBvh(showroomBvh, instanceBounds);
+}
+
+/* Sets the attribute pointers of the bound VAO from the chair's vertex layout */
+void UBindVertexLayout(bool positionOnly)
+{
+	for (const MeshAttribute &attribute : chairLayout)
+	{
+		if (positionOnly && attribute.location != 0)
+			continue;
+
+		glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized, chairStride, (GLvoid *)(size_t)attribute.offset);
+		glEnableVertexAttribArray(attribute.location); // Enables vertex attribute
+	}
+}
+
+/* Parses the mesh and texture options */
+void UParseMeshArgs(int argc, char *argv[])
+{
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--mesh")
+			meshPath = argv[++i];
+		else if (arg == "--export-mesh")
+			exportMeshPath = argv[++i];
+		else if (arg == "--texture")
+			texturePath = argv[++i];
+	}
+
+	for (int i = 1; i < argc; i++)
+		if (string(argv[i]) == "--no-optimize")
+			optimizeMesh = false;
+}
+
+/* The built-in chair as a float mesh, one submesh per part, optimized unless --no-optimize */
+void UBuiltinMeshData(MeshData &mesh)
+{
+	mesh.vertexStride = 8 * sizeof(GLfloat);
+	mesh.attributes = {
+		{0, 3, GL_FLOAT, GL_FALSE, 0, 0},					 // position
+		{1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0}, // normal
+		{2, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), 0}, // texture coordinate
+	};
+	mesh.vertices.assign((const unsigned char *)chairVertices, (const unsigned char *)chairVertices + sizeof(chairVertices));
+	mesh.indices.assign(chairIndices, chairIndices + sizeof(chairIndices) / sizeof(GLuint));
+
+	Bounds bounds = UComputeBounds(chairVertices, sizeof(chairVertices) / (8 * sizeof(GLfloat)), 8);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		mesh.boundsMin[axis] = bounds.min[axis];
+		mesh.boundsMax[axis] = bounds.max[axis];
+	}
+
+	// base, leg, seat and chair back, as grouped in chairIndices
+	const uint32_t partTriangles[] = {10, 16, 8, 10};
+	uint32_t firstIndex = 0;
+	for (uint32_t triangles : partTriangles)
+	{
+		MeshSubmesh part = {firstIndex, triangles * 3, 0, 0, {1e30f, 1e30f, 1e30f}, {-1e30f, -1e30f, -1e30f}};
+		for (uint32_t i = firstIndex; i < firstIndex + triangles * 3; i++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				part.boundsMin[axis] = min(part.boundsMin[axis], chairVertices[chairIndices[i] * 8 + axis]);
+				part.boundsMax[axis] = max(part.boundsMax[axis], chairVertices[chairIndices[i] * 8 + axis]);
+			}
+		}
+		mesh.submeshes.push_back(part);
+		firstIndex += triangles * 3;
+	}
+
+	if (optimizeMesh)
+	{
+		MeshOptimizeReport report;
+		UOptimizeMesh(mesh, report);
+		UPrintMeshOptimizeReport(report);
+	}
+}
+
+/* A box around the built-in chair in the float layout, drawn while the real geometry loads */
+void UPlaceholderMeshData(MeshData &mesh)
+{
+	Bounds bounds = UComputeBounds(chairVertices, sizeof(chairVertices) / (8 * sizeof(GLfloat)), 8);
+
+	mesh.vertexStride = 8 * sizeof(GLfloat);
+	mesh.attributes = {
+		{0, 3, GL_FLOAT, GL_FALSE, 0, 0},					 // position
+		{1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0}, // normal
+		{2, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), 0}, // texture coordinate
+	};
+
+	// four corners per face so every face keeps its own normal
+	vector<GLfloat> vertices;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int side = 0; side < 2; side++)
+		{
+			int u = (axis + 1) % 3, v = (axis + 2) % 3;
+			uint32_t first = (uint32_t)(vertices.size() / 8);
+
+			for (int corner = 0; corner < 4; corner++)
+			{
+				glm::vec3 position, normal(0.0f);
+				position[axis] = side ? bounds.max[axis] : bounds.min[axis];
+				position[u] = (corner == 1 || corner == 2) ? bounds.max[u] : bounds.min[u];
+				position[v] = corner >= 2 ? bounds.max[v] : bounds.min[v];
+				normal[axis] = side ? 1.0f : -1.0f;
+
+				vertices.insert(vertices.end(), {position.x, position.y, position.z, normal.x, normal.y, normal.z,
+												 (corner == 1 || corner == 2) ? 1.0f : 0.0f, corner >= 2 ? 1.0f : 0.0f});
+			}
+
+			mesh.indices.insert(mesh.indices.end(), {first, first + 1, first + 2, first, first + 2, first + 3});
+		}
+	}
+
+	mesh.vertices.assign((const unsigned char *)vertices.data(), (const unsigned char *)(vertices.data() + vertices.size()));
+	for (int axis = 0; axis < 3; axis++)
+	{
+		mesh.boundsMin[axis] = bounds.min[axis];
+		mesh.boundsMax[axis] = bounds.max[axis];
+	}
+	mesh.submeshes.push_back({0, (uint32_t)mesh.indices.size(), 0, 0,
+							  {bounds.min.x, bounds.min.y, bounds.min.z}, {bounds.max.x, bounds.max.y, bounds.max.z}});
+}
+
+/* Writes the built-in chair as a mesh file */
+bool UExportBuiltinMesh(const string &path)
+{
+	MeshData mesh;
+	UBuiltinMeshData(mesh);
+
+	// the file carries levels of detail, like a converted one
+	UBuildMeshLods(mesh, lodOptions.levels);
+	UPrintMeshLodReport(mesh);
+
+	if (!UWriteMesh(path, mesh))
+		return false;
+
+	cout << "Wrote the built-in chair to " << path << endl;
+	return true;
+}
+
+/* Destroys the vertex arrays and buffers */
+void UDestroyBuffers(void)
+{
+	glDeleteVertexArrays(1, &ObjVAO);
+	glDeleteVertexArrays(1, &LightVAO);
+	glDeleteBuffers(1, &VBO);
+	glDeleteBuffers(1, &EBO);
+
+	if (showroom.count > 0)
+	{
+		glDeleteVertexArrays(1, &ShowroomVAO);
+		glDeleteBuffers(1, &InstanceVBO);
+	}
+
+	glDeleteVertexArrays((GLsizei)lodVAOs.size(), lodVAOs.data());
+	lodVAOs.clear();
+
+	delete lightClusters;
+	lightClusters = nullptr;
+
+	delete uniformRing;
+	uniformRing = nullptr;
+
+	delete occlusionBuffer;
+	occlusionBuffer = nullptr;
+	chairOccluder = OccluderMesh();
+
+	glDeleteTextures(1, &lightmapTexture);
+	lightmapTexture = 0;
+	chairLightmapped = false;
+
+	UDestroyMaterials();
+}
+
+/* Unwraps the chair and bakes its lighting as placed and lit in the scene, then writes the lightmap */
+int UBakeChairLightmap(void)
+{
+	MeshData mesh;
+	vector<unsigned char> indexBytes;
+	GLenum indexType;
+	string source = ULoadChairMeshData(meshPath, mesh, indexBytes, indexType);
+
+	LightmapStats stats;
+	if (!UUnwrapChairMesh(lightmapOptions.size, mesh, indexBytes, indexType, stats))
+		return -1;
+
+	vector<LightmapLight> lights = {{light0Position, light0Color}, {light1Position, light1Color}};
+	TextureImage image;
+	UBakeLightmap(mesh, UChairModel(), lights, lightmapOptions, *taskPool, image, stats);
+
+	if (!UWriteTexture(lightmapOptions.bakePath, image))
+		return -1;
+
+	cout << "Baked " << source << " into " << lightmapOptions.bakePath << ": " << lightmapOptions.size << "x" << lightmapOptions.size << ", "
+		 << stats.charts << " charts covering " << stats.coverage * 100.0f << "% of the atlas" << endl;
+	cout << "  " << stats.texels << " texels, " << stats.rays << " rays (" << lightmapOptions.aoRays << " occlusion rays per texel) in "
+		 << stats.bakeMs << " ms on " << taskPool->size() << " threads" << endl;
+	return 0;
+}
+
+/* Scatters --lights local lights over the chair or the showroom floor and sets up their clusters */
+void UCreateSceneLights(void)
+{
+	// the showroom grid plus half a spacing around it, or the chair's neighbourhood; from knee to above head height
+	float half = 1.5f, radius = 1.5f;
+	if (showroom.count > 0)
+	{
+		int side = (int)ceil(sqrt((double)showroom.count));
+		half = 0.5f * side * showroom.spacing;
+		radius = 1.5f * showroom.spacing;
+	}
+
+	Bounds region;
+	region.min = glm::vec3(-half, -0.5f, -half);
+	region.max = glm::vec3(half, 2.5f, half);
+	UCreateClusterLights(clusterOptions.lights, region, radius, restLights);
+
+	delete lightClusters;
+	lightClusters = new LightClusters(clusterOptions);
+
+	cout << "Clustered lighting: " << restLights.size() << " local lights, " << clusterOptions.gridX << "x" << clusterOptions.gridY << "x"
+		 << clusterOptions.gridZ << " clusters" << (clusterOptions.loopAll ? ", shaded without the clusters (--light-loop)" : "") << endl;
+}
+
+/* Chair placement: centered, turned around and scaled up */
+glm::mat4 UChairModel(void)
+{
+	glm::mat4 model = glm::mat4(1.0);
+
+	model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));		 // place the object at the center of the viewport
+	model = glm::rotate(model, 180.0f, glm::vec3(0.0f, 1.0f, 0.0f)); // rotate the object 180 degrees on Y axis
+	model = glm::scale(model, glm::vec3(2.0f, 2.0f, 2.0f));			 // increase the object size by a scale of 2
+
+	return model;
 }
 
 /* Generate and Load The Texture */
 void UGenerateTexture()
 {
+	UPROFILE_SCOPE("UGenerateTexture");
+
+	// a single wood-coloured texel until the real texture is resident
+	const unsigned char placeholder[4] = {150, 111, 74, 255};
+
 	glGenTextures(1, &texture);
 	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glBindTexture(GL_TEXTURE_2D, 0); // unbind the texture
 
-	int width, height;
+	// precompressed copies of the JPG skip the decode and the mip build and take a fraction of the memory
+	vector<string> candidates = {"wood-texture1.ktx2", "wood-texture1.dds"};
+	if (!texturePath.empty())
+		candidates = {texturePath};
 
-	unsigned char *image = SOIL_load_image("wood-texture1.jpg", &width, &height, 0, SOIL_LOAD_RGB); // loads texture file
+	// format support needs the context, so it is settled here for the loader thread
+	vector<bool> supported;
+	for (int format = TEXTURE_RGBA8; format <= TEXTURE_ETC2_RGB; format++)
+		supported.push_back(UTextureFormatSupported((TextureFormat)format));
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	SOIL_free_image_data(image);
-	glBindTexture(GL_TEXTURE_2D, 0); // unbind the texture
+	shared_ptr<string> description(new string);
+	auto start = chrono::steady_clock::now();
+
+	assetLoader->load(
+		"wood texture",
+		[candidates, supported, description](AssetPayload &payload)
+		{
+			UPROFILE_SCOPE("decode wood texture");
+
+			for (const string &path : candidates)
+				if (UReadTextureFile(path, supported, payload.texture, *description))
+					return true;
+
+			int width, height;
+			unsigned char *image = SOIL_load_image("wood-texture1.jpg", &width, &height, 0, SOIL_LOAD_RGBA); // loads texture file
+			if (!image)
+				return false;
+
+			payload.texture.format = TEXTURE_RGBA8;
+			payload.texture.width = width;
+			payload.texture.height = height;
+			payload.texture.levels.assign(1, vector<unsigned char>(image, image + (size_t)width * height * 4));
+			payload.generateMips = true;
+			SOIL_free_image_data(image);
+
+			*description = "wood-texture1.jpg: " + to_string(width) + "x" + to_string(height) + " RGBA8 decoded, mipmaps generated";
+			return true;
+		},
+		[description, start](AssetPayload &payload)
+		{
+			glDeleteTextures(1, &texture);
+			texture = payload.textureObject;
+
+			textureBytes = 0;
+			for (const vector<unsigned char> &level : payload.texture.levels)
+				textureBytes += level.size();
+			if (payload.generateMips)
+				textureBytes = textureBytes * 4 / 3; // plus a third for the mips
+
+			chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+			cout << "Texture " << *description << ", " << textureBytes / 1024.0 << " KB resident after " << elapsed.count() << " ms" << endl;
+		});
+}
+
+/* Creates the finishes of --materials from wood-coloured texels and queues the generated layers */
+void UCreateMaterials(void)
+{
+	UPROFILE_SCOPE("UCreateMaterials");
+
+	int count = materialOptions.count;
+	bool separate = materialOptions.separate;
+
+	// every finish of the same placeholder texel the wood starts with, until the real layers are resident
+	const unsigned char placeholder[4] = {150, 111, 74, 255};
+	MaterialLayers layers;
+	UBuildMaterialLayers(placeholder, 1, 1, count, layers);
+	if (separate && streamOptions.enabled)
+		UCreateStreamedMaterials(count);
+	else if (separate)
+		UCreateMaterialTextures(layers, materialTextures);
+	else
+		materialArray = UCreateMaterialArray(layers);
+
+	// GL 3.3 has no base instance, so an instanced draw of one finish needs a buffer holding only its chairs
+	if (separate && showroom.count > 0)
+	{
+		materialVAOs.resize(count);
+		materialInstanceVBOs.resize(count);
+		materialInstanceData.assign(count, vector<ChairInstance>());
+		glGenVertexArrays(count, materialVAOs.data());
+		glGenBuffers(count, materialInstanceVBOs.data());
+
+		for (int layer = 0; layer < count; layer++)
+		{
+			glBindVertexArray(materialVAOs[layer]);
+			glBindBuffer(GL_ARRAY_BUFFER, VBO);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+			UBindVertexLayout(false);
+			UEnableInstanceAttributes(materialInstanceVBOs[layer]);
+		}
+		glBindVertexArray(0);
+	}
+
+	if (textureStreamer)
+		return; // the streamer produces the levels itself, as they are needed
+
+	shared_ptr<MaterialLayers> generated(new MaterialLayers);
+	auto start = chrono::steady_clock::now();
+
+	assetLoader->load(
+		"materials",
+		[count, generated](AssetPayload &payload)
+		{
+			UPROFILE_SCOPE("generate materials");
+
+			// the layers are generated from the decoded JPG; the precompressed copies would need a CPU decoder
+			int width, height;
+			unsigned char *image = SOIL_load_image("wood-texture1.jpg", &width, &height, 0, SOIL_LOAD_RGBA);
+			if (!image)
+				return false;
+
+			UBuildMaterialLayers(image, width, height, count, *generated);
+			SOIL_free_image_data(image);
+			return true; // the payload stays empty, the layers go to GL in one piece when ready
+		},
+		[separate, generated, start](AssetPayload &)
+		{
+			if (separate)
+			{
+				glDeleteTextures((GLsizei)materialTextures.size(), materialTextures.data());
+				UCreateMaterialTextures(*generated, materialTextures);
+			}
+			else
+			{
+				glDeleteTextures(1, &materialArray);
+				materialArray = UCreateMaterialArray(*generated);
+			}
+
+			chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+			cout << "Materials: " << generated->count << " finishes of " << generated->width << "x" << generated->height << ", "
+				 << (separate ? "one texture each" : "layers of one texture array") << ", "
+				 << generated->texels.size() * 4 / 3 / 1024.0 << " KB with mipmaps, resident after " << elapsed.count() << " ms" << endl;
+			generated->texels = vector<unsigned char>();
+		});
+
+	cout << "Materials: " << count << (separate ? " finishes, one texture and one draw each" : " finishes in one texture array") << endl;
+}
+
+/* Gives every finish a streamed texture; its levels are generated on the streamer's thread from the wood, decoded once */
+void UCreateStreamedMaterials(int count)
+{
+	struct Wood
+	{
+		mutex lock;
+		bool decoded = false;
+		vector<vector<unsigned char>> levels; // finest first, empty when the image failed to load
+		vector<float> means;
+	};
+	shared_ptr<Wood> wood(new Wood);
+	uint32_t size = (uint32_t)streamOptions.size;
+
+	auto source = [wood, size](int texture, int level, vector<unsigned char> &texels)
+	{
+		UPROFILE_SCOPE("stream material level");
+
+		{
+			lock_guard<mutex> guard(wood->lock);
+			if (!wood->decoded)
+			{
+				wood->decoded = true;
+				int width, height;
+				unsigned char *image = SOIL_load_image("wood-texture1.jpg", &width, &height, 0, SOIL_LOAD_RGBA);
+				if (image)
+				{
+					UBuildWoodChain(image, width, height, size, wood->levels);
+					SOIL_free_image_data(image);
+					for (uint32_t i = 0; i < wood->levels.size(); i++)
+						wood->means.push_back(UMeanLuminance(wood->levels[i].data(), wood->levels[i].size() / 4));
+				}
+			}
+		}
+		if (wood->levels.empty())
+			return false;
+
+		// the weave keeps its size on the chair, so its threads narrow level by level like the layers' box filter
+		uint32_t side = max(1u, size >> level);
+		uint32_t threadSize = 4 * side / MATERIAL_LAYER_SIZE;
+		texels.resize((size_t)side * side * 4);
+		UBuildMaterialLevel(wood->levels[level].data(), side, side, wood->means[level], texture, threadSize < 2 ? 0 : threadSize, texels.data());
+		return true;
+	};
+
+	textureStreamer = new TextureStreamer(streamOptions, count, source);
+	materialTextures.resize(count);
+	for (int i = 0; i < count; i++)
+		materialTextures[i] = textureStreamer->texture(i);
+
+	cout << "Texture streaming: " << count << " finishes of " << streamOptions.size << "x" << streamOptions.size << ", "
+		 << (textureStreamer->sparse() ? "sparse textures committed level by level" : "levels specified in place") << ", "
+		 << streamOptions.budgetMb << " MB budget, " << streamOptions.uploadKb << " KB uploaded per frame" << endl;
+}
+
+/* Tells the streamer how large each drawn finish is on screen, so next frame's levels follow this frame's view */
+void UStreamMaterials(const glm::mat4 &view, const glm::mat4 &projection)
+{
+	glm::vec3 center = 0.5f * (chairBounds.min + chairBounds.max);
+	float extent = glm::length(chairBounds.max - chairBounds.min); // the texture wraps the chair about once
+
+	auto use = [&](const glm::mat4 &model, int layer)
+	{
+		float scale = glm::length(glm::vec3(model[0]));
+		float depth = -(view * model * glm::vec4(center, 1.0f)).z;
+		textureStreamer->use(layer, ULodPixelsPerUnit(projection, (float)WindowHeight, depth, 0.5f * extent * scale, scale) * extent);
+	};
+
+	if (chairInstances.empty())
+	{
+		use(sceneGraph.world(chairNode), 0);
+		return;
+	}
+	for (uint32_t instance : visibleInstances)
+		use(chairInstances[instance].model, (int)chairInstances[instance].layer);
+}
+
+void UDestroyMaterials(void)
+{
+	glDeleteTextures(1, &materialArray);
+	materialArray = 0;
+
+	// the streamer owns its textures
+	if (textureStreamer)
+		materialTextures.clear();
+	delete textureStreamer;
+	textureStreamer = nullptr;
+
+	glDeleteTextures((GLsizei)materialTextures.size(), materialTextures.data());
+	glDeleteVertexArrays((GLsizei)materialVAOs.size(), materialVAOs.data());
+	glDeleteBuffers((GLsizei)materialInstanceVBOs.size(), materialInstanceVBOs.data());
+	materialTextures.clear();
+	materialVAOs.clear();
+	materialInstanceVBOs.clear();
+	materialInstanceData.clear();
+}
+
+/* Whether the current context can sample the format without decoding it on the CPU */
+bool UTextureFormatSupported(TextureFormat format)
+{
+	switch (format)
+	{
+	case TEXTURE_BC1:
+	case TEXTURE_BC3:
+		return GLEW_EXT_texture_compression_s3tc;
+	case TEXTURE_BC7:
+		return GLEW_ARB_texture_compression_bptc || GLEW_VERSION_4_2;
+	case TEXTURE_ETC2_RGB:
+		return GLEW_ARB_ES3_compatibility || GLEW_VERSION_4_3;
+	default:
+		return true;
+	}
+}
+
+/* Loader thread: copies a DDS / KTX2 file and its stored mip chain out of the memory mapping */
+bool UReadTextureFile(const string &path, const vector<bool> &supported, TextureImage &image, string &description)
+{
+	TextureView file;
+	if (!UOpenTexture(path, file))
+		return false;
+
+	if (!supported[file.format])
+	{
+		cout << "Texture " << path << ": " << UTextureFormatName(file.format) << " is not supported by this driver" << endl;
+		UCloseTexture(file);
+		return false;
+	}
+
+	image.format = file.format;
+	image.width = file.width;
+	image.height = file.height;
+	image.levels.clear();
+	for (const TextureLevel &level : file.levels)
+		image.levels.emplace_back(level.data, level.data + level.size);
+
+	description = path + ": " + to_string(file.width) + "x" + to_string(file.height) + " " + UTextureFormatName(file.format) + ", " +
+				  to_string(file.levels.size()) + " stored levels";
+
+	UCloseTexture(file);
+	return true;
 }
 
 /* Implements The UKeyboard Function */
 void UKeyboard(unsigned char key, GLint x, GLint y)
 {
+	cameraSim.push(CAMERA_KEY_DOWN, key); // pan and reset keys take effect at the next simulation step
+	URequestRedraw();
+
 	switch (key)
 	{
 	case 'o':
@@ -616,6 +3357,8 @@ void UKeyReleased(unsigned char key, GLint x, GLint y)
 {
 	currentKey = '0';
 	currentProjection = userSelection;
+	cameraSim.push(CAMERA_KEY_UP, key);
+	URequestRedraw();
 }
 
 /* Implements the UMouseMove Function */
@@ -636,25 +3379,16 @@ void UMousePers(int x, int y)
 				mouseXOffset *= sensitivity;
 				mouseYOffset *= sensitivity;
 
-				// accumulates the yaw and pitch variables
-				yaw += mouseXOffset;
-				pitch += mouseYOffset;
-
-				// Maintain a 90 degree pitch for gimbal lock
-				if (pitch > 89.0f)
-					pitch = 89.0f;
-
-				if (pitch < -89.0f)
-					pitch = -89.0f;
+				// the simulation accumulates yaw and pitch on its next step
+				cameraSim.push(CAMERA_ORBIT, 0, mouseXOffset, mouseYOffset);
+				URequestRedraw();
 			}
 
 			// zoom in/out the object when ALT + Mouse Move up/down
-			if (mouseButton == GLUT_RIGHT_BUTTON && mouseState == GLUT_DOWN)
+			if (mouseButton == GLUT_RIGHT_BUTTON && mouseState == GLUT_DOWN && y != lastMouseY)
 			{
-				if ((lastMouseY - y) > 0)
-					cameraPosition += zoomSpeed * CameraForwardZ;
-				if ((lastMouseY - y) < 0)
-					cameraPosition -= zoomSpeed * CameraForwardZ;
+				cameraSim.push(CAMERA_ZOOM, 0, 0.0f, (float)(lastMouseY - y));
+				URequestRedraw();
 			}
 		}
 	}
@@ -662,11 +3396,6 @@ void UMousePers(int x, int y)
 	// updates with new mouse coordinates
 	lastMouseX = x;
 	lastMouseY = y;
-
-	// converts mouse coordinates / degrees into Radians, then to vectors
-	front.x = 5.0f * cos(yaw);
-	front.y = 5.0f * sin(pitch);
-	front.z = sin(yaw) * cos(pitch) * 5.0f;
 }
 
 void UMouseOrtho(int x, int y)
@@ -684,27 +3413,14 @@ void UMouseOrtho(int x, int y)
 			mouseXOffset *= sensitivity;
 			mouseYOffset *= sensitivity;
 
-			// accumulates the yaw and pitch variables
-			yaw += mouseXOffset;
-			pitch += mouseYOffset;
-
-			// maintain a 90 degree pitch for gimbal lock
-			if (pitch > 89.0f)
-				pitch = 89.0f;
-
-			if (pitch < -89.0f)
-				pitch = -89.0f;
+			cameraSim.push(CAMERA_ORBIT, 0, mouseXOffset, mouseYOffset);
+			URequestRedraw();
 		}
 	}
 
 	// Updates with new mouse coordinates
 	lastMouseX = x;
 	lastMouseY = y;
-
-	// Converts mouse coordinates / degrees into Radians, then to vectors
-	front.x = 5.0 * cos(yaw);
-	front.y = 5.0 * sin(pitch);
-	front.z = sin(yaw) * cos(pitch) * 5.0;
 }
 
 /* Implements The UMouseClick Function */
@@ -728,12 +3444,14 @@ void WireframeModeOn()
 {
 	glLineWidth(1.0f);						   // Add thick to the lines
 	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); // draw wireframe lines
+	UTracePolygonMode(GL_LINE);
 }
 
 void WireframeModeOff()
 {
 	glLineWidth(1.0f);						   // Add thick to the lines
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL); // draw fills
+	UTracePolygonMode(GL_FILL);
 }
 
 /* Show in console key controls */
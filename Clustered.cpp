@@ -0,0 +1,335 @@
+/*
+ * Clustered.cpp
+ *
+ *  Clustered forward lighting: point and spot lights live in a texture buffer, the view
+ *  frustum is cut into a froxel grid, and every frame the worker threads list the lights
+ *  touching each cluster so a fragment only loops over the lights of its own cluster
+ */
+
+/* Header Inclusions */
+#include "Clustered.h"
+#include "FrameTrace.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace std; // standard namespace
+
+#define CLUSTER_TEXTURE_UNIT 1 // lights, ranges and indices take units 1, 2 and 3; the wood texture keeps unit 0
+
+LightClusters::LightClusters(const ClusterOptions &options)
+	: options(options)
+{
+	glGenBuffers(3, buffers);
+	glGenTextures(3, textures);
+
+	const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+	for (int i = 0; i < 3; i++)
+	{
+		// a texture buffer needs storage before it is attached, even when there is nothing to light yet
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+	}
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	sliceIndices.resize(options.gridZ);
+}
+
+LightClusters::~LightClusters()
+{
+	glDeleteTextures(3, textures);
+	glDeleteBuffers(3, buffers);
+}
+
+/* Depth slices and the view-space box of every cluster, redone only when the projection or viewport changes */
+void LightClusters::buildGrid(const glm::mat4 &projection, int width, int height)
+{
+	gridProjection = projection;
+	gridWidth = width;
+	gridHeight = height;
+	tileWidth = (width + options.gridX - 1) / options.gridX;
+	tileHeight = (height + options.gridY - 1) / options.gridY;
+
+	// points on the near and far planes through an NDC position, in view space
+	glm::mat4 inverse = glm::inverse(projection);
+	auto unproject = [&](float x, float y, float z)
+	{
+		glm::vec4 point = inverse * glm::vec4(x, y, z, 1.0f);
+		return glm::vec3(point) / point.w;
+	};
+
+	// exponential slices between the near and far plane, thin close to the camera where the pixels are
+	float nearDepth = -unproject(0.0f, 0.0f, -1.0f).z;
+	float farDepth = -unproject(0.0f, 0.0f, 1.0f).z;
+	sliceScale = options.gridZ / log(farDepth / nearDepth);
+	sliceBias = -log(nearDepth) * sliceScale;
+
+	sliceDepth.resize(options.gridZ + 1);
+	for (int z = 0; z <= options.gridZ; z++)
+		sliceDepth[z] = nearDepth * pow(farDepth / nearDepth, (float)z / options.gridZ);
+
+	clusterBounds.resize((size_t)options.gridX * options.gridY * options.gridZ);
+	for (int y = 0; y < options.gridY; y++)
+	{
+		for (int x = 0; x < options.gridX; x++)
+		{
+			// the tile's corners as NDC, clamped where the last column or row hangs off the screen
+			float ndcX[2] = {2.0f * x * tileWidth / width - 1.0f, min(1.0f, 2.0f * (x + 1) * tileWidth / width - 1.0f)};
+			float ndcY[2] = {2.0f * y * tileHeight / height - 1.0f, min(1.0f, 2.0f * (y + 1) * tileHeight / height - 1.0f)};
+
+			glm::vec3 nearPoints[4], farPoints[4];
+			for (int corner = 0; corner < 4; corner++)
+			{
+				nearPoints[corner] = unproject(ndcX[corner & 1], ndcY[corner >> 1], -1.0f);
+				farPoints[corner] = unproject(ndcX[corner & 1], ndcY[corner >> 1], 1.0f);
+			}
+
+			for (int z = 0; z < options.gridZ; z++)
+			{
+				Bounds &box = clusterBounds[((size_t)z * options.gridY + y) * options.gridX + x];
+				box = Bounds();
+
+				// where the four corner rays cross the slice's two depths; works for either projection
+				for (int corner = 0; corner < 4; corner++)
+				{
+					float nearZ = -nearPoints[corner].z, farZ = -farPoints[corner].z;
+					for (int side = 0; side < 2; side++)
+					{
+						float t = (sliceDepth[z + side] - nearZ) / (farZ - nearZ);
+						glm::vec3 point = nearPoints[corner] + (farPoints[corner] - nearPoints[corner]) * t;
+						box.min = glm::min(box.min, point);
+						box.max = glm::max(box.max, point);
+					}
+				}
+			}
+		}
+	}
+}
+
+void LightClusters::update(const vector<ClusterLight> &lights, const glm::mat4 &view, const glm::mat4 &projection, int width, int height, TaskPool &pool)
+{
+	UPROFILE_SCOPE("LightClusters::update");
+	auto start = chrono::steady_clock::now();
+
+	if (width != gridWidth || height != gridHeight || memcmp(&projection, &gridProjection, sizeof(glm::mat4)) != 0)
+		buildGrid(projection, width, height);
+
+	// bounding spheres in view space, where the cluster boxes are
+	lightCount = (int)lights.size();
+	viewLights.resize(lights.size());
+	for (size_t i = 0; i < lights.size(); i++)
+		viewLights[i] = glm::vec4(glm::vec3(view * glm::vec4(lights[i].position, 1.0f)), lights[i].radius);
+
+	size_t clustersPerSlice = (size_t)options.gridX * options.gridY;
+	ranges.resize(clustersPerSlice * options.gridZ * 2);
+
+	// one depth slice per task: only lights reaching its depth range are tested against its clusters
+	pool.parallelFor(options.gridZ, 1, [&](size_t begin, size_t end, unsigned)
+					 {
+		vector<uint32_t> candidates;
+		for (size_t z = begin; z < end; z++)
+		{
+			candidates.clear();
+			for (uint32_t i = 0; i < (uint32_t)viewLights.size(); i++)
+			{
+				float depth = -viewLights[i].z, radius = viewLights[i].w;
+				if (depth + radius >= sliceDepth[z] && depth - radius <= sliceDepth[z + 1])
+					candidates.push_back(i);
+			}
+
+			vector<uint32_t> &indices = sliceIndices[z];
+			indices.clear();
+
+			for (size_t cluster = z * clustersPerSlice; cluster < (z + 1) * clustersPerSlice; cluster++)
+			{
+				const Bounds &box = clusterBounds[cluster];
+				uint32_t first = (uint32_t)indices.size();
+
+				for (uint32_t i : candidates)
+				{
+					// sphere against box: squared distance from the center to the closest point of the box
+					glm::vec3 center(viewLights[i]);
+					glm::vec3 closest = glm::clamp(center, box.min, box.max);
+					glm::vec3 offset = center - closest;
+					if (glm::dot(offset, offset) <= viewLights[i].w * viewLights[i].w)
+						indices.push_back(i);
+				}
+
+				ranges[cluster * 2] = first; // relative to the slice until the slices are joined
+				ranges[cluster * 2 + 1] = (uint32_t)indices.size() - first;
+			}
+		} });
+
+	// join the slices: shift every range by the indices of the slices before it
+	frameStats = ClusterStats();
+	vector<uint32_t> sliceFirst(options.gridZ);
+	for (int z = 0; z < options.gridZ; z++)
+	{
+		sliceFirst[z] = frameStats.lightRefs;
+		for (size_t cluster = z * clustersPerSlice; cluster < (z + 1) * clustersPerSlice; cluster++)
+		{
+			ranges[cluster * 2] += frameStats.lightRefs;
+			frameStats.maxLights = max(frameStats.maxLights, ranges[cluster * 2 + 1]);
+		}
+		frameStats.lightRefs += (uint32_t)sliceIndices[z].size();
+	}
+
+	// orphan and refill all three buffers; the previous frame's copies stay valid for the GPU
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[0]);
+	glBufferData(GL_TEXTURE_BUFFER, max<size_t>(16, lights.size() * sizeof(ClusterLight)), NULL, GL_STREAM_DRAW);
+	UTraceUpload(GL_TEXTURE_BUFFER, buffers[0], 0, max<size_t>(16, lights.size() * sizeof(ClusterLight)), NULL, TRACE_UPLOAD_ORPHAN);
+	if (!lights.empty())
+	{
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, lights.size() * sizeof(ClusterLight), lights.data());
+		UTraceUpload(GL_TEXTURE_BUFFER, buffers[0], 0, lights.size() * sizeof(ClusterLight), lights.data(), 0);
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[1]);
+	glBufferData(GL_TEXTURE_BUFFER, ranges.size() * sizeof(uint32_t), ranges.data(), GL_STREAM_DRAW);
+	UTraceUpload(GL_TEXTURE_BUFFER, buffers[1], 0, ranges.size() * sizeof(uint32_t), ranges.data(), TRACE_UPLOAD_ORPHAN);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[2]);
+	glBufferData(GL_TEXTURE_BUFFER, max<size_t>(16, frameStats.lightRefs * sizeof(uint32_t)), NULL, GL_STREAM_DRAW);
+	UTraceUpload(GL_TEXTURE_BUFFER, buffers[2], 0, max<size_t>(16, frameStats.lightRefs * sizeof(uint32_t)), NULL, TRACE_UPLOAD_ORPHAN);
+	for (int z = 0; z < options.gridZ; z++)
+	{
+		if (!sliceIndices[z].empty())
+		{
+			glBufferSubData(GL_TEXTURE_BUFFER, sliceFirst[z] * sizeof(uint32_t), sliceIndices[z].size() * sizeof(uint32_t), sliceIndices[z].data());
+			UTraceUpload(GL_TEXTURE_BUFFER, buffers[2], sliceFirst[z] * sizeof(uint32_t), sliceIndices[z].size() * sizeof(uint32_t), sliceIndices[z].data(), 0);
+		}
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	frameStats.buildMs = elapsed.count();
+}
+
+void LightClusters::bind(const ProgramUniforms &uniforms) const
+{
+	const char *samplers[3] = {"lightData", "clusterRanges", "clusterIndices"};
+	for (int i = 0; i < 3; i++)
+	{
+		GLint unit = CLUSTER_TEXTURE_UNIT + i;
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		glUniform1i(uniforms.location(samplers[i]), unit);
+		UTraceBindTexture(unit, GL_TEXTURE_BUFFER, textures[i]);
+		UTraceUniform(uniforms.location(samplers[i]), GL_INT, &unit);
+	}
+	glActiveTexture(GL_TEXTURE0);
+
+	GLint grid[3] = {options.gridX, options.gridY, options.gridZ};
+	GLfloat tileSize[2] = {(GLfloat)tileWidth, (GLfloat)tileHeight}, depth[2] = {sliceScale, sliceBias};
+	GLint count = lightCount, loopAll = options.loopAll;
+	glUniform3iv(uniforms.location("clusterGrid"), 1, grid);
+	glUniform2fv(uniforms.location("clusterTileSize"), 1, tileSize);
+	glUniform2fv(uniforms.location("clusterDepth"), 1, depth);
+	glUniform1i(uniforms.location("lightCount"), count);
+	glUniform1i(uniforms.location("loopAllLights"), loopAll);
+
+	UTraceUniform(uniforms.location("clusterGrid"), GL_INT_VEC3, grid);
+	UTraceUniform(uniforms.location("clusterTileSize"), GL_FLOAT_VEC2, tileSize);
+	UTraceUniform(uniforms.location("clusterDepth"), GL_FLOAT_VEC2, depth);
+	UTraceUniform(uniforms.location("lightCount"), GL_INT, &count);
+	UTraceUniform(uniforms.location("loopAllLights"), GL_INT, &loopAll);
+}
+
+/* Parses --lights N, --light-loop, --light-bench and --clusters XxYxZ */
+bool UParseClusterArgs(int argc, char *argv[], ClusterOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--lights")
+		{
+			options.lights = i + 1 < argc ? atoi(argv[++i]) : -1;
+			if (options.lights < 0)
+			{
+				cout << "--lights expects a light count" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--light-loop")
+		{
+			options.loopAll = true;
+		}
+		else if (arg == "--light-bench")
+		{
+			options.benchmark = true;
+		}
+		else if (arg == "--clusters")
+		{
+			if (i + 1 >= argc || sscanf(argv[++i], "%dx%dx%d", &options.gridX, &options.gridY, &options.gridZ) != 3 ||
+				options.gridX <= 0 || options.gridY <= 0 || options.gridZ <= 0)
+			{
+				cout << "--clusters expects COLUMNSxROWSxSLICES, e.g. 16x9x24" << endl;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/* Integer hash turned into [0, 1), so the lights are the same on every run */
+static float ULightRandom(uint32_t light, uint32_t channel)
+{
+	uint32_t hash = (light * 2654435761u) ^ (channel * 2246822519u);
+	hash ^= hash >> 15;
+	hash *= 2654435761u;
+	hash ^= hash >> 13;
+	return (hash & 0xFFFFFF) / 16777216.0f;
+}
+
+void UCreateClusterLights(int count, const Bounds &region, float radius, vector<ClusterLight> &lights)
+{
+	lights.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		ClusterLight &light = lights[i];
+		for (int axis = 0; axis < 3; axis++)
+			light.position[axis] = region.min[axis] + (region.max[axis] - region.min[axis]) * ULightRandom(i, axis);
+		light.radius = radius * (0.6f + 0.8f * ULightRandom(i, 3));
+
+		// saturated hues, dimmed so a few overlapping lights do not wash the chairs out
+		float hue = ULightRandom(i, 4) * 6.0f;
+		glm::vec3 color = glm::clamp(glm::vec3(fabs(hue - 3.0f) - 1.0f, 2.0f - fabs(hue - 2.0f), 2.0f - fabs(hue - 4.0f)), 0.0f, 1.0f);
+		light.color = 0.6f * color;
+
+		light.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+		if (i % 4 == 3)
+		{
+			light.spotOuter = cos(glm::radians(35.0f));
+			light.spotInner = cos(glm::radians(25.0f));
+		}
+		else
+		{
+			light.spotOuter = -2.0f; // point light: every direction is inside the cone
+			light.spotInner = -1.0f;
+		}
+	}
+}
+
+void UAnimateClusterLights(const vector<ClusterLight> &rest, float seconds, vector<ClusterLight> &lights)
+{
+	lights = rest;
+	for (size_t i = 0; i < lights.size(); i++)
+	{
+		float phase = ULightRandom((uint32_t)i, 5) * glm::radians(360.0f);
+		float speed = 0.5f + ULightRandom((uint32_t)i, 6);
+		float orbit = 0.25f * rest[i].radius;
+
+		lights[i].position += orbit * glm::vec3(cos(seconds * speed + phase), 0.0f, sin(seconds * speed + phase));
+	}
+}
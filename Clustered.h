@@ -0,0 +1,96 @@
+/*
+ * Clustered.h
+ *
+ *  Clustered forward lighting: point and spot lights live in a texture buffer, the view
+ *  frustum is cut into a froxel grid, and every frame the worker threads list the lights
+ *  touching each cluster so a fragment only loops over the lights of its own cluster
+ */
+
+#ifndef CLUSTERED_H
+#define CLUSTERED_H
+
+#include <cstdint>
+#include <vector>
+#include <GL/glew.h>
+#include <GL/glm/glm.hpp>
+
+#include "Culling.h"
+#include "TaskPool.h"
+#include "UniformBuffers.h"
+
+/* Command line options of the local lights */
+struct ClusterOptions
+{
+	int lights = 0;			// --lights N point and spot lights over the scene, 0 keeps only the key and fill lights
+	bool loopAll = false;	// --light-loop shades every light at every fragment, for comparison
+	bool benchmark = false; // --light-bench sweeps the light count in headless mode
+	int gridX = 16, gridY = 9, gridZ = 24; // --clusters XxYxZ columns, rows and depth slices
+};
+
+/* One light, laid out as the light buffer stores it: three RGBA32F texels */
+struct ClusterLight
+{
+	glm::vec3 position; // world space
+	float radius;		// no light beyond it
+	glm::vec3 color;
+	float spotOuter;	 // cosine of the cone edge, below -1 for a point light
+	glm::vec3 direction; // spot axis, world space
+	float spotInner;	 // cosine where the cone reaches full strength
+};
+
+/* Per-frame results of the cluster build */
+struct ClusterStats
+{
+	uint32_t lightRefs = 0;	 // light indices over all clusters
+	uint32_t maxLights = 0;	 // most lights in one cluster
+	double buildMs = 0.0;	 // listing and uploading
+};
+
+/* The light buffer, the froxel grid and its light lists, and the texture buffers the shader reads them from */
+class LightClusters
+{
+public:
+	explicit LightClusters(const ClusterOptions &options);
+	~LightClusters();
+
+	LightClusters(const LightClusters &) = delete;
+	LightClusters &operator=(const LightClusters &) = delete;
+
+	// lists the lights of every cluster on the pool and uploads lights, ranges and indices
+	void update(const std::vector<ClusterLight> &lights, const glm::mat4 &view, const glm::mat4 &projection, int width, int height, TaskPool &pool);
+
+	// binds the texture buffers to units 1 to 3 and sets the cluster uniforms of the current program, at its reflected locations
+	void bind(const ProgramUniforms &uniforms) const;
+
+	const ClusterStats &stats() const { return frameStats; }
+
+private:
+	void buildGrid(const glm::mat4 &projection, int width, int height);
+
+	ClusterOptions options;
+	GLuint buffers[3], textures[3]; // lights, cluster ranges, light indices
+
+	// grid of the last projection and viewport: view-space box of every cluster, depth slicing
+	glm::mat4 gridProjection;
+	int gridWidth = 0, gridHeight = 0;
+	int tileWidth = 1, tileHeight = 1; // pixels per column and row
+	float sliceScale = 0.0f, sliceBias = 0.0f; // slice = log(depth) * scale + bias
+	std::vector<float> sliceDepth;			   // gridZ + 1 slice boundaries
+	std::vector<Bounds> clusterBounds;
+
+	int lightCount = 0;
+	std::vector<glm::vec4> viewLights;				 // view-space center and radius
+	std::vector<std::vector<uint32_t>> sliceIndices; // light indices of each slice, cluster after cluster
+	std::vector<uint32_t> ranges;					 // first index and count of every cluster
+	ClusterStats frameStats;
+};
+
+bool UParseClusterArgs(int argc, char *argv[], ClusterOptions &options);
+
+// 'count' lights scattered over 'region', every fourth a spot pointing down; identical on every run
+void UCreateClusterLights(int count, const Bounds &region, float radius, std::vector<ClusterLight> &lights);
+
+// lights circling their rest position at 'seconds'
+void UAnimateClusterLights(const std::vector<ClusterLight> &rest, float seconds, std::vector<ClusterLight> &lights);
+
+#endif
@@ -0,0 +1,404 @@
+/*
+ * Culling.cpp
+ *
+ *  BVH over instance bounds with incremental refit and parallel frustum culling
+ */
+
+/* Header Inclusions */
+#include "Culling.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std; // standard namespace
+
+#define BVH_LEAF_SIZE 4		// instances per leaf before a node is split
+#define BVH_BINS 12			// SAH bins per split
+#define FRONTIER_PER_WORKER 8 // subtrees handed to each worker, leaves room for stealing
+#define ALL_PLANES 0x3F		// one bit per frustum plane still to be tested
+
+/* Subtree root handed to a culling task, with the planes its parent did not already pass */
+struct FrontierEntry
+{
+	uint32_t node;
+	uint32_t mask;
+};
+
+/* Culling scratch kept between frames to avoid reallocations */
+static vector<FrontierEntry> frontier, nextFrontier;
+static vector<vector<uint32_t>> frontierVisible;
+
+/* Refit scratch */
+static vector<uint32_t> refitNodes, refitStamp;
+static uint32_t refitEpoch;
+
+static void UGrow(Bounds &bounds, const Bounds &other)
+{
+	bounds.min = glm::min(bounds.min, other.min);
+	bounds.max = glm::max(bounds.max, other.max);
+}
+
+static float USurfaceArea(const Bounds &bounds)
+{
+	glm::vec3 extent = glm::max(bounds.max - bounds.min, glm::vec3(0.0f));
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+/* Bounds of interleaved vertex positions (position first, 'stride' floats per vertex) */
+Bounds UComputeBounds(const GLfloat *vertices, size_t vertexCount, size_t stride)
+{
+	Bounds bounds;
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		glm::vec3 position(vertices[i * stride], vertices[i * stride + 1], vertices[i * stride + 2]);
+		bounds.min = glm::min(bounds.min, position);
+		bounds.max = glm::max(bounds.max, position);
+	}
+	return bounds;
+}
+
+/* World bounds of a transformed box (Arvo's method, no corner enumeration) */
+Bounds UTransformBounds(const Bounds &local, const glm::mat4 &model)
+{
+	Bounds world;
+	world.min = world.max = glm::vec3(model[3]);
+
+	for (int column = 0; column < 3; column++)
+	{
+		glm::vec3 a = glm::vec3(model[column]) * local.min[column];
+		glm::vec3 b = glm::vec3(model[column]) * local.max[column];
+		world.min += glm::min(a, b);
+		world.max += glm::max(a, b);
+	}
+	return world;
+}
+
+/* Recomputes a node's box from its children or its instances */
+static void UUpdateNodeBounds(Bvh &bvh, uint32_t nodeIndex)
+{
+	BvhNode &node = bvh.nodes[nodeIndex];
+	Bounds bounds;
+
+	if (node.count == 0)
+	{
+		const BvhNode &left = bvh.nodes[node.leftFirst];
+		const BvhNode &right = bvh.nodes[node.leftFirst + 1];
+		bounds.min = glm::min(left.min, right.min);
+		bounds.max = glm::max(left.max, right.max);
+	}
+	else
+	{
+		for (uint32_t i = 0; i < node.count; i++)
+			UGrow(bounds, bvh.bounds[bvh.items[node.leftFirst + i]]);
+	}
+
+	node.min = bounds.min;
+	node.max = bounds.max;
+}
+
+/* Picks a split with binned SAH along the longest centroid axis, returns the left count (0 = keep as leaf) */
+static uint32_t UPartitionNode(Bvh &bvh, const BvhNode &node, const vector<glm::vec3> &centroids)
+{
+	uint32_t *items = &bvh.items[node.leftFirst];
+
+	Bounds centroidBounds;
+	for (uint32_t i = 0; i < node.count; i++)
+	{
+		centroidBounds.min = glm::min(centroidBounds.min, centroids[items[i]]);
+		centroidBounds.max = glm::max(centroidBounds.max, centroids[items[i]]);
+	}
+
+	glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	if (extent[axis] <= 0.0f)
+		return 0; // every centroid coincides, nothing to split
+
+	// bin the instances by centroid
+	Bounds binBounds[BVH_BINS];
+	uint32_t binCount[BVH_BINS] = {0};
+	float scale = BVH_BINS / extent[axis];
+
+	for (uint32_t i = 0; i < node.count; i++)
+	{
+		int bin = min(BVH_BINS - 1, (int)((centroids[items[i]][axis] - centroidBounds.min[axis]) * scale));
+		binCount[bin]++;
+		UGrow(binBounds[bin], bvh.bounds[items[i]]);
+	}
+
+	// sweep from both sides to get the cost of every split plane
+	float leftArea[BVH_BINS - 1], rightArea[BVH_BINS - 1];
+	uint32_t leftCount[BVH_BINS - 1], rightCount[BVH_BINS - 1];
+	Bounds leftBox, rightBox;
+	uint32_t leftSum = 0, rightSum = 0;
+
+	for (int i = 0; i < BVH_BINS - 1; i++)
+	{
+		leftSum += binCount[i];
+		UGrow(leftBox, binBounds[i]);
+		leftCount[i] = leftSum;
+		leftArea[i] = USurfaceArea(leftBox);
+
+		rightSum += binCount[BVH_BINS - 1 - i];
+		UGrow(rightBox, binBounds[BVH_BINS - 1 - i]);
+		rightCount[BVH_BINS - 2 - i] = rightSum;
+		rightArea[BVH_BINS - 2 - i] = USurfaceArea(rightBox);
+	}
+
+	int bestSplit = -1;
+	float bestCost = 1e30f;
+	for (int i = 0; i < BVH_BINS - 1; i++)
+	{
+		if (leftCount[i] == 0 || rightCount[i] == 0)
+			continue;
+
+		float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+		if (cost < bestCost)
+		{
+			bestCost = cost;
+			bestSplit = i;
+		}
+	}
+
+	if (bestSplit < 0)
+		return 0;
+
+	uint32_t *middle = partition(items, items + node.count, [&](uint32_t item)
+								 { return min(BVH_BINS - 1, (int)((centroids[item][axis] - centroidBounds.min[axis]) * scale)) <= bestSplit; });
+
+	return (uint32_t)(middle - items);
+}
+
+/* Builds the hierarchy top-down; children are always stored after their parent */
+void UBuildBvh(Bvh &bvh, const vector<Bounds> &instanceBounds)
+{
+	uint32_t count = (uint32_t)instanceBounds.size();
+
+	bvh.bounds = instanceBounds;
+	bvh.items.resize(count);
+	bvh.itemLeaf.assign(count, 0);
+	bvh.nodes.clear();
+	bvh.parents.clear();
+
+	if (count == 0)
+		return;
+
+	vector<glm::vec3> centroids(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		bvh.items[i] = i;
+		centroids[i] = 0.5f * (instanceBounds[i].min + instanceBounds[i].max);
+	}
+
+	bvh.nodes.reserve(2 * count);
+	bvh.parents.reserve(2 * count);
+	bvh.nodes.push_back(BvhNode{glm::vec3(0.0f), 0, glm::vec3(0.0f), count});
+	bvh.parents.push_back(0);
+
+	vector<uint32_t> pending(1, 0);
+	while (!pending.empty())
+	{
+		uint32_t nodeIndex = pending.back();
+		pending.pop_back();
+
+		UUpdateNodeBounds(bvh, nodeIndex);
+
+		BvhNode node = bvh.nodes[nodeIndex];
+		if (node.count <= BVH_LEAF_SIZE)
+			continue;
+
+		uint32_t leftCount = UPartitionNode(bvh, node, centroids);
+		if (leftCount == 0 || leftCount == node.count)
+			continue;
+
+		uint32_t left = (uint32_t)bvh.nodes.size();
+		bvh.nodes.push_back(BvhNode{glm::vec3(0.0f), node.leftFirst, glm::vec3(0.0f), leftCount});
+		bvh.nodes.push_back(BvhNode{glm::vec3(0.0f), node.leftFirst + leftCount, glm::vec3(0.0f), node.count - leftCount});
+		bvh.parents.push_back(nodeIndex);
+		bvh.parents.push_back(nodeIndex);
+
+		bvh.nodes[nodeIndex].leftFirst = left;
+		bvh.nodes[nodeIndex].count = 0;
+
+		pending.push_back(left);
+		pending.push_back(left + 1);
+	}
+
+	for (uint32_t nodeIndex = 0; nodeIndex < bvh.nodes.size(); nodeIndex++)
+	{
+		const BvhNode &node = bvh.nodes[nodeIndex];
+		for (uint32_t i = 0; i < node.count; i++)
+			bvh.itemLeaf[bvh.items[node.leftFirst + i]] = nodeIndex;
+	}
+}
+
+/* Refits only the leaves of the moved instances and their ancestors; bvh.bounds must already hold the new boxes */
+void URefitBvh(Bvh &bvh, const vector<uint32_t> &movedInstances)
+{
+	if (bvh.nodes.empty() || movedInstances.empty())
+		return;
+
+	refitStamp.resize(bvh.nodes.size(), 0);
+	refitNodes.clear();
+	refitEpoch++;
+
+	// gather every affected node once, stopping at the first ancestor another instance already reached
+	for (uint32_t instance : movedInstances)
+	{
+		uint32_t nodeIndex = bvh.itemLeaf[instance];
+		while (refitStamp[nodeIndex] != refitEpoch)
+		{
+			refitStamp[nodeIndex] = refitEpoch;
+			refitNodes.push_back(nodeIndex);
+			if (nodeIndex == 0)
+				break;
+			nodeIndex = bvh.parents[nodeIndex];
+		}
+	}
+
+	// children have larger indices than their parents, so descending order is bottom-up
+	sort(refitNodes.begin(), refitNodes.end(), greater<uint32_t>());
+	for (uint32_t nodeIndex : refitNodes)
+		UUpdateNodeBounds(bvh, nodeIndex);
+}
+
+/* Frustum planes (ax + by + cz + d >= 0 inside) from a view-projection matrix, Gribb/Hartmann */
+void UExtractFrustum(const glm::mat4 &viewProjection, glm::vec4 planes[6])
+{
+	glm::vec4 rows[4];
+	for (int row = 0; row < 4; row++)
+		rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+
+	planes[0] = rows[3] + rows[0]; // left
+	planes[1] = rows[3] - rows[0]; // right
+	planes[2] = rows[3] + rows[1]; // bottom
+	planes[3] = rows[3] - rows[1]; // top
+	planes[4] = rows[3] + rows[2]; // near
+	planes[5] = rows[3] - rows[2]; // far
+}
+
+/* Tests a box against the planes in 'mask'; returns false when outside, clears the planes the box is fully inside of */
+static bool UTestBox(const glm::vec4 planes[6], const glm::vec3 &boxMin, const glm::vec3 &boxMax, uint32_t &mask)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		if (!(mask & (1u << i)))
+			continue;
+
+		const glm::vec4 &plane = planes[i];
+
+		// corner furthest along the plane normal, then the one furthest against it
+		glm::vec3 positive(plane.x > 0.0f ? boxMax.x : boxMin.x, plane.y > 0.0f ? boxMax.y : boxMin.y, plane.z > 0.0f ? boxMax.z : boxMin.z);
+		if (plane.x * positive.x + plane.y * positive.y + plane.z * positive.z + plane.w < 0.0f)
+			return false;
+
+		glm::vec3 negative(plane.x > 0.0f ? boxMin.x : boxMax.x, plane.y > 0.0f ? boxMin.y : boxMax.y, plane.z > 0.0f ? boxMin.z : boxMax.z);
+		if (plane.x * negative.x + plane.y * negative.y + plane.z * negative.z + plane.w >= 0.0f)
+			mask &= ~(1u << i);
+	}
+	return true;
+}
+
+/* Depth-first cull of one subtree, appending visible instances in tree order */
+static void UCullSubtree(const Bvh &bvh, const glm::vec4 planes[6], FrontierEntry start, vector<uint32_t> &visible)
+{
+	vector<FrontierEntry> stack;
+	stack.reserve(64);
+	stack.push_back(start);
+
+	while (!stack.empty())
+	{
+		FrontierEntry entry = stack.back();
+		stack.pop_back();
+		const BvhNode &node = bvh.nodes[entry.node];
+
+		if (node.count > 0)
+		{
+			for (uint32_t i = 0; i < node.count; i++)
+			{
+				uint32_t instance = bvh.items[node.leftFirst + i];
+				uint32_t mask = entry.mask;
+				if (mask == 0 || UTestBox(planes, bvh.bounds[instance].min, bvh.bounds[instance].max, mask))
+					visible.push_back(instance);
+			}
+			continue;
+		}
+
+		// push right first so the left child is visited first
+		for (int child = 1; child >= 0; child--)
+		{
+			uint32_t childIndex = node.leftFirst + child;
+			uint32_t mask = entry.mask;
+			if (mask == 0 || UTestBox(planes, bvh.nodes[childIndex].min, bvh.nodes[childIndex].max, mask))
+				stack.push_back(FrontierEntry{childIndex, mask});
+		}
+	}
+}
+
+/* Culls the hierarchy against the view frustum: the top levels are split on the calling thread into
+   subtrees that the pool culls in parallel, results are concatenated in tree order */
+void UCullBvh(const Bvh &bvh, const glm::mat4 &viewProjection, TaskPool &pool, vector<uint32_t> &visible, CullStats &stats)
+{
+	UPROFILE_SCOPE("UCullBvh");
+	auto start = chrono::steady_clock::now();
+
+	visible.clear();
+	frontier.clear();
+
+	glm::vec4 planes[6];
+	UExtractFrustum(viewProjection, planes);
+
+	uint32_t rootMask = ALL_PLANES;
+	if (!bvh.nodes.empty() && UTestBox(planes, bvh.nodes[0].min, bvh.nodes[0].max, rootMask))
+		frontier.push_back(FrontierEntry{0, rootMask});
+
+	// widen the frontier breadth-first until every worker has several subtrees to chew on
+	size_t target = (size_t)pool.size() * FRONTIER_PER_WORKER;
+	bool expanded = true;
+	while (expanded && frontier.size() < target)
+	{
+		expanded = false;
+		nextFrontier.clear();
+
+		for (const FrontierEntry &entry : frontier)
+		{
+			const BvhNode &node = bvh.nodes[entry.node];
+			if (node.count > 0 || entry.mask == 0)
+			{
+				nextFrontier.push_back(entry);
+				continue;
+			}
+
+			for (uint32_t child = 0; child < 2; child++)
+			{
+				uint32_t childIndex = node.leftFirst + child;
+				uint32_t mask = entry.mask;
+				if (UTestBox(planes, bvh.nodes[childIndex].min, bvh.nodes[childIndex].max, mask))
+					nextFrontier.push_back(FrontierEntry{childIndex, mask});
+			}
+			expanded = true;
+		}
+
+		frontier.swap(nextFrontier);
+	}
+
+	if (frontierVisible.size() < frontier.size())
+		frontierVisible.resize(frontier.size());
+
+	pool.parallelFor(frontier.size(), 1, [&](size_t begin, size_t end, unsigned)
+					 {
+		UPROFILE_SCOPE("UCullSubtree");
+		for (size_t i = begin; i < end; i++)
+		{
+			frontierVisible[i].clear();
+			UCullSubtree(bvh, planes, frontier[i], frontierVisible[i]);
+		} });
+
+	// compact the per-subtree lists into one visible-instance list
+	for (size_t i = 0; i < frontier.size(); i++)
+		visible.insert(visible.end(), frontierVisible[i].begin(), frontierVisible[i].end());
+
+	stats.visible = (uint32_t)visible.size();
+	stats.culled = (uint32_t)bvh.bounds.size() - stats.visible;
+	stats.cullMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,59 @@
+/*
+ * Culling.h
+ *
+ *  BVH over instance bounds with incremental refit and parallel frustum culling
+ */
+
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <cstdint>
+#include <vector>
+#include <GL/glew.h>
+#include <GL/glm/glm.hpp>
+
+#include "TaskPool.h"
+
+/* Axis aligned bounding box */
+struct Bounds
+{
+	glm::vec3 min = glm::vec3(1e30f);
+	glm::vec3 max = glm::vec3(-1e30f);
+};
+
+/* 32 byte node: internal nodes have count 0 and children at leftFirst and leftFirst + 1,
+   leaves hold 'count' instances starting at items[leftFirst] */
+struct BvhNode
+{
+	glm::vec3 min;
+	uint32_t leftFirst;
+	glm::vec3 max;
+	uint32_t count;
+};
+
+/* Bounding volume hierarchy over the showroom instances */
+struct Bvh
+{
+	std::vector<BvhNode> nodes;
+	std::vector<uint32_t> items;	// instance indices grouped by leaf
+	std::vector<uint32_t> parents;	// parent of every node, root points to itself
+	std::vector<uint32_t> itemLeaf; // leaf holding each instance
+	std::vector<Bounds> bounds;		// world bounds of each instance
+};
+
+/* Per-frame culling results */
+struct CullStats
+{
+	uint32_t visible = 0;
+	uint32_t culled = 0;
+	double cullMs = 0.0;
+};
+
+Bounds UComputeBounds(const GLfloat *vertices, size_t vertexCount, size_t stride);
+Bounds UTransformBounds(const Bounds &local, const glm::mat4 &model);
+void UBuildBvh(Bvh &bvh, const std::vector<Bounds> &instanceBounds);
+void URefitBvh(Bvh &bvh, const std::vector<uint32_t> &movedInstances);
+void UExtractFrustum(const glm::mat4 &viewProjection, glm::vec4 planes[6]);
+void UCullBvh(const Bvh &bvh, const glm::mat4 &viewProjection, TaskPool &pool, std::vector<uint32_t> &visible, CullStats &stats);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * FramePacer.cpp
+ *
+ *  On-demand and frame-rate capped redraws for the GLUT window
+ */
+
+/* Header Inclusions */
+#include "FramePacer.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <GL/freeglut.h>
+
+using namespace std; // standard namespace
+
+static FramePacerOptions pacer;
+static bool framePending = false;				   // a redisplay is posted or its timer is armed
+static chrono::steady_clock::time_point nextFrame; // start of the next frame slot when capped
+
+/* Parses --on-demand and --fps-cap N */
+bool UParseFramePacerArgs(int argc, char *argv[], FramePacerOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--on-demand")
+		{
+			options.onDemand = true;
+		}
+		else if (arg == "--fps-cap")
+		{
+			options.fpsCap = i + 1 < argc ? atoi(argv[++i]) : 0;
+			if (options.fpsCap <= 0)
+			{
+				cout << "--fps-cap expects a positive frame rate" << endl;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void UInitFramePacer(const FramePacerOptions &options)
+{
+	pacer = options;
+	nextFrame = chrono::steady_clock::now();
+	framePending = true; // GLUT draws the first frame when the window is shown
+
+	if (pacer.onDemand || pacer.fpsCap > 0)
+	{
+		cout << "Rendering " << (pacer.onDemand ? "on demand" : "continuously");
+		if (pacer.fpsCap > 0)
+			cout << ", capped at " << pacer.fpsCap << " fps";
+		cout << endl;
+	}
+}
+
+static void UPacedRedisplay(int)
+{
+	glutPostRedisplay();
+}
+
+/* Posts the next redisplay, holding it back to the start of the next frame slot when capped */
+static void UScheduleFrame(void)
+{
+	if (framePending)
+		return;
+	framePending = true;
+
+	chrono::duration<double, milli> wait = nextFrame - chrono::steady_clock::now();
+	if (pacer.fpsCap > 0 && wait.count() > 0.0)
+		glutTimerFunc((unsigned int)ceil(wait.count()), UPacedRedisplay, 0); // the event loop keeps handling input meanwhile
+	else
+		glutPostRedisplay();
+}
+
+void URequestRedraw(void)
+{
+	UScheduleFrame();
+}
+
+void UFrameDone(bool animating)
+{
+	framePending = false;
+
+	if (pacer.fpsCap > 0)
+	{
+		// slots follow each other at the exact period so rounding to whole milliseconds does not drift;
+		// a late frame starts the next slot now rather than rushing to catch up
+		auto now = chrono::steady_clock::now();
+		nextFrame += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / pacer.fpsCap));
+		if (nextFrame < now)
+			nextFrame = now;
+	}
+
+	if (!pacer.onDemand || animating)
+		UScheduleFrame();
+}
@@ -0,0 +1,24 @@
+/*
+ * FramePacer.h
+ *
+ *  Decides when the GLUT window draws: continuously, or only while something on screen
+ *  changes, optionally held to a frame-rate cap
+ */
+
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+/* Command line options of the window's render loop */
+struct FramePacerOptions
+{
+	bool onDemand = false; // --on-demand draws only after input, resizes and while something animates
+	int fpsCap = 0;		   // --fps-cap N frames per second at most, 0 leaves it to the driver
+};
+
+bool UParseFramePacerArgs(int argc, char *argv[], FramePacerOptions &options);
+void UInitFramePacer(const FramePacerOptions &options);
+
+void URequestRedraw(void);			 // input callbacks: the scene changed, draw it (at most once per frame slot)
+void UFrameDone(bool animating); // end of the display callback: schedules the next frame if one is needed
+
+#endif
@@ -0,0 +1,480 @@
+/*
+ * FrameRecorder.cpp
+ *
+ *  Frame recording without stalls: each frame is read back into one of a ring of pixel pack
+ *  buffers behind a fence, mapped once the fence has signaled a frame or two later, and
+ *  handed to a writer thread that streams a Y4M video, raw RGB frames or a PNG sequence
+ */
+
+/* Header Inclusions */
+#include "FrameRecorder.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+using namespace std; // standard namespace
+
+static const char *formatNames[] = {"y4m", "raw", "png"};
+
+/* Appends a big endian 32-bit value, as PNG stores them */
+static void UPutBE32(vector<unsigned char> &out, uint32_t value)
+{
+	out.push_back((unsigned char)(value >> 24));
+	out.push_back((unsigned char)(value >> 16));
+	out.push_back((unsigned char)(value >> 8));
+	out.push_back((unsigned char)value);
+}
+
+static uint32_t UCrc32(const unsigned char *bytes, size_t size)
+{
+	static uint32_t table[256];
+	static bool filled = false;
+	if (!filled)
+	{
+		for (uint32_t n = 0; n < 256; n++)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+		filled = true;
+	}
+
+	uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < size; i++)
+		crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFFu;
+}
+
+/* Writes a PNG chunk: length, type, data and the CRC of type and data */
+static void UWriteChunk(ofstream &file, const char *type, vector<unsigned char> &data)
+{
+	vector<unsigned char> length;
+	UPutBE32(length, (uint32_t)data.size());
+	file.write((const char *)length.data(), 4);
+
+	data.insert(data.begin(), type, type + 4);
+	vector<unsigned char> crc;
+	UPutBE32(crc, UCrc32(data.data(), data.size()));
+	file.write((const char *)data.data(), data.size());
+	file.write((const char *)crc.data(), 4);
+}
+
+/* Writes top-down RGB24 as a PNG; there is no zlib in the tree, so the image data goes in stored (uncompressed) deflate blocks */
+static bool UWritePNG(const string &path, const vector<unsigned char> &rgb, int width, int height, vector<unsigned char> &scratch)
+{
+	ofstream file(path, ios::binary | ios::trunc);
+	if (!file)
+		return false;
+
+	static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	file.write((const char *)signature, 8);
+
+	vector<unsigned char> header;
+	UPutBE32(header, (uint32_t)width);
+	UPutBE32(header, (uint32_t)height);
+	header.insert(header.end(), {8, 2, 0, 0, 0}); // 8-bit RGB, deflate, adaptive filtering, no interlace
+	UWriteChunk(file, "IHDR", header);
+
+	// filtered rows: a filter type byte (0, none) before each row
+	size_t rowBytes = (size_t)width * 3;
+	size_t rawBytes = (rowBytes + 1) * height;
+
+	scratch.clear();
+	scratch.reserve(2 + rawBytes + (rawBytes / 65535 + 1) * 5 + 4);
+	scratch.push_back(0x78); // zlib: deflate, 32 KB window
+	scratch.push_back(0x01);
+
+	uint32_t a = 1, b = 0; // Adler-32 of the filtered rows
+	size_t blockLeft = 0;
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned char *row = &rgb[(size_t)y * rowBytes];
+		for (size_t i = 0; i <= rowBytes; i++)
+		{
+			if (blockLeft == 0)
+			{
+				// stored block: final flag, then its length and the length's complement, little endian
+				size_t written = (size_t)y * (rowBytes + 1) + i;
+				blockLeft = min<size_t>(65535, rawBytes - written);
+				scratch.push_back(written + blockLeft == rawBytes ? 1 : 0);
+				scratch.push_back((unsigned char)blockLeft);
+				scratch.push_back((unsigned char)(blockLeft >> 8));
+				scratch.push_back((unsigned char)~blockLeft);
+				scratch.push_back((unsigned char)(~blockLeft >> 8));
+			}
+
+			unsigned char value = i == 0 ? 0 : row[i - 1];
+			scratch.push_back(value);
+			blockLeft--;
+
+			a += value;
+			b += a;
+			if ((i & 4095) == 4095) // well inside the 5552 bytes before the sums can overflow
+			{
+				a %= 65521;
+				b %= 65521;
+			}
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	UPutBE32(scratch, (b << 16) | a);
+	UWriteChunk(file, "IDAT", scratch);
+
+	vector<unsigned char> end;
+	UWriteChunk(file, "IEND", end);
+
+	return (bool)file;
+}
+
+/* File name of frame 'frame' from a printf pattern with one integer conversion */
+static string UFramePath(const string &pattern, uint64_t frame)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), pattern.c_str(), (int)frame);
+	return path;
+}
+
+/* Parses --record FILE, --record-format y4m|raw|png, --record-buffers N and --record-fps N */
+bool UParseRecorderArgs(int argc, char *argv[], RecorderOptions &options)
+{
+	bool formatGiven = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--record")
+		{
+			if (i + 1 >= argc)
+			{
+				cout << "--record expects a file" << endl;
+				return false;
+			}
+			options.path = argv[++i];
+		}
+		else if (arg == "--record-format")
+		{
+			string format = i + 1 < argc ? argv[++i] : "";
+			auto found = find_if(begin(formatNames), end(formatNames), [&](const char *name) { return format == name; });
+			if (found == end(formatNames))
+			{
+				cout << "--record-format expects y4m, raw or png" << endl;
+				return false;
+			}
+			options.format = (RecordFormat)(found - begin(formatNames));
+			formatGiven = true;
+		}
+		else if (arg == "--record-buffers")
+		{
+			options.buffers = i + 1 < argc ? atoi(argv[++i]) : 0;
+			if (options.buffers < 2 || options.buffers > RECORDER_MAX_BUFFERS)
+			{
+				cout << "--record-buffers expects 2 to " << RECORDER_MAX_BUFFERS << " buffers" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--record-fps")
+		{
+			options.fps = i + 1 < argc ? atoi(argv[++i]) : 0;
+			if (options.fps <= 0)
+			{
+				cout << "--record-fps expects a positive frame rate" << endl;
+				return false;
+			}
+		}
+	}
+
+	if (options.path.empty())
+		return true;
+
+	if (!formatGiven)
+	{
+		size_t dot = options.path.find_last_of('.');
+		string extension = dot == string::npos ? "" : options.path.substr(dot + 1);
+		options.format = extension == "y4m" ? RECORD_Y4M : extension == "png" ? RECORD_PNG : RECORD_RAW;
+	}
+
+	// a PNG sequence numbers its files: one %d, optionally zero padded, inserted before the extension when missing
+	if (options.format == RECORD_PNG)
+	{
+		size_t percent = options.path.find('%');
+		if (percent == string::npos)
+		{
+			size_t dot = options.path.find_last_of('.');
+			options.path.insert(dot == string::npos ? options.path.size() : dot, "_%05d");
+		}
+		else
+		{
+			size_t conversion = options.path.find_first_not_of("0123456789", percent + 1);
+			if (conversion == string::npos || options.path[conversion] != 'd' || options.path.find('%', percent + 1) != string::npos)
+			{
+				cout << "--record expects one %d in a PNG name, e.g. shots/frame_%05d.png" << endl;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+FrameRecorder::FrameRecorder(const RecorderOptions &options)
+	: options(options)
+{
+	for (int i = 0; i < options.buffers; i++)
+		glGenBuffers(1, &slots[i].buffer);
+
+	if (options.format != RECORD_PNG)
+	{
+		file.open(options.path, ios::binary | ios::trunc);
+		if (!file)
+			cout << "Cannot write " << options.path << ", frames are not recorded" << endl;
+	}
+
+	writer = thread(&FrameRecorder::run, this);
+}
+
+FrameRecorder::~FrameRecorder()
+{
+	// the readbacks still in flight are waited for, the writer drains its queue and stops
+	while (slots[oldest].state == SLOT_READING)
+		retire(true);
+
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	writer.join();
+
+	reclaim();
+	for (int i = 0; i < options.buffers; i++)
+		glDeleteBuffers(1, &slots[i].buffer);
+
+	cout << "[Record] " << frames << " frames to " << options.path << " (" << formatNames[options.format] << ")";
+	if (skipped > 0)
+		cout << ", " << skipped << " skipped";
+	cout << ", writer " << (frames ? writeMs / frames : 0.0) << " ms per frame" << endl;
+}
+
+void FrameRecorder::capture(int width, int height)
+{
+	UPROFILE_SCOPE("FrameRecorder::capture");
+	auto start = chrono::steady_clock::now();
+	lastStats.waitMs = 0.0;
+
+	reclaim();
+	retire(false);
+
+	// the buffer to reuse is still being read back or written out: the render thread has to wait for it
+	Slot &slot = slots[next];
+	if (slot.state != SLOT_FREE)
+	{
+		auto waitStart = chrono::steady_clock::now();
+		if (slot.state == SLOT_READING)
+			retire(true);
+		{
+			unique_lock<mutex> guard(lock);
+			written.wait(guard, [&] { return slot.state == SLOT_WRITTEN; });
+		}
+		reclaim();
+
+		chrono::duration<double, milli> waited = chrono::steady_clock::now() - waitStart;
+		lastStats.waitMs = waited.count();
+	}
+
+	// BGRA is the layout most drivers keep, so the pack is a plain copy
+	size_t size = (size_t)width * height * 4;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+	if (slot.size != size)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		slot.size = size;
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.width = width;
+	slot.height = height;
+	slot.state = SLOT_READING;
+	next = (next + 1) % options.buffers;
+
+	lastStats.inFlight = 0;
+	for (int i = 0; i < options.buffers; i++)
+		lastStats.inFlight += slots[i].state != SLOT_FREE;
+
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	lastStats.captureMs = elapsed.count();
+}
+
+void FrameRecorder::retire(bool wait)
+{
+	while (slots[oldest].state == SLOT_READING)
+	{
+		Slot &slot = slots[oldest];
+
+		GLenum result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (wait && result == GL_TIMEOUT_EXPIRED)
+			result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms at a time
+		if (result == GL_TIMEOUT_EXPIRED)
+			return; // the later ones were issued after it
+		glDeleteSync(slot.fence);
+		slot.fence = 0;
+
+		// the mapping stays while the writer reads it; only the GL thread maps and unmaps
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+		slot.pixels = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.size, GL_MAP_READ_BIT);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		slot.state = SLOT_WRITING;
+		{
+			lock_guard<mutex> guard(lock);
+			jobs.push_back(&slot);
+		}
+		wake.notify_one();
+
+		oldest = (oldest + 1) % options.buffers;
+		wait = false; // only the oldest is waited for
+	}
+}
+
+void FrameRecorder::reclaim()
+{
+	for (int i = 0; i < options.buffers; i++)
+	{
+		Slot &slot = slots[i];
+		if (slot.state != SLOT_WRITTEN)
+			continue;
+
+		if (slot.pixels)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			slot.pixels = nullptr;
+		}
+		slot.state = SLOT_FREE;
+	}
+}
+
+void FrameRecorder::run()
+{
+	unique_lock<mutex> guard(lock);
+	for (;;)
+	{
+		wake.wait(guard, [&] { return stopping || !jobs.empty(); });
+		if (jobs.empty())
+			return; // stopping, and every frame is out
+
+		Slot *slot = jobs.front();
+		jobs.pop_front();
+
+		guard.unlock();
+		write(*slot);
+		guard.lock();
+
+		slot->state = SLOT_WRITTEN;
+		written.notify_all();
+	}
+}
+
+void FrameRecorder::write(Slot &slot)
+{
+	auto start = chrono::steady_clock::now();
+	int width = slot.width, height = slot.height;
+
+	// a video keeps the size of its first frame; frames of another size are left out
+	bool video = options.format != RECORD_PNG;
+	if (!slot.pixels || (video && !file.is_open()) || (video && fileWidth && (width != fileWidth || height != fileHeight)))
+	{
+		skipped++;
+		return;
+	}
+	if (video && !fileWidth)
+	{
+		fileWidth = width;
+		fileHeight = height;
+		if (options.format == RECORD_Y4M)
+			file << "YUV4MPEG2 W" << width << " H" << height << " F" << options.fps << ":1 Ip A1:1 C420jpeg\n";
+	}
+
+	const unsigned char *pixels = slot.pixels;
+	if (options.format == RECORD_Y4M)
+	{
+		// BT.601 limited range; chroma is the mean of each 2x2 block, rows flipped to top-down
+		int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+		planes.resize((size_t)width * height + 2 * (size_t)chromaWidth * chromaHeight);
+		unsigned char *luma = planes.data();
+		unsigned char *cb = luma + (size_t)width * height;
+		unsigned char *cr = cb + (size_t)chromaWidth * chromaHeight;
+
+		for (int y = 0; y < height; y++)
+		{
+			const unsigned char *row = pixels + (size_t)(height - 1 - y) * width * 4;
+			for (int x = 0; x < width; x++)
+			{
+				int b = row[4 * x], g = row[4 * x + 1], r = row[4 * x + 2];
+				luma[(size_t)y * width + x] = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+			}
+		}
+		for (int y = 0; y < chromaHeight; y++)
+		{
+			int y0 = 2 * y, y1 = min(2 * y + 1, height - 1);
+			const unsigned char *rows[2] = {pixels + (size_t)(height - 1 - y0) * width * 4, pixels + (size_t)(height - 1 - y1) * width * 4};
+			for (int x = 0; x < chromaWidth; x++)
+			{
+				int x0 = 2 * x, x1 = min(2 * x + 1, width - 1);
+				int r = 0, g = 0, b = 0;
+				for (const unsigned char *row : rows)
+				{
+					b += row[4 * x0] + row[4 * x1];
+					g += row[4 * x0 + 1] + row[4 * x1 + 1];
+					r += row[4 * x0 + 2] + row[4 * x1 + 2];
+				}
+				r = (r + 2) / 4, g = (g + 2) / 4, b = (b + 2) / 4;
+				cb[(size_t)y * chromaWidth + x] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+				cr[(size_t)y * chromaWidth + x] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+			}
+		}
+
+		file << "FRAME\n";
+		file.write((const char *)planes.data(), planes.size());
+	}
+	else
+	{
+		rgb.resize((size_t)width * height * 3);
+		for (int y = 0; y < height; y++)
+		{
+			const unsigned char *row = pixels + (size_t)(height - 1 - y) * width * 4;
+			unsigned char *out = &rgb[(size_t)y * width * 3];
+			for (int x = 0; x < width; x++)
+			{
+				out[3 * x] = row[4 * x + 2];
+				out[3 * x + 1] = row[4 * x + 1];
+				out[3 * x + 2] = row[4 * x];
+			}
+		}
+
+		if (options.format == RECORD_RAW)
+		{
+			file.write((const char *)rgb.data(), rgb.size());
+		}
+		else if (!UWritePNG(UFramePath(options.path, frames), rgb, width, height, planes))
+		{
+			if (skipped++ == 0)
+				cout << "Cannot write " << UFramePath(options.path, frames) << endl;
+			return;
+		}
+	}
+
+	frames++;
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	writeMs += elapsed.count();
+}
@@ -0,0 +1,111 @@
+/*
+ * FrameRecorder.h
+ *
+ *  Frame recording without stalls: each frame is read back into one of a ring of pixel pack
+ *  buffers behind a fence, mapped once the fence has signaled a frame or two later, and
+ *  handed to a writer thread that streams a Y4M video, raw RGB frames or a PNG sequence
+ */
+
+#ifndef FRAMERECORDER_H
+#define FRAMERECORDER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <GL/glew.h>
+
+#define RECORDER_MAX_BUFFERS 8
+
+/* File formats of a recording */
+enum RecordFormat
+{
+	RECORD_Y4M, // one YUV 4:2:0 video, BT.601 limited range
+	RECORD_RAW, // frames of top-down RGB24 back to back
+	RECORD_PNG, // one image per frame, named from a printf pattern
+};
+
+/* Command line options of the recorder */
+struct RecorderOptions
+{
+	std::string path;				  // --record FILE, or a PNG pattern such as shots/frame_%05d.png
+	RecordFormat format = RECORD_Y4M; // --record-format y4m|raw|png, from the extension of FILE otherwise
+	int buffers = 3;				  // --record-buffers N pack buffers in flight or being written, 2 to RECORDER_MAX_BUFFERS
+	int fps = 60;					  // --record-fps N frame rate stated in the Y4M header
+};
+
+/* What the recorder did during the last capture() */
+struct RecorderStats
+{
+	double captureMs = 0.0; // on the render thread, waits included
+	double waitMs = 0.0;	// blocked on a fence or on the writer for the buffer being reused
+	int inFlight = 0;		// buffers read into or being written after this frame
+};
+
+class FrameRecorder
+{
+public:
+	explicit FrameRecorder(const RecorderOptions &options); // starts the writer thread
+	~FrameRecorder();											// GL thread: writes every frame still in flight
+
+	FrameRecorder(const FrameRecorder &) = delete;
+	FrameRecorder &operator=(const FrameRecorder &) = delete;
+
+	// GL thread, after drawing: queues a readback of the current read framebuffer
+	void capture(int width, int height);
+
+	const RecorderStats &stats() const { return lastStats; }
+
+private:
+	enum SlotState
+	{
+		SLOT_FREE,
+		SLOT_READING, // readback issued, fenced
+		SLOT_WRITING, // mapped, owned by the writer
+		SLOT_WRITTEN, // the writer is done, to be unmapped
+	};
+
+	struct Slot
+	{
+		GLuint buffer = 0;
+		size_t size = 0;
+		GLsync fence = 0;
+		int width = 0, height = 0;
+		const unsigned char *pixels = nullptr; // BGRA, bottom row first, while mapped
+		std::atomic<int> state{SLOT_FREE};
+	};
+
+	void retire(bool wait); // maps the oldest readbacks whose fences signaled, all of them with 'wait'
+	void reclaim();			// unmaps what the writer is done with
+	void write(Slot &slot); // writer thread
+	void run();				// writer thread
+
+	RecorderOptions options;
+	Slot slots[RECORDER_MAX_BUFFERS];
+	int next = 0;	// slot of the next readback
+	int oldest = 0; // oldest slot still reading
+
+	std::thread writer;
+	std::mutex lock;
+	std::condition_variable wake, written;
+	std::deque<Slot *> jobs; // mapped slots in frame order
+	bool stopping = false;
+
+	// writer thread only
+	std::ofstream file;
+	int fileWidth = 0, fileHeight = 0; // of the video, set by its first frame
+	uint64_t frames = 0, skipped = 0;
+	double writeMs = 0.0;
+	std::vector<unsigned char> rgb, planes;
+
+	RecorderStats lastStats;
+};
+
+bool UParseRecorderArgs(int argc, char *argv[], RecorderOptions &options);
+
+#endif
@@ -0,0 +1,588 @@
+/*
+ * FrameTrace.cpp
+ *
+ *  Frame capture and replay: every frame's input (camera events, held keys, clock and
+ *  scene time) and the GL calls it issued are written to a compact binary trace, which a
+ *  replay re-runs through the renderer or re-issues call by call, as fast as possible or
+ *  at the captured pace
+ */
+
+/* Header Inclusions */
+#include "FrameTrace.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace std; // standard namespace
+
+// capture state: the chunk of the open frame, and the events that arrived since the last one
+static bool capturing = false;
+static bool frameOpen = false;
+static ofstream captureFile;
+static vector<unsigned char> chunk, lastCalls;
+static vector<CameraEvent> pendingEvents;
+static size_t callsStart = 0;
+
+/* Appends the bytes of a plain value */
+template <typename T>
+static void UPut(vector<unsigned char> &out, const T &value)
+{
+	const unsigned char *bytes = (const unsigned char *)&value;
+	out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+static void UPutString(vector<unsigned char> &out, const string &text)
+{
+	UPut(out, (uint32_t)text.size());
+	out.insert(out.end(), text.begin(), text.end());
+}
+
+/* Reads a plain value at 'cursor'; false past 'end', leaving a zero value and the cursor at the end */
+template <typename T>
+static bool UGet(const unsigned char *&cursor, const unsigned char *end, T &value)
+{
+	if ((size_t)(end - cursor) < sizeof(T))
+	{
+		value = T();
+		cursor = end;
+		return false;
+	}
+	memcpy(&value, cursor, sizeof(T));
+	cursor += sizeof(T);
+	return true;
+}
+
+static bool UGetString(const unsigned char *&cursor, const unsigned char *end, string &text)
+{
+	uint32_t length;
+	if (!UGet(cursor, end, length) || (size_t)(end - cursor) < length)
+		return false;
+	text.assign((const char *)cursor, length);
+	cursor += length;
+	return true;
+}
+
+/* Bytes of the values of a TRACE_UNIFORM of 'type', 0 for a type the trace does not carry */
+static size_t UUniformBytes(GLenum type)
+{
+	switch (type)
+	{
+	case GL_INT:
+	case GL_FLOAT:
+		return 4;
+	case GL_INT_VEC2:
+	case GL_FLOAT_VEC2:
+		return 8;
+	case GL_INT_VEC3:
+	case GL_FLOAT_VEC3:
+		return 12;
+	default:
+		return 0;
+	}
+}
+
+/* Parses --capture FILE, --replay FILE, --replay-calls and --replay-timing */
+bool UParseTraceArgs(int argc, char *argv[], TraceOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--capture" || arg == "--replay")
+		{
+			if (i + 1 >= argc)
+			{
+				cout << arg << " expects a trace file" << endl;
+				return false;
+			}
+			(arg == "--capture" ? options.capturePath : options.replayPath) = argv[++i];
+		}
+		else if (arg == "--replay-calls")
+		{
+			options.calls = true;
+		}
+		else if (arg == "--replay-timing")
+		{
+			options.timing = true;
+		}
+	}
+
+	if (!options.capturePath.empty() && !options.replayPath.empty())
+	{
+		cout << "--capture and --replay cannot be combined" << endl;
+		return false;
+	}
+	if ((options.calls || options.timing) && options.replayPath.empty())
+	{
+		cout << "--replay-calls and --replay-timing need --replay FILE" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool UStartCapture(const string &path, int argc, char *argv[], const string &renderer)
+{
+	// the options the run was started with, so a replay builds the same scene
+	vector<string> arguments;
+	for (int i = 1; i < argc; i++)
+	{
+		if (string(argv[i]) == "--capture")
+			i++;
+		else
+			arguments.push_back(argv[i]);
+	}
+
+	if (!path.empty())
+	{
+		captureFile.open(path, ios::binary | ios::trunc);
+		if (!captureFile)
+		{
+			cout << "Cannot write " << path << endl;
+			return false;
+		}
+
+		vector<unsigned char> header;
+		UPut(header, TraceHeader{TRACE_MAGIC, TRACE_VERSION, (uint32_t)sizeof(TraceHeader), (uint32_t)arguments.size()});
+		for (const string &argument : arguments)
+			UPutString(header, argument);
+		UPutString(header, renderer);
+		captureFile.write((const char *)header.data(), header.size());
+	}
+
+	capturing = true;
+	pendingEvents.clear();
+	return true;
+}
+
+void UStopCapture(void)
+{
+	if (captureFile.is_open())
+		captureFile.close();
+	capturing = frameOpen = false;
+}
+
+void UTraceBeginFrame(const TraceFrame &frame)
+{
+	if (!capturing)
+		return;
+
+	chunk.clear();
+	for (const CameraEvent &event : pendingEvents)
+	{
+		chunk.push_back(TRACE_EVENT);
+		UPut(chunk, event);
+	}
+	pendingEvents.clear();
+
+	chunk.push_back(TRACE_FRAME);
+	UPut(chunk, frame);
+	callsStart = chunk.size();
+	frameOpen = true;
+}
+
+size_t UTraceEndFrame(void)
+{
+	if (!frameOpen)
+		return 0;
+	UPROFILE_SCOPE("UTraceEndFrame");
+	frameOpen = false;
+
+	lastCalls.assign(chunk.begin() + callsStart, chunk.end());
+
+	// one write per frame, flushed so a window closed mid-run still leaves every whole frame
+	uint32_t bytes = (uint32_t)chunk.size();
+	if (captureFile.is_open())
+	{
+		captureFile.write((const char *)&bytes, sizeof(bytes));
+		captureFile.write((const char *)chunk.data(), chunk.size());
+		captureFile.flush();
+	}
+	return sizeof(bytes) + bytes;
+}
+
+const vector<unsigned char> &UTraceLastCalls(void)
+{
+	return lastCalls;
+}
+
+void UTraceEvent(const CameraEvent &event)
+{
+	if (capturing)
+		pendingEvents.push_back(event);
+}
+
+void UTraceEnable(GLenum cap)
+{
+	if (!frameOpen)
+		return;
+	chunk.push_back(TRACE_ENABLE);
+	UPut(chunk, cap);
+}
+
+void UTraceClear(GLbitfield mask)
+{
+	if (!frameOpen)
+		return;
+	chunk.push_back(TRACE_CLEAR);
+	UPut(chunk, mask);
+}
+
+void UTracePolygonMode(GLenum mode)
+{
+	if (!frameOpen)
+		return;
+	chunk.push_back(TRACE_POLYGON_MODE);
+	UPut(chunk, mode);
+}
+
+void UTraceUseProgram(GLuint program)
+{
+	if (!frameOpen)
+		return;
+	chunk.push_back(TRACE_USE_PROGRAM);
+	UPut(chunk, program);
+}
+
+void UTraceBindVertexArray(GLuint vao)
+{
+	if (!frameOpen)
+		return;
+	chunk.push_back(TRACE_BIND_VERTEX_ARRAY);
+	UPut(chunk, vao);
+}
+
+void UTraceBindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+	if (!frameOpen)
+		return;
+	chunk.push_back(TRACE_BIND_TEXTURE);
+	UPut(chunk, unit);
+	UPut(chunk, target);
+	UPut(chunk, texture);
+}
+
+void UTraceBindUniformRange(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	if (!frameOpen)
+		return;
+	chunk.push_back(TRACE_BIND_UNIFORM_RANGE);
+	UPut(chunk, binding);
+	UPut(chunk, buffer);
+	UPut(chunk, (int64_t)offset);
+	UPut(chunk, (int64_t)size);
+}
+
+void UTraceUniform(GLint location, GLenum type, const void *values)
+{
+	size_t bytes = UUniformBytes(type);
+	if (!frameOpen || bytes == 0)
+		return;
+	chunk.push_back(TRACE_UNIFORM);
+	UPut(chunk, location);
+	UPut(chunk, type);
+	chunk.insert(chunk.end(), (const unsigned char *)values, (const unsigned char *)values + bytes);
+}
+
+void UTraceUpload(GLenum target, GLuint buffer, GLintptr offset, GLsizeiptr size, const void *data, uint32_t flags)
+{
+	if (!frameOpen)
+		return;
+	if (!data)
+		flags |= TRACE_UPLOAD_EMPTY;
+	chunk.push_back(TRACE_UPLOAD);
+	UPut(chunk, target);
+	UPut(chunk, buffer);
+	UPut(chunk, flags);
+	UPut(chunk, (int64_t)offset);
+	UPut(chunk, (int64_t)size);
+	if (!(flags & TRACE_UPLOAD_EMPTY))
+		chunk.insert(chunk.end(), (const unsigned char *)data, (const unsigned char *)data + size);
+}
+
+void UTraceAttribPointer(GLuint buffer, GLuint location, GLint components, GLenum type, GLsizei stride, size_t offset, GLuint divisor)
+{
+	if (!frameOpen)
+		return;
+	chunk.push_back(TRACE_ATTRIB_POINTER);
+	UPut(chunk, buffer);
+	UPut(chunk, location);
+	UPut(chunk, components);
+	UPut(chunk, type);
+	UPut(chunk, stride);
+	UPut(chunk, (uint64_t)offset);
+	UPut(chunk, divisor);
+}
+
+void UTraceDraw(GLsizei count, GLenum indexType, size_t firstByte, GLsizei instances)
+{
+	if (!frameOpen)
+		return;
+	chunk.push_back(TRACE_DRAW);
+	UPut(chunk, count);
+	UPut(chunk, indexType);
+	UPut(chunk, (uint64_t)firstByte);
+	UPut(chunk, instances);
+}
+
+bool UReadTrace(const string &path, TraceFile &trace)
+{
+	ifstream file(path, ios::binary);
+	if (!file)
+	{
+		cout << "Cannot read " << path << endl;
+		return false;
+	}
+	trace.data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+
+	const unsigned char *cursor = trace.data.data(), *end = cursor + trace.data.size();
+	TraceHeader header;
+	if (!UGet(cursor, end, header) || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION || header.headerSize < sizeof(TraceHeader))
+	{
+		cout << path << " is not a version " << TRACE_VERSION << " frame trace" << endl;
+		return false;
+	}
+	cursor += header.headerSize - sizeof(TraceHeader);
+
+	trace.arguments.resize(header.argumentCount);
+	for (string &argument : trace.arguments)
+	{
+		if (!UGetString(cursor, end, argument))
+		{
+			cout << path << " is truncated in its header" << endl;
+			return false;
+		}
+	}
+	if (!UGetString(cursor, end, trace.renderer))
+	{
+		cout << path << " is truncated in its header" << endl;
+		return false;
+	}
+
+	// a capture cut short ends in a partial chunk, which is dropped
+	uint32_t bytes;
+	while (UGet(cursor, end, bytes) && (size_t)(end - cursor) >= bytes)
+	{
+		const unsigned char *chunkEnd = cursor + bytes;
+		TraceFrameData frame;
+		uint8_t record;
+		while (UGet(cursor, chunkEnd, record) && record == TRACE_EVENT)
+		{
+			CameraEvent event;
+			UGet(cursor, chunkEnd, event);
+			frame.events.push_back(event);
+		}
+		if (record != TRACE_FRAME || !UGet(cursor, chunkEnd, frame.frame))
+		{
+			cout << path << ": frame " << trace.frames.size() << " has no frame record" << endl;
+			return false;
+		}
+
+		frame.calls = cursor;
+		frame.callBytes = chunkEnd - cursor;
+		trace.frames.push_back(frame);
+		cursor = chunkEnd;
+	}
+
+	if (trace.frames.empty())
+	{
+		cout << path << " holds no whole frame" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+TraceReplayer::~TraceReplayer()
+{
+	for (const auto &buffer : uniformBuffers)
+		glDeleteBuffers(1, &buffer.second);
+}
+
+GLuint TraceReplayer::uniformBuffer(GLuint captured, size_t size)
+{
+	GLuint &name = uniformBuffers[captured];
+	size_t &capacity = uniformSizes[captured];
+	if (!name)
+		glGenBuffers(1, &name);
+
+	// the frames write everything they read, so growing may drop the contents
+	if (capacity < size)
+	{
+		capacity = max(size, 2 * capacity);
+		glBindBuffer(GL_UNIFORM_BUFFER, name);
+		glBufferData(GL_UNIFORM_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+	}
+	return name;
+}
+
+void TraceReplayer::frame(const TraceFrameData &frame)
+{
+	UPROFILE_SCOPE("TraceReplayer::frame");
+
+	const unsigned char *cursor = frame.calls, *end = frame.calls + frame.callBytes;
+	uint8_t record;
+	while (UGet(cursor, end, record))
+	{
+		switch (record)
+		{
+		case TRACE_ENABLE:
+		{
+			GLenum cap;
+			UGet(cursor, end, cap);
+			glEnable(cap);
+			break;
+		}
+		case TRACE_CLEAR:
+		{
+			GLbitfield mask;
+			UGet(cursor, end, mask);
+			glClear(mask);
+			break;
+		}
+		case TRACE_POLYGON_MODE:
+		{
+			GLenum mode;
+			UGet(cursor, end, mode);
+			glPolygonMode(GL_FRONT_AND_BACK, mode);
+			break;
+		}
+		case TRACE_USE_PROGRAM:
+		{
+			GLuint program;
+			UGet(cursor, end, program);
+			glUseProgram(program);
+			break;
+		}
+		case TRACE_BIND_VERTEX_ARRAY:
+		{
+			GLuint vao;
+			UGet(cursor, end, vao);
+			glBindVertexArray(vao);
+			break;
+		}
+		case TRACE_BIND_TEXTURE:
+		{
+			GLuint unit, texture;
+			GLenum target;
+			UGet(cursor, end, unit);
+			UGet(cursor, end, target);
+			UGet(cursor, end, texture);
+			glActiveTexture(GL_TEXTURE0 + unit);
+			glBindTexture(target, texture);
+			glActiveTexture(GL_TEXTURE0);
+			break;
+		}
+		case TRACE_BIND_UNIFORM_RANGE:
+		{
+			GLuint binding, buffer;
+			int64_t offset, size;
+			UGet(cursor, end, binding);
+			UGet(cursor, end, buffer);
+			UGet(cursor, end, offset);
+			UGet(cursor, end, size);
+			glBindBufferRange(GL_UNIFORM_BUFFER, binding, uniformBuffer(buffer, (size_t)(offset + size)), (GLintptr)offset, (GLsizeiptr)size);
+			break;
+		}
+		case TRACE_UNIFORM:
+		{
+			GLint location;
+			GLenum type;
+			UGet(cursor, end, location);
+			UGet(cursor, end, type);
+			if ((size_t)(end - cursor) < UUniformBytes(type))
+				return;
+			const GLint *ints = (const GLint *)cursor;
+			const GLfloat *floats = (const GLfloat *)cursor;
+			switch (type)
+			{
+			case GL_INT: glUniform1iv(location, 1, ints); break;
+			case GL_INT_VEC2: glUniform2iv(location, 1, ints); break;
+			case GL_INT_VEC3: glUniform3iv(location, 1, ints); break;
+			case GL_FLOAT: glUniform1fv(location, 1, floats); break;
+			case GL_FLOAT_VEC2: glUniform2fv(location, 1, floats); break;
+			case GL_FLOAT_VEC3: glUniform3fv(location, 1, floats); break;
+			}
+			cursor += UUniformBytes(type);
+			break;
+		}
+		case TRACE_UPLOAD:
+		{
+			GLenum target;
+			GLuint buffer;
+			uint32_t flags;
+			int64_t offset, size;
+			UGet(cursor, end, target);
+			UGet(cursor, end, buffer);
+			UGet(cursor, end, flags);
+			UGet(cursor, end, offset);
+			UGet(cursor, end, size);
+			const void *data = (flags & TRACE_UPLOAD_EMPTY) ? NULL : cursor;
+			if (data && end - cursor < size)
+			{
+				cout << "Truncated trace upload, the rest of the frame is skipped" << endl;
+				return;
+			}
+
+			if (target == GL_UNIFORM_BUFFER)
+			{
+				glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer(buffer, (size_t)(offset + size)));
+				if (data)
+					glBufferSubData(GL_UNIFORM_BUFFER, (GLintptr)offset, (GLsizeiptr)size, data);
+			}
+			else
+			{
+				glBindBuffer(target, buffer);
+				if (flags & TRACE_UPLOAD_ORPHAN)
+					glBufferData(target, (GLsizeiptr)(offset + size), NULL, GL_STREAM_DRAW);
+				if (data)
+					glBufferSubData(target, (GLintptr)offset, (GLsizeiptr)size, data);
+			}
+			if (data)
+				cursor += size;
+			break;
+		}
+		case TRACE_ATTRIB_POINTER:
+		{
+			GLuint buffer, location, divisor;
+			GLint components;
+			GLenum type;
+			GLsizei stride;
+			uint64_t offset;
+			UGet(cursor, end, buffer);
+			UGet(cursor, end, location);
+			UGet(cursor, end, components);
+			UGet(cursor, end, type);
+			UGet(cursor, end, stride);
+			UGet(cursor, end, offset);
+			UGet(cursor, end, divisor);
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+			glVertexAttribPointer(location, components, type, GL_FALSE, stride, (const GLvoid *)(size_t)offset);
+			glEnableVertexAttribArray(location);
+			glVertexAttribDivisor(location, divisor);
+			break;
+		}
+		case TRACE_DRAW:
+		{
+			GLsizei count, instances;
+			GLenum indexType;
+			uint64_t first;
+			UGet(cursor, end, count);
+			UGet(cursor, end, indexType);
+			UGet(cursor, end, first);
+			UGet(cursor, end, instances);
+			if (instances > 0)
+				glDrawElementsInstanced(GL_TRIANGLES, count, indexType, (const GLvoid *)(size_t)first, instances);
+			else
+				glDrawElements(GL_TRIANGLES, count, indexType, (const GLvoid *)(size_t)first);
+			break;
+		}
+		default:
+			cout << "Unknown trace record " << (int)record << ", the rest of the frame is skipped" << endl;
+			return;
+		}
+	}
+}
@@ -0,0 +1,141 @@
+/*
+ * FrameTrace.h
+ *
+ *  Frame capture and replay: every frame's input (camera events, held keys, clock and
+ *  scene time) and the GL calls it issued are written to a compact binary trace, which a
+ *  replay re-runs through the renderer or re-issues call by call, as fast as possible or
+ *  at the captured pace
+ *
+ *  File layout, little endian:
+ *    TraceHeader | argument strings | renderer string | frame chunk...
+ *  A chunk is its byte count (uint32) followed by records, each a TraceRecord byte and its
+ *  fields: the camera events that arrived before the frame, one TRACE_FRAME, then the calls
+ */
+
+#ifndef FRAMETRACE_H
+#define FRAMETRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "CameraSim.h"
+
+#define TRACE_MAGIC 0x43525446u // "FTRC"
+#define TRACE_VERSION 1u
+
+/* Command line options of capture and replay */
+struct TraceOptions
+{
+	std::string capturePath; // --capture FILE records every frame's input and GL calls
+	std::string replayPath;	 // --replay FILE re-runs a capture headless, with the options it was captured with
+	bool calls = false;		 // --replay-calls re-issues the captured GL calls instead of re-running the frames
+	bool timing = false;	 // --replay-timing starts each frame at its captured time instead of at once
+};
+
+/* Start of a trace file; argument and renderer strings follow, each a uint32 length and its characters */
+struct TraceHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t headerSize; // sizeof(TraceHeader), lets older readers skip newer fields
+	uint32_t argumentCount;
+};
+
+/* Record tags; the fields of each follow it as stored in memory */
+enum TraceRecord : uint8_t
+{
+	TRACE_EVENT = 1,		  // CameraEvent
+	TRACE_FRAME,			  // TraceFrame
+	TRACE_ENABLE,			  // cap
+	TRACE_CLEAR,			  // mask
+	TRACE_POLYGON_MODE,		  // mode, for both faces
+	TRACE_USE_PROGRAM,		  // program
+	TRACE_BIND_VERTEX_ARRAY,  // vao
+	TRACE_BIND_TEXTURE,		  // unit, target, texture
+	TRACE_BIND_UNIFORM_RANGE, // binding, buffer, offset, size
+	TRACE_UNIFORM,			  // location, type, values (GL_INT, GL_INT_VEC3 or GL_FLOAT_VEC2)
+	TRACE_UPLOAD,			  // target, buffer, flags, offset, size, then the bytes unless TRACE_UPLOAD_EMPTY
+	TRACE_ATTRIB_POINTER,	  // buffer, location, components, type, stride, offset, divisor of the bound vertex array
+	TRACE_DRAW,				  // count, index type, first index byte offset, instances (0 without instancing)
+};
+
+#define TRACE_UPLOAD_ORPHAN 1u // the buffer is reallocated to 'size' first, as glBufferData does
+#define TRACE_UPLOAD_EMPTY 2u  // no bytes follow, the storage is left undefined
+
+#define TRACE_FRAME_WARMUP 1u // an untimed warm-up frame of a headless run, replayed untimed too
+
+/* Input and window of one frame: everything that drives it besides the options */
+struct TraceFrame
+{
+	double clock = 0.0;		// UCameraClock() the camera simulation advanced to
+	float sceneTime = 0.0f; // seconds driving the animation
+	int32_t width = 0, height = 0;
+	int32_t pathFrame = -1, pathFrames = 0; // frame of the scripted headless path, -1 for an interactive frame
+	unsigned char currentKey = '0', currentProjection = 'p', userSelection = 'p';
+	unsigned char flags = 0; // TRACE_FRAME_WARMUP
+};
+
+/* One frame of an opened trace; 'calls' points into the trace's data */
+struct TraceFrameData
+{
+	TraceFrame frame;
+	std::vector<CameraEvent> events;
+	const unsigned char *calls = nullptr;
+	size_t callBytes = 0;
+};
+
+/* A whole trace read into memory */
+struct TraceFile
+{
+	std::vector<std::string> arguments; // of the captured run, --capture and its path left out
+	std::string renderer;				// GL_RENDERER of the captured run
+	std::vector<unsigned char> data;
+	std::vector<TraceFrameData> frames;
+};
+
+/* Re-issues captured calls; uniform buffers are its own, a captured ring may be immutable or gone */
+class TraceReplayer
+{
+public:
+	~TraceReplayer();
+
+	void frame(const TraceFrameData &frame);
+
+private:
+	GLuint uniformBuffer(GLuint captured, size_t size); // its stand-in, grown to at least 'size' bytes
+
+	std::map<GLuint, GLuint> uniformBuffers;
+	std::map<GLuint, size_t> uniformSizes;
+};
+
+bool UParseTraceArgs(int argc, char *argv[], TraceOptions &options);
+
+// an empty path captures into memory only, for UTraceLastCalls
+bool UStartCapture(const std::string &path, int argc, char *argv[], const std::string &renderer);
+void UStopCapture(void);
+
+void UTraceBeginFrame(const TraceFrame &frame);
+size_t UTraceEndFrame(void); // writes the frame's chunk, returns its bytes
+const std::vector<unsigned char> &UTraceLastCalls(void); // the call records of the last frame ended
+
+// recorders, no-ops outside a captured frame (events: outside a capture)
+void UTraceEvent(const CameraEvent &event);
+void UTraceEnable(GLenum cap);
+void UTraceClear(GLbitfield mask);
+void UTracePolygonMode(GLenum mode);
+void UTraceUseProgram(GLuint program);
+void UTraceBindVertexArray(GLuint vao);
+void UTraceBindTexture(GLuint unit, GLenum target, GLuint texture);
+void UTraceBindUniformRange(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size);
+void UTraceUniform(GLint location, GLenum type, const void *values);
+void UTraceUpload(GLenum target, GLuint buffer, GLintptr offset, GLsizeiptr size, const void *data, uint32_t flags);
+void UTraceAttribPointer(GLuint buffer, GLuint location, GLint components, GLenum type, GLsizei stride, size_t offset, GLuint divisor);
+void UTraceDraw(GLsizei count, GLenum indexType, size_t firstByte, GLsizei instances);
+
+bool UReadTrace(const std::string &path, TraceFile &trace);
+
+#endif
@@ -0,0 +1,539 @@
+/*
+ * Headless.cpp
+ *
+ *  Offscreen (EGL + FBO) render mode and frame-time benchmark harness
+ */
+
+/* Header Inclusions */
+#include "Headless.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#ifndef _WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+using namespace std; // standard namespace
+
+#define QUERY_LATENCY 4 // frames between issuing a timer query and reading it back
+
+/* Variable declarations for the offscreen context and framebuffer */
+#ifndef _WIN32
+static EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+static EGLContext eglContext = EGL_NO_CONTEXT;
+static EGLSurface eglSurface = EGL_NO_SURFACE;
+#endif
+static GLuint headlessFBO, headlessColorRBO, headlessDepthRBO;
+static int headlessWidth, headlessHeight;
+
+/* Named per-frame counters reported by the render stages (visible instances, cull time, ...) */
+static map<string, vector<double>> frameStats; // one value per timed frame
+static map<string, vector<double>> liveStats;  // values since the last console summary
+static int statFrame = -1, statFrameCount = 0; // frame of the timed run being recorded, -1 outside of it
+static bool warmingUp = false;					 // rendering the untimed frames before the timed run
+
+/* Parses the headless benchmark options, ignoring anything it does not know */
+bool UParseHeadlessArgs(int argc, char *argv[], HeadlessOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--headless")
+			options.enabled = true;
+		else if (arg == "--frames" && hasValue)
+			options.frames = atoi(argv[++i]);
+		else if (arg == "--warmup" && hasValue)
+			options.warmup = atoi(argv[++i]);
+		else if (arg == "--size" && hasValue)
+		{
+			if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2)
+			{
+				cout << "Invalid --size, expected WIDTHxHEIGHT" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--json" && hasValue)
+			options.jsonPath = argv[++i];
+		else if (arg == "--dump" && hasValue)
+		{
+			stringstream list(argv[++i]);
+			string item;
+			while (getline(list, item, ','))
+				options.dumpFrames.push_back(atoi(item.c_str()));
+		}
+		else if (arg == "--dump-prefix" && hasValue)
+			options.dumpPrefix = argv[++i];
+	}
+
+	if (options.frames <= 0 || options.warmup < 0 || options.width <= 0 || options.height <= 0)
+	{
+		cout << "Frame count and size must be positive" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+/* Creates a surfaceless EGL context and an FBO to render into */
+bool UCreateHeadlessContext(int width, int height)
+{
+#ifdef _WIN32
+	cout << "Headless mode requires EGL and is not available on this platform" << endl;
+	return false;
+#else
+	// prefer the Mesa surfaceless platform so no X server or GPU device is needed
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+		eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (eglDisplay == EGL_NO_DISPLAY)
+		eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor))
+	{
+		cout << "Failed to initialize EGL" << endl;
+		return false;
+	}
+
+	// surface type 0 matches every config, the default framebuffer is never used
+	const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, 0,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_NONE};
+
+	EGLConfig config;
+	EGLint configCount = 0;
+	if (!eglChooseConfig(eglDisplay, configAttribs, &config, 1, &configCount) || configCount == 0)
+	{
+		cout << "No EGL config supports desktop OpenGL" << endl;
+		return false;
+	}
+
+	eglBindAPI(EGL_OPENGL_API);
+
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE};
+
+	eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+	if (eglContext == EGL_NO_CONTEXT)
+	{
+		cout << "Failed to create an OpenGL 3.3 core EGL context" << endl;
+		return false;
+	}
+
+	// make the context current without a surface, fall back to a tiny pbuffer
+	if (!eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext))
+	{
+		const EGLint pbufferAttribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+		eglSurface = eglCreatePbufferSurface(eglDisplay, config, pbufferAttribs);
+		if (eglSurface == EGL_NO_SURFACE || !eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext))
+		{
+			cout << "Failed to make the EGL context current" << endl;
+			return false;
+		}
+	}
+
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK)
+	{
+		cout << "Failed to initialize GLEW" << endl;
+		return false;
+	}
+
+	// color and depth renderbuffers take the place of the window's back buffer
+	headlessWidth = width;
+	headlessHeight = height;
+
+	glGenFramebuffers(1, &headlessFBO);
+	glGenRenderbuffers(1, &headlessColorRBO);
+	glGenRenderbuffers(1, &headlessDepthRBO);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, headlessColorRBO);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, headlessDepthRBO);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, headlessFBO);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headlessColorRBO);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, headlessDepthRBO);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		cout << "Offscreen framebuffer is incomplete" << endl;
+		return false;
+	}
+
+	glViewport(0, 0, width, height);
+
+	cout << "Headless renderer: " << glGetString(GL_RENDERER) << " (" << glGetString(GL_VERSION) << ")" << endl;
+	return true;
+#endif
+}
+
+/* Reallocates the offscreen color and depth buffers at a new size */
+void UResizeHeadlessFramebuffer(int width, int height)
+{
+	headlessWidth = width;
+	headlessHeight = height;
+
+	glBindRenderbuffer(GL_RENDERBUFFER, headlessColorRBO);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, headlessDepthRBO);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+	glViewport(0, 0, width, height);
+}
+
+/* Releases the offscreen framebuffer and EGL context */
+void UDestroyHeadlessContext()
+{
+#ifndef _WIN32
+	if (eglContext == EGL_NO_CONTEXT)
+		return;
+
+	glDeleteFramebuffers(1, &headlessFBO);
+	glDeleteRenderbuffers(1, &headlessColorRBO);
+	glDeleteRenderbuffers(1, &headlessDepthRBO);
+
+	eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (eglSurface != EGL_NO_SURFACE)
+		eglDestroySurface(eglDisplay, eglSurface);
+	eglDestroyContext(eglDisplay, eglContext);
+	eglTerminate(eglDisplay);
+
+	eglContext = EGL_NO_CONTEXT;
+	eglSurface = EGL_NO_SURFACE;
+	eglDisplay = EGL_NO_DISPLAY;
+#endif
+}
+
+/* Nearest-rank percentile, p in [0, 100] */
+double UPercentile(vector<double> values, double p)
+{
+	if (values.empty())
+		return 0.0;
+
+	sort(values.begin(), values.end());
+	size_t rank = (size_t)ceil(p / 100.0 * values.size());
+	return values[rank > 0 ? rank - 1 : 0];
+}
+
+/* Reads the current read framebuffer as tightly packed RGB, bottom row first */
+void UReadFramebuffer(int width, int height, vector<unsigned char> &rgb)
+{
+	rgb.resize((size_t)width * height * 3);
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rgb.data());
+}
+
+/* Writes the current read framebuffer as a binary PPM, flipped to top-down rows */
+bool UWritePPM(const string &path, int width, int height)
+{
+	vector<unsigned char> pixels;
+	UReadFramebuffer(width, height, pixels);
+
+	ofstream file(path, ios::binary);
+	if (!file)
+	{
+		cout << "Cannot write " << path << endl;
+		return false;
+	}
+
+	file << "P6\n"
+		 << width << " " << height << "\n255\n";
+	for (int y = height - 1; y >= 0; y--)
+		file.write((const char *)&pixels[(size_t)y * width * 3], (streamsize)width * 3);
+
+	return true;
+}
+
+bool UHeadlessWarmup(void)
+{
+	return warmingUp;
+}
+
+/* Records a named counter for the current frame */
+void URecordFrameStat(const string &name, double value)
+{
+	if (statFrame >= 0)
+	{
+		vector<double> &series = frameStats[name];
+		series.resize(statFrameCount, 0.0);
+		series[statFrame] = value;
+	}
+	else
+	{
+		liveStats[name].push_back(value);
+	}
+}
+
+/* Prints the mean of every counter recorded since the last call, at most once per interval */
+void UPrintFrameStats(double intervalSeconds)
+{
+	static auto lastPrint = chrono::steady_clock::now();
+
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - lastPrint;
+	if (elapsed.count() < intervalSeconds || liveStats.empty())
+		return;
+
+	cout << "[Stats]";
+	for (const auto &stat : liveStats)
+	{
+		double sum = 0.0;
+		for (double value : stat.second)
+			sum += value;
+		cout << " " << stat.first << " " << sum / stat.second.size();
+	}
+	cout << endl;
+
+	liveStats.clear();
+	lastPrint = chrono::steady_clock::now();
+}
+
+string UJsonString(const string &text)
+{
+	string quoted = "\"";
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			quoted += '\\';
+			quoted += c;
+		}
+		else if ((unsigned char)c < 0x20)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+			quoted += escaped;
+		}
+		else
+		{
+			quoted += c;
+		}
+	}
+	return quoted + "\"";
+}
+
+/* The options of one run of a benchmark, with the run's name appended to the report and the frame dumps */
+HeadlessOptions UBenchmarkRun(const HeadlessOptions &options, const string &name)
+{
+	HeadlessOptions run = options;
+	run.dumpPrefix += "_" + name;
+	if (!run.jsonPath.empty())
+	{
+		size_t extension = run.jsonPath.find_last_of('.');
+		run.jsonPath.insert(extension == string::npos ? run.jsonPath.size() : extension, "_" + name);
+	}
+	return run;
+}
+
+/* Writes min/p50/p99/max/mean of one timing series as a JSON object */
+static void UWriteStats(ostream &out, const vector<double> &values)
+{
+	double sum = 0.0;
+	for (double value : values)
+		sum += value;
+
+	out << "{\"min\": " << UPercentile(values, 0.0)
+		<< ", \"p50\": " << UPercentile(values, 50.0)
+		<< ", \"p99\": " << UPercentile(values, 99.0)
+		<< ", \"max\": " << UPercentile(values, 100.0)
+		<< ", \"mean\": " << (values.empty() ? 0.0 : sum / values.size()) << "}";
+}
+
+static void UWriteSeries(ostream &out, const vector<double> &values)
+{
+	out << "[";
+	for (size_t i = 0; i < values.size(); i++)
+		out << (i ? ", " : "") << values[i];
+	out << "]";
+}
+
+/* Writes the benchmark report */
+static void UWriteReport(ostream &out, const HeadlessOptions &options, const FrameTimings &timings, const string &renderer, const string &version)
+{
+	out << "{\n";
+	out << "  \"renderer\": " << UJsonString(renderer) << ",\n";
+	out << "  \"version\": " << UJsonString(version) << ",\n";
+	out << "  \"frames\": " << options.frames << ",\n";
+	out << "  \"width\": " << options.width << ",\n";
+	out << "  \"height\": " << options.height << ",\n";
+	out << "  \"cpu_ms\": ";
+	UWriteStats(out, timings.cpuMs);
+	out << ",\n  \"gpu_ms\": ";
+	UWriteStats(out, timings.gpuMs);
+	out << ",\n  \"stats\": {";
+	for (auto stat = frameStats.begin(); stat != frameStats.end(); ++stat)
+	{
+		out << (stat == frameStats.begin() ? "\n" : ",\n") << "    " << UJsonString(stat->first) << ": ";
+		UWriteStats(out, stat->second);
+	}
+	out << "\n  },\n  \"per_frame\": {\n    \"cpu_ms\": ";
+	UWriteSeries(out, timings.cpuMs);
+	out << ",\n    \"gpu_ms\": ";
+	UWriteSeries(out, timings.gpuMs);
+	for (const auto &stat : frameStats)
+	{
+		out << ",\n    " << UJsonString(stat.first) << ": ";
+		UWriteSeries(out, stat.second);
+	}
+	out << "\n  }\n}\n";
+}
+
+/* Writes the report to --json, or to the console without one */
+static int UWriteReportFile(const HeadlessOptions &options, const FrameTimings &timings, const string &renderer, const string &version)
+{
+	if (options.jsonPath.empty())
+	{
+		UWriteReport(cout, options, timings, renderer, version);
+		return 0;
+	}
+
+	ofstream file(options.jsonPath);
+	if (!file)
+	{
+		cout << "Cannot write " << options.jsonPath << endl;
+		return -1;
+	}
+	UWriteReport(file, options, timings, renderer, version);
+	return 0;
+}
+
+/* Renders the scripted frames and reports CPU and GPU frame times, copied to 'results' when given */
+int URunHeadless(const HeadlessOptions &options, UHeadlessFrameFunc renderFrame, FrameTimings *results, UHeadlessFrameFunc waitFrame)
+{
+	FrameTimings timings;
+	timings.cpuMs.reserve(options.frames);
+	timings.gpuMs.assign(options.frames, 0.0);
+
+	// untimed frames let the driver finish lazy shader compiles and allocations
+	warmingUp = true;
+	for (int frame = 0; frame < options.warmup; frame++)
+	{
+		renderFrame(0, options.frames);
+		UPROFILE_FRAME();
+	}
+	warmingUp = false;
+	glFinish();
+	statFrameCount = options.frames;
+
+	// timer queries are read back QUERY_LATENCY frames later so they never stall the CPU
+	GLuint queries[QUERY_LATENCY];
+	glGenQueries(QUERY_LATENCY, queries);
+
+	// llvmpipe returns garbage for the first timer query that covers any work, so a clear's is spent before the timed frames
+	GLuint64 discarded = 0;
+	glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+	glClear(GL_COLOR_BUFFER_BIT); // every frame clears again
+	glEndQuery(GL_TIME_ELAPSED);
+	glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &discarded);
+
+	for (int frame = 0; frame < options.frames; frame++)
+	{
+		int slot = frame % QUERY_LATENCY;
+		if (frame >= QUERY_LATENCY)
+		{
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &elapsed);
+			timings.gpuMs[frame - QUERY_LATENCY] = elapsed / 1.0e6;
+		}
+
+		if (waitFrame)
+			waitFrame(frame, options.frames);
+
+		auto start = chrono::steady_clock::now();
+
+		statFrame = frame;
+		glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+		renderFrame(frame, options.frames);
+		glEndQuery(GL_TIME_ELAPSED);
+		glFlush(); // stands in for the buffer swap of the windowed path
+
+		chrono::duration<double, milli> cpu = chrono::steady_clock::now() - start;
+		timings.cpuMs.push_back(cpu.count());
+		UPROFILE_FRAME(); // outside the timed region
+
+		if (find(options.dumpFrames.begin(), options.dumpFrames.end(), frame) != options.dumpFrames.end())
+			UWritePPM(options.dumpPrefix + "_" + to_string(frame) + ".ppm", headlessWidth, headlessHeight);
+	}
+
+	// collect the queries still in flight
+	for (int frame = max(0, options.frames - QUERY_LATENCY); frame < options.frames; frame++)
+	{
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(queries[frame % QUERY_LATENCY], GL_QUERY_RESULT, &elapsed);
+		timings.gpuMs[frame] = elapsed / 1.0e6;
+	}
+
+	glDeleteQueries(QUERY_LATENCY, queries);
+	statFrame = -1;
+
+	cout << "[Benchmark] " << options.frames << " frames at " << options.width << "x" << options.height << endl;
+	cout << "CPU ms  p50 " << UPercentile(timings.cpuMs, 50.0) << "  p99 " << UPercentile(timings.cpuMs, 99.0) << endl;
+	cout << "GPU ms  p50 " << UPercentile(timings.gpuMs, 50.0) << "  p99 " << UPercentile(timings.gpuMs, 99.0) << endl;
+
+	if (results)
+		*results = timings;
+
+	return UWriteReportFile(options, timings, (const char *)glGetString(GL_RENDERER), (const char *)glGetString(GL_VERSION));
+}
+
+/* Same scripted run for a renderer that draws on the CPU: no context, no GPU times, frames dumped through 'dumpFrame' */
+int URunHeadlessCpu(const HeadlessOptions &options, UHeadlessFrameFunc renderFrame, UHeadlessDumpFunc dumpFrame, const string &renderer, FrameTimings *results)
+{
+	FrameTimings timings;
+	timings.cpuMs.reserve(options.frames);
+
+	warmingUp = true;
+	for (int frame = 0; frame < options.warmup; frame++)
+	{
+		renderFrame(0, options.frames);
+		UPROFILE_FRAME();
+	}
+	warmingUp = false;
+	statFrameCount = options.frames;
+
+	for (int frame = 0; frame < options.frames; frame++)
+	{
+		auto start = chrono::steady_clock::now();
+
+		statFrame = frame;
+		renderFrame(frame, options.frames); // returns with the frame complete, nothing is left in flight
+
+		chrono::duration<double, milli> cpu = chrono::steady_clock::now() - start;
+		timings.cpuMs.push_back(cpu.count());
+		UPROFILE_FRAME();
+
+		if (find(options.dumpFrames.begin(), options.dumpFrames.end(), frame) != options.dumpFrames.end())
+			dumpFrame(options.dumpPrefix + "_" + to_string(frame) + ".ppm");
+	}
+	statFrame = -1;
+
+	cout << "[Benchmark] " << options.frames << " frames at " << options.width << "x" << options.height << " on the CPU (" << renderer << ")" << endl;
+	cout << "CPU ms  p50 " << UPercentile(timings.cpuMs, 50.0) << "  p99 " << UPercentile(timings.cpuMs, 99.0) << endl;
+
+	if (results)
+		*results = timings;
+
+	return UWriteReportFile(options, timings, renderer, "none");
+}
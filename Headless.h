@@ -0,0 +1,55 @@
+/*
+ * Headless.h
+ *
+ *  Offscreen (EGL + FBO) render mode and frame-time benchmark harness
+ */
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+/* Command line options for the headless benchmark */
+struct HeadlessOptions
+{
+	bool enabled = false;			 // --headless
+	int frames = 300;				 // --frames N
+	int warmup = 10;				 // --warmup N untimed frames before the run
+	int width = 1064, height = 800;	 // --size WxH
+	std::string jsonPath;			 // --json file (stdout when empty)
+	std::vector<int> dumpFrames;	 // --dump 0,150,299
+	std::string dumpPrefix = "frame"; // --dump-prefix name
+};
+
+/* Per-frame timings collected by the harness (milliseconds) */
+struct FrameTimings
+{
+	std::vector<double> cpuMs; // time spent issuing the frame on the CPU
+	std::vector<double> gpuMs; // GL_TIME_ELAPSED of the frame on the GPU
+};
+
+/* Callback that renders frame number 'frame' out of 'frameCount' */
+typedef void (*UHeadlessFrameFunc)(int frame, int frameCount);
+
+/* Callback that writes the last frame of a renderer without a GL context to a PPM file */
+typedef bool (*UHeadlessDumpFunc)(const std::string &path);
+
+bool UParseHeadlessArgs(int argc, char *argv[], HeadlessOptions &options);
+bool UCreateHeadlessContext(int width, int height);
+void UDestroyHeadlessContext();
+void UResizeHeadlessFramebuffer(int width, int height);
+// 'waitFrame', when given, runs before each timed frame outside its timing, e.g. to pace a replay
+int URunHeadless(const HeadlessOptions &options, UHeadlessFrameFunc renderFrame, FrameTimings *results = nullptr, UHeadlessFrameFunc waitFrame = nullptr);
+int URunHeadlessCpu(const HeadlessOptions &options, UHeadlessFrameFunc renderFrame, UHeadlessDumpFunc dumpFrame, const std::string &renderer, FrameTimings *results = nullptr);
+void UReadFramebuffer(int width, int height, std::vector<unsigned char> &rgb);
+bool UWritePPM(const std::string &path, int width, int height);
+void URecordFrameStat(const std::string &name, double value);
+bool UHeadlessWarmup(void); // whether the frame being rendered is one of the untimed warm-up frames
+void UPrintFrameStats(double intervalSeconds);
+std::string UJsonString(const std::string &text); // quoted and escaped for a JSON report
+HeadlessOptions UBenchmarkRun(const HeadlessOptions &options, const std::string &name); // with "_name" appended to the report and dump names
+double UPercentile(std::vector<double> values, double p);
+
+#endif
@@ -0,0 +1,564 @@
+/*
+ * Lightmap.cpp
+ *
+ *  Offline lightmap baking for the static chair: the mesh is unwrapped into planar charts
+ *  packed in one atlas, then every texel traces shadowed diffuse light and ambient occlusion
+ *  against a BVH of the chair's triangles on the task pool
+ */
+
+/* Header Inclusions */
+#include "Lightmap.h"
+#include "Culling.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+
+using namespace std; // standard namespace
+
+#define LIGHTMAP_CHART_COS 0.9f // a triangle joins a chart while its normal is within about 25 degrees of the chart's
+#define LIGHTMAP_PADDING 2		// texels between a chart and the edge of its rectangle, room for filtering and dilation
+#define LIGHTMAP_BIAS 1e-3f		// world units rays start off the surface, so a texel does not shadow itself
+
+/* Parses --bake-lightmap file, --lightmap file, --lightmap-size N, --ao-rays N and --ao-distance D */
+bool UParseLightmapArgs(int argc, char *argv[], LightmapOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--bake-lightmap" || arg == "--lightmap")
+		{
+			string &path = arg == "--lightmap" ? options.path : options.bakePath;
+			path = i + 1 < argc ? argv[++i] : "";
+			if (path.empty())
+			{
+				cout << arg << " expects a .ktx2 or .dds file" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--lightmap-size")
+		{
+			options.size = i + 1 < argc ? atoi(argv[++i]) : 0;
+			if (options.size < 16 || options.size > 8192)
+			{
+				cout << "--lightmap-size expects an atlas edge between 16 and 8192 texels" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--ao-rays")
+		{
+			options.aoRays = i + 1 < argc ? atoi(argv[++i]) : -1;
+			if (options.aoRays < 0)
+			{
+				cout << "--ao-rays expects a ray count, 0 turns ambient occlusion off" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--ao-distance")
+		{
+			options.aoDistance = i + 1 < argc ? (float)atof(argv[++i]) : 0.0f;
+			if (options.aoDistance <= 0.0f)
+			{
+				cout << "--ao-distance expects a positive distance in world units" << endl;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static const MeshAttribute *UFindLocation(const MeshData &mesh, uint32_t location)
+{
+	for (const MeshAttribute &attribute : mesh.attributes)
+		if (attribute.location == location)
+			return &attribute;
+	return NULL;
+}
+
+static glm::vec3 UReadVec3(const MeshData &mesh, const MeshAttribute &attribute, uint32_t vertex)
+{
+	glm::vec3 value;
+	memcpy(&value[0], &mesh.vertices[(size_t)vertex * mesh.vertexStride + attribute.offset], 3 * sizeof(float));
+	return value;
+}
+
+/* A chart's projection plane and its place in the atlas */
+struct LightmapChart
+{
+	vector<uint32_t> triangles;
+	glm::vec3 u, v;			  // in-plane axes
+	glm::vec2 min, extent;	  // projected bounds, object units
+	int x = 0, y = 0;		  // rectangle corner in the atlas, texels
+	int width = 0, height = 0; // rectangle size including the padding
+};
+
+/* Shelf packing, tallest charts first; false when the charts do not fit at this scale */
+static bool UPackCharts(vector<LightmapChart> &charts, const vector<uint32_t> &order, float scale, int size)
+{
+	int x = 0, y = 0, shelfHeight = 0;
+	for (uint32_t index : order)
+	{
+		LightmapChart &chart = charts[index];
+		chart.width = (int)ceil(chart.extent.x * scale) + 2 * LIGHTMAP_PADDING;
+		chart.height = (int)ceil(chart.extent.y * scale) + 2 * LIGHTMAP_PADDING;
+
+		if (x + chart.width > size)
+		{
+			x = 0;
+			y += shelfHeight;
+			shelfHeight = 0;
+		}
+		if (x + chart.width > size || y + chart.height > size)
+			return false;
+
+		chart.x = x;
+		chart.y = y;
+		x += chart.width;
+		shelfHeight = max(shelfHeight, chart.height);
+	}
+
+	return true;
+}
+
+bool UUnwrapLightmap(const MeshData &mesh, int size, MeshData &unwrapped, LightmapStats &stats)
+{
+	const MeshAttribute *position = UFindLocation(mesh, 0);
+	if (!position || position->type != GL_FLOAT || position->components < 3 || mesh.indices.size() < 3)
+	{
+		cout << "The lightmap needs a mesh with float positions and triangles" << endl;
+		return false;
+	}
+
+	size_t triangleCount = mesh.indices.size() / 3;
+
+	// corners at the same position are one corner, whatever normal or texture coordinate they carry
+	map<tuple<float, float, float>, uint32_t> welded;
+	vector<uint32_t> cornerId(mesh.indices.size());
+	for (size_t i = 0; i < triangleCount * 3; i++)
+	{
+		glm::vec3 p = UReadVec3(mesh, *position, mesh.indices[i]);
+		cornerId[i] = welded.emplace(make_tuple(p.x, p.y, p.z), (uint32_t)welded.size()).first->second;
+	}
+
+	vector<glm::vec3> faceNormals(triangleCount);
+	unordered_map<uint64_t, vector<uint32_t>> edgeTriangles;
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		glm::vec3 a = UReadVec3(mesh, *position, mesh.indices[t * 3]);
+		glm::vec3 b = UReadVec3(mesh, *position, mesh.indices[t * 3 + 1]);
+		glm::vec3 c = UReadVec3(mesh, *position, mesh.indices[t * 3 + 2]);
+		glm::vec3 n = glm::cross(b - a, c - a);
+		float length = glm::length(n);
+		faceNormals[t] = length > 0.0f ? n / length : glm::vec3(0.0f, 1.0f, 0.0f);
+
+		for (int edge = 0; edge < 3; edge++)
+		{
+			uint64_t first = cornerId[t * 3 + edge], second = cornerId[t * 3 + (edge + 1) % 3];
+			edgeTriangles[min(first, second) << 32 | max(first, second)].push_back(t);
+		}
+	}
+
+	// grow charts across shared edges while the surface stays roughly flat
+	vector<int> chartOf(triangleCount, -1);
+	vector<LightmapChart> charts;
+	for (uint32_t seed = 0; seed < triangleCount; seed++)
+	{
+		if (chartOf[seed] >= 0)
+			continue;
+
+		LightmapChart chart;
+		glm::vec3 normal = faceNormals[seed];
+		chartOf[seed] = (int)charts.size();
+		chart.triangles.push_back(seed);
+
+		for (size_t next = 0; next < chart.triangles.size(); next++)
+		{
+			uint32_t t = chart.triangles[next];
+			for (int edge = 0; edge < 3; edge++)
+			{
+				uint64_t first = cornerId[t * 3 + edge], second = cornerId[t * 3 + (edge + 1) % 3];
+				for (uint32_t neighbour : edgeTriangles[min(first, second) << 32 | max(first, second)])
+				{
+					if (chartOf[neighbour] >= 0 || glm::dot(faceNormals[neighbour], normal) < LIGHTMAP_CHART_COS)
+						continue;
+					chartOf[neighbour] = (int)charts.size();
+					chart.triangles.push_back(neighbour);
+				}
+			}
+		}
+
+		// project onto the plane of the seed triangle
+		chart.u = glm::normalize(glm::cross(fabs(normal.y) < 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f), normal));
+		chart.v = glm::cross(normal, chart.u);
+
+		glm::vec2 low(1e30f), high(-1e30f);
+		for (uint32_t t : chart.triangles)
+		{
+			for (int corner = 0; corner < 3; corner++)
+			{
+				glm::vec3 p = UReadVec3(mesh, *position, mesh.indices[t * 3 + corner]);
+				glm::vec2 planar(glm::dot(p, chart.u), glm::dot(p, chart.v));
+				low = glm::vec2(min(low.x, planar.x), min(low.y, planar.y));
+				high = glm::vec2(max(high.x, planar.x), max(high.y, planar.y));
+			}
+		}
+		chart.min = low;
+		chart.extent = high - low;
+		charts.push_back(chart);
+	}
+
+	// the densest texel scale at which every chart still fits
+	vector<uint32_t> order(charts.size());
+	float area = 0.0f;
+	for (uint32_t i = 0; i < charts.size(); i++)
+	{
+		order[i] = i;
+		area += charts[i].extent.x * charts[i].extent.y;
+	}
+	stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+				{ return charts[a].extent.y > charts[b].extent.y; });
+
+	float scale = area > 0.0f ? sqrt(0.7f * size * size / area) : (float)size;
+	bool packed = false;
+	for (int attempt = 0; attempt < 100 && !packed; attempt++)
+	{
+		packed = UPackCharts(charts, order, scale, size);
+		if (!packed)
+			scale *= 0.95f;
+	}
+	if (!packed)
+	{
+		cout << "Cannot fit " << charts.size() << " charts in a " << size << "x" << size << " lightmap" << endl;
+		return false;
+	}
+
+	// one output vertex per source vertex and chart, with the lightmap coordinate appended
+	unwrapped.vertexStride = mesh.vertexStride + 2 * sizeof(float);
+	unwrapped.attributes = mesh.attributes;
+	unwrapped.attributes.push_back({LIGHTMAP_LOCATION, 2, GL_FLOAT, GL_FALSE, mesh.vertexStride, 0});
+	unwrapped.vertices.clear();
+	unwrapped.indices.resize(triangleCount * 3);
+	unwrapped.submeshes = mesh.submeshes;
+	memcpy(unwrapped.boundsMin, mesh.boundsMin, sizeof(unwrapped.boundsMin));
+	memcpy(unwrapped.boundsMax, mesh.boundsMax, sizeof(unwrapped.boundsMax));
+
+	unordered_map<uint64_t, uint32_t> remap;
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		const LightmapChart &chart = charts[chartOf[t]];
+		for (int corner = 0; corner < 3; corner++)
+		{
+			uint32_t source = mesh.indices[t * 3 + corner];
+			uint64_t key = (uint64_t)chartOf[t] << 32 | source;
+
+			auto found = remap.find(key);
+			if (found == remap.end())
+			{
+				found = remap.emplace(key, (uint32_t)remap.size()).first;
+
+				glm::vec3 p = UReadVec3(mesh, *position, source);
+				float coordinate[2] = {(chart.x + LIGHTMAP_PADDING + (glm::dot(p, chart.u) - chart.min.x) * scale) / size,
+									   (chart.y + LIGHTMAP_PADDING + (glm::dot(p, chart.v) - chart.min.y) * scale) / size};
+
+				const unsigned char *vertex = &mesh.vertices[(size_t)source * mesh.vertexStride];
+				unwrapped.vertices.insert(unwrapped.vertices.end(), vertex, vertex + mesh.vertexStride);
+				unwrapped.vertices.insert(unwrapped.vertices.end(), (const unsigned char *)coordinate, (const unsigned char *)(coordinate + 2));
+			}
+			unwrapped.indices[t * 3 + corner] = found->second;
+		}
+	}
+
+	stats.charts = (int)charts.size();
+	return true;
+}
+
+/* Integer hash turned into [0, 1), so a bake is the same on every run and at every thread count */
+static float ULightmapRandom(uint32_t texel, uint32_t ray, uint32_t channel)
+{
+	uint32_t hash = (texel * 2654435761u) ^ (ray * 2246822519u) ^ (channel * 3266489917u);
+	hash ^= hash >> 15;
+	hash *= 2654435761u;
+	hash ^= hash >> 13;
+	return (hash & 0xFFFFFF) / 16777216.0f;
+}
+
+/* Whether anything in the BVH lies along the ray closer than 'distance' */
+static bool UOccluded(const Bvh &bvh, const vector<glm::vec3> &corners, const glm::vec3 &origin, const glm::vec3 &direction, float distance)
+{
+	if (bvh.nodes.empty())
+		return false;
+
+	glm::vec3 inverse;
+	for (int axis = 0; axis < 3; axis++)
+		inverse[axis] = 1.0f / (fabs(direction[axis]) > 1e-12f ? direction[axis] : copysign(1e-12f, direction[axis]));
+
+	uint32_t stack[64];
+	int depth = 0;
+	stack[depth++] = 0;
+
+	while (depth > 0)
+	{
+		const BvhNode &node = bvh.nodes[stack[--depth]];
+
+		// slab test against the node box
+		float nearT = 0.0f, farT = distance;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float t0 = (node.min[axis] - origin[axis]) * inverse[axis];
+			float t1 = (node.max[axis] - origin[axis]) * inverse[axis];
+			nearT = max(nearT, min(t0, t1));
+			farT = min(farT, max(t0, t1));
+		}
+		if (nearT > farT)
+			continue;
+
+		if (node.count == 0)
+		{
+			if (depth + 2 <= 64)
+			{
+				stack[depth++] = node.leftFirst;
+				stack[depth++] = node.leftFirst + 1;
+			}
+			continue;
+		}
+
+		// Moller-Trumbore against the leaf's triangles
+		for (uint32_t i = 0; i < node.count; i++)
+		{
+			uint32_t triangle = bvh.items[node.leftFirst + i];
+			const glm::vec3 &a = corners[triangle * 3];
+			glm::vec3 e1 = corners[triangle * 3 + 1] - a, e2 = corners[triangle * 3 + 2] - a;
+
+			glm::vec3 p = glm::cross(direction, e2);
+			float determinant = glm::dot(e1, p);
+			if (fabs(determinant) < 1e-12f)
+				continue;
+
+			float inverseDeterminant = 1.0f / determinant;
+			glm::vec3 s = origin - a;
+			float u = glm::dot(s, p) * inverseDeterminant;
+			if (u < 0.0f || u > 1.0f)
+				continue;
+
+			glm::vec3 q = glm::cross(s, e1);
+			float v = glm::dot(direction, q) * inverseDeterminant;
+			if (v < 0.0f || u + v > 1.0f)
+				continue;
+
+			float t = glm::dot(e2, q) * inverseDeterminant;
+			if (t > 1e-4f && t < distance)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Light reaching one texel, in the terms of the object shader's LightCalc without the specular:
+ * ambient 0.1 plus diffuse max(N.L, 0.1) per light. Occlusion darkens the constant 0.2 and a
+ * shadow removes the rest, so an unoccluded texel bakes exactly what LightCalc computes.
+ */
+static glm::vec3 UBakeTexel(const Bvh &bvh, const vector<glm::vec3> &corners, const vector<LightmapLight> &lights, const LightmapOptions &options,
+							uint32_t texel, const glm::vec3 &position, const glm::vec3 &normal, const glm::vec3 &face, long long &rays)
+{
+	glm::vec3 origin = position + face * LIGHTMAP_BIAS;
+
+	// cosine-weighted hemisphere rays, stratified along the polar angle
+	glm::vec3 tangent = glm::normalize(glm::cross(fabs(normal.y) < 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f), normal));
+	glm::vec3 bitangent = glm::cross(normal, tangent);
+
+	int open = 0;
+	for (int ray = 0; ray < options.aoRays; ray++)
+	{
+		float u1 = (ray + ULightmapRandom(texel, ray, 0)) / options.aoRays;
+		float phi = glm::radians(360.0f) * ULightmapRandom(texel, ray, 1);
+		float r = sqrt(u1);
+		glm::vec3 direction = tangent * (r * cos(phi)) + bitangent * (r * sin(phi)) + normal * sqrt(max(0.0f, 1.0f - u1));
+
+		if (!UOccluded(bvh, corners, origin, direction, options.aoDistance))
+			open++;
+	}
+	rays += options.aoRays;
+	float ao = options.aoRays > 0 ? (float)open / options.aoRays : 1.0f;
+
+	glm::vec3 light(0.0f);
+	for (const LightmapLight &lamp : lights)
+	{
+		glm::vec3 toLight = lamp.position - origin;
+		float distance = glm::length(toLight);
+		glm::vec3 direction = toLight / distance;
+
+		float impact = max(glm::dot(normal, direction), 0.1f) - 0.1f;
+		if (impact > 0.0f)
+		{
+			rays++;
+			if (UOccluded(bvh, corners, origin, direction, distance))
+				impact = 0.0f;
+		}
+
+		light += lamp.color * (0.2f * ao + impact);
+	}
+
+	return light;
+}
+
+/* Signed double area of a, b, p in atlas texels */
+static float UEdge(const glm::vec2 &a, const glm::vec2 &b, const glm::vec2 &p)
+{
+	return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+void UBakeLightmap(const MeshData &unwrapped, const glm::mat4 &model, const vector<LightmapLight> &lights, const LightmapOptions &options,
+				   TaskPool &pool, TextureImage &image, LightmapStats &stats)
+{
+	auto start = chrono::steady_clock::now();
+
+	const MeshAttribute *position = UFindLocation(unwrapped, 0);
+	const MeshAttribute *normal = UFindLocation(unwrapped, 1);
+	const MeshAttribute *coordinate = UFindLocation(unwrapped, LIGHTMAP_LOCATION);
+	int size = options.size;
+
+	// world-space triangles, their BVH and their corners in atlas texels
+	glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+	size_t triangleCount = unwrapped.indices.size() / 3;
+	vector<glm::vec3> corners(triangleCount * 3), normals(triangleCount * 3);
+	vector<glm::vec2> texels(triangleCount * 3);
+	vector<Bounds> triangleBounds(triangleCount);
+
+	for (size_t i = 0; i < triangleCount * 3; i++)
+	{
+		uint32_t vertex = unwrapped.indices[i];
+		corners[i] = glm::vec3(model * glm::vec4(UReadVec3(unwrapped, *position, vertex), 1.0f));
+		normals[i] = normal ? normalMatrix * UReadVec3(unwrapped, *normal, vertex) : glm::vec3(0.0f);
+
+		float atlas[2];
+		memcpy(atlas, &unwrapped.vertices[(size_t)vertex * unwrapped.vertexStride + coordinate->offset], sizeof(atlas));
+		texels[i] = glm::vec2(atlas[0], atlas[1]) * (float)size;
+
+		Bounds &bounds = triangleBounds[i / 3];
+		bounds.min = glm::vec3(min(bounds.min.x, corners[i].x), min(bounds.min.y, corners[i].y), min(bounds.min.z, corners[i].z));
+		bounds.max = glm::vec3(max(bounds.max.x, corners[i].x), max(bounds.max.y, corners[i].y), max(bounds.max.z, corners[i].z));
+	}
+
+	Bvh bvh;
+	UBuildBvh(bvh, triangleBounds);
+
+	// triangles by atlas row, so each row is traced by exactly one worker
+	vector<vector<uint32_t>> rowTriangles(size);
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		float low = min(texels[t * 3].y, min(texels[t * 3 + 1].y, texels[t * 3 + 2].y));
+		float high = max(texels[t * 3].y, max(texels[t * 3 + 1].y, texels[t * 3 + 2].y));
+		for (int y = max(0, (int)floor(low)); y <= min(size - 1, (int)ceil(high)); y++)
+			rowTriangles[y].push_back(t);
+	}
+
+	vector<glm::vec3> light((size_t)size * size, glm::vec3(0.0f));
+	vector<unsigned char> covered((size_t)size * size, 0);
+	atomic<long long> rayTotal{0};
+	atomic<int> texelTotal{0};
+
+	pool.parallelFor(size, 4, [&](size_t begin, size_t end, unsigned)
+					 {
+		long long rays = 0;
+		int traced = 0;
+
+		for (size_t y = begin; y < end; y++)
+		{
+			for (uint32_t t : rowTriangles[y])
+			{
+				const glm::vec2 &a = texels[t * 3], &b = texels[t * 3 + 1], &c = texels[t * 3 + 2];
+				float area = UEdge(a, b, c);
+				if (fabs(area) < 1e-8f)
+					continue;
+
+				glm::vec3 face = glm::normalize(glm::cross(corners[t * 3 + 1] - corners[t * 3], corners[t * 3 + 2] - corners[t * 3]));
+				int first = max(0, (int)floor(min(a.x, min(b.x, c.x)))), last = min(size - 1, (int)ceil(max(a.x, max(b.x, c.x))));
+
+				for (int x = first; x <= last; x++)
+				{
+					// texel centers inside the triangle, edges included
+					glm::vec2 center(x + 0.5f, y + 0.5f);
+					float w0 = UEdge(b, c, center) / area, w1 = UEdge(c, a, center) / area, w2 = 1.0f - w0 - w1;
+					if (w0 < -1e-4f || w1 < -1e-4f || w2 < -1e-4f)
+						continue;
+
+					glm::vec3 p = w0 * corners[t * 3] + w1 * corners[t * 3 + 1] + w2 * corners[t * 3 + 2];
+					glm::vec3 n = w0 * normals[t * 3] + w1 * normals[t * 3 + 1] + w2 * normals[t * 3 + 2];
+					n = glm::length(n) > 0.0f ? glm::normalize(n) : face;
+
+					size_t texel = y * size + x;
+					light[texel] = UBakeTexel(bvh, corners, lights, options, (uint32_t)texel, p, n, glm::dot(face, n) < 0.0f ? -face : face, rays);
+					covered[texel] = 1;
+					traced++;
+				}
+			}
+		}
+
+		rayTotal += rays;
+		texelTotal += traced; });
+
+	// grow every chart into its padding, so filtering at a chart edge never reads an unlit texel
+	for (int pass = 0; pass < LIGHTMAP_PADDING * 2; pass++)
+	{
+		vector<glm::vec3> grown = light;
+		vector<unsigned char> grownCovered = covered;
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size; x++)
+			{
+				if (covered[y * size + x])
+					continue;
+
+				glm::vec3 sum(0.0f);
+				int count = 0;
+				for (int dy = -1; dy <= 1; dy++)
+				{
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						int nx = x + dx, ny = y + dy;
+						if (nx < 0 || ny < 0 || nx >= size || ny >= size || !covered[ny * size + nx])
+							continue;
+						sum += light[ny * size + nx];
+						count++;
+					}
+				}
+
+				if (count > 0)
+				{
+					grown[y * size + x] = sum / (float)count;
+					grownCovered[y * size + x] = 1;
+				}
+			}
+		}
+		light.swap(grown);
+		covered.swap(grownCovered);
+	}
+
+	image.format = TEXTURE_RGBA8;
+	image.width = image.height = size;
+	image.levels.assign(1, vector<unsigned char>((size_t)size * size * 4));
+	unsigned char *out = image.levels[0].data();
+	for (size_t texel = 0; texel < light.size(); texel++)
+	{
+		for (int channel = 0; channel < 3; channel++)
+			out[texel * 4 + channel] = (unsigned char)(min(max(light[texel][channel] / LIGHTMAP_RANGE, 0.0f), 1.0f) * 255.0f + 0.5f);
+		out[texel * 4 + 3] = 255;
+	}
+
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	stats.texels = texelTotal;
+	stats.rays = rayTotal;
+	stats.coverage = (float)stats.texels / ((float)size * size);
+	stats.bakeMs = elapsed.count();
+}
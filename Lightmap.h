@@ -0,0 +1,61 @@
+/*
+ * Lightmap.h
+ *
+ *  Offline lightmap baking for the static chair: the mesh is unwrapped into planar charts
+ *  packed in one atlas, then every texel traces shadowed diffuse light and ambient occlusion
+ *  against a BVH of the chair's triangles on the task pool
+ */
+
+#ifndef LIGHTMAP_H
+#define LIGHTMAP_H
+
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include <GL/glm/glm.hpp>
+
+#include "MeshFile.h"
+#include "TaskPool.h"
+#include "TextureFile.h"
+
+#define LIGHTMAP_LOCATION 8		// vertex attribute of the lightmap coordinate, after the instance attributes
+#define LIGHTMAP_RANGE 2.0f		// stored texel 255 is this much light, two lights can add up past 1
+#define LIGHTMAP_TEXTURE_UNIT 4 // above the clustered lighting's texture buffers
+
+/* Command line options of the baker and of the baked lighting */
+struct LightmapOptions
+{
+	std::string bakePath;	 // --bake-lightmap file.ktx2|file.dds bakes the chair's lightmap and exits
+	std::string path;		 // --lightmap file.ktx2|file.dds draws with a baked lightmap
+	int size = 512;			 // --lightmap-size N atlas edge in texels, the same for baking and drawing
+	int aoRays = 64;		 // --ao-rays N occlusion rays per texel
+	float aoDistance = 0.5f; // --ao-distance D world units an occluder still darkens
+};
+
+/* A light the baker shades with, in world space */
+struct LightmapLight
+{
+	glm::vec3 position;
+	glm::vec3 color;
+};
+
+/* What the unwrap and the bake produced */
+struct LightmapStats
+{
+	int charts = 0;
+	float coverage = 0.0f; // share of the atlas covered by triangles
+	int texels = 0;		   // texels traced
+	long long rays = 0;	   // shadow and occlusion rays
+	double bakeMs = 0.0;
+};
+
+bool UParseLightmapArgs(int argc, char *argv[], LightmapOptions &options);
+
+// splits 'mesh' (float layout) into planar charts and appends a lightmap coordinate to every vertex; the same mesh and size give the same atlas
+bool UUnwrapLightmap(const MeshData &mesh, int size, MeshData &unwrapped, LightmapStats &stats);
+
+// traces the unwrapped mesh placed by 'model' and writes an RGBA8 lightmap of light / LIGHTMAP_RANGE
+void UBakeLightmap(const MeshData &unwrapped, const glm::mat4 &model, const std::vector<LightmapLight> &lights, const LightmapOptions &options,
+				   TaskPool &pool, TextureImage &image, LightmapStats &stats);
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * Materials.cpp
+ *
+ *  Chair finishes as layers of one GL_TEXTURE_2D_ARRAY: every layer is generated from the
+ *  wood texture, each chair carries the index of its layer, and chairs of different finishes
+ *  share one program, one texture bind and one instanced draw
+ */
+
+/* Header Inclusions */
+#include "Materials.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std; // standard namespace
+
+/* How a finish treats the wood it is generated from */
+enum MaterialPattern
+{
+	MATERIAL_GRAIN, // stained, the grain shows fully
+	MATERIAL_GLOSS, // painted or lacquered, the grain barely shows through
+	MATERIAL_WEAVE, // upholstered, a thread pattern over a hint of the grain
+};
+
+/* The finishes in layer order (rgb tint, specular intensity); past the end they repeat in shifted colours */
+static const struct
+{
+	glm::vec3 tint;
+	float specular;
+	MaterialPattern pattern;
+} materialFinishes[] = {
+	{glm::vec3(1.00f, 1.00f, 1.00f), 0.50f, MATERIAL_GRAIN}, // natural wood
+	{glm::vec3(0.55f, 0.38f, 0.26f), 0.35f, MATERIAL_GRAIN}, // walnut stain
+	{glm::vec3(0.85f, 0.72f, 0.55f), 0.40f, MATERIAL_GRAIN}, // light oak
+	{glm::vec3(0.20f, 0.20f, 0.22f), 0.80f, MATERIAL_GLOSS}, // black lacquer
+	{glm::vec3(0.80f, 0.15f, 0.12f), 0.70f, MATERIAL_GLOSS}, // red lacquer
+	{glm::vec3(0.95f, 0.95f, 0.90f), 0.60f, MATERIAL_GLOSS}, // white paint
+	{glm::vec3(0.82f, 0.78f, 0.68f), 0.10f, MATERIAL_WEAVE}, // linen
+	{glm::vec3(0.25f, 0.32f, 0.55f), 0.05f, MATERIAL_WEAVE}, // blue wool
+};
+
+static const int materialFinishCount = sizeof(materialFinishes) / sizeof(materialFinishes[0]);
+
+/* Parses --materials N, --material-textures and --material-bench */
+bool UParseMaterialArgs(int argc, char *argv[], MaterialOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--materials")
+		{
+			options.count = i + 1 < argc ? atoi(argv[++i]) : 0;
+			if (options.count <= 0 || options.count > MATERIAL_MAX_LAYERS)
+			{
+				cout << "--materials expects 1 to " << MATERIAL_MAX_LAYERS << " finishes" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--material-textures")
+		{
+			options.separate = true;
+		}
+		else if (arg == "--material-bench")
+		{
+			options.benchmark = true;
+		}
+	}
+
+	return true;
+}
+
+/* Halves an RGBA8 image with a 2x2 box filter, odd edges clamped */
+static void UHalveImage(vector<unsigned char> &image, uint32_t &width, uint32_t &height)
+{
+	uint32_t halfWidth = max(1u, width / 2), halfHeight = max(1u, height / 2);
+	vector<unsigned char> half((size_t)halfWidth * halfHeight * 4);
+
+	for (uint32_t y = 0; y < halfHeight; y++)
+	{
+		for (uint32_t x = 0; x < halfWidth; x++)
+		{
+			uint32_t x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1);
+			uint32_t y0 = min(2 * y, height - 1), y1 = min(2 * y + 1, height - 1);
+			for (int c = 0; c < 4; c++)
+			{
+				int sum = image[((size_t)y0 * width + x0) * 4 + c] + image[((size_t)y0 * width + x1) * 4 + c] +
+						  image[((size_t)y1 * width + x0) * 4 + c] + image[((size_t)y1 * width + x1) * 4 + c];
+				half[((size_t)y * halfWidth + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+	}
+
+	image.swap(half);
+	width = halfWidth;
+	height = halfHeight;
+}
+
+/* Tint of finish 'layer'; every repetition of the table turns the colours a little further */
+static glm::vec3 UMaterialTint(int layer)
+{
+	glm::vec3 tint = materialFinishes[layer % materialFinishCount].tint;
+	float shift = fmod((layer / materialFinishCount) * 0.381966f, 1.0f); // golden ratio steps never repeat
+	return glm::mix(tint, glm::vec3(tint.g, tint.b, tint.r), shift);
+}
+
+float UMaterialSpecular(int layer)
+{
+	return materialFinishes[layer % materialFinishCount].specular;
+}
+
+float UMeanLuminance(const unsigned char *rgba, size_t texels)
+{
+	double total = 0.0;
+	for (size_t i = 0; i < texels; i++)
+		total += 0.299 * rgba[4 * i] + 0.587 * rgba[4 * i + 1] + 0.114 * rgba[4 * i + 2];
+	return (float)max(total / texels, 1.0);
+}
+
+void UBuildMaterialLevel(const unsigned char *rgba, uint32_t width, uint32_t height, float mean, int layer, uint32_t threadSize, unsigned char *out)
+{
+	glm::vec3 tint = UMaterialTint(layer);
+	MaterialPattern pattern = materialFinishes[layer % materialFinishCount].pattern;
+
+	for (uint32_t y = 0; y < height; y++)
+	{
+		for (uint32_t x = 0; x < width; x++)
+		{
+			size_t i = (size_t)y * width + x;
+			glm::vec3 wood(rgba[4 * i], rgba[4 * i + 1], rgba[4 * i + 2]);
+			float luminance = 0.299f * wood.r + 0.587f * wood.g + 0.114f * wood.b;
+
+			glm::vec3 color;
+			if (pattern == MATERIAL_GRAIN)
+			{
+				color = wood * tint;
+			}
+			else if (pattern == MATERIAL_GLOSS)
+			{
+				color = (mean + 0.25f * (luminance - mean)) * tint;
+			}
+			else
+			{
+				// over and under threads; threads narrower than a texel blend to their mean
+				float thread = threadSize == 0 ? 0.925f : ((x / threadSize + y / threadSize) & 1) ? 0.85f : 1.0f;
+				color = mean * tint * thread * (0.85f + 0.15f * luminance / mean);
+			}
+
+			color = glm::clamp(color, glm::vec3(0.0f), glm::vec3(255.0f));
+			out[4 * i] = (unsigned char)(color.r + 0.5f);
+			out[4 * i + 1] = (unsigned char)(color.g + 0.5f);
+			out[4 * i + 2] = (unsigned char)(color.b + 0.5f);
+			out[4 * i + 3] = rgba[4 * i + 3];
+		}
+	}
+}
+
+void UBuildMaterialLayers(const unsigned char *rgba, uint32_t width, uint32_t height, int count, MaterialLayers &layers)
+{
+	vector<unsigned char> base(rgba, rgba + (size_t)width * height * 4);
+	while (width > MATERIAL_LAYER_SIZE || height > MATERIAL_LAYER_SIZE)
+		UHalveImage(base, width, height);
+
+	// the mean luminance is what the gloss and weave finishes keep of the grain
+	size_t texels = (size_t)width * height;
+	float mean = UMeanLuminance(base.data(), texels);
+
+	layers.width = width;
+	layers.height = height;
+	layers.count = count;
+	layers.texels.resize(texels * 4 * count);
+
+	for (int layer = 0; layer < count; layer++)
+		UBuildMaterialLevel(base.data(), width, height, mean, layer, 4, layers.texels.data() + texels * 4 * layer); // threads every four texels
+}
+
+void UBuildWoodChain(const unsigned char *rgba, uint32_t width, uint32_t height, uint32_t size, vector<vector<unsigned char>> &levels)
+{
+	// bilinear to size x size, wrapping at the edges as the chair samples it
+	vector<unsigned char> image((size_t)size * size * 4);
+	for (uint32_t y = 0; y < size; y++)
+	{
+		float sy = (y + 0.5f) * height / size - 0.5f;
+		int y0 = (int)floor(sy);
+		float fy = sy - y0;
+		uint32_t rows[2] = {(uint32_t)((y0 % (int)height + height) % height), (uint32_t)(((y0 + 1) % (int)height + height) % height)};
+
+		for (uint32_t x = 0; x < size; x++)
+		{
+			float sx = (x + 0.5f) * width / size - 0.5f;
+			int x0 = (int)floor(sx);
+			float fx = sx - x0;
+			uint32_t columns[2] = {(uint32_t)((x0 % (int)width + width) % width), (uint32_t)(((x0 + 1) % (int)width + width) % width)};
+
+			for (int c = 0; c < 4; c++)
+			{
+				float top = rgba[((size_t)rows[0] * width + columns[0]) * 4 + c] * (1.0f - fx) + rgba[((size_t)rows[0] * width + columns[1]) * 4 + c] * fx;
+				float bottom = rgba[((size_t)rows[1] * width + columns[0]) * 4 + c] * (1.0f - fx) + rgba[((size_t)rows[1] * width + columns[1]) * 4 + c] * fx;
+				image[((size_t)y * size + x) * 4 + c] = (unsigned char)(top * (1.0f - fy) + bottom * fy + 0.5f);
+			}
+		}
+	}
+
+	levels.clear();
+	uint32_t levelWidth = size, levelHeight = size;
+	levels.push_back(image);
+	while (levelWidth > 1)
+	{
+		UHalveImage(image, levelWidth, levelHeight);
+		levels.push_back(image);
+	}
+}
+
+GLuint UCreateMaterialArray(const MaterialLayers &layers)
+{
+	GLuint array;
+	glGenTextures(1, &array);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, layers.width, layers.height, layers.count, 0, GL_RGBA, GL_UNSIGNED_BYTE, layers.texels.data());
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY); // mips are built per layer, finishes never bleed into each other
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return array;
+}
+
+void UCreateMaterialTextures(const MaterialLayers &layers, vector<GLuint> &textures)
+{
+	size_t layerBytes = (size_t)layers.width * layers.height * 4;
+
+	textures.resize(layers.count);
+	glGenTextures(layers.count, textures.data());
+	for (int layer = 0; layer < layers.count; layer++)
+	{
+		glBindTexture(GL_TEXTURE_2D, textures[layer]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, layers.width, layers.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, layers.texels.data() + layerBytes * layer);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void UAssignMaterials(int count, vector<ChairInstance> &instances)
+{
+	if (count <= 0)
+		return;
+
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		// a different hash bit range than the showroom's tints, so neighbours differ
+		int layer = (int)((((unsigned int)i * 2654435761u) >> 12) % (unsigned int)count);
+		instances[i].material = glm::vec4(1.0f, 1.0f, 1.0f, UMaterialSpecular(layer)); // the layer carries the colour
+		instances[i].layer = (GLfloat)layer;
+	}
+}
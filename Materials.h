@@ -0,0 +1,56 @@
+/*
+ * Materials.h
+ *
+ *  Chair finishes as layers of one GL_TEXTURE_2D_ARRAY: every layer is generated from the
+ *  wood texture, each chair carries the index of its layer, and chairs of different finishes
+ *  share one program, one texture bind and one instanced draw
+ */
+
+#ifndef MATERIALS_H
+#define MATERIALS_H
+
+#include <cstdint>
+#include <vector>
+#include <GL/glew.h>
+
+#include "Showroom.h"
+
+#define MATERIAL_LAYER_SIZE 512 // largest layer side; larger images are box filtered down to it
+#define MATERIAL_MAX_LAYERS 256 // array layers every GL 3.3 driver must allow
+
+/* Command line options of the material system */
+struct MaterialOptions
+{
+	int count = 0;			// --materials N finishes, one array layer each; 0 keeps the single tinted wood texture
+	bool separate = false;	// --material-textures one 2D texture and one draw per finish instead, for comparison
+	bool benchmark = false; // --material-bench sweeps the finish count, texture array against separate textures
+};
+
+/* Every finish's texels, RGBA8, layer after layer */
+struct MaterialLayers
+{
+	uint32_t width = 0, height = 0;
+	int count = 0;
+	std::vector<unsigned char> texels;
+};
+
+bool UParseMaterialArgs(int argc, char *argv[], MaterialOptions &options);
+
+// generates 'count' finishes from an RGBA8 image: wood stains, lacquers and fabrics, then the same in shifted colours
+void UBuildMaterialLayers(const unsigned char *rgba, uint32_t width, uint32_t height, int count, MaterialLayers &layers);
+float UMaterialSpecular(int layer);
+
+// one finish at any size: 'rgba' is the wood at that size with mean luminance 'mean', woven threads are 'threadSize' texels wide (0: narrower than one)
+void UBuildMaterialLevel(const unsigned char *rgba, uint32_t width, uint32_t height, float mean, int layer, uint32_t threadSize, unsigned char *out);
+float UMeanLuminance(const unsigned char *rgba, size_t texels);
+
+// the wood resampled to size x size (a power of two) and box filtered down to 1x1, finest first
+void UBuildWoodChain(const unsigned char *rgba, uint32_t width, uint32_t height, uint32_t size, std::vector<std::vector<unsigned char>> &levels);
+
+GLuint UCreateMaterialArray(const MaterialLayers &layers);								// GL_TEXTURE_2D_ARRAY with mipmaps
+void UCreateMaterialTextures(const MaterialLayers &layers, std::vector<GLuint> &textures); // one GL_TEXTURE_2D per layer
+
+// gives every chair one of 'count' finishes; the layer replaces the tint, 0 leaves the chairs as they are
+void UAssignMaterials(int count, std::vector<ChairInstance> &instances);
+
+#endif
@@ -0,0 +1,985 @@
+/*
+ * MeshConvert.cpp
+ *
+ *  Offline converter from Wavefront OBJ and glTF 2.0 (.gltf / .glb) to the binary mesh format
+ *
+ *  Usage: MeshConvert input.obj|input.gltf|input.glb output.mesh [--no-optimize] [--no-lods]
+ */
+
+/* Header Inclusions */
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "MeshFile.h"
+#include "MeshLod.h"
+#include "MeshOptimize.h"
+
+using namespace std; // standard namespace
+
+/* Vertex layout written by the converter: position, normal, texture coordinate as floats */
+struct ConvertVertex
+{
+	float position[3];
+	float normal[3];
+	float uv[2];
+};
+
+/* Geometry gathered from the source file, one index range per material */
+struct ConvertMesh
+{
+	vector<ConvertVertex> vertices;
+	vector<uint32_t> indices;
+	vector<MeshSubmesh> submeshes;
+};
+
+/* Starts a new submesh unless the current one is still empty */
+static void UBeginSubmesh(ConvertMesh &mesh, uint32_t material)
+{
+	if (!mesh.submeshes.empty() && mesh.submeshes.back().indexCount == 0)
+	{
+		mesh.submeshes.back().material = material;
+		return;
+	}
+
+	MeshSubmesh submesh = {(uint32_t)mesh.indices.size(), 0, material, 0, {0, 0, 0}, {0, 0, 0}};
+	mesh.submeshes.push_back(submesh);
+}
+
+/* Area weighted vertex normals for vertices that came without one */
+static void UGenerateNormals(ConvertMesh &mesh, const vector<bool> &needsNormal)
+{
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+	{
+		ConvertVertex *corner[3] = {&mesh.vertices[mesh.indices[i]], &mesh.vertices[mesh.indices[i + 1]], &mesh.vertices[mesh.indices[i + 2]]};
+
+		float e1[3], e2[3], n[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			e1[axis] = corner[1]->position[axis] - corner[0]->position[axis];
+			e2[axis] = corner[2]->position[axis] - corner[0]->position[axis];
+		}
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+
+		for (int c = 0; c < 3; c++)
+		{
+			if (!needsNormal[mesh.indices[i + c]])
+				continue;
+			for (int axis = 0; axis < 3; axis++)
+				corner[c]->normal[axis] += n[axis];
+		}
+	}
+
+	for (size_t i = 0; i < mesh.vertices.size(); i++)
+	{
+		if (!needsNormal[i])
+			continue;
+
+		float *n = mesh.vertices[i].normal;
+		float length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length > 0.0f)
+		{
+			n[0] /= length;
+			n[1] /= length;
+			n[2] /= length;
+		}
+		else
+		{
+			n[1] = 1.0f;
+		}
+	}
+}
+
+/*--- Wavefront OBJ ---*/
+
+/* Resolves a 1-based or negative (relative) OBJ index, returns -1 when absent */
+static long UObjIndex(const char *text, size_t count)
+{
+	if (!text || !*text)
+		return -1;
+
+	long index = strtol(text, NULL, 10);
+	if (index < 0)
+		index += (long)count;
+	else
+		index -= 1;
+
+	return (index >= 0 && (size_t)index < count) ? index : -1;
+}
+
+static bool ULoadObj(const string &path, ConvertMesh &mesh)
+{
+	ifstream file(path);
+	if (!file)
+	{
+		cout << "Cannot open " << path << endl;
+		return false;
+	}
+
+	vector<float> positions, normals, uvs;
+	map<string, uint32_t> materials;
+	vector<bool> needsNormal;
+
+	// every distinct position/uv/normal triple becomes one output vertex
+	struct TripleHash
+	{
+		size_t operator()(const uint64_t &key) const { return (size_t)(key ^ (key >> 29) ^ (key >> 47)); }
+	};
+	unordered_map<uint64_t, uint32_t, TripleHash> vertexMap;
+	map<tuple<long, long, long>, uint32_t> wideVertexMap; // for files with more than 2^21 positions
+
+	UBeginSubmesh(mesh, 0);
+
+	string line;
+	vector<uint32_t> face;
+	while (getline(file, line))
+	{
+		const char *cursor = line.c_str();
+		while (*cursor == ' ' || *cursor == '\t')
+			cursor++;
+
+		if (cursor[0] == 'v' && cursor[1] == ' ')
+		{
+			char *end;
+			const char *next = cursor + 2;
+			for (int i = 0; i < 3; i++)
+			{
+				positions.push_back(strtof(next, &end));
+				next = end;
+			}
+		}
+		else if (cursor[0] == 'v' && cursor[1] == 'n')
+		{
+			char *end;
+			const char *next = cursor + 2;
+			for (int i = 0; i < 3; i++)
+			{
+				normals.push_back(strtof(next, &end));
+				next = end;
+			}
+		}
+		else if (cursor[0] == 'v' && cursor[1] == 't')
+		{
+			char *end;
+			const char *next = cursor + 2;
+			for (int i = 0; i < 2; i++)
+			{
+				uvs.push_back(strtof(next, &end));
+				next = end;
+			}
+		}
+		else if (cursor[0] == 'f' && cursor[1] == ' ')
+		{
+			face.clear();
+			stringstream corners(cursor + 2);
+			string corner;
+
+			while (corners >> corner)
+			{
+				// v, v/vt, v//vn or v/vt/vn
+				string parts[3];
+				size_t part = 0;
+				for (char c : corner)
+				{
+					if (c == '/')
+						part = min<size_t>(part + 1, 2);
+					else
+						parts[part] += c;
+				}
+
+				long v = UObjIndex(parts[0].c_str(), positions.size() / 3);
+				long vt = UObjIndex(parts[1].c_str(), uvs.size() / 2);
+				long vn = UObjIndex(parts[2].c_str(), normals.size() / 3);
+				if (v < 0)
+				{
+					cout << "Bad face index in " << path << ": " << corner << endl;
+					return false;
+				}
+
+				uint32_t *slot;
+				if (v < (1 << 21) && vt < (1 << 21) && vn < (1 << 21))
+				{
+					uint64_t key = (uint64_t)v | (uint64_t)(vt + 1) << 21 | (uint64_t)(vn + 1) << 42;
+					auto found = vertexMap.find(key);
+					if (found != vertexMap.end())
+					{
+						face.push_back(found->second);
+						continue;
+					}
+					slot = &vertexMap[key];
+				}
+				else
+				{
+					auto key = make_tuple(v, vt, vn);
+					auto found = wideVertexMap.find(key);
+					if (found != wideVertexMap.end())
+					{
+						face.push_back(found->second);
+						continue;
+					}
+					slot = &wideVertexMap[key];
+				}
+
+				ConvertVertex vertex;
+				memset(&vertex, 0, sizeof(vertex));
+				memcpy(vertex.position, &positions[v * 3], sizeof(vertex.position));
+				if (vn >= 0)
+					memcpy(vertex.normal, &normals[vn * 3], sizeof(vertex.normal));
+				if (vt >= 0)
+					memcpy(vertex.uv, &uvs[vt * 2], sizeof(vertex.uv));
+
+				*slot = (uint32_t)mesh.vertices.size();
+				face.push_back(*slot);
+				mesh.vertices.push_back(vertex);
+				needsNormal.push_back(vn < 0);
+			}
+
+			// triangulate the polygon as a fan
+			for (size_t i = 2; i < face.size(); i++)
+			{
+				mesh.indices.push_back(face[0]);
+				mesh.indices.push_back(face[i - 1]);
+				mesh.indices.push_back(face[i]);
+				mesh.submeshes.back().indexCount += 3;
+			}
+		}
+		else if (strncmp(cursor, "usemtl", 6) == 0)
+		{
+			string name = cursor + 6;
+			name.erase(0, name.find_first_not_of(" \t"));
+
+			auto found = materials.find(name);
+			uint32_t material = found != materials.end() ? found->second : (uint32_t)materials.size();
+			materials[name] = material;
+			UBeginSubmesh(mesh, material);
+		}
+	}
+
+	UGenerateNormals(mesh, needsNormal);
+	return true;
+}
+
+/*--- glTF 2.0 ---*/
+
+/* Minimal JSON document tree, enough for glTF */
+struct JsonValue
+{
+	enum Type
+	{
+		NUL,
+		BOOLEAN,
+		NUMBER,
+		STRING,
+		ARRAY,
+		OBJECT
+	} type = NUL;
+	double number = 0.0;
+	string text;
+	vector<JsonValue> items;
+	vector<pair<string, JsonValue>> members;
+
+	const JsonValue *get(const string &key) const
+	{
+		for (const auto &member : members)
+			if (member.first == key)
+				return &member.second;
+		return NULL;
+	}
+
+	double numberOr(const string &key, double fallback) const
+	{
+		const JsonValue *value = get(key);
+		return value && value->type == NUMBER ? value->number : fallback;
+	}
+};
+
+struct JsonParser
+{
+	const char *cursor;
+	const char *end;
+
+	void skip()
+	{
+		while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r'))
+			cursor++;
+	}
+
+	bool parseString(string &out)
+	{
+		if (*cursor != '"')
+			return false;
+		cursor++;
+
+		while (cursor < end && *cursor != '"')
+		{
+			if (*cursor == '\\' && cursor + 1 < end)
+			{
+				cursor++;
+				switch (*cursor)
+				{
+				case 'n':
+					out += '\n';
+					break;
+				case 't':
+					out += '\t';
+					break;
+				case 'u':
+					// glTF keys and URIs are ASCII in practice, keep a placeholder for anything else
+					out += '?';
+					cursor += 4;
+					break;
+				default:
+					out += *cursor;
+				}
+				cursor++;
+			}
+			else
+			{
+				out += *cursor++;
+			}
+		}
+
+		if (cursor >= end)
+			return false;
+		cursor++;
+		return true;
+	}
+
+	bool parse(JsonValue &value)
+	{
+		skip();
+		if (cursor >= end)
+			return false;
+
+		if (*cursor == '{')
+		{
+			value.type = JsonValue::OBJECT;
+			cursor++;
+			skip();
+			if (*cursor == '}')
+			{
+				cursor++;
+				return true;
+			}
+
+			while (true)
+			{
+				skip();
+				string key;
+				if (!parseString(key))
+					return false;
+				skip();
+				if (*cursor++ != ':')
+					return false;
+
+				value.members.push_back(make_pair(key, JsonValue()));
+				if (!parse(value.members.back().second))
+					return false;
+
+				skip();
+				if (*cursor == ',')
+				{
+					cursor++;
+					continue;
+				}
+				if (*cursor++ != '}')
+					return false;
+				return true;
+			}
+		}
+
+		if (*cursor == '[')
+		{
+			value.type = JsonValue::ARRAY;
+			cursor++;
+			skip();
+			if (*cursor == ']')
+			{
+				cursor++;
+				return true;
+			}
+
+			while (true)
+			{
+				value.items.push_back(JsonValue());
+				if (!parse(value.items.back()))
+					return false;
+
+				skip();
+				if (*cursor == ',')
+				{
+					cursor++;
+					continue;
+				}
+				if (*cursor++ != ']')
+					return false;
+				return true;
+			}
+		}
+
+		if (*cursor == '"')
+		{
+			value.type = JsonValue::STRING;
+			return parseString(value.text);
+		}
+
+		if (!strncmp(cursor, "true", 4) || !strncmp(cursor, "false", 5))
+		{
+			value.type = JsonValue::BOOLEAN;
+			value.number = *cursor == 't' ? 1.0 : 0.0;
+			cursor += *cursor == 't' ? 4 : 5;
+			return true;
+		}
+
+		if (!strncmp(cursor, "null", 4))
+		{
+			cursor += 4;
+			return true;
+		}
+
+		char *numberEnd;
+		value.type = JsonValue::NUMBER;
+		value.number = strtod(cursor, &numberEnd);
+		if (numberEnd == cursor)
+			return false;
+		cursor = numberEnd;
+		return true;
+	}
+};
+
+static bool UReadFile(const string &path, vector<unsigned char> &data)
+{
+	ifstream file(path, ios::binary | ios::ate);
+	if (!file)
+		return false;
+
+	data.resize((size_t)file.tellg());
+	file.seekg(0);
+	file.read((char *)data.data(), data.size());
+	return (bool)file;
+}
+
+static bool UDecodeBase64(const string &text, vector<unsigned char> &data)
+{
+	static const string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	uint32_t bits = 0;
+	int bitCount = 0;
+	for (char c : text)
+	{
+		if (c == '=')
+			break;
+
+		size_t value = alphabet.find(c);
+		if (value == string::npos)
+			return false;
+
+		bits = (bits << 6) | (uint32_t)value;
+		bitCount += 6;
+		if (bitCount >= 8)
+		{
+			bitCount -= 8;
+			data.push_back((unsigned char)(bits >> bitCount));
+		}
+	}
+	return true;
+}
+
+/* glTF document with its binary buffers */
+struct GltfFile
+{
+	JsonValue json;
+	vector<vector<unsigned char>> buffers;
+};
+
+/* Reads accessor 'index' as floats, 'components' per element (normalized integers are expanded) */
+static bool UReadAccessor(const GltfFile &gltf, int index, int components, vector<float> &out)
+{
+	const JsonValue *accessors = gltf.json.get("accessors");
+	const JsonValue *views = gltf.json.get("bufferViews");
+	if (!accessors || index < 0 || index >= (int)accessors->items.size() || !views)
+		return false;
+
+	const JsonValue &accessor = accessors->items[index];
+	int viewIndex = (int)accessor.numberOr("bufferView", -1);
+	if (viewIndex < 0 || viewIndex >= (int)views->items.size())
+		return false; // sparse-only accessors are not supported
+
+	const JsonValue &view = views->items[viewIndex];
+	int bufferIndex = (int)view.numberOr("buffer", 0);
+	if (bufferIndex >= (int)gltf.buffers.size())
+		return false;
+
+	size_t count = (size_t)accessor.numberOr("count", 0);
+	int componentType = (int)accessor.numberOr("componentType", 0);
+	bool normalized = accessor.get("normalized") && accessor.get("normalized")->number != 0.0;
+
+	size_t componentSize = componentType == GL_FLOAT || componentType == GL_UNSIGNED_INT ? 4 : componentType == GL_SHORT || componentType == GL_UNSIGNED_SHORT ? 2
+																																								  : 1;
+	size_t stride = (size_t)view.numberOr("byteStride", 0);
+	if (stride == 0)
+		stride = componentSize * components;
+
+	size_t offset = (size_t)view.numberOr("byteOffset", 0) + (size_t)accessor.numberOr("byteOffset", 0);
+	const vector<unsigned char> &buffer = gltf.buffers[bufferIndex];
+	if (count > 0 && offset + (count - 1) * stride + componentSize * components > buffer.size())
+		return false;
+
+	out.resize(count * components);
+	for (size_t i = 0; i < count; i++)
+	{
+		const unsigned char *element = &buffer[offset + i * stride];
+		for (int c = 0; c < components; c++)
+		{
+			const unsigned char *p = element + c * componentSize;
+			float value;
+			switch (componentType)
+			{
+			case GL_FLOAT:
+				memcpy(&value, p, 4);
+				break;
+			case GL_UNSIGNED_INT:
+			{
+				uint32_t v;
+				memcpy(&v, p, 4);
+				value = (float)v;
+				break;
+			}
+			case GL_UNSIGNED_SHORT:
+			{
+				uint16_t v;
+				memcpy(&v, p, 2);
+				value = normalized ? v / 65535.0f : v;
+				break;
+			}
+			case GL_SHORT:
+			{
+				int16_t v;
+				memcpy(&v, p, 2);
+				value = normalized ? max(v / 32767.0f, -1.0f) : v;
+				break;
+			}
+			case GL_UNSIGNED_BYTE:
+				value = normalized ? *p / 255.0f : *p;
+				break;
+			case GL_BYTE:
+				value = normalized ? max((int8_t)*p / 127.0f, -1.0f) : (int8_t)*p;
+				break;
+			default:
+				return false;
+			}
+			out[i * components + c] = value;
+		}
+	}
+	return true;
+}
+
+/* Column-major 4x4 transform of a node from 'matrix' or translation/rotation/scale */
+static void UNodeTransform(const JsonValue &node, float m[16])
+{
+	const JsonValue *matrix = node.get("matrix");
+	if (matrix && matrix->items.size() == 16)
+	{
+		for (int i = 0; i < 16; i++)
+			m[i] = (float)matrix->items[i].number;
+		return;
+	}
+
+	float t[3] = {0, 0, 0}, r[4] = {0, 0, 0, 1}, s[3] = {1, 1, 1};
+	if (const JsonValue *v = node.get("translation"))
+		for (int i = 0; i < 3 && i < (int)v->items.size(); i++)
+			t[i] = (float)v->items[i].number;
+	if (const JsonValue *v = node.get("rotation"))
+		for (int i = 0; i < 4 && i < (int)v->items.size(); i++)
+			r[i] = (float)v->items[i].number;
+	if (const JsonValue *v = node.get("scale"))
+		for (int i = 0; i < 3 && i < (int)v->items.size(); i++)
+			s[i] = (float)v->items[i].number;
+
+	// rotation quaternion (x, y, z, w) to matrix, scaled per column
+	float x = r[0], y = r[1], z = r[2], w = r[3];
+	float rotation[9] = {
+		1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w),
+		2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w),
+		2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y)};
+
+	for (int column = 0; column < 3; column++)
+	{
+		for (int row = 0; row < 3; row++)
+			m[column * 4 + row] = rotation[column * 3 + row] * s[column];
+		m[column * 4 + 3] = 0.0f;
+	}
+	m[12] = t[0];
+	m[13] = t[1];
+	m[14] = t[2];
+	m[15] = 1.0f;
+}
+
+static void UMultiply(const float a[16], const float b[16], float out[16])
+{
+	float result[16];
+	for (int column = 0; column < 4; column++)
+		for (int row = 0; row < 4; row++)
+		{
+			result[column * 4 + row] = 0.0f;
+			for (int k = 0; k < 4; k++)
+				result[column * 4 + row] += a[k * 4 + row] * b[column * 4 + k];
+		}
+	memcpy(out, result, sizeof(result));
+}
+
+/* Appends every triangle primitive of a mesh, transformed by the node's world matrix */
+static bool UAppendGltfMesh(const GltfFile &gltf, const JsonValue &gltfMesh, const float world[16], ConvertMesh &mesh, vector<bool> &needsNormal)
+{
+	// normals use the inverse transpose of the upper 3x3
+	const float *m = world;
+	float cofactor[9] = {
+		m[5] * m[10] - m[6] * m[9], m[6] * m[8] - m[4] * m[10], m[4] * m[9] - m[5] * m[8],
+		m[2] * m[9] - m[1] * m[10], m[0] * m[10] - m[2] * m[8], m[1] * m[8] - m[0] * m[9],
+		m[1] * m[6] - m[2] * m[5], m[2] * m[4] - m[0] * m[6], m[0] * m[5] - m[1] * m[4]};
+
+	const JsonValue *primitives = gltfMesh.get("primitives");
+	if (!primitives)
+		return true;
+
+	for (const JsonValue &primitive : primitives->items)
+	{
+		if ((int)primitive.numberOr("mode", 4) != 4)
+		{
+			cout << "Skipping a non-triangle primitive" << endl;
+			continue;
+		}
+
+		const JsonValue *attributes = primitive.get("attributes");
+		vector<float> positions, normals, uvs, indices;
+		if (!attributes || !UReadAccessor(gltf, attributes->get("POSITION") ? (int)attributes->get("POSITION")->number : -1, 3, positions))
+		{
+			cout << "Primitive without readable POSITION data" << endl;
+			return false;
+		}
+		if (attributes->get("NORMAL"))
+			UReadAccessor(gltf, (int)attributes->get("NORMAL")->number, 3, normals);
+		if (attributes->get("TEXCOORD_0"))
+			UReadAccessor(gltf, (int)attributes->get("TEXCOORD_0")->number, 2, uvs);
+
+		size_t vertexCount = positions.size() / 3;
+		if (primitive.get("indices"))
+		{
+			if (!UReadAccessor(gltf, (int)primitive.get("indices")->number, 1, indices))
+				return false;
+		}
+		else
+		{
+			for (size_t i = 0; i < vertexCount; i++)
+				indices.push_back((float)i);
+		}
+
+		UBeginSubmesh(mesh, (uint32_t)primitive.numberOr("material", 0));
+		uint32_t base = (uint32_t)mesh.vertices.size();
+
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			ConvertVertex vertex;
+			memset(&vertex, 0, sizeof(vertex));
+
+			const float *p = &positions[i * 3];
+			for (int row = 0; row < 3; row++)
+				vertex.position[row] = m[row] * p[0] + m[4 + row] * p[1] + m[8 + row] * p[2] + m[12 + row];
+
+			if (normals.size() == positions.size())
+			{
+				const float *n = &normals[i * 3];
+				float length = 0.0f;
+				for (int row = 0; row < 3; row++)
+				{
+					vertex.normal[row] = cofactor[row] * n[0] + cofactor[3 + row] * n[1] + cofactor[6 + row] * n[2];
+					length += vertex.normal[row] * vertex.normal[row];
+				}
+				length = sqrt(length);
+				for (int row = 0; length > 0.0f && row < 3; row++)
+					vertex.normal[row] /= length;
+			}
+
+			// glTF puts the texture origin top-left, the chair shader expects OBJ's bottom-left
+			if (uvs.size() / 2 == vertexCount)
+			{
+				vertex.uv[0] = uvs[i * 2];
+				vertex.uv[1] = 1.0f - uvs[i * 2 + 1];
+			}
+
+			mesh.vertices.push_back(vertex);
+			needsNormal.push_back(normals.size() != positions.size());
+		}
+
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				uint32_t index = (uint32_t)indices[i + c];
+				if (index >= vertexCount)
+				{
+					cout << "Index out of range in primitive" << endl;
+					return false;
+				}
+				mesh.indices.push_back(base + index);
+			}
+			mesh.submeshes.back().indexCount += 3;
+		}
+	}
+	return true;
+}
+
+static bool UAppendGltfNode(const GltfFile &gltf, int nodeIndex, const float parent[16], ConvertMesh &mesh, vector<bool> &needsNormal, int depth)
+{
+	const JsonValue *nodes = gltf.json.get("nodes");
+	if (!nodes || nodeIndex < 0 || nodeIndex >= (int)nodes->items.size() || depth > 64)
+		return false;
+
+	const JsonValue &node = nodes->items[nodeIndex];
+	float local[16], world[16];
+	UNodeTransform(node, local);
+	UMultiply(parent, local, world);
+
+	const JsonValue *meshes = gltf.json.get("meshes");
+	int meshIndex = (int)node.numberOr("mesh", -1);
+	if (meshes && meshIndex >= 0 && meshIndex < (int)meshes->items.size())
+	{
+		if (!UAppendGltfMesh(gltf, meshes->items[meshIndex], world, mesh, needsNormal))
+			return false;
+	}
+
+	if (const JsonValue *children = node.get("children"))
+	{
+		for (const JsonValue &child : children->items)
+			if (!UAppendGltfNode(gltf, (int)child.number, world, mesh, needsNormal, depth + 1))
+				return false;
+	}
+	return true;
+}
+
+static bool ULoadGltf(const string &path, ConvertMesh &mesh)
+{
+	vector<unsigned char> file;
+	if (!UReadFile(path, file))
+	{
+		cout << "Cannot open " << path << endl;
+		return false;
+	}
+
+	GltfFile gltf;
+	const char *jsonStart = (const char *)file.data();
+	size_t jsonLength = file.size();
+	vector<unsigned char> glbBinary;
+
+	// .glb: 12 byte header, then a JSON chunk and an optional BIN chunk
+	if (file.size() >= 20 && !memcmp(file.data(), "glTF", 4))
+	{
+		uint32_t chunkLength, chunkType;
+		memcpy(&chunkLength, &file[12], 4);
+		memcpy(&chunkType, &file[16], 4);
+		if (chunkType != 0x4E4F534Au || 20 + (size_t)chunkLength > file.size())
+		{
+			cout << "Malformed GLB header" << endl;
+			return false;
+		}
+		jsonStart = (const char *)&file[20];
+		jsonLength = chunkLength;
+
+		size_t binaryChunk = 20 + chunkLength;
+		if (binaryChunk + 8 <= file.size())
+		{
+			memcpy(&chunkLength, &file[binaryChunk], 4);
+			if (binaryChunk + 8 + chunkLength <= file.size())
+				glbBinary.assign(file.begin() + binaryChunk + 8, file.begin() + binaryChunk + 8 + chunkLength);
+		}
+	}
+
+	JsonParser parser = {jsonStart, jsonStart + jsonLength};
+	if (!parser.parse(gltf.json) || gltf.json.type != JsonValue::OBJECT)
+	{
+		cout << "Cannot parse glTF JSON in " << path << endl;
+		return false;
+	}
+
+	string directory = path.substr(0, path.find_last_of("/\\") + 1);
+
+	if (const JsonValue *buffers = gltf.json.get("buffers"))
+	{
+		for (const JsonValue &buffer : buffers->items)
+		{
+			gltf.buffers.push_back(vector<unsigned char>());
+			const JsonValue *uri = buffer.get("uri");
+
+			if (!uri)
+				gltf.buffers.back() = glbBinary;
+			else if (uri->text.compare(0, 5, "data:") == 0)
+				UDecodeBase64(uri->text.substr(uri->text.find(',') + 1), gltf.buffers.back());
+			else if (!UReadFile(directory + uri->text, gltf.buffers.back()))
+			{
+				cout << "Cannot read buffer " << uri->text << endl;
+				return false;
+			}
+		}
+	}
+
+	vector<bool> needsNormal;
+	const float identity[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+
+	// the default scene's root nodes, or every mesh untransformed when there is no scene
+	const JsonValue *scenes = gltf.json.get("scenes");
+	int sceneIndex = (int)gltf.json.numberOr("scene", 0);
+	if (scenes && sceneIndex < (int)scenes->items.size() && scenes->items[sceneIndex].get("nodes"))
+	{
+		for (const JsonValue &root : scenes->items[sceneIndex].get("nodes")->items)
+			if (!UAppendGltfNode(gltf, (int)root.number, identity, mesh, needsNormal, 0))
+				return false;
+	}
+	else if (const JsonValue *meshes = gltf.json.get("meshes"))
+	{
+		for (const JsonValue &gltfMesh : meshes->items)
+			if (!UAppendGltfMesh(gltf, gltfMesh, identity, mesh, needsNormal))
+				return false;
+	}
+
+	UGenerateNormals(mesh, needsNormal);
+	return true;
+}
+
+/*--- Output ---*/
+
+/* Packs the converted geometry into the file layout, with per-submesh and overall bounds */
+static void UBuildMeshData(ConvertMesh &mesh, MeshData &data)
+{
+	data.vertexStride = sizeof(ConvertVertex);
+	data.attributes = {
+		{0, 3, GL_FLOAT, GL_FALSE, (uint32_t)offsetof(ConvertVertex, position), 0},
+		{1, 3, GL_FLOAT, GL_FALSE, (uint32_t)offsetof(ConvertVertex, normal), 0},
+		{2, 2, GL_FLOAT, GL_FALSE, (uint32_t)offsetof(ConvertVertex, uv), 0},
+	};
+	data.vertices.assign((const unsigned char *)mesh.vertices.data(), (const unsigned char *)(mesh.vertices.data() + mesh.vertices.size()));
+	data.indices.swap(mesh.indices);
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		data.boundsMin[axis] = 1e30f;
+		data.boundsMax[axis] = -1e30f;
+	}
+
+	for (MeshSubmesh &submesh : mesh.submeshes)
+	{
+		if (submesh.indexCount == 0)
+			continue;
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			submesh.boundsMin[axis] = 1e30f;
+			submesh.boundsMax[axis] = -1e30f;
+		}
+
+		for (uint32_t i = submesh.firstIndex; i < submesh.firstIndex + submesh.indexCount; i++)
+		{
+			const float *p = mesh.vertices[data.indices[i]].position;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				submesh.boundsMin[axis] = min(submesh.boundsMin[axis], p[axis]);
+				submesh.boundsMax[axis] = max(submesh.boundsMax[axis], p[axis]);
+			}
+		}
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			data.boundsMin[axis] = min(data.boundsMin[axis], submesh.boundsMin[axis]);
+			data.boundsMax[axis] = max(data.boundsMax[axis], submesh.boundsMax[axis]);
+		}
+		data.submeshes.push_back(submesh);
+	}
+}
+
+static bool UEndsWith(const string &text, const string &suffix)
+{
+	if (text.size() < suffix.size())
+		return false;
+
+	for (size_t i = 0; i < suffix.size(); i++)
+		if (tolower(text[text.size() - suffix.size() + i]) != suffix[i])
+			return false;
+	return true;
+}
+
+/* Main Program */
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		cout << "Usage: MeshConvert input.obj|input.gltf|input.glb output.mesh [--no-optimize] [--no-lods]" << endl;
+		return -1;
+	}
+
+	string input = argv[1], output = argv[2];
+	bool optimize = true, lods = true;
+	for (int i = 3; i < argc; i++)
+	{
+		optimize &= string(argv[i]) != "--no-optimize";
+		lods &= string(argv[i]) != "--no-lods";
+	}
+	auto start = chrono::steady_clock::now();
+
+	ConvertMesh mesh;
+	bool loaded;
+	if (UEndsWith(input, ".obj"))
+		loaded = ULoadObj(input, mesh);
+	else if (UEndsWith(input, ".gltf") || UEndsWith(input, ".glb"))
+		loaded = ULoadGltf(input, mesh);
+	else
+	{
+		cout << "Unknown input format: " << input << endl;
+		return -1;
+	}
+
+	if (!loaded || mesh.indices.empty())
+	{
+		cout << "No triangles found in " << input << endl;
+		return -1;
+	}
+
+	MeshData data;
+	UBuildMeshData(mesh, data);
+
+	// weld, clean up and reorder for the vertex cache, overdraw and vertex fetch
+	if (optimize)
+	{
+		MeshOptimizeReport report;
+		UOptimizeMesh(data, report);
+		UPrintMeshOptimizeReport(report);
+	}
+
+	// coarser index lists over the same vertices, after the optimizer so they inherit its triangle order
+	if (lods)
+	{
+		UBuildMeshLods(data, LOD_MAX_LEVELS);
+		UPrintMeshLodReport(data);
+	}
+
+	if (!UWriteMesh(output, data))
+		return -1;
+
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+	cout << "Converted " << input << " -> " << output << endl;
+	cout << "  " << data.vertices.size() / data.vertexStride << " vertices, " << (data.lods.empty() ? data.indices.size() : data.lods[0].indexCount) / 3 << " triangles, "
+		 << data.submeshes.size() << " submeshes in " << elapsed.count() << " s" << endl;
+
+	return 0;
+}
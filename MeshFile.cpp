@@ -0,0 +1,297 @@
+/*
+ * MeshFile.cpp
+ *
+ *  Versioned binary mesh container, loaded with mmap and handed straight to GL
+ */
+
+/* Header Inclusions */
+#include "MeshFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std; // standard namespace
+
+static uint64_t UAlignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+/* Maps a whole file read-only */
+bool UMapFile(const string &path, MappedFile &file)
+{
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(handle, &size);
+
+	HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	const void *data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (!data)
+	{
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file.fileHandle = handle;
+	file.mappingHandle = mapping;
+	file.data = (const unsigned char *)data;
+	file.size = (size_t)size.QuadPart;
+#else
+	int descriptor = open(path.c_str(), O_RDONLY);
+	if (descriptor < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(descriptor, &info) != 0 || info.st_size == 0)
+	{
+		close(descriptor);
+		return false;
+	}
+
+	void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	if (data == MAP_FAILED)
+	{
+		close(descriptor);
+		return false;
+	}
+
+	// the whole file is about to be streamed into GL, ask for read-ahead
+	madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+	file.descriptor = descriptor;
+	file.data = (const unsigned char *)data;
+	file.size = (size_t)info.st_size;
+#endif
+	return true;
+}
+
+void UUnmapFile(MappedFile &file)
+{
+	if (!file.data)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(file.data);
+	CloseHandle(file.mappingHandle);
+	CloseHandle(file.fileHandle);
+	file.fileHandle = file.mappingHandle = nullptr;
+#else
+	munmap((void *)file.data, file.size);
+	close(file.descriptor);
+	file.descriptor = -1;
+#endif
+	file.data = nullptr;
+	file.size = 0;
+}
+
+/* Bytes one attribute takes in a vertex, 0 for a layout the renderer cannot draw */
+static uint32_t UAttributeSize(const MeshAttribute &attribute)
+{
+	if (attribute.type == GL_INT_2_10_10_10_REV || attribute.type == GL_UNSIGNED_INT_2_10_10_10_REV)
+		return attribute.components == 4 || attribute.components == GL_BGRA ? 4 : 0;
+
+	uint32_t components = attribute.components == GL_BGRA ? 4 : attribute.components;
+	if (components < 1 || components > 4)
+		return 0;
+
+	switch (attribute.type)
+	{
+	case GL_BYTE:
+	case GL_UNSIGNED_BYTE:
+		return components;
+	case GL_SHORT:
+	case GL_UNSIGNED_SHORT:
+	case GL_HALF_FLOAT:
+		return components * 2;
+	case GL_INT:
+	case GL_UNSIGNED_INT:
+	case GL_FLOAT:
+		return components * 4;
+	default:
+		return 0;
+	}
+}
+
+/* Maps a mesh file and checks that every block lies inside it and every index and range inside its block */
+bool UOpenMesh(const string &path, MeshView &mesh)
+{
+	if (!UMapFile(path, mesh.file))
+	{
+		cout << "Cannot open mesh " << path << endl;
+		return false;
+	}
+
+	const MeshHeader *header = (const MeshHeader *)mesh.file.data;
+	uint64_t size = mesh.file.size;
+
+	// version 1 files are read as a single level of detail; their header ends before the LOD table
+	bool current = size >= sizeof(MeshHeader) && header->version == MESH_VERSION && header->headerSize == sizeof(MeshHeader);
+	bool legacy = size >= MESH_V1_HEADER_SIZE && header->version == 1 && header->headerSize == MESH_V1_HEADER_SIZE;
+	uint32_t lodCount = current ? header->lodCount : 0;
+
+	const char *problem = NULL;
+	if (size < MESH_V1_HEADER_SIZE || header->magic != MESH_MAGIC)
+		problem = "not a mesh file";
+	else if (!current && !legacy)
+		problem = "unsupported mesh version";
+	else if (header->attributeCount == 0 || header->attributeCount > MESH_MAX_ATTRIBUTES)
+		problem = "bad attribute count";
+	else if (header->indexType != GL_UNSIGNED_SHORT && header->indexType != GL_UNSIGNED_INT)
+		problem = "bad index type";
+	else if (header->vertexOffset % MESH_ALIGNMENT || header->indexOffset % MESH_ALIGNMENT)
+		problem = "misaligned data block";
+	else if (header->vertexOffset + header->vertexSize > size || header->indexOffset + header->indexSize > size ||
+			 header->submeshOffset + (uint64_t)header->submeshCount * sizeof(MeshSubmesh) > size ||
+			 (lodCount > 0 && header->lodOffset + (uint64_t)lodCount * sizeof(MeshLod) > size))
+		problem = "truncated file";
+	else if ((uint64_t)header->vertexCount * header->vertexStride != header->vertexSize ||
+			 (uint64_t)header->indexCount * (header->indexType == GL_UNSIGNED_SHORT ? 2 : 4) != header->indexSize)
+		problem = "inconsistent block sizes";
+
+	for (uint32_t i = 0; i < header->attributeCount && !problem; i++)
+	{
+		uint32_t attributeSize = UAttributeSize(header->attributes[i]);
+		if (attributeSize == 0 || (uint64_t)header->attributes[i].offset + attributeSize > header->vertexStride)
+			problem = "bad vertex attribute";
+	}
+
+	const MeshSubmesh *submeshes = (const MeshSubmesh *)(mesh.file.data + header->submeshOffset);
+	for (uint32_t i = 0; i < header->submeshCount && !problem; i++)
+	{
+		if ((uint64_t)submeshes[i].firstIndex + submeshes[i].indexCount > header->indexCount)
+			problem = "bad submesh range";
+	}
+
+	const MeshLod *lods = lodCount > 0 && !problem ? (const MeshLod *)(mesh.file.data + header->lodOffset) : nullptr;
+	for (uint32_t i = 0; i < lodCount && !problem; i++)
+	{
+		if ((uint64_t)lods[i].firstIndex + lods[i].indexCount > header->indexCount || lods[i].indexCount % 3)
+			problem = "bad level of detail range";
+	}
+
+	// every consumer indexes per-vertex arrays with these, so one stray index would reach past them
+	if (!problem)
+	{
+		const unsigned char *indices = mesh.file.data + header->indexOffset;
+		uint32_t largest = 0;
+		for (uint32_t i = 0; i < header->indexCount; i++)
+		{
+			uint32_t index = header->indexType == GL_UNSIGNED_SHORT ? ((const uint16_t *)indices)[i] : ((const uint32_t *)indices)[i];
+			largest = max(largest, index);
+		}
+		if (header->indexCount > 0 && largest >= header->vertexCount)
+			problem = "index past the last vertex";
+	}
+
+	if (problem)
+	{
+		cout << "Cannot load mesh " << path << ": " << problem << endl;
+		UUnmapFile(mesh.file);
+		return false;
+	}
+
+	mesh.header = header;
+	mesh.submeshes = submeshes;
+	mesh.lods = lods;
+	mesh.lodCount = lodCount;
+	mesh.vertices = mesh.file.data + header->vertexOffset;
+	mesh.indices = mesh.file.data + header->indexOffset;
+	return true;
+}
+
+void UCloseMesh(MeshView &mesh)
+{
+	UUnmapFile(mesh.file);
+	mesh.header = nullptr;
+	mesh.submeshes = nullptr;
+	mesh.lods = nullptr;
+	mesh.lodCount = 0;
+	mesh.vertices = nullptr;
+	mesh.indices = nullptr;
+}
+
+/* Writes a mesh, choosing 16-bit indices whenever the vertex count allows it */
+bool UWriteMesh(const string &path, const MeshData &mesh)
+{
+	if (mesh.attributes.empty() || mesh.attributes.size() > MESH_MAX_ATTRIBUTES || mesh.vertexStride == 0)
+	{
+		cout << "Mesh has no usable vertex layout" << endl;
+		return false;
+	}
+
+	MeshHeader header;
+	memset(&header, 0, sizeof(header));
+
+	uint32_t vertexCount = (uint32_t)(mesh.vertices.size() / mesh.vertexStride);
+	bool shortIndices = vertexCount <= 0xFFFF;
+
+	header.magic = MESH_MAGIC;
+	header.version = MESH_VERSION;
+	header.headerSize = sizeof(MeshHeader);
+	memcpy(header.boundsMin, mesh.boundsMin, sizeof(header.boundsMin));
+	memcpy(header.boundsMax, mesh.boundsMax, sizeof(header.boundsMax));
+
+	header.vertexCount = vertexCount;
+	header.vertexStride = mesh.vertexStride;
+	header.indexCount = (uint32_t)mesh.indices.size();
+	header.indexType = shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	header.submeshCount = (uint32_t)mesh.submeshes.size();
+	header.attributeCount = (uint32_t)mesh.attributes.size();
+	for (size_t i = 0; i < mesh.attributes.size(); i++)
+		header.attributes[i] = mesh.attributes[i];
+
+	header.lodCount = (uint32_t)mesh.lods.size();
+
+	header.submeshOffset = sizeof(MeshHeader);
+	header.lodOffset = header.submeshOffset + header.submeshCount * sizeof(MeshSubmesh);
+	header.vertexOffset = UAlignUp(header.lodOffset + header.lodCount * sizeof(MeshLod), MESH_ALIGNMENT);
+	header.vertexSize = (uint64_t)vertexCount * mesh.vertexStride;
+	header.indexOffset = UAlignUp(header.vertexOffset + header.vertexSize, MESH_ALIGNMENT);
+	header.indexSize = (uint64_t)header.indexCount * (shortIndices ? 2 : 4);
+
+	ofstream file(path, ios::binary);
+	if (!file)
+	{
+		cout << "Cannot write " << path << endl;
+		return false;
+	}
+
+	static const char padding[MESH_ALIGNMENT] = {0};
+
+	file.write((const char *)&header, sizeof(header));
+	file.write((const char *)mesh.submeshes.data(), header.submeshCount * sizeof(MeshSubmesh));
+	file.write((const char *)mesh.lods.data(), header.lodCount * sizeof(MeshLod));
+	file.write(padding, header.vertexOffset - (uint64_t)file.tellp());
+	file.write((const char *)mesh.vertices.data(), header.vertexSize);
+	file.write(padding, header.indexOffset - (uint64_t)file.tellp());
+
+	if (shortIndices)
+	{
+		vector<uint16_t> narrow(mesh.indices.begin(), mesh.indices.end());
+		file.write((const char *)narrow.data(), header.indexSize);
+	}
+	else
+	{
+		file.write((const char *)mesh.indices.data(), header.indexSize);
+	}
+
+	return (bool)file;
+}
@@ -0,0 +1,138 @@
+/*
+ * MeshFile.h
+ *
+ *  Versioned binary mesh container, loaded with mmap and handed straight to GL
+ *
+ *  Layout (little-endian):
+ *    MeshHeader | MeshSubmesh[submeshCount] | MeshLod[lodCount] | pad | vertex block | pad | index block
+ *  Blocks start on MESH_ALIGNMENT byte boundaries; vertices are interleaved with the
+ *  stride and attribute layout recorded in the header. The index block holds every level
+ *  of detail after each other, all over the same vertices; version 1 files have one level.
+ */
+
+#ifndef MESHFILE_H
+#define MESHFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#define MESH_MAGIC 0x4853454Du // "MESH"
+#define MESH_VERSION 2u
+#define MESH_ALIGNMENT 64u
+#define MESH_MAX_ATTRIBUTES 8
+
+/* One vertex attribute, described the way glVertexAttribPointer wants it */
+struct MeshAttribute
+{
+	uint32_t location;	 // shader attribute location (0 position, 1 normal, 2 texture coordinate)
+	uint32_t components; // 1 to 4, or GL_BGRA
+	uint32_t type;		 // GL_FLOAT, GL_HALF_FLOAT, GL_SHORT, ...
+	uint32_t normalized; // GL_TRUE for normalized integer formats
+	uint32_t offset;	 // byte offset inside the vertex
+	uint32_t reserved;
+};
+
+/* Index range drawn with one material */
+struct MeshSubmesh
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t material; // material slot, resolved by the renderer
+	uint32_t reserved;
+	float boundsMin[3];
+	float boundsMax[3];
+};
+
+/* One level of detail: an index range of the index block and how far it strays from the full mesh */
+struct MeshLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error; // quadric estimate of the distance to the full detail surface, in object units; 0 for level 0
+	uint32_t reserved;
+};
+
+/* File header */
+struct MeshHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t headerSize; // sizeof(MeshHeader), lets older loaders skip newer fields
+	uint32_t flags;
+
+	float boundsMin[3];
+	float boundsMax[3];
+
+	uint32_t vertexCount;
+	uint32_t vertexStride;
+	uint64_t vertexOffset;
+	uint64_t vertexSize;
+
+	uint32_t indexCount;
+	uint32_t indexType; // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	uint64_t indexOffset;
+	uint64_t indexSize;
+
+	uint32_t submeshCount;
+	uint32_t attributeCount;
+	uint64_t submeshOffset;
+
+	MeshAttribute attributes[MESH_MAX_ATTRIBUTES];
+
+	// version 2
+	uint32_t lodCount; // 0, or every level with the full detail first
+	uint32_t reserved;
+	uint64_t lodOffset;
+};
+
+#define MESH_V1_HEADER_SIZE offsetof(MeshHeader, lodCount) // version 1 headers end before the LOD table
+
+/* Read-only memory mapping of a whole file */
+struct MappedFile
+{
+	const unsigned char *data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void *fileHandle = nullptr;
+	void *mappingHandle = nullptr;
+#else
+	int descriptor = -1;
+#endif
+};
+
+/* A validated mesh file: pointers into the mapping, nothing is copied */
+struct MeshView
+{
+	MappedFile file;
+	const MeshHeader *header = nullptr;
+	const MeshSubmesh *submeshes = nullptr;
+	const MeshLod *lods = nullptr; // lodCount of them, nullptr for a single level
+	uint32_t lodCount = 0;
+	const void *vertices = nullptr;
+	const void *indices = nullptr;
+};
+
+/* In-memory mesh used by the writers (converter, exporter, optimizers) */
+struct MeshData
+{
+	uint32_t vertexStride = 0;
+	std::vector<MeshAttribute> attributes;
+	std::vector<unsigned char> vertices; // interleaved, vertexStride bytes each
+	std::vector<uint32_t> indices;		// with levels of detail, every level after each other
+	std::vector<MeshSubmesh> submeshes; // within level 0
+	std::vector<MeshLod> lods;			// empty for a single level, else level 0 first
+	float boundsMin[3] = {0.0f, 0.0f, 0.0f};
+	float boundsMax[3] = {0.0f, 0.0f, 0.0f};
+};
+
+bool UMapFile(const std::string &path, MappedFile &file);
+void UUnmapFile(MappedFile &file);
+
+bool UOpenMesh(const std::string &path, MeshView &mesh);
+void UCloseMesh(MeshView &mesh);
+bool UWriteMesh(const std::string &path, const MeshData &mesh);
+
+#endif
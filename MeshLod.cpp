@@ -0,0 +1,580 @@
+/*
+ * MeshLod.cpp
+ *
+ *  Levels of detail: an offline quadric error edge collapse builds coarser index lists over
+ *  the mesh's own vertices, each with the object space error it adds, and at runtime every
+ *  instance draws the coarsest level whose error projects below a pixel threshold
+ */
+
+/* Header Inclusions */
+#include "MeshLod.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace std; // standard namespace
+
+#define LOD_EDGE_WEIGHT 10.0 // how strongly borders and UV / normal seams hold their line, against the surface
+#define LOD_MAX_FLIP 0.25f	 // smallest cosine between a triangle's normal before and after a collapse
+
+/* What a position may do during one pass */
+enum LodVertexKind
+{
+	LOD_MANIFOLD, // inside a surface, one set of attributes: collapses along any edge
+	LOD_BORDER,	  // on an open edge: collapses along it only, so the outline stays
+	LOD_SEAM,	  // two sets of attributes on either side of a seam: collapses along the seam only
+	LOD_LOCKED,	  // corners, seam ends, non-manifold spots: stays
+};
+
+/* Sum of squared distances to planes, weighted, as the symmetric 4x4 matrix of Garland and Heckbert */
+struct LodQuadric
+{
+	double a2 = 0, b2 = 0, c2 = 0, ab = 0, ac = 0, bc = 0, ad = 0, bd = 0, cd = 0, d2 = 0;
+	double weight = 0; // surface area gathered, to turn the sum into a mean
+
+	void addPlane(const glm::vec3 &n, float d, double w)
+	{
+		a2 += w * n.x * n.x;
+		b2 += w * n.y * n.y;
+		c2 += w * n.z * n.z;
+		ab += w * n.x * n.y;
+		ac += w * n.x * n.z;
+		bc += w * n.y * n.z;
+		ad += w * n.x * d;
+		bd += w * n.y * d;
+		cd += w * n.z * d;
+		d2 += w * d * d;
+	}
+
+	void add(const LodQuadric &q)
+	{
+		a2 += q.a2, b2 += q.b2, c2 += q.c2, ab += q.ab, ac += q.ac, bc += q.bc;
+		ad += q.ad, bd += q.bd, cd += q.cd, d2 += q.d2, weight += q.weight;
+	}
+
+	// mean squared distance of 'p' to the gathered planes
+	double error(const glm::vec3 &p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double sum = a2 * x * x + b2 * y * y + c2 * z * z + 2 * (ab * x * y + ac * x * z + bc * y * z) + 2 * (ad * x + bd * y + cd * z) + d2;
+		return max(sum, 0.0) / max(weight, 1e-12);
+	}
+};
+
+static uint64_t UEdgeKey(uint32_t a, uint32_t b)
+{
+	return ((uint64_t)a << 32) | b;
+}
+
+/* Parses --lod, --lod-error P, --lod-fade and --lod-levels N */
+bool UParseLodArgs(int argc, char *argv[], LodOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--lod")
+		{
+			options.enabled = true;
+		}
+		else if (arg == "--lod-error")
+		{
+			options.pixelError = i + 1 < argc ? (float)atof(argv[++i]) : 0.0f;
+			if (options.pixelError <= 0.0f)
+			{
+				cout << "--lod-error expects a positive number of pixels" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--lod-fade")
+		{
+			options.enabled = true;
+			options.fade = true;
+		}
+		else if (arg == "--lod-levels")
+		{
+			options.levels = i + 1 < argc ? atoi(argv[++i]) : 0;
+			if (options.levels < 2 || options.levels > LOD_MAX_LEVELS)
+			{
+				cout << "--lod-levels expects 2 to " << LOD_MAX_LEVELS << " levels" << endl;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/* Edge collapse state over one mesh: positions shared by several vertices (wedges) collapse together */
+class LodSimplifier
+{
+public:
+	LodSimplifier(const MeshData &mesh, const MeshAttribute &position);
+
+	// one pass of independent collapses removing about 'budget' triangles; false when nothing could collapse
+	bool pass(size_t budget);
+
+	vector<uint32_t> indices; // the current level
+	double error = 0.0;		  // largest collapse error so far, squared
+
+private:
+	void classify();
+	bool collapse(uint32_t from, uint32_t to, double cost);
+
+	vector<glm::vec3> positions;	// per vertex
+	vector<uint32_t> positionOf;	// per vertex, the first vertex at the same position
+	vector<uint32_t> nextWedge;		// per vertex, the next vertex at the same position, cyclic
+	vector<LodQuadric> quadrics;	// per position
+	vector<LodVertexKind> kinds;	// per position, this pass
+	vector<uint8_t> locked;			// per position, touched by a collapse this pass
+	vector<uint8_t> referenced;		// per vertex, used by the current level
+	vector<uint32_t> vertexRemap;	// per vertex, where a collapse sent it
+	unordered_set<uint64_t> borderEdges, seamEdges; // undirected position edges, smaller position first
+
+	// triangles around every position, this pass
+	vector<uint32_t> firstTriangle, triangles;
+};
+
+LodSimplifier::LodSimplifier(const MeshData &mesh, const MeshAttribute &position) : indices(mesh.indices)
+{
+	uint32_t vertexCount = (uint32_t)(mesh.vertices.size() / mesh.vertexStride);
+	positions.resize(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; v++)
+		memcpy(&positions[v], &mesh.vertices[(size_t)v * mesh.vertexStride + position.offset], sizeof(glm::vec3));
+
+	// vertices with identical positions are wedges of one position: split normals or texture coordinates
+	vector<uint32_t> order(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; v++)
+		order[v] = v;
+	auto less = [this](uint32_t a, uint32_t b)
+	{
+		const glm::vec3 &p = positions[a], &q = positions[b];
+		return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z != q.z ? p.z < q.z : a < b;
+	};
+	sort(order.begin(), order.end(), less);
+
+	positionOf.resize(vertexCount);
+	nextWedge.resize(vertexCount);
+	for (uint32_t i = 0; i < vertexCount;)
+	{
+		uint32_t end = i + 1;
+		while (end < vertexCount && positions[order[end]] == positions[order[i]])
+			end++;
+		for (uint32_t j = i; j < end; j++)
+		{
+			positionOf[order[j]] = order[i];
+			nextWedge[order[j]] = order[j + 1 < end ? j + 1 : i];
+		}
+		i = end;
+	}
+
+	// every triangle's plane, weighted by its area, on each of its corners
+	quadrics.resize(vertexCount);
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const glm::vec3 &p0 = positions[indices[i]], &p1 = positions[indices[i + 1]], &p2 = positions[indices[i + 2]];
+		glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(n);
+		if (length <= 0.0f)
+			continue;
+
+		n /= length;
+		LodQuadric q;
+		q.addPlane(n, -glm::dot(n, p0), 0.5 * length);
+		q.weight = 0.5 * length;
+		for (int c = 0; c < 3; c++)
+			quadrics[positionOf[indices[i + c]]].add(q);
+	}
+
+	// borders and seams hold their line through planes standing on them; they add no area
+	classify();
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		for (int e = 0; e < 3; e++)
+		{
+			uint32_t pa = positionOf[indices[i + e]], pb = positionOf[indices[i + (e + 1) % 3]];
+			uint64_t key = UEdgeKey(min(pa, pb), max(pa, pb));
+			if (!borderEdges.count(key) && !seamEdges.count(key))
+				continue;
+
+			const glm::vec3 &p0 = positions[indices[i]], &p1 = positions[indices[i + 1]], &p2 = positions[indices[i + 2]];
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			glm::vec3 edge = positions[pb] - positions[pa];
+			glm::vec3 n = glm::cross(edge, normal);
+			float length = glm::length(n);
+			if (length <= 0.0f)
+				continue;
+
+			n /= length;
+			LodQuadric q;
+			q.addPlane(n, -glm::dot(n, positions[pa]), LOD_EDGE_WEIGHT * glm::dot(edge, edge));
+			quadrics[pa].add(q);
+			quadrics[pb].add(q);
+		}
+	}
+}
+
+/* Triangles around every position, open edges and seams, and what every position may do */
+void LodSimplifier::classify()
+{
+	uint32_t vertexCount = (uint32_t)positions.size();
+
+	firstTriangle.assign(vertexCount + 1, 0);
+	referenced.assign(vertexCount, 0);
+	for (uint32_t index : indices)
+	{
+		firstTriangle[positionOf[index] + 1]++;
+		referenced[index] = 1;
+	}
+	for (uint32_t p = 0; p < vertexCount; p++)
+		firstTriangle[p + 1] += firstTriangle[p];
+	triangles.resize(indices.size());
+	vector<uint32_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+		triangles[fill[positionOf[indices[i]]]++] = (uint32_t)(i / 3);
+
+	// directed edges by vertex and by position; a position edge used twice in one direction is non-manifold
+	unordered_set<uint64_t> vertexEdges;
+	unordered_map<uint64_t, uint32_t> positionEdges;
+	vertexEdges.reserve(indices.size());
+	positionEdges.reserve(indices.size());
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		for (int e = 0; e < 3; e++)
+		{
+			uint32_t a = indices[i + e], b = indices[i + (e + 1) % 3];
+			vertexEdges.insert(UEdgeKey(a, b));
+			positionEdges[UEdgeKey(positionOf[a], positionOf[b])]++;
+		}
+	}
+
+	vector<uint32_t> borders(vertexCount, 0), seams(vertexCount, 0);
+	vector<uint8_t> nonManifold(vertexCount, 0);
+	borderEdges.clear();
+	seamEdges.clear();
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		for (int e = 0; e < 3; e++)
+		{
+			uint32_t a = indices[i + e], b = indices[i + (e + 1) % 3];
+			uint32_t pa = positionOf[a], pb = positionOf[b];
+			uint64_t key = UEdgeKey(min(pa, pb), max(pa, pb));
+
+			auto opposite = positionEdges.find(UEdgeKey(pb, pa));
+			if (positionEdges[UEdgeKey(pa, pb)] > 1 || (opposite != positionEdges.end() && opposite->second > 1))
+			{
+				nonManifold[pa] = nonManifold[pb] = 1;
+			}
+			else if (opposite == positionEdges.end())
+			{
+				borders[pa]++, borders[pb]++;
+				borderEdges.insert(key);
+			}
+			else if (!vertexEdges.count(UEdgeKey(b, a)))
+			{
+				// each side of a seam counts once, so a seam edge counts twice at either end
+				seams[pa]++, seams[pb]++;
+				seamEdges.insert(key);
+			}
+		}
+	}
+
+	kinds.assign(vertexCount, LOD_LOCKED);
+	for (uint32_t p = 0; p < vertexCount; p++)
+	{
+		if (positionOf[p] != p || nonManifold[p])
+			continue;
+
+		uint32_t wedges = 0;
+		uint32_t v = p;
+		do
+		{
+			wedges += referenced[v];
+			v = nextWedge[v];
+		} while (v != p);
+
+		if (borders[p] == 0 && seams[p] == 0 && wedges == 1)
+			kinds[p] = LOD_MANIFOLD;
+		else if (borders[p] == 2 && seams[p] == 0 && wedges == 1)
+			kinds[p] = LOD_BORDER;
+		else if (borders[p] == 0 && seams[p] == 4 && wedges == 2)
+			kinds[p] = LOD_SEAM;
+	}
+}
+
+/* Moves every wedge of position 'from' onto the wedge of 'to' it shares a triangle with; false when that is unsafe */
+bool LodSimplifier::collapse(uint32_t from, uint32_t to, double cost)
+{
+	if (locked[from] || locked[to])
+		return false;
+
+	// link condition: besides the triangles on the edge, the two fans must not meet, or the surface pinches
+	vector<uint32_t> around;
+	uint32_t shared = 0;
+	for (uint32_t t = firstTriangle[from]; t < firstTriangle[from + 1]; t++)
+	{
+		const uint32_t *corner = &indices[3 * triangles[t]];
+		bool onEdge = false;
+		for (int c = 0; c < 3; c++)
+			onEdge |= positionOf[corner[c]] == to;
+		shared += onEdge;
+		for (int c = 0; c < 3; c++)
+			if (positionOf[corner[c]] != from)
+				around.push_back(positionOf[corner[c]]);
+	}
+	sort(around.begin(), around.end());
+	around.erase(unique(around.begin(), around.end()), around.end());
+
+	uint32_t common = 0;
+	vector<uint32_t> seen;
+	for (uint32_t t = firstTriangle[to]; t < firstTriangle[to + 1]; t++)
+	{
+		const uint32_t *corner = &indices[3 * triangles[t]];
+		for (int c = 0; c < 3; c++)
+		{
+			uint32_t p = positionOf[corner[c]];
+			if (p != to && p != from && binary_search(around.begin(), around.end(), p) && find(seen.begin(), seen.end(), p) == seen.end())
+			{
+				seen.push_back(p);
+				common++;
+			}
+		}
+	}
+	if (shared == 0 || common > shared)
+		return false;
+
+	// no triangle left around 'from' may turn over
+	for (uint32_t t = firstTriangle[from]; t < firstTriangle[from + 1]; t++)
+	{
+		const uint32_t *corner = &indices[3 * triangles[t]];
+		glm::vec3 before[3], after[3];
+		bool onEdge = false;
+		for (int c = 0; c < 3; c++)
+		{
+			before[c] = after[c] = positions[corner[c]];
+			if (positionOf[corner[c]] == from)
+				after[c] = positions[to];
+			onEdge |= positionOf[corner[c]] == to;
+		}
+		if (onEdge)
+			continue;
+
+		glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+		glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+		if (glm::dot(n0, n1) < LOD_MAX_FLIP * glm::length(n0) * glm::length(n1))
+			return false;
+	}
+
+	// every wedge follows the triangles on the edge to its counterpart; a wedge with none, or two, would tear the seam
+	vector<pair<uint32_t, uint32_t>> moves;
+	uint32_t wedge = from;
+	do
+	{
+		if (referenced[wedge])
+		{
+			uint32_t target = ~0u;
+			for (uint32_t t = firstTriangle[from]; t < firstTriangle[from + 1]; t++)
+			{
+				const uint32_t *corner = &indices[3 * triangles[t]];
+				if (corner[0] != wedge && corner[1] != wedge && corner[2] != wedge)
+					continue;
+				for (int c = 0; c < 3; c++)
+				{
+					if (positionOf[corner[c]] != to)
+						continue;
+					if (target != ~0u && target != corner[c])
+						return false;
+					target = corner[c];
+				}
+			}
+			if (target == ~0u)
+				return false;
+			moves.push_back({wedge, target});
+		}
+		wedge = nextWedge[wedge];
+	} while (wedge != from);
+
+	for (const pair<uint32_t, uint32_t> &move : moves)
+		vertexRemap[move.first] = move.second;
+	quadrics[to].add(quadrics[from]);
+	error = max(error, cost);
+
+	// the fans of both ends changed, so nothing in them collapses again this pass
+	locked[from] = locked[to] = 1;
+	for (uint32_t p : around)
+		locked[p] = 1;
+	for (uint32_t t = firstTriangle[to]; t < firstTriangle[to + 1]; t++)
+		for (int c = 0; c < 3; c++)
+			locked[positionOf[indices[3 * triangles[t] + c]]] = 1;
+
+	return true;
+}
+
+bool LodSimplifier::pass(size_t budget)
+{
+	classify();
+
+	// the cheapest allowed collapse of every position
+	struct Candidate
+	{
+		double cost;
+		uint32_t from, to;
+	};
+	vector<Candidate> candidates;
+	for (uint32_t p = 0; p < positions.size(); p++)
+	{
+		if (positionOf[p] != p || kinds[p] == LOD_LOCKED)
+			continue;
+
+		Candidate best = {HUGE_VAL, p, ~0u};
+		for (uint32_t t = firstTriangle[p]; t < firstTriangle[p + 1]; t++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				uint32_t q = positionOf[indices[3 * triangles[t] + c]];
+				if (q == p)
+					continue;
+
+				uint64_t key = UEdgeKey(min(p, q), max(p, q));
+				if ((kinds[p] == LOD_BORDER && !borderEdges.count(key)) || (kinds[p] == LOD_SEAM && !seamEdges.count(key)))
+					continue;
+
+				double cost = quadrics[p].error(positions[q]);
+				if (cost < best.cost)
+					best = {cost, p, q};
+			}
+		}
+		if (best.to != ~0u)
+			candidates.push_back(best);
+	}
+	sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+		 { return a.cost < b.cost; });
+
+	locked.assign(positions.size(), 0);
+	vertexRemap.resize(positions.size());
+	for (uint32_t v = 0; v < vertexRemap.size(); v++)
+		vertexRemap[v] = v;
+
+	// an interior collapse removes two triangles, a border one; stop once the budget is met
+	size_t removed = 0;
+	uint32_t collapses = 0;
+	for (const Candidate &candidate : candidates)
+	{
+		if (removed >= budget)
+			break;
+		if (!collapse(candidate.from, candidate.to, candidate.cost))
+			continue;
+
+		removed += kinds[candidate.from] == LOD_BORDER ? 1 : 2;
+		collapses++;
+	}
+	if (collapses == 0)
+		return false;
+
+	// triangles keep their order, so each level inherits the full detail's vertex cache order
+	size_t kept = 0;
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		uint32_t a = vertexRemap[indices[i]], b = vertexRemap[indices[i + 1]], c = vertexRemap[indices[i + 2]];
+		if (positionOf[a] == positionOf[b] || positionOf[b] == positionOf[c] || positionOf[a] == positionOf[c])
+			continue;
+		indices[kept++] = a;
+		indices[kept++] = b;
+		indices[kept++] = c;
+	}
+	indices.resize(kept);
+	return true;
+}
+
+/* Levels halve the triangles until one would not remove LOD_MIN_REDUCTION of them; all share the vertex block */
+bool UBuildMeshLods(MeshData &mesh, int maxLevels)
+{
+	mesh.lods.clear();
+
+	const MeshAttribute *position = NULL;
+	for (const MeshAttribute &attribute : mesh.attributes)
+		if (attribute.location == 0 && attribute.type == GL_FLOAT && attribute.components >= 3)
+			position = &attribute;
+	if (!position || mesh.vertexStride == 0 || mesh.indices.size() < 6)
+		return false;
+
+	uint32_t fullCount = (uint32_t)mesh.indices.size();
+	vector<uint32_t> levels = mesh.indices;
+	vector<MeshLod> lods = {{0, fullCount, 0.0f, 0}};
+
+	LodSimplifier simplifier(mesh, *position);
+	size_t previous = fullCount / 3;
+	while ((int)lods.size() < maxLevels)
+	{
+		size_t target = (size_t)(previous * LOD_LEVEL_RATIO);
+		bool progress = true;
+		while (simplifier.indices.size() / 3 > target && progress)
+			progress = simplifier.pass(simplifier.indices.size() / 3 - target);
+
+		size_t count = simplifier.indices.size() / 3;
+		if (count == 0 || count > previous * (1.0f - LOD_MIN_REDUCTION))
+			break;
+
+		MeshLod lod = {(uint32_t)levels.size(), (uint32_t)simplifier.indices.size(), (float)sqrt(simplifier.error), 0};
+		levels.insert(levels.end(), simplifier.indices.begin(), simplifier.indices.end());
+		lods.push_back(lod);
+		previous = count;
+		if (!progress)
+			break;
+	}
+
+	if (lods.size() < 2)
+		return false;
+
+	mesh.indices.swap(levels);
+	mesh.lods.swap(lods);
+	return true;
+}
+
+void UPrintMeshLodReport(const MeshData &mesh)
+{
+	if (mesh.lods.empty())
+	{
+		cout << "[Mesh LOD] no coarser level could be built" << endl;
+		return;
+	}
+
+	cout << "[Mesh LOD] " << mesh.lods.size() << " levels" << endl;
+	for (size_t i = 0; i < mesh.lods.size(); i++)
+		cout << "  level " << i << ": " << mesh.lods[i].indexCount / 3 << " triangles, error " << mesh.lods[i].error << endl;
+}
+
+float ULodPixelsPerUnit(const glm::mat4 &projection, float viewportHeight, float depth, float radius, float scale)
+{
+	float pixels = scale * projection[1][1] * viewportHeight * 0.5f;
+
+	// perspective shrinks with the distance of the nearest point of the bounds; orthographic keeps one scale
+	if (projection[3][3] == 0.0f)
+		pixels /= max(depth - radius, 1e-3f);
+	return pixels;
+}
+
+LodSelection USelectLod(const vector<MeshLod> &lods, const LodOptions &options, float pixelsPerUnit)
+{
+	LodSelection selection;
+	if (!options.enabled)
+		return selection;
+
+	while (selection.level + 1 < (int)lods.size() && lods[selection.level + 1].error * pixelsPerUnit <= options.pixelError)
+		selection.level++;
+
+	// within twice the threshold the next level fades in, reaching all pixels just as it is selected
+	if (options.fade && selection.level + 1 < (int)lods.size())
+	{
+		float next = lods[selection.level + 1].error * pixelsPerUnit;
+		if (next < 2.0f * options.pixelError)
+			selection.fade = (2.0f * options.pixelError - next) / options.pixelError;
+	}
+	return selection;
+}
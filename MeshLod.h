@@ -0,0 +1,48 @@
+/*
+ * MeshLod.h
+ *
+ *  Levels of detail: an offline quadric error edge collapse builds coarser index lists over
+ *  the mesh's own vertices, each with the object space error it adds, and at runtime every
+ *  instance draws the coarsest level whose error projects below a pixel threshold
+ */
+
+#ifndef MESHLOD_H
+#define MESHLOD_H
+
+#include <cstdint>
+#include <vector>
+#include <GL/glm/glm.hpp>
+
+#include "MeshFile.h"
+
+#define LOD_MAX_LEVELS 8	   // levels stored in a mesh, full detail included
+#define LOD_LEVEL_RATIO 0.5f   // each level aims at this share of the previous one's triangles
+#define LOD_MIN_REDUCTION 0.1f // a level removing less than this share of triangles ends the chain
+
+/* Command line options of the LOD system */
+struct LodOptions
+{
+	bool enabled = false;	// --lod picks a level per instance; off always draws the full detail
+	float pixelError = 1.0f; // --lod-error P largest projected error accepted, in pixels
+	bool fade = false;		// --lod-fade dithers between neighbouring levels instead of popping
+	int levels = LOD_MAX_LEVELS; // --lod-levels N levels built for meshes that come without them
+};
+
+/* The level one instance draws; with a fade it is drawn twice, blended by a dither */
+struct LodSelection
+{
+	int level = 0;
+	float fade = 0.0f; // 0 no fade, else the share of pixels handed to level + 1
+};
+
+bool UParseLodArgs(int argc, char *argv[], LodOptions &options);
+
+// appends up to 'maxLevels' - 1 coarser levels to the index block and fills mesh.lods; false when nothing could be built
+bool UBuildMeshLods(MeshData &mesh, int maxLevels);
+void UPrintMeshLodReport(const MeshData &mesh);
+
+// screen pixels per object unit at the instance: 'depth' is the view depth of its bounds' centre, 'radius' their radius
+float ULodPixelsPerUnit(const glm::mat4 &projection, float viewportHeight, float depth, float radius, float scale);
+LodSelection USelectLod(const std::vector<MeshLod> &lods, const LodOptions &options, float pixelsPerUnit);
+
+#endif
@@ -0,0 +1,506 @@
+/*
+ * MeshOptimize.cpp
+ *
+ *  Mesh clean-up and reordering: welding, degenerate / duplicate removal, vertex cache,
+ *  overdraw and vertex fetch ordering
+ */
+
+/* Header Inclusions */
+#include "MeshOptimize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <unordered_set>
+
+using namespace std; // standard namespace
+
+/* FIFO cache simulation with timestamps: a vertex hits while fewer than cacheSize misses happened since it was loaded */
+MeshCacheStats UAnalyzeVertexCache(const vector<uint32_t> &indices, uint32_t cacheSize)
+{
+	MeshCacheStats stats;
+	stats.triangles = (uint32_t)(indices.size() / 3);
+
+	uint32_t vertexCount = indices.empty() ? 0 : *max_element(indices.begin(), indices.end()) + 1;
+	vector<uint32_t> loadedAt(vertexCount, 0);
+	vector<bool> referenced(vertexCount, false);
+
+	uint32_t timestamp = cacheSize + 1, misses = 0;
+	for (uint32_t index : indices)
+	{
+		if (timestamp - loadedAt[index] > cacheSize)
+		{
+			loadedAt[index] = timestamp++;
+			misses++;
+		}
+		if (!referenced[index])
+		{
+			referenced[index] = true;
+			stats.vertices++;
+		}
+	}
+
+	stats.acmr = stats.triangles ? (double)misses / stats.triangles : 0.0;
+	stats.atvr = stats.vertices ? (double)misses / stats.vertices : 0.0;
+	return stats;
+}
+
+/* The float position attribute, NULL when positions are stored in another format */
+static const MeshAttribute *UFloatPosition(const MeshData &mesh)
+{
+	for (const MeshAttribute &attribute : mesh.attributes)
+		if (attribute.location == 0 && attribute.type == GL_FLOAT && attribute.components >= 3)
+			return &attribute;
+	return NULL;
+}
+
+static void UReadPosition(const MeshData &mesh, const MeshAttribute &position, uint32_t vertex, float out[3])
+{
+	memcpy(out, &mesh.vertices[(size_t)vertex * mesh.vertexStride + position.offset], 3 * sizeof(float));
+}
+
+/* Points every index at the first vertex with identical bytes */
+static uint32_t UWeldVertices(MeshData &mesh)
+{
+	size_t vertexCount = mesh.vertices.size() / mesh.vertexStride;
+	size_t tableSize = 1;
+	while (tableSize < vertexCount * 2)
+		tableSize *= 2;
+
+	// open addressing over vertex ids, hashed and compared on the raw vertex bytes
+	vector<uint32_t> table(tableSize, ~0u);
+	vector<uint32_t> remap(vertexCount);
+	uint32_t welded = 0;
+
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		const unsigned char *bytes = &mesh.vertices[v * mesh.vertexStride];
+
+		uint32_t hash = 2166136261u;
+		for (uint32_t i = 0; i < mesh.vertexStride; i++)
+			hash = (hash ^ bytes[i]) * 16777619u;
+
+		size_t slot = hash & (tableSize - 1);
+		while (table[slot] != ~0u && memcmp(&mesh.vertices[(size_t)table[slot] * mesh.vertexStride], bytes, mesh.vertexStride) != 0)
+			slot = (slot + 1) & (tableSize - 1);
+
+		if (table[slot] == ~0u)
+			table[slot] = (uint32_t)v;
+		else
+			welded++;
+		remap[v] = table[slot];
+	}
+
+	for (uint32_t &index : mesh.indices)
+		index = remap[index];
+	return welded;
+}
+
+/* Rotation of a triangle that starts at its smallest index, so equal triangles compare equal */
+struct TriangleKey
+{
+	uint32_t a, b, c;
+
+	bool operator==(const TriangleKey &other) const { return a == other.a && b == other.b && c == other.c; }
+};
+
+struct TriangleKeyHash
+{
+	size_t operator()(const TriangleKey &key) const { return (size_t)key.a * 73856093u ^ (size_t)key.b * 19349663u ^ (size_t)key.c * 83492791u; }
+};
+
+/* Drops triangles with repeated vertices or zero area, and repeats of a triangle with the same winding */
+static void URemoveDegenerates(MeshData &mesh, MeshOptimizeReport &report)
+{
+	const MeshAttribute *position = UFloatPosition(mesh);
+	vector<uint32_t> kept;
+	kept.reserve(mesh.indices.size());
+
+	for (MeshSubmesh &submesh : mesh.submeshes)
+	{
+		unordered_set<TriangleKey, TriangleKeyHash> seen;
+		uint32_t first = (uint32_t)kept.size();
+
+		for (uint32_t i = submesh.firstIndex; i + 2 < submesh.firstIndex + submesh.indexCount; i += 3)
+		{
+			uint32_t a = mesh.indices[i], b = mesh.indices[i + 1], c = mesh.indices[i + 2];
+
+			bool degenerate = a == b || b == c || a == c;
+			if (!degenerate && position)
+			{
+				float p0[3], p1[3], p2[3];
+				UReadPosition(mesh, *position, a, p0);
+				UReadPosition(mesh, *position, b, p1);
+				UReadPosition(mesh, *position, c, p2);
+
+				float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+				float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+				float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+				degenerate = n[0] == 0.0f && n[1] == 0.0f && n[2] == 0.0f;
+			}
+			if (degenerate)
+			{
+				report.degenerateTriangles++;
+				continue;
+			}
+
+			TriangleKey key = a < b && a < c ? TriangleKey{a, b, c} : b < c ? TriangleKey{b, c, a} : TriangleKey{c, a, b};
+			if (!seen.insert(key).second)
+			{
+				report.duplicateTriangles++;
+				continue;
+			}
+
+			kept.push_back(a);
+			kept.push_back(b);
+			kept.push_back(c);
+		}
+
+		submesh.firstIndex = first;
+		submesh.indexCount = (uint32_t)kept.size() - first;
+	}
+
+	mesh.indices.swap(kept);
+}
+
+/* Forsyth's linear-speed vertex cache optimisation over one index range of local vertex ids */
+static void UOptimizeVertexCache(uint32_t *indices, size_t indexCount, uint32_t vertexCount)
+{
+	const uint32_t cacheSize = MESH_FORSYTH_CACHE_SIZE;
+	size_t triangleCount = indexCount / 3;
+
+	// triangles around every vertex, shrunk as triangles are emitted
+	vector<uint32_t> remaining(vertexCount, 0), adjacencyStart(vertexCount + 1, 0);
+	for (size_t i = 0; i < indexCount; i++)
+		remaining[indices[i]]++;
+	for (uint32_t v = 0; v < vertexCount; v++)
+		adjacencyStart[v + 1] = adjacencyStart[v] + remaining[v];
+
+	vector<uint32_t> adjacency(indexCount), fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+	for (size_t i = 0; i < indexCount; i++)
+		adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+
+	// score tables: recently used vertices, then vertices with few triangles left
+	float cacheScore[cacheSize];
+	for (uint32_t position = 0; position < cacheSize; position++)
+		cacheScore[position] = position < 3 ? 0.75f : powf(1.0f - (position - 3) / (float)(cacheSize - 3), 1.5f);
+
+	vector<int> cachePosition(vertexCount, -1);
+	vector<float> vertexScore(vertexCount), triangleScore(triangleCount, 0.0f);
+	auto score = [&](uint32_t v) {
+		if (remaining[v] == 0)
+			return -1.0f;
+		return (cachePosition[v] >= 0 ? cacheScore[cachePosition[v]] : 0.0f) + 2.0f / sqrtf((float)remaining[v]);
+	};
+
+	for (uint32_t v = 0; v < vertexCount; v++)
+		vertexScore[v] = score(v);
+	for (size_t t = 0; t < triangleCount; t++)
+		triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+	vector<bool> emitted(triangleCount, false);
+	vector<uint32_t> output;
+	output.reserve(indexCount);
+	vector<uint32_t> cache, nextCache;
+	size_t cursor = 0; // dead-end fallback walks the input order
+	int best = triangleCount ? 0 : -1;
+
+	while (best >= 0)
+	{
+		emitted[best] = true;
+		const uint32_t *triangle = &indices[best * 3];
+
+		// emit, and drop the triangle from its vertices' adjacency
+		nextCache.assign(triangle, triangle + 3);
+		for (int c = 0; c < 3; c++)
+		{
+			uint32_t v = triangle[c];
+			output.push_back(v);
+
+			uint32_t *list = &adjacency[adjacencyStart[v]];
+			for (uint32_t i = 0; i < remaining[v]; i++)
+			{
+				if (list[i] == (uint32_t)best)
+				{
+					list[i] = list[remaining[v] - 1];
+					break;
+				}
+			}
+			remaining[v]--;
+		}
+
+		// the emitted vertices move to the front of the LRU cache
+		for (uint32_t v : cache)
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+				nextCache.push_back(v);
+
+		for (size_t i = 0; i < nextCache.size(); i++)
+			cachePosition[nextCache[i]] = i < cacheSize ? (int)i : -1;
+
+		// rescore the cached vertices and their triangles, picking the best one as we go
+		best = -1;
+		float bestScore = -1.0f;
+		for (uint32_t v : nextCache)
+		{
+			float delta = score(v) - vertexScore[v];
+			vertexScore[v] += delta;
+
+			for (uint32_t i = 0; i < remaining[v]; i++)
+			{
+				uint32_t t = adjacency[adjacencyStart[v] + i];
+				triangleScore[t] += delta;
+			}
+		}
+		for (size_t i = 0; i < nextCache.size() && i < cacheSize; i++)
+		{
+			uint32_t v = nextCache[i];
+			for (uint32_t j = 0; j < remaining[v]; j++)
+			{
+				uint32_t t = adjacency[adjacencyStart[v] + j];
+				if (triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					best = (int)t;
+				}
+			}
+		}
+
+		if (nextCache.size() > cacheSize)
+			nextCache.resize(cacheSize);
+		cache.swap(nextCache);
+
+		// nothing left around the cache: continue with the next unused triangle
+		if (best < 0)
+		{
+			while (cursor < triangleCount && emitted[cursor])
+				cursor++;
+			best = cursor < triangleCount ? (int)cursor : -1;
+		}
+	}
+
+	memcpy(indices, output.data(), output.size() * sizeof(uint32_t));
+}
+
+/* Triangle misses of a FIFO cache over [first, last) triangles, written per triangle into 'misses' */
+static void USimulateCache(const uint32_t *indices, size_t first, size_t last, vector<uint32_t> &loadedAt, uint32_t &timestamp, vector<uint32_t> &misses)
+{
+	const uint32_t cacheSize = MESH_STATS_CACHE_SIZE;
+	for (size_t t = first; t < last; t++)
+	{
+		misses[t] = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			uint32_t v = indices[t * 3 + c];
+			if (timestamp - loadedAt[v] > cacheSize)
+			{
+				loadedAt[v] = timestamp++;
+				misses[t]++;
+			}
+		}
+	}
+}
+
+/* Tipsify-style overdraw pass (Sander et al.) over local vertex ids: split the cache-ordered triangles
+   into clusters at cache flushes and wherever the cluster's cache cost stays within the threshold, then
+   draw the clusters facing away from the mesh centre first so they occlude the rest */
+static void UOptimizeOverdraw(const MeshData &mesh, const MeshAttribute &position, const vector<uint32_t> &globalId, uint32_t *indices, size_t indexCount)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount < 2)
+		return;
+
+	vector<uint32_t> loadedAt(globalId.size(), 0), misses(triangleCount);
+	uint32_t timestamp = MESH_STATS_CACHE_SIZE + 1;
+	USimulateCache(indices, 0, triangleCount, loadedAt, timestamp, misses);
+
+	// hard boundaries: triangles that miss on all three vertices start over anyway
+	vector<size_t> hard;
+	for (size_t t = 0; t < triangleCount; t++)
+		if (t == 0 || misses[t] == 3)
+			hard.push_back(t);
+	hard.push_back(triangleCount);
+
+	// soft boundaries inside every hard cluster
+	vector<size_t> clusters;
+	for (size_t h = 0; h + 1 < hard.size(); h++)
+	{
+		size_t start = hard[h], end = hard[h + 1];
+
+		uint32_t clusterMisses = 0;
+		for (size_t t = start; t < end; t++)
+			clusterMisses += misses[t];
+		double threshold = (double)clusterMisses / (end - start) * MESH_OVERDRAW_THRESHOLD;
+
+		// moving the timestamp a whole cache ahead empties the cache without touching every vertex
+		timestamp += MESH_STATS_CACHE_SIZE + 1;
+		clusters.push_back(start);
+
+		uint32_t runningMisses = 0, runningTriangles = 0;
+		for (size_t t = start; t < end; t++)
+		{
+			USimulateCache(indices, t, t + 1, loadedAt, timestamp, misses);
+			runningMisses += misses[t];
+			runningTriangles++;
+
+			if (t + 1 < end && (double)runningMisses / runningTriangles <= threshold)
+			{
+				// a cluster that is already this cheap can be moved on its own
+				clusters.push_back(t + 1);
+				timestamp += MESH_STATS_CACHE_SIZE + 1;
+				runningMisses = runningTriangles = 0;
+			}
+		}
+	}
+	clusters.push_back(triangleCount);
+
+	// centroid of the whole range, weighted by triangle area
+	struct Cluster
+	{
+		size_t start, end;
+		float centroid[3];
+		float normal[3];
+		float area;
+		float sortKey;
+	};
+	vector<Cluster> sorted(clusters.size() - 1);
+	float meshCentroid[3] = {0, 0, 0}, meshArea = 0.0f;
+
+	for (size_t i = 0; i + 1 < clusters.size(); i++)
+	{
+		Cluster &cluster = sorted[i];
+		cluster = {clusters[i], clusters[i + 1], {0, 0, 0}, {0, 0, 0}, 0.0f, 0.0f};
+
+		for (size_t t = cluster.start; t < cluster.end; t++)
+		{
+			float p[3][3];
+			for (int c = 0; c < 3; c++)
+				UReadPosition(mesh, position, globalId[indices[t * 3 + c]], p[c]);
+
+			float e1[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+			float e2[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+			float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+			float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				cluster.centroid[axis] += area * (p[0][axis] + p[1][axis] + p[2][axis]) / 3.0f;
+				cluster.normal[axis] += n[axis];
+			}
+			cluster.area += area;
+		}
+
+		for (int axis = 0; axis < 3; axis++)
+			meshCentroid[axis] += cluster.centroid[axis];
+		meshArea += cluster.area;
+
+		if (cluster.area > 0.0f)
+			for (int axis = 0; axis < 3; axis++)
+				cluster.centroid[axis] /= cluster.area;
+	}
+
+	for (int axis = 0; axis < 3; axis++)
+		meshCentroid[axis] = meshArea > 0.0f ? meshCentroid[axis] / meshArea : 0.0f;
+
+	for (Cluster &cluster : sorted)
+	{
+		float length = sqrtf(cluster.normal[0] * cluster.normal[0] + cluster.normal[1] * cluster.normal[1] + cluster.normal[2] * cluster.normal[2]);
+		cluster.sortKey = 0.0f;
+		for (int axis = 0; length > 0.0f && axis < 3; axis++)
+			cluster.sortKey += (cluster.centroid[axis] - meshCentroid[axis]) * cluster.normal[axis] / length;
+	}
+
+	stable_sort(sorted.begin(), sorted.end(), [](const Cluster &a, const Cluster &b) { return a.sortKey > b.sortKey; });
+
+	vector<uint32_t> output;
+	output.reserve(indexCount);
+	for (const Cluster &cluster : sorted)
+		output.insert(output.end(), indices + cluster.start * 3, indices + cluster.end * 3);
+	memcpy(indices, output.data(), output.size() * sizeof(uint32_t));
+}
+
+/* Renumbers vertices in the order the index buffer first uses them, dropping unused ones */
+static void UOptimizeVertexFetch(MeshData &mesh)
+{
+	size_t vertexCount = mesh.vertices.size() / mesh.vertexStride;
+	vector<uint32_t> remap(vertexCount, ~0u);
+	vector<unsigned char> vertices;
+	vertices.reserve(mesh.vertices.size());
+
+	uint32_t next = 0;
+	for (uint32_t &index : mesh.indices)
+	{
+		if (remap[index] == ~0u)
+		{
+			remap[index] = next++;
+			vertices.insert(vertices.end(), &mesh.vertices[(size_t)index * mesh.vertexStride], &mesh.vertices[(size_t)index * mesh.vertexStride] + mesh.vertexStride);
+		}
+		index = remap[index];
+	}
+
+	mesh.vertices.swap(vertices);
+}
+
+/* Runs every pass in order; submesh ranges stay in place and are only reordered internally */
+void UOptimizeMesh(MeshData &mesh, MeshOptimizeReport &report)
+{
+	report = MeshOptimizeReport();
+	if (mesh.vertexStride == 0 || mesh.indices.empty())
+		return;
+
+	// a mesh without submeshes is treated as one range
+	if (mesh.submeshes.empty())
+	{
+		MeshSubmesh whole = {0, (uint32_t)mesh.indices.size(), 0, 0, {0, 0, 0}, {0, 0, 0}};
+		memcpy(whole.boundsMin, mesh.boundsMin, sizeof(whole.boundsMin));
+		memcpy(whole.boundsMax, mesh.boundsMax, sizeof(whole.boundsMax));
+		mesh.submeshes.push_back(whole);
+	}
+
+	report.before = UAnalyzeVertexCache(mesh.indices, MESH_STATS_CACHE_SIZE);
+
+	report.weldedVertices = UWeldVertices(mesh);
+	URemoveDegenerates(mesh, report);
+
+	const MeshAttribute *position = UFloatPosition(mesh);
+	report.overdrawSorted = position != NULL;
+
+	// per submesh, on local vertex ids so the work is proportional to the submesh
+	size_t vertexCount = mesh.vertices.size() / mesh.vertexStride;
+	vector<uint32_t> localId(vertexCount, ~0u), globalId;
+	for (const MeshSubmesh &submesh : mesh.submeshes)
+	{
+		uint32_t *indices = mesh.indices.data() + submesh.firstIndex;
+
+		globalId.clear();
+		for (uint32_t i = 0; i < submesh.indexCount; i++)
+		{
+			if (localId[indices[i]] == ~0u)
+			{
+				localId[indices[i]] = (uint32_t)globalId.size();
+				globalId.push_back(indices[i]);
+			}
+			indices[i] = localId[indices[i]];
+		}
+
+		UOptimizeVertexCache(indices, submesh.indexCount, (uint32_t)globalId.size());
+		if (position)
+			UOptimizeOverdraw(mesh, *position, globalId, indices, submesh.indexCount);
+
+		for (uint32_t i = 0; i < submesh.indexCount; i++)
+			indices[i] = globalId[indices[i]];
+		for (uint32_t v : globalId)
+			localId[v] = ~0u;
+	}
+
+	UOptimizeVertexFetch(mesh);
+	report.after = UAnalyzeVertexCache(mesh.indices, MESH_STATS_CACHE_SIZE);
+}
+
+void UPrintMeshOptimizeReport(const MeshOptimizeReport &report)
+{
+	cout << "[Mesh optimize] welded " << report.weldedVertices << " vertices, removed " << report.degenerateTriangles << " degenerate and "
+		 << report.duplicateTriangles << " duplicate triangles" << (report.overdrawSorted ? "" : ", overdraw order skipped (no float positions)") << endl;
+	cout << "  before: " << report.before.triangles << " triangles, " << report.before.vertices << " vertices, ACMR " << report.before.acmr << ", ATVR " << report.before.atvr << endl;
+	cout << "  after:  " << report.after.triangles << " triangles, " << report.after.vertices << " vertices, ACMR " << report.after.acmr << ", ATVR " << report.after.atvr << endl;
+}
@@ -0,0 +1,44 @@
+/*
+ * MeshOptimize.h
+ *
+ *  Mesh clean-up and reordering: welding, degenerate / duplicate removal, vertex cache,
+ *  overdraw and vertex fetch ordering
+ */
+
+#ifndef MESHOPTIMIZE_H
+#define MESHOPTIMIZE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "MeshFile.h"
+
+#define MESH_STATS_CACHE_SIZE 16	// FIFO cache simulated for the ACMR / ATVR figures
+#define MESH_FORSYTH_CACHE_SIZE 32	// LRU cache modelled by the triangle ordering
+#define MESH_OVERDRAW_THRESHOLD 1.05 // cache cost accepted for better overdraw order
+
+/* Post-transform vertex cache efficiency of an index list */
+struct MeshCacheStats
+{
+	uint32_t triangles = 0;
+	uint32_t vertices = 0; // distinct vertices referenced
+	double acmr = 0.0;	   // cache misses per triangle, 0.5 is ideal for a regular grid
+	double atvr = 0.0;	   // cache misses per vertex, 1.0 is ideal
+};
+
+/* What the optimizer changed */
+struct MeshOptimizeReport
+{
+	uint32_t weldedVertices = 0;
+	uint32_t degenerateTriangles = 0;
+	uint32_t duplicateTriangles = 0;
+	bool overdrawSorted = false; // only possible with float positions
+	MeshCacheStats before;
+	MeshCacheStats after;
+};
+
+MeshCacheStats UAnalyzeVertexCache(const std::vector<uint32_t> &indices, uint32_t cacheSize);
+void UOptimizeMesh(MeshData &mesh, MeshOptimizeReport &report);
+void UPrintMeshOptimizeReport(const MeshOptimizeReport &report);
+
+#endif
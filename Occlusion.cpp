@@ -0,0 +1,411 @@
+/*
+ * Occlusion.cpp
+ *
+ *  Software occlusion culling: the nearest chairs are rasterized as occluders into a small
+ *  CPU depth buffer, a max-depth pyramid is built over it, and every chair that survived
+ *  the frustum is dropped when its bounding box lies behind the pyramid
+ */
+
+/* Header Inclusions */
+#include "Occlusion.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace std; // standard namespace
+
+// span kernel: 1 SSE (4 pixels), 0 plain C++; build with -DOCCLUSION_SIMD=N to force one
+#ifndef OCCLUSION_SIMD
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define OCCLUSION_SIMD 1
+#else
+#define OCCLUSION_SIMD 0
+#endif
+#endif
+
+#if OCCLUSION_SIMD == 1
+#include <xmmintrin.h>
+#endif
+
+#define OCCLUSION_LANES 4 // pixels per span step; buffer rows are padded to a multiple
+
+/* Parses --occlusion, --occluders N, --occlusion-width W and --occlusion-bench */
+bool UParseOcclusionArgs(int argc, char *argv[], OcclusionOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--occlusion")
+		{
+			options.enabled = true;
+		}
+		else if (arg == "--occluders")
+		{
+			options.occluders = i + 1 < argc ? atoi(argv[++i]) : 0;
+			if (options.occluders <= 0)
+			{
+				cout << "--occluders expects a positive number of chairs" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--occlusion-width")
+		{
+			options.width = i + 1 < argc ? atoi(argv[++i]) : 0;
+			if (options.width < 16 || options.width > 4096)
+			{
+				cout << "--occlusion-width expects 16 to 4096 columns" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--occlusion-bench")
+		{
+			options.benchmark = true;
+		}
+	}
+
+	return true;
+}
+
+bool UBuildOccluderMesh(const MeshData &mesh, OccluderMesh &occluder)
+{
+	const MeshAttribute *position = NULL;
+	for (const MeshAttribute &attribute : mesh.attributes)
+		if (attribute.location == 0 && attribute.type == GL_FLOAT && attribute.components >= 3)
+			position = &attribute;
+	if (!position)
+		return false;
+
+	// the finest level cheap enough to rasterize every frame; its error is far below a depth buffer texel
+	uint32_t first = 0, count = (uint32_t)mesh.indices.size();
+	for (const MeshLod &lod : mesh.lods)
+	{
+		first = lod.firstIndex;
+		count = lod.indexCount;
+		if (lod.indexCount / 3 <= OCCLUSION_OCCLUDER_TRIANGLES)
+			break;
+	}
+
+	occluder.positions.clear();
+	occluder.indices.resize(count);
+	vector<uint32_t> remap(mesh.vertices.size() / mesh.vertexStride, ~0u);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t vertex = mesh.indices[first + i];
+		if (remap[vertex] == ~0u)
+		{
+			remap[vertex] = (uint32_t)occluder.positions.size();
+			glm::vec3 p;
+			memcpy(&p, &mesh.vertices[(size_t)vertex * mesh.vertexStride + position->offset], sizeof(p));
+			occluder.positions.push_back(p);
+		}
+		occluder.indices[i] = remap[vertex];
+	}
+	return true;
+}
+
+void OcclusionBuffer::resize(int width, int height)
+{
+	width = (width + OCCLUSION_LANES - 1) / OCCLUSION_LANES * OCCLUSION_LANES;
+	height = max(height, 1);
+	if (!widths.empty() && widths[0] == width && heights[0] == height)
+		return;
+
+	// halved until a single texel, odd sizes rounding up so every texel of a level is covered by the next
+	levels.clear();
+	widths.clear();
+	heights.clear();
+	for (int w = width, h = height;; w = (w + 1) / 2, h = (h + 1) / 2)
+	{
+		widths.push_back(w);
+		heights.push_back(h);
+		levels.push_back(vector<float>((size_t)w * h, 1.0f));
+		if (w == 1 && h == 1)
+			break;
+	}
+}
+
+/* Clip space corners of the occluder's triangles to pixels and depth; triangles crossing the near plane are clipped to it */
+void OcclusionBuffer::setup(const OccluderMesh &mesh, const glm::mat4 &placement, vector<ScreenTriangle> &out) const
+{
+	glm::mat4 transform = viewProjection * placement;
+	glm::vec2 scale(0.5f * widths[0], 0.5f * heights[0]);
+
+	auto toScreen = [&](const glm::vec4 &clip)
+	{
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		return glm::vec3((ndc.x + 1.0f) * scale.x, (ndc.y + 1.0f) * scale.y, ndc.z * 0.5f + 0.5f);
+	};
+
+	// every vertex once, the triangles share them
+	vector<glm::vec4> vertices(mesh.positions.size());
+	for (size_t i = 0; i < mesh.positions.size(); i++)
+		vertices[i] = transform * glm::vec4(mesh.positions[i], 1.0f);
+
+	out.clear();
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+	{
+		glm::vec4 clip[3];
+		float distance[3]; // to the near plane z = -w, positive in front
+		int inside = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			clip[c] = vertices[mesh.indices[i + c]];
+			distance[c] = clip[c].z + clip[c].w;
+			inside += distance[c] > 0.0f;
+		}
+		if (inside == 0)
+			continue;
+
+		// trivially outside one side of the frustum
+		bool outside = true;
+		for (int axis = 0; axis < 2 && outside; axis++)
+		{
+			bool left = true, right = true;
+			for (int c = 0; c < 3; c++)
+			{
+				left &= clip[c][axis] < -clip[c].w;
+				right &= clip[c][axis] > clip[c].w;
+			}
+			outside = left || right;
+		}
+		if (outside && inside == 3)
+			continue;
+
+		if (inside == 3)
+		{
+			out.push_back({{toScreen(clip[0]), toScreen(clip[1]), toScreen(clip[2])}});
+			continue;
+		}
+
+		// one or two corners behind the near plane: the polygon in front of it, fanned into triangles
+		glm::vec4 polygon[4];
+		int corners = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			int next = (c + 1) % 3;
+			if (distance[c] > 0.0f)
+				polygon[corners++] = clip[c];
+			if ((distance[c] > 0.0f) != (distance[next] > 0.0f))
+			{
+				float t = distance[c] / (distance[c] - distance[next]);
+				polygon[corners++] = clip[c] + t * (clip[next] - clip[c]);
+			}
+		}
+		for (int c = 1; c + 1 < corners; c++)
+			out.push_back({{toScreen(polygon[0]), toScreen(polygon[c]), toScreen(polygon[c + 1])}});
+	}
+}
+
+/* The band's triangles over its rows, keeping the nearest depth at each pixel centre */
+void OcclusionBuffer::rasterizeBand(int band)
+{
+	int width = widths[0];
+	int firstRow = band * OCCLUSION_BAND_ROWS, endRow = min(heights[0], firstRow + OCCLUSION_BAND_ROWS);
+	float *depth = levels[0].data();
+
+	for (uint32_t index : bins[band])
+	{
+		const ScreenTriangle &triangle = triangles[index];
+		const glm::vec3 &a = triangle.v[0], &b = triangle.v[1], &c = triangle.v[2];
+
+		int x0 = max(0, (int)floor(min(a.x, min(b.x, c.x))));
+		int x1 = min(width - 1, (int)ceil(max(a.x, max(b.x, c.x))));
+		int y0 = max(firstRow, (int)floor(min(a.y, min(b.y, c.y))));
+		int y1 = min(endRow - 1, (int)ceil(max(a.y, max(b.y, c.y))));
+		if (x0 > x1 || y0 > y1)
+			continue;
+
+		float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+		if (fabs(area) < 1e-8f)
+			continue;
+
+		// edge functions oriented so the inside is positive whatever the winding; occluders are drawn two-sided
+		float sign = area > 0.0f ? 1.0f : -1.0f;
+		float e0dx = sign * (b.y - c.y), e0dy = sign * (c.x - b.x), e0c = sign * (b.x * c.y - b.y * c.x);
+		float e1dx = sign * (c.y - a.y), e1dy = sign * (a.x - c.x), e1c = sign * (c.x * a.y - c.y * a.x);
+		float e2dx = sign * (a.y - b.y), e2dy = sign * (b.x - a.x), e2c = sign * (a.x * b.y - a.y * b.x);
+
+		// depth is affine in screen space: z = a + x * dzdx + y * dzdy
+		float inverseArea = 1.0f / area;
+		float dzdx = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) * inverseArea;
+		float dzdy = ((c.z - a.z) * (b.x - a.x) - (b.z - a.z) * (c.x - a.x)) * inverseArea;
+		float z0 = a.z - a.x * dzdx - a.y * dzdy;
+
+		x0 &= ~(OCCLUSION_LANES - 1); // spans start on a lane boundary, rows are padded to one
+		for (int y = y0; y <= y1; y++)
+		{
+			float py = y + 0.5f;
+			float *row = depth + (size_t)y * width;
+
+#if OCCLUSION_SIMD == 1
+			__m128 ramp = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			__m128 zero = _mm_setzero_ps();
+			for (int x = x0; x <= x1; x += OCCLUSION_LANES)
+			{
+				__m128 px = _mm_add_ps(_mm_set1_ps((float)x), ramp);
+				__m128 e0 = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(e0dx)), _mm_set1_ps(e0dy * py + e0c));
+				__m128 e1 = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(e1dx)), _mm_set1_ps(e1dy * py + e1c));
+				__m128 e2 = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(e2dx)), _mm_set1_ps(e2dy * py + e2c));
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+
+				__m128 z = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(dzdx)), _mm_set1_ps(z0 + py * dzdy));
+				__m128 old = _mm_loadu_ps(row + x);
+				__m128 nearest = _mm_min_ps(old, _mm_max_ps(z, zero));
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+			}
+#else
+			for (int x = x0; x <= x1; x++)
+			{
+				float px = x + 0.5f;
+				if (e0dx * px + e0dy * py + e0c < 0.0f || e1dx * px + e1dy * py + e1c < 0.0f || e2dx * px + e2dy * py + e2c < 0.0f)
+					continue;
+				float z = max(z0 + px * dzdx + py * dzdy, 0.0f);
+				row[x] = min(row[x], z);
+			}
+#endif
+		}
+	}
+}
+
+/* Each level keeps the farthest depth of the (up to) four texels below it */
+void OcclusionBuffer::buildPyramid()
+{
+	for (size_t level = 1; level < levels.size(); level++)
+	{
+		const vector<float> &below = levels[level - 1];
+		vector<float> &above = levels[level];
+		int belowWidth = widths[level - 1], belowHeight = heights[level - 1];
+
+		for (int y = 0; y < heights[level]; y++)
+		{
+			int y0 = 2 * y, y1 = min(2 * y + 1, belowHeight - 1);
+			for (int x = 0; x < widths[level]; x++)
+			{
+				int x0 = 2 * x, x1 = min(2 * x + 1, belowWidth - 1);
+				above[(size_t)y * widths[level] + x] = max(max(below[(size_t)y0 * belowWidth + x0], below[(size_t)y0 * belowWidth + x1]),
+														   max(below[(size_t)y1 * belowWidth + x0], below[(size_t)y1 * belowWidth + x1]));
+			}
+		}
+	}
+}
+
+void OcclusionBuffer::render(const glm::mat4 &viewProjection, const OccluderMesh &mesh, const vector<glm::mat4> &placements, TaskPool &pool)
+{
+	UPROFILE_SCOPE("OcclusionBuffer::render");
+	auto start = chrono::steady_clock::now();
+
+	this->viewProjection = viewProjection;
+	lastStats = OcclusionStats();
+	lastStats.occluders = (uint32_t)placements.size();
+
+	// occluders are set up in parallel, then every band of rows is rasterized by one task over all of them
+	occluderTriangles.resize(placements.size());
+	pool.parallelFor(placements.size(), 1, [&](size_t begin, size_t end, unsigned)
+					 {
+						 for (size_t i = begin; i < end; i++)
+							 setup(mesh, placements[i], occluderTriangles[i]);
+					 });
+
+	triangles.clear();
+	for (const vector<ScreenTriangle> &occluder : occluderTriangles)
+		triangles.insert(triangles.end(), occluder.begin(), occluder.end());
+	lastStats.triangles = (uint32_t)triangles.size();
+
+	// binned by the bands their rows cross, so a band only walks the triangles that can touch it
+	int bands = (heights[0] + OCCLUSION_BAND_ROWS - 1) / OCCLUSION_BAND_ROWS;
+	bins.resize(bands);
+	for (vector<uint32_t> &bin : bins)
+		bin.clear();
+	for (uint32_t i = 0; i < triangles.size(); i++)
+	{
+		const glm::vec3 *v = triangles[i].v;
+		int y0 = max(0, (int)floor(min(v[0].y, min(v[1].y, v[2].y)))), y1 = min(heights[0] - 1, (int)ceil(max(v[0].y, max(v[1].y, v[2].y))));
+		for (int band = y0 / OCCLUSION_BAND_ROWS; band <= y1 / OCCLUSION_BAND_ROWS; band++)
+			bins[band].push_back(i);
+	}
+
+	fill(levels[0].begin(), levels[0].end(), 1.0f);
+	pool.parallelFor(bands, 1, [&](size_t begin, size_t end, unsigned)
+					 {
+						 UPROFILE_SCOPE("OcclusionBuffer::rasterizeBand");
+						 for (size_t band = begin; band < end; band++)
+							 rasterizeBand((int)band);
+					 });
+
+	buildPyramid();
+
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	lastStats.rasterMs = elapsed.count();
+}
+
+bool OcclusionBuffer::visible(const Bounds &bounds) const
+{
+	// the box's screen rectangle and its nearest depth; a corner behind the near plane makes it visible
+	glm::vec2 low(1e30f), high(-1e30f);
+	float nearest = 1.0f;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		glm::vec3 p((corner & 1) ? bounds.max.x : bounds.min.x, (corner & 2) ? bounds.max.y : bounds.min.y, (corner & 4) ? bounds.max.z : bounds.min.z);
+		glm::vec4 clip = viewProjection * glm::vec4(p, 1.0f);
+		if (clip.z < -clip.w || clip.w <= 0.0f)
+			return true;
+
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		low = glm::vec2(min(low.x, ndc.x), min(low.y, ndc.y));
+		high = glm::vec2(max(high.x, ndc.x), max(high.y, ndc.y));
+		nearest = min(nearest, ndc.z * 0.5f + 0.5f);
+	}
+
+	int x0 = max(0, (int)floor((low.x + 1.0f) * 0.5f * widths[0])), x1 = min(widths[0] - 1, (int)floor((high.x + 1.0f) * 0.5f * widths[0]));
+	int y0 = max(0, (int)floor((low.y + 1.0f) * 0.5f * heights[0])), y1 = min(heights[0] - 1, (int)floor((high.y + 1.0f) * 0.5f * heights[0]));
+	if (x0 > x1 || y0 > y1)
+		return true; // off the buffer, the frustum test has the last word
+
+	// the level where the rectangle spans at most a few texels, every one of which must be nearer than the box
+	int size = max(x1 - x0, y1 - y0) + 1;
+	int level = 0;
+	while ((size >> level) > 4 && level + 1 < (int)levels.size())
+		level++;
+
+	const vector<float> &depth = levels[level];
+	int width = widths[level];
+	for (int y = y0 >> level; y <= y1 >> level; y++)
+		for (int x = x0 >> level; x <= x1 >> level; x++)
+			if (depth[(size_t)y * width + x] >= nearest)
+				return true;
+	return false;
+}
+
+void OcclusionBuffer::cull(const vector<Bounds> &bounds, vector<uint32_t> &instances, TaskPool &pool)
+{
+	UPROFILE_SCOPE("OcclusionBuffer::cull");
+	auto start = chrono::steady_clock::now();
+
+	flags.resize(instances.size());
+	pool.parallelFor(instances.size(), 256, [&](size_t begin, size_t end, unsigned)
+					 {
+						 for (size_t i = begin; i < end; i++)
+							 flags[i] = visible(bounds[instances[i]]);
+					 });
+
+	size_t kept = 0;
+	for (size_t i = 0; i < instances.size(); i++)
+		if (flags[i])
+			instances[kept++] = instances[i];
+
+	lastStats.tested = (uint32_t)instances.size();
+	lastStats.occluded = (uint32_t)(instances.size() - kept);
+	instances.resize(kept);
+
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	lastStats.testMs = elapsed.count();
+}
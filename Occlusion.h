@@ -0,0 +1,94 @@
+/*
+ * Occlusion.h
+ *
+ *  Software occlusion culling: the nearest chairs are rasterized as occluders into a small
+ *  CPU depth buffer, a max-depth pyramid is built over it, and every chair that survived
+ *  the frustum is dropped when its bounding box lies behind the pyramid
+ */
+
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <cstdint>
+#include <vector>
+#include <GL/glm/glm.hpp>
+
+#include "Culling.h"
+#include "MeshFile.h"
+#include "TaskPool.h"
+
+#define OCCLUSION_BAND_ROWS 8				 // depth buffer rows per raster task
+#define OCCLUSION_OCCLUDER_TRIANGLES 2048 // the occluder is the finest level of detail within this many triangles
+
+/* Command line options of the occlusion culler */
+struct OcclusionOptions
+{
+	bool enabled = false;	// --occlusion tests the frustum-visible chairs against the occluders' depth
+	int occluders = 32;		// --occluders N nearest visible chairs rasterized each frame
+	int width = 256;		// --occlusion-width W depth buffer columns, the rows follow the window's aspect
+	bool benchmark = false; // --occlusion-bench frustum culling alone against frustum and occlusion culling
+};
+
+/* What the last cull did */
+struct OcclusionStats
+{
+	uint32_t tested = 0;   // chairs that passed the frustum
+	uint32_t occluded = 0; // of them, hidden behind the occluders
+	uint32_t occluders = 0;
+	uint32_t triangles = 0; // occluder triangles rasterized, after near plane clipping
+	double rasterMs = 0.0;	// occluder setup, rasterization and pyramid
+	double testMs = 0.0;
+};
+
+/* Occluder geometry: positions only, compacted to the vertices its triangles use */
+struct OccluderMesh
+{
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> indices;
+};
+
+/* Low resolution depth buffer (0 near, 1 far) and its pyramid, each level keeping the farthest depth of four texels */
+class OcclusionBuffer
+{
+public:
+	void resize(int width, int height); // keeps the buffers when the size is unchanged
+
+	// clears, rasterizes 'mesh' at every placement and builds the pyramid
+	void render(const glm::mat4 &viewProjection, const OccluderMesh &mesh, const std::vector<glm::mat4> &placements, TaskPool &pool);
+
+	bool visible(const Bounds &bounds) const; // a world box against the last render()
+
+	// drops the occluded instances from 'instances', keeping the order of the rest
+	void cull(const std::vector<Bounds> &bounds, std::vector<uint32_t> &instances, TaskPool &pool);
+
+	const OcclusionStats &stats() const { return lastStats; }
+	int width() const { return widths.empty() ? 0 : widths[0]; }
+	int height() const { return heights.empty() ? 0 : heights[0]; }
+	const float *depth() const { return levels.empty() ? nullptr : levels[0].data(); } // level 0, row 0 at the bottom
+
+private:
+	struct ScreenTriangle
+	{
+		glm::vec3 v[3]; // pixels and depth
+	};
+
+	void setup(const OccluderMesh &mesh, const glm::mat4 &placement, std::vector<ScreenTriangle> &out) const;
+	void rasterizeBand(int band);
+	void buildPyramid();
+
+	glm::mat4 viewProjection = glm::mat4(1.0f);
+	std::vector<std::vector<float>> levels; // level 0 is the depth buffer
+	std::vector<int> widths, heights;
+	std::vector<std::vector<ScreenTriangle>> occluderTriangles; // per occluder, set up in parallel
+	std::vector<ScreenTriangle> triangles;
+	std::vector<std::vector<uint32_t>> bins; // the triangles overlapping each band of rows
+	std::vector<uint8_t> flags;
+	OcclusionStats lastStats;
+};
+
+bool UParseOcclusionArgs(int argc, char *argv[], OcclusionOptions &options);
+
+// the occluder of a float layout mesh; false when the positions are stored in another format
+bool UBuildOccluderMesh(const MeshData &mesh, OccluderMesh &occluder);
+
+#endif
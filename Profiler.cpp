@@ -0,0 +1,437 @@
+/*
+ * Profiler.cpp
+ *
+ *  Per-thread event rings, timestamp query frames, rolling summary and trace export
+ */
+
+/* Header Inclusions */
+#include "Profiler.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <GL/glew.h>
+
+using namespace std; // standard namespace
+
+/* Parses --profile and --trace file.json */
+bool UParseProfilerArgs(int argc, char *argv[], ProfilerOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--profile")
+		{
+			options.summary = true;
+		}
+		else if (arg == "--trace")
+		{
+			if (i + 1 >= argc)
+			{
+				cout << "--trace expects a file name" << endl;
+				return false;
+			}
+			options.tracePath = argv[++i];
+		}
+	}
+
+#if !PROFILER_ENABLED
+	if (options.summary || !options.tracePath.empty())
+		cout << "This build has the profiler compiled out, --profile and --trace are ignored" << endl;
+#endif
+
+	return true;
+}
+
+#if PROFILER_ENABLED
+
+#define PROFILER_RING_SIZE 4096			// events a thread can record between two drains, a power of two
+#define PROFILER_GPU_FRAMES 2			// timestamp query sets in flight, read back one frame late
+#define PROFILER_TRACE_LIMIT 2000000	// events kept for the trace file, about 50 MB
+#define PROFILER_GPU_THREAD 0			// trace row of the GPU scopes, CPU threads count from 1
+
+/* One finished scope */
+struct ProfileEvent
+{
+	const char *name;
+	uint64_t start, end; // steady clock nanoseconds
+	uint32_t depth;
+};
+
+/* Single producer (the owning thread), single consumer (the GL thread in UProfileFrame) */
+struct ProfileRing
+{
+	ProfileEvent events[PROFILER_RING_SIZE];
+	atomic<uint64_t> head{0}, tail{0};
+	atomic<uint64_t> dropped{0};
+	uint32_t thread = 0;
+	const char *name = "thread";
+	uint32_t depth = 0; // open scopes, touched by the owner only
+};
+
+/* GL_TIMESTAMP pairs issued during one frame */
+struct GpuFrame
+{
+	vector<GLuint> queries; // begin and end of record i at 2i and 2i + 1, grown on demand
+	vector<ProfileEvent> records;
+};
+
+/* Time per frame of one scope over the current summary interval */
+struct SummaryEntry
+{
+	uint32_t thread, depth;
+	uint64_t first; // earliest start seen, orders children after their parents
+	const char *name;
+	double ms = 0.0;
+	uint64_t calls = 0;
+};
+
+struct TraceEvent
+{
+	const char *name;
+	uint64_t start, end;
+	uint32_t thread, depth;
+};
+
+static ProfilerOptions profiler;
+static atomic<bool> profiling{false};
+
+static mutex ringLock; // guards the list, not the rings
+static vector<unique_ptr<ProfileRing>> rings;
+static thread_local ProfileRing *threadRing = nullptr;
+static thread_local const char *threadName = nullptr;
+
+static GpuFrame gpuFrames[PROFILER_GPU_FRAMES];
+static int gpuFrame = 0;
+static uint32_t gpuDepth = 0;
+static int64_t gpuOffset = 0; // steady clock minus GL_TIMESTAMP, both in nanoseconds
+static uint64_t gpuDropped = 0;
+
+static unordered_map<string, SummaryEntry> summary;
+static uint64_t summaryFrames = 0;
+static chrono::steady_clock::time_point lastSummary;
+
+static vector<TraceEvent> trace;
+static uint64_t traceDropped = 0;
+
+static inline uint64_t UProfileClock(void)
+{
+	return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* The calling thread's ring, registered on its first event */
+static ProfileRing &UThreadRing(void)
+{
+	if (!threadRing)
+	{
+		lock_guard<mutex> guard(ringLock);
+		rings.push_back(unique_ptr<ProfileRing>(new ProfileRing));
+		threadRing = rings.back().get();
+		threadRing->thread = (uint32_t)rings.size(); // after the GPU row
+		if (threadName)
+			threadRing->name = threadName;
+	}
+	return *threadRing;
+}
+
+void UProfileThread(const char *name)
+{
+	threadName = name;
+	if (threadRing)
+		threadRing->name = name;
+}
+
+// installed before main, so the workers of a pool created before UInitProfiler are named too
+static const bool poolThreadsNamed = (taskPoolThreadStarted = UProfileThread, true);
+
+ProfileScope::ProfileScope(const char *name)
+	: name(name), start(0)
+{
+	if (!profiling.load(memory_order_relaxed))
+		return;
+
+	UThreadRing().depth++;
+	start = UProfileClock();
+}
+
+ProfileScope::~ProfileScope()
+{
+	if (start == 0)
+		return;
+
+	uint64_t end = UProfileClock();
+	ProfileRing &ring = *threadRing;
+	ring.depth--;
+
+	// a full ring drops the event rather than wait for the GL thread
+	uint64_t head = ring.head.load(memory_order_relaxed);
+	if (head - ring.tail.load(memory_order_acquire) >= PROFILER_RING_SIZE)
+	{
+		ring.dropped.fetch_add(1, memory_order_relaxed);
+		return;
+	}
+
+	ring.events[head & (PROFILER_RING_SIZE - 1)] = ProfileEvent{name, start, end, ring.depth};
+	ring.head.store(head + 1, memory_order_release);
+}
+
+GpuProfileScope::GpuProfileScope(const char *name)
+	: frame(gpuFrame), query(-1)
+{
+	if (!profiling.load(memory_order_relaxed))
+		return;
+
+	GpuFrame &set = gpuFrames[frame];
+	query = (int)set.records.size();
+	if (set.queries.size() < 2 * set.records.size() + 2)
+	{
+		set.queries.resize(set.queries.size() + 2);
+		glGenQueries(2, &set.queries[set.queries.size() - 2]);
+	}
+
+	set.records.push_back(ProfileEvent{name, 0, 0, gpuDepth++});
+	glQueryCounter(set.queries[2 * query], GL_TIMESTAMP);
+}
+
+GpuProfileScope::~GpuProfileScope()
+{
+	if (query < 0)
+		return;
+
+	glQueryCounter(gpuFrames[frame].queries[2 * query + 1], GL_TIMESTAMP);
+	gpuDepth--;
+}
+
+/* Adds a finished scope to the rolling summary and the trace */
+static void URecordEvent(const ProfileEvent &event, uint32_t thread)
+{
+	if (profiler.summary)
+	{
+		string key = to_string(thread) + ":" + to_string(event.depth) + ":" + event.name;
+		auto found = summary.find(key);
+		if (found == summary.end())
+			found = summary.emplace(key, SummaryEntry{thread, event.depth, event.start, event.name}).first;
+
+		SummaryEntry &entry = found->second;
+		entry.first = min(entry.first, event.start);
+		entry.ms += (event.end - event.start) / 1.0e6;
+		entry.calls++;
+	}
+
+	if (!profiler.tracePath.empty())
+	{
+		if (trace.size() < PROFILER_TRACE_LIMIT)
+			trace.push_back(TraceEvent{event.name, event.start, event.end, thread, event.depth});
+		else
+			traceDropped++;
+	}
+}
+
+/* Moves every ring's events out, in the order each thread finished them */
+static void UDrainRings(void)
+{
+	lock_guard<mutex> guard(ringLock);
+
+	for (unique_ptr<ProfileRing> &ring : rings)
+	{
+		uint64_t tail = ring->tail.load(memory_order_relaxed);
+		uint64_t head = ring->head.load(memory_order_acquire);
+
+		for (; tail != head; tail++)
+			URecordEvent(ring->events[tail & (PROFILER_RING_SIZE - 1)], ring->thread);
+
+		ring->tail.store(tail, memory_order_release);
+	}
+}
+
+/* Reads one frame's timestamps back, or drops them if the GPU is not there yet: the profiler never stalls */
+static void UResolveGpuFrame(GpuFrame &frame, bool wait)
+{
+	if (frame.records.empty())
+		return;
+
+	GLint available = GL_TRUE;
+	if (!wait)
+		glGetQueryObjectiv(frame.queries[2 * frame.records.size() - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+
+	if (available)
+	{
+		for (size_t i = 0; i < frame.records.size(); i++)
+		{
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(frame.queries[2 * i], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(frame.queries[2 * i + 1], GL_QUERY_RESULT, &end);
+
+			ProfileEvent event = frame.records[i];
+			event.start = (uint64_t)((int64_t)begin + gpuOffset);
+			event.end = (uint64_t)((int64_t)end + gpuOffset);
+			URecordEvent(event, PROFILER_GPU_THREAD);
+		}
+	}
+	else
+	{
+		gpuDropped++;
+	}
+
+	frame.records.clear();
+}
+
+/* Rows grouped by thread, each thread's scopes as a tree in the order they first ran */
+static void UPrintSummary(void)
+{
+	vector<const SummaryEntry *> entries;
+	for (const auto &entry : summary)
+		entries.push_back(&entry.second);
+
+	sort(entries.begin(), entries.end(), [](const SummaryEntry *a, const SummaryEntry *b)
+		 {
+			 // CPU threads in the order they registered, the GPU last
+			 uint32_t rowA = a->thread == PROFILER_GPU_THREAD ? UINT32_MAX : a->thread;
+			 uint32_t rowB = b->thread == PROFILER_GPU_THREAD ? UINT32_MAX : b->thread;
+			 return rowA != rowB ? rowA < rowB : a->first < b->first;
+		 });
+
+	cout << "[Profile] ms per frame over " << summaryFrames << " frames" << endl;
+	for (const SummaryEntry *entry : entries)
+	{
+		string label = string(2 * entry->depth, ' ') + entry->name;
+		cout << "  " << setw(6) << left << (entry->thread == PROFILER_GPU_THREAD ? "GPU" : "CPU" + to_string(entry->thread - 1))
+			 << setw(32) << label << right << fixed << setprecision(3) << setw(9) << entry->ms / summaryFrames;
+		if (entry->calls != summaryFrames)
+			cout << "  (" << entry->calls << (entry->calls == 1 ? " call)" : " calls)");
+		cout << defaultfloat << endl;
+	}
+
+	if (gpuDropped > 0)
+		cout << "  " << gpuDropped << " GPU frames not ready in time, skipped" << endl;
+
+	summary.clear();
+	summaryFrames = 0;
+	gpuDropped = 0;
+}
+
+void UProfileFrame(void)
+{
+	if (!profiling.load(memory_order_relaxed))
+		return;
+
+	UDrainRings();
+
+	// the other query set was issued a frame ago; read it back and reuse it for the next frame
+	gpuFrame = (gpuFrame + 1) % PROFILER_GPU_FRAMES;
+	UResolveGpuFrame(gpuFrames[gpuFrame], false);
+
+	summaryFrames++;
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - lastSummary;
+	if (profiler.summary && elapsed.count() >= profiler.summaryInterval)
+	{
+		UPrintSummary();
+		lastSummary = chrono::steady_clock::now();
+	}
+}
+
+void UInitProfiler(const ProfilerOptions &options, bool context)
+{
+	profiler = options;
+	if (!profiler.summary && profiler.tracePath.empty())
+		return;
+
+	UProfileThread("main");
+	UThreadRing();
+
+	// maps GPU timestamps onto the CPU clock so both share the trace's time axis
+	if (context)
+	{
+		GLint64 gpuNow = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+		gpuOffset = (int64_t)UProfileClock() - (int64_t)gpuNow;
+	}
+
+	lastSummary = chrono::steady_clock::now();
+	profiling = true;
+}
+
+/* Chrome trace format: one complete ("X") event per scope, timestamps in microseconds */
+static bool UWriteTrace(const string &path)
+{
+	ofstream out(path);
+	if (!out)
+	{
+		cout << "Cannot write " << path << endl;
+		return false;
+	}
+
+	uint64_t origin = UINT64_MAX;
+	for (const TraceEvent &event : trace)
+		origin = min(origin, event.start);
+
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << PROFILER_GPU_THREAD << ", \"args\": {\"name\": \"GPU\"}}";
+	for (const unique_ptr<ProfileRing> &ring : rings)
+		out << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << ring->thread << ", \"args\": {\"name\": \"" << ring->name << "\"}}";
+
+	out << fixed << setprecision(3);
+	for (const TraceEvent &event : trace)
+	{
+		out << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.thread
+			<< ", \"ts\": " << (event.start - origin) / 1000.0 << ", \"dur\": " << (event.end - event.start) / 1000.0
+			<< ", \"args\": {\"depth\": " << event.depth << "}}";
+	}
+	out << "\n]}\n";
+
+	return (bool)out;
+}
+
+void UShutdownProfiler(void)
+{
+	if (!profiling)
+		return;
+	profiling = false;
+
+	// nothing is waiting for a next frame anymore, so the last GPU frames may block
+	UDrainRings();
+	for (int i = 1; i <= PROFILER_GPU_FRAMES; i++)
+		UResolveGpuFrame(gpuFrames[(gpuFrame + i) % PROFILER_GPU_FRAMES], true);
+
+	for (GpuFrame &frame : gpuFrames)
+	{
+		if (!frame.queries.empty())
+			glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+		frame.queries.clear();
+	}
+
+	uint64_t ringDropped = 0;
+	for (const unique_ptr<ProfileRing> &ring : rings)
+		ringDropped += ring->dropped;
+
+	if (!profiler.tracePath.empty() && UWriteTrace(profiler.tracePath))
+	{
+		cout << "Trace: " << trace.size() << " events written to " << profiler.tracePath;
+		if (traceDropped + ringDropped > 0)
+			cout << " (" << traceDropped + ringDropped << " dropped)";
+		cout << endl;
+	}
+
+	trace.clear();
+}
+
+#else
+
+void UInitProfiler(const ProfilerOptions &options, bool context)
+{
+}
+
+void UShutdownProfiler(void)
+{
+}
+
+#endif
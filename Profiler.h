@@ -0,0 +1,77 @@
+/*
+ * Profiler.h
+ *
+ *  Hierarchical CPU and GPU frame profiler: scoped timers record into per-thread rings,
+ *  the GL thread drains them once per frame into a rolling console summary and a
+ *  Chrome trace (chrome://tracing, ui.perfetto.dev)
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <string>
+
+// build with -DPROFILER_ENABLED=0 to compile every probe out of the program
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+/* Command line options of the profiler, which stays idle unless one is given */
+struct ProfilerOptions
+{
+	bool summary = false;		   // --profile prints the per-scope time per frame every interval
+	double summaryInterval = 2.0;  // seconds between summaries
+	std::string tracePath;		   // --trace file.json records every scope for the trace viewer
+};
+
+bool UParseProfilerArgs(int argc, char *argv[], ProfilerOptions &options);
+void UInitProfiler(const ProfilerOptions &options, bool context = true); // on the GL thread once the context exists; false without one, CPU scopes only
+void UShutdownProfiler(void);											  // writes the trace, while the context still exists
+
+#if PROFILER_ENABLED
+
+/* Times its enclosing block on the calling thread; 'name' must outlive the program, e.g. a literal */
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char *name);
+	~ProfileScope();
+
+private:
+	const char *name;
+	uint64_t start; // 0 while the profiler is idle
+};
+
+/* Times the GL commands issued in its block with a pair of timestamp queries, GL thread only */
+class GpuProfileScope
+{
+public:
+	explicit GpuProfileScope(const char *name);
+	~GpuProfileScope();
+
+private:
+	int frame; // query set it was issued into
+	int query; // record in that set, -1 while the profiler is idle
+};
+
+void UProfileFrame(void);			   // GL thread, after the buffer swap: drains the rings and resolves older GPU frames
+void UProfileThread(const char *name); // labels the calling thread in the trace
+
+#define UPROFILE_JOIN2(a, b) a##b
+#define UPROFILE_JOIN(a, b) UPROFILE_JOIN2(a, b)
+#define UPROFILE_SCOPE(name) ProfileScope UPROFILE_JOIN(profileScope, __LINE__)(name)
+#define UPROFILE_GPU_SCOPE(name) GpuProfileScope UPROFILE_JOIN(gpuProfileScope, __LINE__)(name)
+#define UPROFILE_FRAME() UProfileFrame()
+#define UPROFILE_THREAD(name) UProfileThread(name)
+
+#else
+
+#define UPROFILE_SCOPE(name)
+#define UPROFILE_GPU_SCOPE(name)
+#define UPROFILE_FRAME()
+#define UPROFILE_THREAD(name)
+
+#endif
+
+#endif
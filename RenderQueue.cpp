@@ -0,0 +1,217 @@
+/*
+ * RenderQueue.cpp
+ *
+ *  Retained render queue: draws are recorded as commands with a 64-bit sort key, radix
+ *  sorted once per frame and submitted through a cache that skips redundant GL binds
+ */
+
+/* Header Inclusions */
+#include "RenderQueue.h"
+#include "FrameTrace.h"
+#include "Profiler.h"
+#include "UniformBuffers.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace std; // standard namespace
+
+/* Sort key, most significant first: pass 4 bits | program 10 | texture 12 | vertex array 10 | depth 28 */
+#define KEY_PROGRAM_BITS 10
+#define KEY_TEXTURE_BITS 12
+#define KEY_VAO_BITS 10
+#define KEY_DEPTH_BITS 28
+
+void GLStateCache::invalidate()
+{
+	// no GL name is ~0, so the first bind of each kind after this always goes out
+	program = vao = ~0u;
+	fill(textures, textures + RENDER_TEXTURE_UNITS, ~0u);
+	for (UniformRange &range : ranges)
+		range.buffer = ~0u;
+}
+
+void GLStateCache::useProgram(GLuint next)
+{
+	if (program == next)
+	{
+		stats.skipped++;
+		return;
+	}
+
+	glUseProgram(next);
+	UTraceUseProgram(next);
+	program = next;
+	stats.programChanges++;
+}
+
+void GLStateCache::bindVertexArray(GLuint next)
+{
+	if (vao == next)
+	{
+		stats.skipped++;
+		return;
+	}
+
+	glBindVertexArray(next);
+	UTraceBindVertexArray(next);
+	vao = next;
+	stats.vaoChanges++;
+}
+
+void GLStateCache::bindTexture(unsigned unit, GLuint texture, GLenum target)
+{
+	if (unit < RENDER_TEXTURE_UNITS && textures[unit] == texture)
+	{
+		stats.skipped++;
+		return;
+	}
+
+	if (unit != 0)
+		glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(target, texture);
+	if (unit != 0)
+		glActiveTexture(GL_TEXTURE0);
+	UTraceBindTexture(unit, target, texture);
+
+	if (unit < RENDER_TEXTURE_UNITS)
+		textures[unit] = texture;
+	stats.textureChanges++;
+}
+
+void GLStateCache::bindUniformRange(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	if (binding < RENDER_UNIFORM_BINDINGS && ranges[binding].buffer == buffer && ranges[binding].offset == offset && ranges[binding].size == size)
+	{
+		stats.skipped++;
+		return;
+	}
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+	UTraceBindUniformRange(binding, buffer, offset, size);
+	if (binding < RENDER_UNIFORM_BINDINGS)
+		ranges[binding] = {buffer, offset, size};
+	stats.uniformChanges++;
+}
+
+RenderQueue::RenderQueue(const RenderQueueOptions &options)
+	: options(options)
+{
+}
+
+void RenderQueue::clear()
+{
+	commands.clear();
+}
+
+void RenderQueue::push(const RenderCommand &command)
+{
+	commands.push_back(command);
+}
+
+/* Dense index of a GL name, assigned on first sight; names past the field width share the last slot */
+uint32_t RenderQueue::slot(vector<GLuint> &names, GLuint name)
+{
+	for (uint32_t i = 0; i < names.size(); i++)
+		if (names[i] == name)
+			return i;
+
+	names.push_back(name);
+	return (uint32_t)names.size() - 1;
+}
+
+uint64_t RenderQueue::sortKey(const RenderCommand &command)
+{
+	uint64_t program = min<uint64_t>(slot(programSlots, command.program), (1u << KEY_PROGRAM_BITS) - 1);
+	uint64_t texture = min<uint64_t>(slot(textureSlots, command.texture), (1u << KEY_TEXTURE_BITS) - 1);
+	uint64_t vao = min<uint64_t>(slot(vaoSlots, command.vao), (1u << KEY_VAO_BITS) - 1);
+
+	// a positive float orders like its bit pattern; the top bits are enough for front to back
+	float depth = max(command.depth, 0.0f);
+	uint32_t bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	uint64_t depthKey = bits >> (31 - KEY_DEPTH_BITS);
+
+	return (uint64_t)command.pass << 60 | program << (KEY_TEXTURE_BITS + KEY_VAO_BITS + KEY_DEPTH_BITS) |
+		   texture << (KEY_VAO_BITS + KEY_DEPTH_BITS) | vao << KEY_DEPTH_BITS | depthKey;
+}
+
+/* Least significant digit first, 8 bits at a time; digits every key shares are skipped */
+void RenderQueue::radixSort()
+{
+	size_t count = keys.size();
+	scratch.resize(count);
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		size_t histogram[256] = {};
+		for (uint32_t index : order)
+			histogram[(keys[index] >> shift) & 0xFF]++;
+
+		if (histogram[(keys[order[0]] >> shift) & 0xFF] == count)
+			continue;
+
+		size_t offset = 0;
+		for (size_t &bucket : histogram)
+		{
+			size_t size = bucket;
+			bucket = offset;
+			offset += size;
+		}
+
+		for (uint32_t index : order)
+			scratch[histogram[(keys[index] >> shift) & 0xFF]++] = index;
+		order.swap(scratch);
+	}
+}
+
+void RenderQueue::submit(GLStateCache &state)
+{
+	UPROFILE_SCOPE("RenderQueue::submit");
+
+	if (commands.empty())
+		return;
+
+	keys.resize(commands.size());
+	order.resize(commands.size());
+	for (uint32_t i = 0; i < commands.size(); i++)
+	{
+		keys[i] = sortKey(commands[i]);
+		order[i] = i;
+	}
+
+	if (options.sort)
+		radixSort();
+
+	for (uint32_t index : order)
+	{
+		const RenderCommand &command = commands[index];
+
+		state.useProgram(command.program);
+		state.bindVertexArray(command.vao);
+		state.bindTexture(0, command.texture, command.textureTarget);
+		if (command.objectBuffer != 0)
+			state.bindUniformRange(OBJECT_BLOCK_BINDING, command.objectBuffer, command.objectOffset, sizeof(ObjectUniforms));
+
+		const GLvoid *first = (const GLvoid *)((size_t)command.firstIndex * (command.indexType == GL_UNSIGNED_SHORT ? 2 : 4));
+		if (command.instances > 0)
+			glDrawElementsInstanced(GL_TRIANGLES, command.count, command.indexType, first, command.instances);
+		else
+			glDrawElements(GL_TRIANGLES, command.count, command.indexType, first);
+		UTraceDraw(command.count, command.indexType, (size_t)first, command.instances);
+		state.stats.drawCalls++;
+		state.stats.triangles += (uint64_t)(command.count / 3) * max(command.instances, 1);
+	}
+}
+
+/* Parses --no-sort */
+bool UParseRenderQueueArgs(int argc, char *argv[], RenderQueueOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+		if (string(argv[i]) == "--no-sort")
+			options.sort = false;
+
+	return true;
+}
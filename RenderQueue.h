@@ -0,0 +1,121 @@
+/*
+ * RenderQueue.h
+ *
+ *  Retained render queue: draws are recorded as commands with a 64-bit sort key, radix
+ *  sorted once per frame and submitted through a cache that skips redundant GL binds
+ */
+
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <GL/glew.h>
+
+#define RENDER_TEXTURE_UNITS 8	  // texture units the state cache shadows
+#define RENDER_UNIFORM_BINDINGS 4 // uniform block binding points the state cache shadows
+
+/* Command line options of the render queue */
+struct RenderQueueOptions
+{
+	bool sort = true; // --no-sort submits in recording order, to compare the state changes
+};
+
+/* Passes in submission order, the top bits of the sort key */
+enum RenderPass
+{
+	RENDER_PASS_OPAQUE,
+	RENDER_PASS_LAMPS,
+};
+
+/* Binds issued and skipped during one frame */
+struct RenderStats
+{
+	uint32_t drawCalls = 0;
+	uint32_t programChanges = 0;
+	uint32_t vaoChanges = 0;
+	uint32_t textureChanges = 0;
+	uint32_t uniformChanges = 0; // uniform block ranges bound
+	uint32_t skipped = 0;		 // binds that matched the shadowed state
+	uint64_t triangles = 0;		 // submitted, every instance counted
+
+	uint32_t stateChanges() const { return programChanges + vaoChanges + textureChanges + uniformChanges; }
+};
+
+/* Shadows the bound program, vertex array, textures and uniform block ranges; only real changes reach GL.
+   A unit's texture is shadowed by name alone, which GL keeps unique across targets */
+class GLStateCache
+{
+public:
+	// forget the bindings: code outside the queue (loaders, profiler queries, cluster setup) binds behind the cache's back
+	void invalidate();
+
+	void useProgram(GLuint program);
+	void bindVertexArray(GLuint vao);
+	void bindTexture(unsigned unit, GLuint texture, GLenum target = GL_TEXTURE_2D); // leaves unit 0 active
+	void bindUniformRange(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+	RenderStats stats;
+
+private:
+	struct UniformRange
+	{
+		GLuint buffer;
+		GLintptr offset;
+		GLsizeiptr size;
+	};
+
+	GLuint program = ~0u, vao = ~0u; // ~0 until the first bind: unknown
+	GLuint textures[RENDER_TEXTURE_UNITS] = {~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u};
+	UniformRange ranges[RENDER_UNIFORM_BINDINGS] = {{~0u, 0, 0}, {~0u, 0, 0}, {~0u, 0, 0}, {~0u, 0, 0}};
+};
+
+/* One draw: what it binds, what it sets and what it draws */
+struct RenderCommand
+{
+	RenderPass pass = RENDER_PASS_OPAQUE;
+	GLuint program = 0;
+	GLuint vao = 0;
+	GLuint texture = 0; // unit 0
+	GLenum textureTarget = GL_TEXTURE_2D; // GL_TEXTURE_2D_ARRAY for the material layers
+	float depth = 0.0f; // view depth of the center, drawn front to back within equal state
+
+	GLuint objectBuffer = 0; // the command's Object uniform block, 0 when the program has none
+	GLintptr objectOffset = 0;
+
+	GLsizei count = 0;	   // indices
+	GLuint firstIndex = 0; // start of the range in the index buffer, a level of detail past the first
+	GLenum indexType = GL_UNSIGNED_INT;
+	GLsizei instances = 0; // 0 draws without instancing
+};
+
+/* Commands recorded during a frame, sorted by pass, program, texture, vertex array and depth */
+class RenderQueue
+{
+public:
+	explicit RenderQueue(const RenderQueueOptions &options = RenderQueueOptions());
+
+	void clear();
+	void push(const RenderCommand &command);
+	void submit(GLStateCache &state); // sorts and draws everything recorded since clear()
+
+	size_t size() const { return commands.size(); }
+
+private:
+	uint64_t sortKey(const RenderCommand &command);
+	uint32_t slot(std::vector<GLuint> &names, GLuint name);
+	void radixSort();
+
+	RenderQueueOptions options;
+	std::vector<RenderCommand> commands;
+	std::vector<uint64_t> keys;
+	std::vector<uint32_t> order, scratch;
+
+	// dense slots for the GL names in the key, kept across frames so the order is stable
+	std::vector<GLuint> programSlots, textureSlots, vaoSlots;
+};
+
+bool UParseRenderQueueArgs(int argc, char *argv[], RenderQueueOptions &options);
+
+#endif
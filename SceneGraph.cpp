@@ -0,0 +1,285 @@
+/*
+ * SceneGraph.cpp
+ *
+ *  Transform hierarchy in structure-of-arrays form: local and world matrices, parents and
+ *  subtree extents live in separate contiguous arrays kept in depth-first order, so a dirty
+ *  subtree is one index range and static nodes are never touched after their first update
+ */
+
+/* Header Inclusions */
+#include "SceneGraph.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std; // standard namespace
+
+// matrix kernel: 1 SSE (one column per register), 0 plain C++; build with -DSCENE_GRAPH_SIMD=N to force one
+#ifndef SCENE_GRAPH_SIMD
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SCENE_GRAPH_SIMD 1
+#else
+#define SCENE_GRAPH_SIMD 0
+#endif
+#endif
+
+#if SCENE_GRAPH_SIMD == 1
+#include <xmmintrin.h>
+#endif
+
+/* out = a * b for column-major 4x4 matrices, summed in the same order as glm so the results match it */
+static inline void UMultiplyMatrices(const float *a, const float *b, float *out)
+{
+#if SCENE_GRAPH_SIMD == 1
+	__m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+	for (int column = 0; column < 4; column++)
+	{
+		const float *bc = b + 4 * column;
+		__m128 r = _mm_mul_ps(a0, _mm_set1_ps(bc[0]));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(bc[1])));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(bc[2])));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(bc[3])));
+		_mm_storeu_ps(out + 4 * column, r);
+	}
+#else
+	float r[16];
+	for (int column = 0; column < 4; column++)
+		for (int row = 0; row < 4; row++)
+			r[4 * column + row] = a[row] * b[4 * column] + a[4 + row] * b[4 * column + 1] + a[8 + row] * b[4 * column + 2] + a[12 + row] * b[4 * column + 3];
+	copy(r, r + 16, out);
+#endif
+}
+
+void SceneGraph::clear()
+{
+	locals.clear();
+	worlds.clear();
+	parents.clear();
+	subtreeEnds.clear();
+	dirty.clear();
+	handleOf.clear();
+	indexOf.clear();
+	dirtyNodes.clear();
+	sorted = true;
+	lastStats = SceneGraphStats();
+}
+
+SceneNode SceneGraph::add(SceneNode parent, const glm::mat4 &local)
+{
+	uint32_t index = (uint32_t)parents.size();
+	SceneNode handle = (SceneNode)indexOf.size();
+	uint32_t parentIndex = parent == SCENE_NO_PARENT ? SCENE_NO_PARENT : indexOf[parent];
+
+	locals.push_back(local);
+	worlds.push_back(local);
+	parents.push_back(parentIndex);
+	subtreeEnds.push_back(index + 1);
+	dirty.push_back(1);
+	handleOf.push_back(handle);
+	indexOf.push_back(index);
+	dirtyNodes.push_back(index);
+
+	// appending stays depth-first when the parent's subtree ends at the tail: it and its ancestors just grow by one
+	if (parentIndex != SCENE_NO_PARENT)
+	{
+		if (subtreeEnds[parentIndex] == index)
+		{
+			for (uint32_t ancestor = parentIndex; ancestor != SCENE_NO_PARENT; ancestor = parents[ancestor])
+				subtreeEnds[ancestor] = index + 1;
+		}
+		else
+		{
+			sorted = false;
+		}
+	}
+
+	return handle;
+}
+
+void SceneGraph::setLocal(SceneNode node, const glm::mat4 &local)
+{
+	uint32_t index = indexOf[node];
+	locals[index] = local;
+
+	if (!dirty[index])
+	{
+		dirty[index] = 1;
+		dirtyNodes.push_back(index);
+	}
+}
+
+/* Reorders every array depth first, children in the order they were added; only after an out-of-order add */
+void SceneGraph::sortDepthFirst()
+{
+	UPROFILE_SCOPE("SceneGraph::sortDepthFirst");
+	uint32_t count = (uint32_t)parents.size();
+
+	// children of every node, flattened
+	vector<uint32_t> firstChild(count + 1, 0), children(count);
+	for (uint32_t i = 0; i < count; i++)
+		if (parents[i] != SCENE_NO_PARENT)
+			firstChild[parents[i] + 1]++;
+	for (uint32_t i = 0; i < count; i++)
+		firstChild[i + 1] += firstChild[i];
+	vector<uint32_t> fill(firstChild.begin(), firstChild.end() - 1);
+	for (uint32_t i = 0; i < count; i++)
+		if (parents[i] != SCENE_NO_PARENT)
+			children[fill[parents[i]]++] = i;
+
+	// pre-order walk from every root; the stack holds children in reverse so the first is visited first
+	vector<uint32_t> order, stack;
+	order.reserve(count);
+	for (uint32_t root = 0; root < count; root++)
+	{
+		if (parents[root] != SCENE_NO_PARENT)
+			continue;
+
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			uint32_t node = stack.back();
+			stack.pop_back();
+			order.push_back(node);
+			for (uint32_t c = firstChild[node + 1]; c > firstChild[node]; c--)
+				stack.push_back(children[c - 1]);
+		}
+	}
+
+	vector<uint32_t> newIndex(count);
+	for (uint32_t i = 0; i < count; i++)
+		newIndex[order[i]] = i;
+
+	vector<glm::mat4> sortedLocals(count), sortedWorlds(count);
+	vector<uint32_t> sortedParents(count), sortedHandles(count);
+	vector<uint8_t> sortedDirty(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t old = order[i];
+		sortedLocals[i] = locals[old];
+		sortedWorlds[i] = worlds[old];
+		sortedParents[i] = parents[old] == SCENE_NO_PARENT ? SCENE_NO_PARENT : newIndex[parents[old]];
+		sortedHandles[i] = handleOf[old];
+		sortedDirty[i] = dirty[old];
+		indexOf[handleOf[old]] = i;
+	}
+
+	locals.swap(sortedLocals);
+	worlds.swap(sortedWorlds);
+	parents.swap(sortedParents);
+	handleOf.swap(sortedHandles);
+	dirty.swap(sortedDirty);
+	for (uint32_t &node : dirtyNodes)
+		node = newIndex[node];
+
+	// a subtree ends where the last of its descendants ends
+	for (uint32_t i = 0; i < count; i++)
+		subtreeEnds[i] = i + 1;
+	for (uint32_t i = count; i-- > 0;)
+		if (parents[i] != SCENE_NO_PARENT)
+			subtreeEnds[parents[i]] = max(subtreeEnds[parents[i]], subtreeEnds[i]);
+
+	sorted = true;
+}
+
+/* Cuts a dirty subtree into tasks of about SCENE_UPDATE_GRAIN nodes; the roots it cuts below are updated here, first */
+void SceneGraph::split(uint32_t begin, uint32_t end)
+{
+	vector<pair<uint32_t, uint32_t>> stack = {{begin, end}};
+	while (!stack.empty())
+	{
+		pair<uint32_t, uint32_t> range = stack.back();
+		stack.pop_back();
+
+		if (range.second - range.first <= SCENE_UPDATE_GRAIN)
+		{
+			tasks.push_back(range);
+			continue;
+		}
+
+		updateRange(range.first, range.first + 1);
+
+		// small sibling subtrees are adjacent, so they are gathered into one task; large ones are cut again
+		uint32_t gathered = range.first + 1;
+		for (uint32_t child = range.first + 1; child < range.second; child = subtreeEnds[child])
+		{
+			uint32_t childEnd = subtreeEnds[child];
+			if (childEnd - child > SCENE_UPDATE_GRAIN)
+			{
+				if (gathered < child)
+					tasks.push_back({gathered, child});
+				stack.push_back({child, childEnd});
+				gathered = childEnd;
+			}
+			else if (childEnd - gathered >= SCENE_UPDATE_GRAIN)
+			{
+				tasks.push_back({gathered, childEnd});
+				gathered = childEnd;
+			}
+		}
+		if (gathered < range.second)
+			tasks.push_back({gathered, range.second});
+	}
+}
+
+/* World matrices of [begin, end); every parent is either earlier in the range or already up to date */
+void SceneGraph::updateRange(uint32_t begin, uint32_t end)
+{
+	for (uint32_t i = begin; i < end; i++)
+	{
+		if (parents[i] == SCENE_NO_PARENT)
+			worlds[i] = locals[i];
+		else
+			UMultiplyMatrices(&worlds[parents[i]][0][0], &locals[i][0][0], &worlds[i][0][0]);
+	}
+}
+
+void SceneGraph::update(TaskPool &pool)
+{
+	UPROFILE_SCOPE("SceneGraph::update");
+	auto start = chrono::steady_clock::now();
+
+	if (!sorted)
+		sortDepthFirst();
+
+	lastStats = SceneGraphStats();
+	lastStats.nodes = (uint32_t)parents.size();
+	if (dirtyNodes.empty())
+		return;
+
+	// only the outermost dirty nodes start a subtree; the ones inside it are covered
+	sort(dirtyNodes.begin(), dirtyNodes.end());
+	tasks.clear();
+	uint32_t covered = 0;
+	for (uint32_t node : dirtyNodes)
+	{
+		dirty[node] = 0;
+		if (node < covered)
+			continue;
+
+		covered = subtreeEnds[node];
+		split(node, covered);
+		lastStats.subtrees++;
+		lastStats.updated += covered - node;
+	}
+	dirtyNodes.clear();
+
+	if (lastStats.updated > SCENE_UPDATE_GRAIN && tasks.size() > 1)
+	{
+		// many small subtrees (a few moving chairs each) are handed out several per chunk
+		size_t grain = max<size_t>(1, tasks.size() * SCENE_UPDATE_GRAIN / lastStats.updated);
+		pool.parallelFor(tasks.size(), grain, [this](size_t begin, size_t end, unsigned)
+						 {
+							 for (size_t t = begin; t < end; t++)
+								 updateRange(tasks[t].first, tasks[t].second);
+						 });
+	}
+	else
+	{
+		for (const pair<uint32_t, uint32_t> &task : tasks)
+			updateRange(task.first, task.second);
+	}
+
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	lastStats.updateMs = elapsed.count();
+}
@@ -0,0 +1,72 @@
+/*
+ * SceneGraph.h
+ *
+ *  Transform hierarchy in structure-of-arrays form: local and world matrices, parents and
+ *  subtree extents live in separate contiguous arrays kept in depth-first order, so a dirty
+ *  subtree is one index range and static nodes are never touched after their first update
+ */
+
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <GL/glm/glm.hpp>
+
+#include "TaskPool.h"
+
+#define SCENE_NO_PARENT 0xFFFFFFFFu
+#define SCENE_UPDATE_GRAIN 2048 // nodes per task; smaller updates run on the calling thread
+
+/* Stable handle of a node; its array index changes when nodes are added and the arrays are re-sorted */
+typedef uint32_t SceneNode;
+
+/* What the last update() did */
+struct SceneGraphStats
+{
+	uint32_t nodes = 0;
+	uint32_t updated = 0;	 // world matrices recomputed
+	uint32_t subtrees = 0;	 // dirty subtrees they came from
+	double updateMs = 0.0;
+};
+
+class SceneGraph
+{
+public:
+	void clear();
+
+	// appends a node under 'parent' (SCENE_NO_PARENT for a root); its world is valid after the next update()
+	SceneNode add(SceneNode parent, const glm::mat4 &local);
+
+	void setLocal(SceneNode node, const glm::mat4 &local); // marks the node and everything below it dirty
+
+	const glm::mat4 &local(SceneNode node) const { return locals[indexOf[node]]; }
+	const glm::mat4 &world(SceneNode node) const { return worlds[indexOf[node]]; } // as of the last update()
+
+	// recomputes the world matrices of the dirty subtrees, large ones on the pool
+	void update(TaskPool &pool);
+
+	size_t size() const { return parents.size(); }
+	const SceneGraphStats &stats() const { return lastStats; }
+
+private:
+	void sortDepthFirst();
+	void split(uint32_t begin, uint32_t end);
+	void updateRange(uint32_t begin, uint32_t end);
+
+	// one entry per node, in depth-first order: a parent precedes its children and a subtree is [node, subtreeEnds[node])
+	std::vector<glm::mat4> locals, worlds;
+	std::vector<uint32_t> parents; // array index of the parent, SCENE_NO_PARENT for roots
+	std::vector<uint32_t> subtreeEnds;
+	std::vector<uint8_t> dirty;
+	std::vector<uint32_t> handleOf; // array index to handle
+
+	std::vector<uint32_t> indexOf;	  // handle to array index
+	std::vector<uint32_t> dirtyNodes; // array indices marked since the last update
+	std::vector<std::pair<uint32_t, uint32_t>> tasks;
+	bool sorted = true;
+	SceneGraphStats lastStats;
+};
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ * ShaderCache.cpp
+ *
+ *  Checked shader program builds backed by an on-disk program binary cache
+ */
+
+/* Header Inclusions */
+#include "ShaderCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std; // standard namespace
+
+/* 64-bit FNV-1a, continued from 'hash' */
+static uint64_t UHashBytes(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+static uint64_t UHashString(uint64_t hash, const char *text)
+{
+	// the terminator goes in too, so "ab" + "c" and "a" + "bc" differ
+	return UHashBytes(hash, text ? text : "", text ? strlen(text) + 1 : 1);
+}
+
+/* Sources, stage types and the driver identity: anything that changes the binary changes the key */
+static uint64_t UProgramKey(const vector<ShaderStage> &stages)
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+
+	for (const ShaderStage &stage : stages)
+	{
+		hash = UHashBytes(hash, &stage.type, sizeof(stage.type));
+		hash = UHashString(hash, stage.source);
+		hash = UHashString(hash, stage.prelude);
+	}
+
+	hash = UHashString(hash, (const char *)glGetString(GL_VENDOR));
+	hash = UHashString(hash, (const char *)glGetString(GL_RENDERER));
+	hash = UHashString(hash, (const char *)glGetString(GL_VERSION));
+	hash = UHashString(hash, (const char *)glGetString(GL_SHADING_LANGUAGE_VERSION));
+	return hash;
+}
+
+static string UCachePath(const ShaderCacheOptions &options, const string &name, uint64_t key)
+{
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+	return options.directory + "/" + name + "-" + hex + ".bin";
+}
+
+static const char *UStageName(GLenum type)
+{
+	switch (type)
+	{
+	case GL_VERTEX_SHADER:
+		return "vertex";
+	case GL_FRAGMENT_SHADER:
+		return "fragment";
+	case GL_GEOMETRY_SHADER:
+		return "geometry";
+	default:
+		return "shader";
+	}
+}
+
+/* Whether the driver can hand out and take back program binaries at all */
+static bool UProgramBinarySupported()
+{
+	if (!GLEW_ARB_get_program_binary && !GLEW_VERSION_4_1)
+		return false;
+
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+/* Reloads a cached binary, 0 when there is none or the driver rejects it */
+static GLuint ULoadProgramBinary(const string &path, uint64_t key)
+{
+	ifstream in(path, ios::binary | ios::ate);
+	if (!in)
+		return 0;
+	streamoff fileSize = in.tellg();
+	in.seekg(0);
+
+	ShaderCacheHeader header;
+	if (!in.read((char *)&header, sizeof(header)) || header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION || header.hash != key)
+		return 0;
+
+	// a truncated or corrupt file must not size the allocation
+	if (header.binarySize == 0 || header.binarySize > (uint64_t)(fileSize - (streamoff)sizeof(header)))
+		return 0;
+
+	vector<char> binary(header.binarySize);
+	if (!in.read(binary.data(), binary.size()))
+		return 0;
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, header.binaryFormat, binary.data(), (GLsizei)binary.size());
+
+	// drivers refuse binaries from other builds of themselves by failing the link status
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked)
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	return program;
+}
+
+static void USaveProgramBinary(const string &path, uint64_t key, GLuint program)
+{
+	GLint size = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (size <= 0)
+		return;
+
+	vector<char> binary(size);
+	GLenum format = 0;
+	glGetProgramBinary(program, size, &size, &format, binary.data());
+
+	ShaderCacheHeader header = {SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, key, format, (uint32_t)size};
+
+	// written aside under a name of this process and renamed, so a crash or a second instance never leaves half a file behind
+	string temporary = path + "." + to_string(getpid()) + ".tmp";
+	{
+		ofstream out(temporary, ios::binary | ios::trunc);
+		if (!out)
+			return;
+		out.write((const char *)&header, sizeof(header));
+		out.write(binary.data(), size);
+		if (!out)
+			return;
+	}
+
+#ifdef _WIN32
+	remove(path.c_str()); // rename does not replace on Windows
+#endif
+	if (rename(temporary.c_str(), path.c_str()) != 0)
+		remove(temporary.c_str());
+}
+
+/* Compiles one stage, printing its info log on failure */
+static GLuint UCompileStage(const string &name, const ShaderStage &stage)
+{
+	GLuint shader = glCreateShader(stage.type);
+
+	// the prelude goes between the #version line, which must come first, and the rest of the source
+	const GLchar *rest = stage.prelude ? strchr(stage.source, '\n') : nullptr;
+	if (rest)
+	{
+		const GLchar *sources[3] = {stage.source, stage.prelude, rest + 1};
+		GLint lengths[3] = {(GLint)(rest + 1 - stage.source), -1, -1};
+		glShaderSource(shader, 3, sources, lengths);
+	}
+	else
+		glShaderSource(shader, 1, &stage.source, NULL);
+	glCompileShader(shader);
+
+	GLint compiled = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if (!compiled)
+	{
+		GLint length = 0;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+		string log(max(length, 1), '\0');
+		glGetShaderInfoLog(shader, length, NULL, &log[0]);
+
+		cout << "Shader " << name << ": " << UStageName(stage.type) << " stage failed to compile" << endl
+			 << log.c_str() << endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+/* Parses --shader-cache dir and --no-shader-cache */
+bool UParseShaderCacheArgs(int argc, char *argv[], ShaderCacheOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--no-shader-cache")
+		{
+			options.enabled = false;
+		}
+		else if (arg == "--shader-cache")
+		{
+			if (i + 1 >= argc)
+			{
+				cout << "--shader-cache expects a directory" << endl;
+				return false;
+			}
+			options.directory = argv[++i];
+		}
+	}
+
+	return true;
+}
+
+GLuint UCreateProgram(const ShaderCacheOptions &options, const string &name, const vector<ShaderStage> &stages, bool *fromCache)
+{
+	if (fromCache)
+		*fromCache = false;
+
+	bool cache = options.enabled && UProgramBinarySupported();
+	uint64_t key = 0;
+	string path;
+
+	if (cache)
+	{
+		key = UProgramKey(stages);
+		path = UCachePath(options, name, key);
+
+		GLuint program = ULoadProgramBinary(path, key);
+		if (program != 0)
+		{
+			if (fromCache)
+				*fromCache = true;
+			return program;
+		}
+	}
+
+	// full compile and link
+	GLuint program = glCreateProgram();
+	vector<GLuint> shaders;
+	bool compiled = true;
+
+	for (const ShaderStage &stage : stages)
+	{
+		GLuint shader = UCompileStage(name, stage);
+		if (shader == 0)
+		{
+			compiled = false;
+			break;
+		}
+		glAttachShader(program, shader);
+		shaders.push_back(shader);
+	}
+
+	GLint linked = GL_FALSE;
+	if (compiled)
+	{
+		if (cache)
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(program);
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+		if (!linked)
+		{
+			GLint length = 0;
+			glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+			string log(max(length, 1), '\0');
+			glGetProgramInfoLog(program, length, NULL, &log[0]);
+
+			cout << "Shader " << name << ": program failed to link" << endl
+				 << log.c_str() << endl;
+		}
+	}
+
+	// the program keeps what it needs once linked
+	for (GLuint shader : shaders)
+	{
+		glDetachShader(program, shader);
+		glDeleteShader(shader);
+	}
+
+	if (!linked)
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	if (cache)
+	{
+#ifdef _WIN32
+		_mkdir(options.directory.c_str());
+#else
+		mkdir(options.directory.c_str(), 0755);
+#endif
+		USaveProgramBinary(path, key, program);
+	}
+
+	return program;
+}
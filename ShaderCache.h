@@ -0,0 +1,54 @@
+/*
+ * ShaderCache.h
+ *
+ *  Builds shader programs with checked compile and link status, and keeps the linked
+ *  binaries on disk so later launches skip the GLSL compiler
+ *
+ *  Cache file (<directory>/<name>-<hash>.bin, little-endian):
+ *    ShaderCacheHeader | program binary
+ *  The hash covers every stage's source and prelude plus the vendor, renderer and version strings,
+ *  so a driver update or a shader edit simply misses the cache.
+ */
+
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#define SHADER_CACHE_MAGIC 0x48435350u // "PSCH"
+#define SHADER_CACHE_VERSION 1u
+
+/* Command line options of the cache */
+struct ShaderCacheOptions
+{
+	bool enabled = true;					// --no-shader-cache always compiles
+	std::string directory = "shadercache"; // --shader-cache dir
+};
+
+/* One stage of a program */
+struct ShaderStage
+{
+	GLenum type; // GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, ...
+	const GLchar *source;
+	const GLchar *prelude = nullptr; // declarations shared between programs, compiled right after the source's #version line
+};
+
+/* Cache file header */
+struct ShaderCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t hash;		   // repeated from the file name, guards against renamed files
+	uint32_t binaryFormat; // as returned by glGetProgramBinary
+	uint32_t binarySize;
+};
+
+bool UParseShaderCacheArgs(int argc, char *argv[], ShaderCacheOptions &options);
+
+// returns the linked program, or 0 after printing the info log of the stage or link that failed
+GLuint UCreateProgram(const ShaderCacheOptions &options, const std::string &name, const std::vector<ShaderStage> &stages, bool *fromCache = nullptr);
+
+#endif
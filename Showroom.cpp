@@ -0,0 +1,140 @@
+/*
+ * Showroom.cpp
+ *
+ *  Instanced "showroom" scene: many chairs submitted with a single draw call
+ */
+
+/* Header Inclusions */
+#include "Showroom.h"
+#include "FrameTrace.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <cstddef>
+#include <string>
+
+#include <GL/glm/gtc/matrix_transform.hpp>
+
+using namespace std; // standard namespace
+
+/* Wood and lacquer finishes the showroom cycles through (rgb tint, specular) */
+static const glm::vec4 showroomFinishes[] = {
+	glm::vec4(1.00f, 1.00f, 1.00f, 0.50f), // natural wood
+	glm::vec4(0.55f, 0.38f, 0.26f, 0.35f), // walnut stain
+	glm::vec4(0.85f, 0.72f, 0.55f, 0.40f), // light oak
+	glm::vec4(0.20f, 0.20f, 0.22f, 0.80f), // black lacquer
+	glm::vec4(0.80f, 0.15f, 0.12f, 0.70f), // red lacquer
+	glm::vec4(0.95f, 0.95f, 0.90f, 0.60f), // white paint
+};
+
+/* Parses the showroom options, ignoring anything it does not know */
+void UParseShowroomArgs(int argc, char *argv[], ShowroomOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--showroom" && hasValue)
+			options.count = max(0, atoi(argv[++i]));
+		else if (arg == "--spacing" && hasValue)
+			options.spacing = (float)atof(argv[++i]);
+		else if (arg == "--showroom-loop")
+			options.loop = true;
+		else if (arg == "--moving" && hasValue)
+			options.moving = min(100, max(0, atoi(argv[++i])));
+		else if (arg == "--no-cull")
+			options.cull = false;
+	}
+}
+
+/* Integer hash so the layout is identical on every run */
+static unsigned int UShowroomHash(int index)
+{
+	return (unsigned int)index * 2654435761u;
+}
+
+/* Whether chair 'index' is one of the moving ones */
+bool UIsShowroomMoving(const ShowroomOptions &options, int index)
+{
+	return (int)((UShowroomHash(index) >> 8) % 100u) < options.moving;
+}
+
+/* Spot of chair 'index' on the grid, before the chair's own model; moving chairs glide around it while turning */
+glm::mat4 UShowroomSpot(const ShowroomOptions &options, int index, float seconds)
+{
+	int side = (int)ceil(sqrt((double)options.count)); // chairs per grid row
+	float half = 0.5f * (side - 1) * options.spacing;
+	unsigned int hash = UShowroomHash(index);
+
+	glm::vec3 position((index % side) * options.spacing - half, 0.0f, (index / side) * options.spacing - half);
+	float turn = glm::radians((float)(hash % 360u));
+
+	if (seconds > 0.0f && UIsShowroomMoving(options, index))
+	{
+		float phase = seconds + (hash % 1000u) * 0.001f * glm::radians(360.0f);
+		position += 0.25f * options.spacing * glm::vec3(cos(phase), 0.0f, sin(phase));
+		turn += seconds;
+	}
+
+	glm::mat4 spot = glm::translate(glm::mat4(1.0f), position);
+	return glm::rotate(spot, turn, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+/* Lays the chairs out on a square grid centered on the origin, each turned and finished differently */
+void UBuildShowroom(const ShowroomOptions &options, const glm::mat4 &baseModel, vector<ChairInstance> &instances)
+{
+	instances.clear();
+	instances.reserve(options.count);
+
+	for (int i = 0; i < options.count; i++)
+	{
+		ChairInstance instance;
+		instance.model = UShowroomSpot(options, i, 0.0f) * baseModel;
+		instance.material = showroomFinishes[(UShowroomHash(i) >> 16) % (sizeof(showroomFinishes) / sizeof(showroomFinishes[0]))];
+
+		instances.push_back(instance);
+	}
+}
+
+/* Binds the instance VBO to the per-instance attributes of the currently bound VAO */
+void UEnableInstanceAttributes(GLuint instanceVBO, GLuint firstInstance)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+	size_t first = firstInstance * sizeof(ChairInstance); // GL 3.3 has no base instance, so the pointers move instead
+
+	// a mat4 attribute occupies four consecutive vec4 locations
+	for (int column = 0; column < 4; column++)
+	{
+		GLuint location = INSTANCE_MODEL_LOCATION + column;
+		glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(ChairInstance), (GLvoid *)(first + offsetof(ChairInstance, model) + column * sizeof(glm::vec4)));
+		glEnableVertexAttribArray(location);
+		glVertexAttribDivisor(location, 1); // advance once per instance, not per vertex
+		UTraceAttribPointer(instanceVBO, location, 4, GL_FLOAT, sizeof(ChairInstance), first + offsetof(ChairInstance, model) + column * sizeof(glm::vec4), 1);
+	}
+
+	glVertexAttribPointer(INSTANCE_MATERIAL_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(ChairInstance), (GLvoid *)(first + offsetof(ChairInstance, material)));
+	glEnableVertexAttribArray(INSTANCE_MATERIAL_LOCATION);
+	glVertexAttribDivisor(INSTANCE_MATERIAL_LOCATION, 1);
+	UTraceAttribPointer(instanceVBO, INSTANCE_MATERIAL_LOCATION, 4, GL_FLOAT, sizeof(ChairInstance), first + offsetof(ChairInstance, material), 1);
+
+	glVertexAttribPointer(INSTANCE_LAYER_LOCATION, 1, GL_FLOAT, GL_FALSE, sizeof(ChairInstance), (GLvoid *)(first + offsetof(ChairInstance, layer)));
+	glEnableVertexAttribArray(INSTANCE_LAYER_LOCATION);
+	glVertexAttribDivisor(INSTANCE_LAYER_LOCATION, 1);
+	UTraceAttribPointer(instanceVBO, INSTANCE_LAYER_LOCATION, 1, GL_FLOAT, sizeof(ChairInstance), first + offsetof(ChairInstance, layer), 1);
+
+	glVertexAttribPointer(INSTANCE_FADE_LOCATION, 1, GL_FLOAT, GL_FALSE, sizeof(ChairInstance), (GLvoid *)(first + offsetof(ChairInstance, fade)));
+	glEnableVertexAttribArray(INSTANCE_FADE_LOCATION);
+	glVertexAttribDivisor(INSTANCE_FADE_LOCATION, 1);
+	UTraceAttribPointer(instanceVBO, INSTANCE_FADE_LOCATION, 1, GL_FLOAT, sizeof(ChairInstance), first + offsetof(ChairInstance, fade), 1);
+}
+
+/* Replaces the contents of the instance VBO, orphaning the old storage so the upload never waits on the GPU */
+void UUploadInstances(GLuint instanceVBO, const ChairInstance *instances, GLsizei count)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(ChairInstance), NULL, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(ChairInstance), instances);
+	UTraceUpload(GL_ARRAY_BUFFER, instanceVBO, 0, count * sizeof(ChairInstance), instances, TRACE_UPLOAD_ORPHAN);
+}
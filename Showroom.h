@@ -0,0 +1,47 @@
+/*
+ * Showroom.h
+ *
+ *  Instanced "showroom" scene: many chairs submitted with a single draw call
+ */
+
+#ifndef SHOWROOM_H
+#define SHOWROOM_H
+
+#include <cstdint>
+#include <vector>
+#include <GL/glew.h>
+#include <GL/glm/glm.hpp>
+
+/* Per-instance data, laid out exactly as the instance VBO stores it */
+struct ChairInstance
+{
+	glm::mat4 model;	// object to world transform
+	glm::vec4 material; // rgb finish tint, a specular intensity
+	GLfloat layer = 0;	// layer of the material array with --materials
+	GLfloat fade = 0;	// level of detail cross-fade with --lod-fade, set per frame
+};
+
+/* Command line options for the showroom scene */
+struct ShowroomOptions
+{
+	int count = 0;		   // --showroom N chairs, 0 renders the single chair
+	float spacing = 2.0f;  // --spacing distance between neighbouring chairs
+	bool loop = false;	   // --showroom-loop one draw call per chair, for comparison
+	int moving = 0;		   // --moving P percent of the chairs that glide around their spot
+	bool cull = true;	   // --no-cull submits every chair, for comparison
+};
+
+/* Instance attribute locations used by the instanced object vertex shader */
+#define INSTANCE_MODEL_LOCATION 3	 // mat4 takes locations 3, 4, 5 and 6
+#define INSTANCE_MATERIAL_LOCATION 7
+#define INSTANCE_LAYER_LOCATION 9 // 8 is the lightmap coordinate
+#define INSTANCE_FADE_LOCATION 10
+
+void UParseShowroomArgs(int argc, char *argv[], ShowroomOptions &options);
+void UBuildShowroom(const ShowroomOptions &options, const glm::mat4 &baseModel, std::vector<ChairInstance> &instances);
+bool UIsShowroomMoving(const ShowroomOptions &options, int index);
+glm::mat4 UShowroomSpot(const ShowroomOptions &options, int index, float seconds);
+void UEnableInstanceAttributes(GLuint instanceVBO, GLuint firstInstance = 0); // attributes start at instance 'firstInstance' of the buffer
+void UUploadInstances(GLuint instanceVBO, const ChairInstance *instances, GLsizei count);
+
+#endif
@@ -0,0 +1,912 @@
+/*
+ * SoftRaster.cpp
+ *
+ *  Tiled, multithreaded SIMD software rasterizer for the chair scene
+ */
+
+/* Header Inclusions */
+#include "SoftRaster.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <GL/glew.h>
+
+using namespace std; // standard namespace
+
+// SIMD kernels: 2 AVX2 (8 pixels), 1 SSE2 (4 pixels), 0 plain C++ (4 pixels); build with -DSOFT_RASTER_SIMD=N to force one
+#ifndef SOFT_RASTER_SIMD
+#if defined(__AVX2__)
+#define SOFT_RASTER_SIMD 2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOFT_RASTER_SIMD 1
+#else
+#define SOFT_RASTER_SIMD 0
+#endif
+#endif
+
+#define SOFT_SETUP_GRAIN 256 // triangles per setup chunk
+
+// plane slots of a Triangle
+#define PLANE_DEPTH 0
+#define PLANE_INV_W 1
+#define PLANE_WORLD 2  // 3 slots
+#define PLANE_NORMAL 5 // 3 slots
+#define PLANE_UV 8	   // 2 slots
+
+/*** SIMD wrappers: vfloat and vint hold one value per pixel of a span, vmask one lane mask ***/
+
+#if SOFT_RASTER_SIMD == 2
+
+#include <immintrin.h>
+#define SOFT_LANES 8
+
+struct vfloat
+{
+	__m256 v;
+};
+struct vint
+{
+	__m256i v;
+};
+struct vmask
+{
+	__m256 v;
+};
+
+static inline vfloat VSet(float x) { return {_mm256_set1_ps(x)}; }
+static inline vfloat VRamp(void) { return {_mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f)}; }
+static inline vfloat VLoad(const float *p) { return {_mm256_loadu_ps(p)}; }
+static inline void VStore(float *p, vfloat a) { _mm256_storeu_ps(p, a.v); }
+static inline vfloat operator+(vfloat a, vfloat b) { return {_mm256_add_ps(a.v, b.v)}; }
+static inline vfloat operator-(vfloat a, vfloat b) { return {_mm256_sub_ps(a.v, b.v)}; }
+static inline vfloat operator*(vfloat a, vfloat b) { return {_mm256_mul_ps(a.v, b.v)}; }
+static inline vfloat operator/(vfloat a, vfloat b) { return {_mm256_div_ps(a.v, b.v)}; }
+static inline vfloat VMin(vfloat a, vfloat b) { return {_mm256_min_ps(a.v, b.v)}; }
+static inline vfloat VMax(vfloat a, vfloat b) { return {_mm256_max_ps(a.v, b.v)}; }
+static inline vfloat VSqrt(vfloat a) { return {_mm256_sqrt_ps(a.v)}; }
+static inline vfloat VFloor(vfloat a) { return {_mm256_floor_ps(a.v)}; }
+static inline vmask operator<(vfloat a, vfloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+static inline vmask operator>(vfloat a, vfloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+static inline vmask operator>=(vfloat a, vfloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+static inline vmask operator&(vmask a, vmask b) { return {_mm256_and_ps(a.v, b.v)}; }
+static inline bool VAny(vmask m) { return _mm256_movemask_ps(m.v) != 0; }
+static inline vfloat VSelect(vmask m, vfloat a, vfloat b) { return {_mm256_blendv_ps(b.v, a.v, m.v)}; }
+static inline vint VSelect(vmask m, vint a, vint b) { return {_mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(b.v), _mm256_castsi256_ps(a.v), m.v))}; }
+
+static inline vint VSetInt(int x) { return {_mm256_set1_epi32(x)}; }
+static inline vint VLoadInt(const uint32_t *p) { return {_mm256_loadu_si256((const __m256i *)p)}; }
+static inline void VStoreInt(uint32_t *p, vint a) { _mm256_storeu_si256((__m256i *)p, a.v); }
+static inline vint VToInt(vfloat a) { return {_mm256_cvttps_epi32(a.v)}; }
+static inline vfloat VToFloat(vint a) { return {_mm256_cvtepi32_ps(a.v)}; }
+static inline vint VBits(vfloat a) { return {_mm256_castps_si256(a.v)}; }
+static inline vfloat VFromBits(vint a) { return {_mm256_castsi256_ps(a.v)}; }
+static inline vint operator+(vint a, vint b) { return {_mm256_add_epi32(a.v, b.v)}; }
+static inline vint operator-(vint a, vint b) { return {_mm256_sub_epi32(a.v, b.v)}; }
+static inline vint operator&(vint a, vint b) { return {_mm256_and_si256(a.v, b.v)}; }
+static inline vint operator|(vint a, vint b) { return {_mm256_or_si256(a.v, b.v)}; }
+static inline vint VShiftRight(vint a, int bits) { return {_mm256_srli_epi32(a.v, bits)}; }
+static inline vint VShiftLeft(vint a, int bits) { return {_mm256_slli_epi32(a.v, bits)}; }
+static inline vint VGather(const int32_t *base, vint index) { return {_mm256_i32gather_epi32(base, index.v, 4)}; }
+
+#elif SOFT_RASTER_SIMD == 1
+
+#include <emmintrin.h>
+#define SOFT_LANES 4
+
+struct vfloat
+{
+	__m128 v;
+};
+struct vint
+{
+	__m128i v;
+};
+struct vmask
+{
+	__m128 v;
+};
+
+static inline vfloat VSet(float x) { return {_mm_set1_ps(x)}; }
+static inline vfloat VRamp(void) { return {_mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f)}; }
+static inline vfloat VLoad(const float *p) { return {_mm_loadu_ps(p)}; }
+static inline void VStore(float *p, vfloat a) { _mm_storeu_ps(p, a.v); }
+static inline vfloat operator+(vfloat a, vfloat b) { return {_mm_add_ps(a.v, b.v)}; }
+static inline vfloat operator-(vfloat a, vfloat b) { return {_mm_sub_ps(a.v, b.v)}; }
+static inline vfloat operator*(vfloat a, vfloat b) { return {_mm_mul_ps(a.v, b.v)}; }
+static inline vfloat operator/(vfloat a, vfloat b) { return {_mm_div_ps(a.v, b.v)}; }
+static inline vfloat VMin(vfloat a, vfloat b) { return {_mm_min_ps(a.v, b.v)}; }
+static inline vfloat VMax(vfloat a, vfloat b) { return {_mm_max_ps(a.v, b.v)}; }
+static inline vfloat VSqrt(vfloat a) { return {_mm_sqrt_ps(a.v)}; }
+static inline vmask operator<(vfloat a, vfloat b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+static inline vmask operator>(vfloat a, vfloat b) { return {_mm_cmpgt_ps(a.v, b.v)}; }
+static inline vmask operator>=(vfloat a, vfloat b) { return {_mm_cmpge_ps(a.v, b.v)}; }
+static inline vmask operator&(vmask a, vmask b) { return {_mm_and_ps(a.v, b.v)}; }
+static inline bool VAny(vmask m) { return _mm_movemask_ps(m.v) != 0; }
+static inline vfloat VSelect(vmask m, vfloat a, vfloat b) { return {_mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v))}; }
+static inline vint VSelect(vmask m, vint a, vint b)
+{
+	__m128i mask = _mm_castps_si128(m.v);
+	return {_mm_or_si128(_mm_and_si128(mask, a.v), _mm_andnot_si128(mask, b.v))};
+}
+
+static inline vint VSetInt(int x) { return {_mm_set1_epi32(x)}; }
+static inline vint VLoadInt(const uint32_t *p) { return {_mm_loadu_si128((const __m128i *)p)}; }
+static inline void VStoreInt(uint32_t *p, vint a) { _mm_storeu_si128((__m128i *)p, a.v); }
+static inline vint VToInt(vfloat a) { return {_mm_cvttps_epi32(a.v)}; }
+static inline vfloat VToFloat(vint a) { return {_mm_cvtepi32_ps(a.v)}; }
+static inline vint VBits(vfloat a) { return {_mm_castps_si128(a.v)}; }
+static inline vfloat VFromBits(vint a) { return {_mm_castsi128_ps(a.v)}; }
+static inline vint operator+(vint a, vint b) { return {_mm_add_epi32(a.v, b.v)}; }
+static inline vint operator-(vint a, vint b) { return {_mm_sub_epi32(a.v, b.v)}; }
+static inline vint operator&(vint a, vint b) { return {_mm_and_si128(a.v, b.v)}; }
+static inline vint operator|(vint a, vint b) { return {_mm_or_si128(a.v, b.v)}; }
+static inline vint VShiftRight(vint a, int bits) { return {_mm_srli_epi32(a.v, bits)}; }
+static inline vint VShiftLeft(vint a, int bits) { return {_mm_slli_epi32(a.v, bits)}; }
+
+// SSE2 has no floor (SSE4.1) and no gather (AVX2)
+static inline vfloat VFloor(vfloat a)
+{
+	vfloat truncated = VToFloat(VToInt(a));
+	return truncated - VSelect(a < truncated, VSet(1.0f), VSet(0.0f));
+}
+
+static inline vint VGather(const int32_t *base, vint index)
+{
+	alignas(16) int32_t lanes[4];
+	_mm_store_si128((__m128i *)lanes, index.v);
+	return {_mm_setr_epi32(base[lanes[0]], base[lanes[1]], base[lanes[2]], base[lanes[3]])};
+}
+
+#else
+
+#define SOFT_LANES 4
+
+struct vfloat
+{
+	float v[SOFT_LANES];
+};
+struct vint
+{
+	int32_t v[SOFT_LANES];
+};
+struct vmask
+{
+	bool v[SOFT_LANES];
+};
+
+#define SOFT_LANEWISE(type, expression) \
+	type r;                              \
+	for (int i = 0; i < SOFT_LANES; i++) \
+		r.v[i] = expression;             \
+	return r;
+
+static inline vfloat VSet(float x) { SOFT_LANEWISE(vfloat, x) }
+static inline vfloat VRamp(void) { SOFT_LANEWISE(vfloat, (float)i) }
+static inline vfloat VLoad(const float *p) { SOFT_LANEWISE(vfloat, p[i]) }
+static inline void VStore(float *p, vfloat a) { memcpy(p, a.v, sizeof(a.v)); }
+static inline vfloat operator+(vfloat a, vfloat b) { SOFT_LANEWISE(vfloat, a.v[i] + b.v[i]) }
+static inline vfloat operator-(vfloat a, vfloat b) { SOFT_LANEWISE(vfloat, a.v[i] - b.v[i]) }
+static inline vfloat operator*(vfloat a, vfloat b) { SOFT_LANEWISE(vfloat, a.v[i] * b.v[i]) }
+static inline vfloat operator/(vfloat a, vfloat b) { SOFT_LANEWISE(vfloat, a.v[i] / b.v[i]) }
+static inline vfloat VMin(vfloat a, vfloat b) { SOFT_LANEWISE(vfloat, a.v[i] < b.v[i] ? a.v[i] : b.v[i]) }
+static inline vfloat VMax(vfloat a, vfloat b) { SOFT_LANEWISE(vfloat, a.v[i] > b.v[i] ? a.v[i] : b.v[i]) }
+static inline vfloat VSqrt(vfloat a) { SOFT_LANEWISE(vfloat, sqrt(a.v[i])) }
+static inline vfloat VFloor(vfloat a) { SOFT_LANEWISE(vfloat, floor(a.v[i])) }
+static inline vmask operator<(vfloat a, vfloat b) { SOFT_LANEWISE(vmask, a.v[i] < b.v[i]) }
+static inline vmask operator>(vfloat a, vfloat b) { SOFT_LANEWISE(vmask, a.v[i] > b.v[i]) }
+static inline vmask operator>=(vfloat a, vfloat b) { SOFT_LANEWISE(vmask, a.v[i] >= b.v[i]) }
+static inline vmask operator&(vmask a, vmask b) { SOFT_LANEWISE(vmask, a.v[i] && b.v[i]) }
+static inline bool VAny(vmask m) { return m.v[0] || m.v[1] || m.v[2] || m.v[3]; }
+static inline vfloat VSelect(vmask m, vfloat a, vfloat b) { SOFT_LANEWISE(vfloat, m.v[i] ? a.v[i] : b.v[i]) }
+static inline vint VSelect(vmask m, vint a, vint b) { SOFT_LANEWISE(vint, m.v[i] ? a.v[i] : b.v[i]) }
+
+static inline vint VSetInt(int x) { SOFT_LANEWISE(vint, x) }
+static inline vint VLoadInt(const uint32_t *p) { SOFT_LANEWISE(vint, (int32_t)p[i]) }
+static inline void VStoreInt(uint32_t *p, vint a) { memcpy(p, a.v, sizeof(a.v)); }
+static inline vint VToInt(vfloat a) { SOFT_LANEWISE(vint, (int32_t)a.v[i]) }
+static inline vfloat VToFloat(vint a) { SOFT_LANEWISE(vfloat, (float)a.v[i]) }
+static inline vint VBits(vfloat a)
+{
+	vint r;
+	memcpy(r.v, a.v, sizeof(r.v));
+	return r;
+}
+static inline vfloat VFromBits(vint a)
+{
+	vfloat r;
+	memcpy(r.v, a.v, sizeof(r.v));
+	return r;
+}
+static inline vint operator+(vint a, vint b) { SOFT_LANEWISE(vint, a.v[i] + b.v[i]) }
+static inline vint operator-(vint a, vint b) { SOFT_LANEWISE(vint, a.v[i] - b.v[i]) }
+static inline vint operator&(vint a, vint b) { SOFT_LANEWISE(vint, a.v[i] & b.v[i]) }
+static inline vint operator|(vint a, vint b) { SOFT_LANEWISE(vint, a.v[i] | b.v[i]) }
+static inline vint VShiftRight(vint a, int bits) { SOFT_LANEWISE(vint, (int32_t)((uint32_t)a.v[i] >> bits)) }
+static inline vint VShiftLeft(vint a, int bits) { SOFT_LANEWISE(vint, (int32_t)((uint32_t)a.v[i] << bits)) }
+static inline vint VGather(const int32_t *base, vint index) { SOFT_LANEWISE(vint, base[index.v[i]]) }
+
+#endif
+
+static inline vfloat VClamp01(vfloat a) { return VMin(VMax(a, VSet(0.0f)), VSet(1.0f)); }
+
+/* log2 from the float's exponent plus a quadratic fit of the mantissa, within 0.01 */
+static inline vfloat VLog2(vfloat a)
+{
+	vint bits = VBits(a);
+	vfloat exponent = VToFloat((VShiftRight(bits, 23) & VSetInt(255)) - VSetInt(127));
+	vfloat mantissa = VFromBits((bits & VSetInt(0x007FFFFF)) | VSetInt(0x3F800000)); // [1, 2)
+	return exponent + (VSet(-0.34484843f) * mantissa + VSet(2.02466578f)) * mantissa - VSet(1.67487759f);
+}
+
+/* Texel index of wrapped (GL_REPEAT) integer coordinates; the clamp keeps rounding at huge coordinates inside the level */
+static inline vint VTexelIndex(vfloat x, vfloat y, vfloat width, vfloat height, vfloat offset)
+{
+	x = VMin(VMax(x - width * VFloor(x / width), VSet(0.0f)), width - VSet(1.0f));
+	y = VMin(VMax(y - height * VFloor(y / height), VSet(0.0f)), height - VSet(1.0f));
+	return VToInt(offset + y * width + x);
+}
+
+static inline void VUnpack(vint texel, vfloat rgb[3])
+{
+	for (int c = 0; c < 3; c++)
+		rgb[c] = VToFloat(VShiftRight(texel, 8 * c) & VSetInt(255)) * VSet(1.0f / 255.0f);
+}
+
+/* GL_LINEAR on level 0, the magnification filter */
+static void USampleBilinear(const SoftTexture &texture, vfloat s, vfloat t, vfloat rgb[3])
+{
+	vfloat width = VSet(texture.levelWidth[0]), height = VSet(texture.levelHeight[0]), offset = VSet(0.0f);
+	const int32_t *texels = (const int32_t *)texture.texels.data();
+
+	vfloat x = s * width - VSet(0.5f), y = t * height - VSet(0.5f);
+	vfloat x0 = VFloor(x), y0 = VFloor(y);
+	vfloat fx = x - x0, fy = y - y0;
+	vfloat x1 = x0 + VSet(1.0f), y1 = y0 + VSet(1.0f);
+
+	vfloat c00[3], c10[3], c01[3], c11[3];
+	VUnpack(VGather(texels, VTexelIndex(x0, y0, width, height, offset)), c00);
+	VUnpack(VGather(texels, VTexelIndex(x1, y0, width, height, offset)), c10);
+	VUnpack(VGather(texels, VTexelIndex(x0, y1, width, height, offset)), c01);
+	VUnpack(VGather(texels, VTexelIndex(x1, y1, width, height, offset)), c11);
+
+	for (int c = 0; c < 3; c++)
+	{
+		vfloat top = c00[c] + (c10[c] - c00[c]) * fx;
+		vfloat bottom = c01[c] + (c11[c] - c01[c]) * fx;
+		rgb[c] = top + (bottom - top) * fy;
+	}
+}
+
+/* Nearest texel of a per-lane mip level */
+static void USampleNearest(const SoftTexture &texture, vint level, vfloat s, vfloat t, vfloat rgb[3])
+{
+	vfloat width = VFromBits(VGather((const int32_t *)texture.levelWidth.data(), level));
+	vfloat height = VFromBits(VGather((const int32_t *)texture.levelHeight.data(), level));
+	vfloat offset = VToFloat(VGather(texture.levelOffset.data(), level));
+
+	vint index = VTexelIndex(VFloor(s * width), VFloor(t * height), width, height, offset);
+	VUnpack(VGather((const int32_t *)texture.texels.data(), index), rgb);
+}
+
+/* GL defaults of the wood texture: GL_LINEAR when magnified, GL_NEAREST_MIPMAP_LINEAR when minified */
+static void USampleTexture(const SoftTexture &texture, vfloat s, vfloat t, vfloat lod, vmask lanes, vfloat rgb[3])
+{
+	USampleBilinear(texture, s, t, rgb);
+
+	vmask minified = lanes & (lod > VSet(0.0f));
+	if (!VAny(minified))
+		return;
+
+	float maxLevel = (float)(texture.levelOffset.size() - 1);
+	vfloat level = VSelect(minified, VMin(lod, VSet(maxLevel)), VSet(0.0f));
+	vfloat lower = VFloor(level);
+	vfloat upper = VMin(lower + VSet(1.0f), VSet(maxLevel));
+
+	vfloat a[3], b[3];
+	USampleNearest(texture, VToInt(lower), s, t, a);
+	USampleNearest(texture, VToInt(upper), s, t, b);
+
+	vfloat blend = level - lower;
+	for (int c = 0; c < 3; c++)
+		rgb[c] = VSelect(minified, a[c] + (b[c] - a[c]) * blend, rgb[c]);
+}
+
+/*** Frame setup ***/
+
+SoftRasterizer::SoftRasterizer(TaskPool &pool, int width, int height, int tileSize)
+	: pool(pool), frameWidth(width), frameHeight(height)
+{
+	this->tileSize = max(SOFT_LANES, (tileSize + SOFT_LANES - 1) / SOFT_LANES * SOFT_LANES);
+	pitch = (width + SOFT_LANES - 1) / SOFT_LANES * SOFT_LANES;
+	tilesX = (width + this->tileSize - 1) / this->tileSize;
+	tilesY = (height + this->tileSize - 1) / this->tileSize;
+
+	color.assign((size_t)pitch * height, 0);
+	depth.assign((size_t)pitch * height, 1.0f);
+}
+
+void SoftRasterizer::render(const SoftFrame &frame)
+{
+	UPROFILE_SCOPE("SoftRasterizer::render");
+
+	shadeVertices(frame);
+	setupTriangles(frame);
+
+	UPROFILE_SCOPE("rasterize tiles");
+	pool.parallelFor((size_t)tilesX * tilesY, 1, [&](size_t begin, size_t end, unsigned)
+					 {
+		for (size_t tile = begin; tile < end; tile++)
+			rasterizeTile(frame, (int)tile); });
+}
+
+/* The object (and lamp) vertex shader for every instance */
+void SoftRasterizer::shadeVertices(const SoftFrame &frame)
+{
+	UPROFILE_SCOPE("shade vertices");
+
+	drawVertexBase.resize(frame.draws.size() + 1);
+	drawTriangleBase.resize(frame.draws.size() + 1);
+	drawVertexBase[0] = drawTriangleBase[0] = 0;
+	for (size_t i = 0; i < frame.draws.size(); i++)
+	{
+		drawVertexBase[i + 1] = drawVertexBase[i] + frame.draws[i].mesh->vertices.size();
+		drawTriangleBase[i + 1] = drawTriangleBase[i] + frame.draws[i].mesh->indices.size() / 3;
+	}
+	vertices.resize(drawVertexBase.back());
+
+	glm::mat4 viewProjection = frame.projection * frame.view;
+
+	pool.parallelFor(frame.draws.size(), 16, [&](size_t begin, size_t end, unsigned)
+					 {
+		for (size_t i = begin; i < end; i++)
+		{
+			const SoftDraw &draw = frame.draws[i];
+			glm::mat4 clipFromObject = viewProjection * draw.model;
+			glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(draw.model)));
+			ClipVertex *out = &vertices[drawVertexBase[i]];
+
+			for (const SoftVertex &vertex : draw.mesh->vertices)
+			{
+				out->clip = clipFromObject * glm::vec4(vertex.position, 1.0f);
+				out->world = glm::vec3(draw.model * glm::vec4(vertex.position, 1.0f));
+				out->normal = normalMatrix * vertex.normal;
+				out->uv = glm::vec2(vertex.uv.x, 1.0f - vertex.uv.y);
+				out++;
+			}
+		} });
+}
+
+
+/* Clips against the near plane (z >= -w); the other planes are left to the screen bounds and the depth test */
+int SoftRasterizer::clipNear(const ClipVertex &a, const ClipVertex &b, const ClipVertex &c, ClipVertex polygon[4])
+{
+	const ClipVertex *corners[3] = {&a, &b, &c};
+	int count = 0;
+
+	for (int i = 0; i < 3; i++)
+	{
+		const ClipVertex &from = *corners[i];
+		const ClipVertex &to = *corners[(i + 1) % 3];
+		float fromDistance = from.clip.z + from.clip.w;
+		float toDistance = to.clip.z + to.clip.w;
+
+		if (fromDistance >= 0.0f)
+			polygon[count++] = from;
+
+		if ((fromDistance >= 0.0f) != (toDistance >= 0.0f))
+		{
+			float t = fromDistance / (fromDistance - toDistance);
+			ClipVertex &cut = polygon[count++];
+			cut.clip = from.clip + (to.clip - from.clip) * t;
+			cut.world = from.world + (to.world - from.world) * t;
+			cut.normal = from.normal + (to.normal - from.normal) * t;
+			cut.uv = from.uv + (to.uv - from.uv) * t;
+		}
+	}
+
+	return count;
+}
+
+/* Projects one triangle to the screen, sets up its edges and planes and adds it to every tile its bounds touch */
+void SoftRasterizer::setupTriangle(const ClipVertex *corners[3], uint32_t draw, vector<Triangle> &triangles, vector<vector<uint32_t>> &bins) const
+{
+	float x[3], y[3], values[3][SOFT_PLANES];
+
+	for (int i = 0; i < 3; i++)
+	{
+		const ClipVertex &vertex = *corners[i];
+		float invW = 1.0f / vertex.clip.w;
+
+		// window coordinates with y pointing down, pixel centers at +0.5
+		x[i] = (vertex.clip.x * invW * 0.5f + 0.5f) * frameWidth;
+		y[i] = (0.5f - vertex.clip.y * invW * 0.5f) * frameHeight;
+
+		float *value = values[i];
+		value[PLANE_DEPTH] = vertex.clip.z * invW * 0.5f + 0.5f;
+		value[PLANE_INV_W] = invW;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			value[PLANE_WORLD + axis] = vertex.world[axis] * invW;
+			value[PLANE_NORMAL + axis] = vertex.normal[axis] * invW;
+		}
+		value[PLANE_UV] = vertex.uv.x * invW;
+		value[PLANE_UV + 1] = vertex.uv.y * invW;
+	}
+
+	// both windings are drawn (no face culling in the GL path either); flip to a positive area
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (!(fabs(area) > 0.0f))
+		return;
+
+	int order[3] = {0, 1, 2};
+	if (area < 0.0f)
+	{
+		swap(order[1], order[2]);
+		area = -area;
+	}
+
+	// pixels whose centers can be inside
+	float minX = max(min(x[0], min(x[1], x[2])) - 0.5f, 0.0f);
+	float maxX = min(max(x[0], max(x[1], x[2])) - 0.5f, (float)(frameWidth - 1));
+	float minY = max(min(y[0], min(y[1], y[2])) - 0.5f, 0.0f);
+	float maxY = min(max(y[0], max(y[1], y[2])) - 0.5f, (float)(frameHeight - 1));
+	if (minX > maxX || minY > maxY)
+		return;
+
+	Triangle triangle;
+	triangle.minX = (int)ceil(minX);
+	triangle.maxX = (int)floor(maxX);
+	triangle.minY = (int)ceil(minY);
+	triangle.maxY = (int)floor(maxY);
+	if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+		return;
+	triangle.draw = draw;
+
+	for (int edge = 0; edge < 3; edge++)
+	{
+		int from = order[edge], to = order[(edge + 1) % 3];
+
+		// written so the shared edge of a neighbour evaluates to exactly the negated value
+		triangle.edgeA[edge] = y[from] - y[to];
+		triangle.edgeB[edge] = x[to] - x[from];
+		triangle.edgeC[edge] = x[from] * y[to] - x[to] * y[from];
+		triangle.topLeft[edge] = triangle.edgeA[edge] > 0.0f || (triangle.edgeA[edge] == 0.0f && triangle.edgeB[edge] > 0.0f);
+	}
+
+	int v0 = order[0], v1 = order[1], v2 = order[2];
+	float dx1 = x[v1] - x[v0], dy1 = y[v1] - y[v0];
+	float dx2 = x[v2] - x[v0], dy2 = y[v2] - y[v0];
+	triangle.originX = x[v0];
+	triangle.originY = y[v0];
+
+	for (int p = 0; p < SOFT_PLANES; p++)
+	{
+		float f0 = values[v0][p], f1 = values[v1][p] - f0, f2 = values[v2][p] - f0;
+		triangle.plane[p][0] = f0;
+		triangle.plane[p][1] = (f1 * dy2 - f2 * dy1) / area;
+		triangle.plane[p][2] = (f2 * dx1 - f1 * dx2) / area;
+	}
+
+	uint32_t index = (uint32_t)triangles.size();
+	triangles.push_back(triangle);
+
+	for (int ty = triangle.minY / tileSize; ty <= triangle.maxY / tileSize; ty++)
+		for (int tx = triangle.minX / tileSize; tx <= triangle.maxX / tileSize; tx++)
+			bins[(size_t)ty * tilesX + tx].push_back(index);
+}
+
+/* Clips, projects and bins every triangle of the frame, chunk by chunk across the pool */
+void SoftRasterizer::setupTriangles(const SoftFrame &frame)
+{
+	UPROFILE_SCOPE("setup and bin");
+
+	size_t triangleCount = drawTriangleBase.back();
+	size_t tiles = (size_t)tilesX * tilesY;
+
+	activeChunks = (triangleCount + SOFT_SETUP_GRAIN - 1) / SOFT_SETUP_GRAIN;
+	if (chunkTriangles.size() < activeChunks)
+	{
+		chunkTriangles.resize(activeChunks);
+		chunkBins.resize(activeChunks);
+	}
+
+	pool.parallelFor(triangleCount, SOFT_SETUP_GRAIN, [&](size_t begin, size_t end, unsigned)
+					 {
+		// a single worker gets the whole range at once, so walk it chunk by chunk
+		for (size_t chunk = begin / SOFT_SETUP_GRAIN; chunk * SOFT_SETUP_GRAIN < end; chunk++)
+		{
+			vector<Triangle> &triangles = chunkTriangles[chunk];
+			vector<vector<uint32_t>> &bins = chunkBins[chunk];
+			triangles.clear();
+			bins.resize(tiles);
+			for (vector<uint32_t> &bin : bins)
+				bin.clear();
+
+			size_t first = chunk * SOFT_SETUP_GRAIN, last = min(triangleCount, first + SOFT_SETUP_GRAIN);
+			size_t draw = upper_bound(drawTriangleBase.begin(), drawTriangleBase.end(), first) - drawTriangleBase.begin() - 1;
+
+			for (size_t t = first; t < last; t++)
+			{
+				while (t >= drawTriangleBase[draw + 1])
+					draw++;
+
+				const uint32_t *index = &frame.draws[draw].mesh->indices[(t - drawTriangleBase[draw]) * 3];
+				const ClipVertex *base = &vertices[drawVertexBase[draw]];
+
+				ClipVertex polygon[4];
+				int count = clipNear(base[index[0]], base[index[1]], base[index[2]], polygon);
+				for (int i = 1; i + 1 < count; i++)
+				{
+					const ClipVertex *corners[3] = {&polygon[0], &polygon[i], &polygon[i + 1]};
+					setupTriangle(corners, (uint32_t)draw, triangles, bins);
+				}
+			}
+		} });
+}
+
+static inline vfloat VDot(const vfloat a[3], const vfloat b[3])
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static inline void VNormalize(vfloat a[3])
+{
+	vfloat scale = VSet(1.0f) / VSqrt(VDot(a, a));
+	for (int axis = 0; axis < 3; axis++)
+		a[axis] = a[axis] * scale;
+}
+
+/* objFragmentShaderSource for one span: textured, tinted, two Phong lights */
+static vint UShadeObject(const SoftFrame &frame, const SoftDraw &draw, const vfloat plane[SOFT_PLANES], const float slopeX[SOFT_PLANES], const float slopeY[SOFT_PLANES], vmask lanes)
+{
+	vfloat w = VSet(1.0f) / plane[PLANE_INV_W];
+	vfloat position[3], normal[3], viewDir[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		position[axis] = plane[PLANE_WORLD + axis] * w;
+		normal[axis] = plane[PLANE_NORMAL + axis] * w;
+		viewDir[axis] = VSet(frame.viewPosition[axis]) - position[axis];
+	}
+	vfloat s = plane[PLANE_UV] * w, t = plane[PLANE_UV + 1] * w;
+
+	// lanes outside the triangle can hold anything up to NaN; keep their texel fetches at the origin
+	s = VSelect(lanes, s, VSet(0.0f));
+	t = VSelect(lanes, t, VSet(0.0f));
+
+	// level of detail from the exact screen derivatives of the perspective-correct coordinates
+	const SoftTexture &texture = *draw.texture;
+	vfloat dsdx = (VSet(slopeX[PLANE_UV]) - s * VSet(slopeX[PLANE_INV_W])) * w * VSet(texture.levelWidth[0]);
+	vfloat dtdx = (VSet(slopeX[PLANE_UV + 1]) - t * VSet(slopeX[PLANE_INV_W])) * w * VSet(texture.levelHeight[0]);
+	vfloat dsdy = (VSet(slopeY[PLANE_UV]) - s * VSet(slopeY[PLANE_INV_W])) * w * VSet(texture.levelWidth[0]);
+	vfloat dtdy = (VSet(slopeY[PLANE_UV + 1]) - t * VSet(slopeY[PLANE_INV_W])) * w * VSet(texture.levelHeight[0]);
+	vfloat lod = VSet(0.5f) * VLog2(VMax(dsdx * dsdx + dtdx * dtdx, dsdy * dsdy + dtdy * dtdy));
+
+	vfloat objTexture[3];
+	USampleTexture(texture, s, t, lod, lanes, objTexture);
+	for (int c = 0; c < 3; c++)
+		objTexture[c] = objTexture[c] * VSet(draw.material[c]);
+
+	VNormalize(normal);
+	VNormalize(viewDir);
+
+	vfloat phong[3] = {VSet(0.0f), VSet(0.0f), VSet(0.0f)};
+	for (int light = 0; light < 2; light++)
+	{
+		vfloat lightDirection[3];
+		for (int axis = 0; axis < 3; axis++)
+			lightDirection[axis] = VSet(frame.lightPosition[light][axis]) - position[axis];
+		VNormalize(lightDirection);
+
+		vfloat cosine = VDot(normal, lightDirection);
+		vfloat impact = VMax(cosine, VSet(0.1f));
+
+		// reflect(-L, N) = 2 (N.L) N - L
+		vfloat reflected[3];
+		for (int axis = 0; axis < 3; axis++)
+			reflected[axis] = VSet(2.0f) * cosine * normal[axis] - lightDirection[axis];
+
+		vfloat specular = VMax(VDot(viewDir, reflected), VSet(0.0f));
+		specular = specular * specular; // ^2
+		specular = specular * specular; // ^4
+		specular = specular * specular; // ^8
+		specular = specular * specular; // ^16
+		specular = specular * VSet(draw.material.a);
+
+		vfloat strength = VSet(0.1f) + impact + specular; // ambient + diffuse + specular
+		for (int c = 0; c < 3; c++)
+			phong[c] = phong[c] + strength * VSet(frame.lightColor[light][c]) * objTexture[c];
+	}
+
+	vint rgba = VSetInt((int32_t)0xFF000000);
+	for (int c = 0; c < 3; c++)
+		rgba = rgba | VShiftLeft(VToInt(VClamp01(phong[c]) * VSet(255.0f) + VSet(0.5f)), 8 * c);
+	return rgba;
+}
+
+/* Clears one tile, then replays its bins in submission order with depth test and shading */
+void SoftRasterizer::rasterizeTile(const SoftFrame &frame, int tile)
+{
+	int tileX0 = (tile % tilesX) * tileSize, tileY0 = (tile / tilesX) * tileSize;
+	int tileX1 = min(tileX0 + tileSize, frameWidth) - 1, tileY1 = min(tileY0 + tileSize, frameHeight) - 1;
+
+	uint32_t clear = 0xFF000000u;
+	for (int c = 0; c < 3; c++)
+		clear |= (uint32_t)(glm::clamp(frame.clearColor[c], 0.0f, 1.0f) * 255.0f + 0.5f) << (8 * c);
+
+	for (int y = tileY0; y <= tileY1; y++)
+	{
+		fill(color.begin() + (size_t)y * pitch + tileX0, color.begin() + (size_t)y * pitch + tileX1 + 1, clear);
+		fill(depth.begin() + (size_t)y * pitch + tileX0, depth.begin() + (size_t)y * pitch + tileX1 + 1, 1.0f);
+	}
+
+	const vint white = VSetInt((int32_t)0xFFFFFFFF);
+	const vfloat ramp = VRamp() + VSet(0.5f);
+
+	for (size_t chunk = 0; chunk < activeChunks; chunk++)
+	{
+		for (uint32_t index : chunkBins[chunk][tile])
+		{
+			const Triangle &triangle = chunkTriangles[chunk][index];
+			const SoftDraw &draw = frame.draws[triangle.draw];
+
+			// spans start on a SIMD-width boundary, which tile edges always are
+			int x0 = max(triangle.minX, tileX0) / SOFT_LANES * SOFT_LANES;
+			int x1 = min(triangle.maxX, tileX1);
+			int y0 = max(triangle.minY, tileY0), y1 = min(triangle.maxY, tileY1);
+			vfloat right = VSet((float)x1 + 1.0f);
+
+			float slopeX[SOFT_PLANES], slopeY[SOFT_PLANES];
+			for (int p = 0; p < SOFT_PLANES; p++)
+			{
+				slopeX[p] = triangle.plane[p][1];
+				slopeY[p] = triangle.plane[p][2];
+			}
+
+			for (int y = y0; y <= y1; y++)
+			{
+				float py = y + 0.5f;
+
+				float rowEdge[3], rowPlane[SOFT_PLANES];
+				for (int edge = 0; edge < 3; edge++)
+					rowEdge[edge] = triangle.edgeB[edge] * py + triangle.edgeC[edge];
+				for (int p = 0; p < SOFT_PLANES; p++)
+					rowPlane[p] = triangle.plane[p][0] + slopeY[p] * (py - triangle.originY) - slopeX[p] * triangle.originX;
+
+				for (int x = x0; x <= x1; x += SOFT_LANES)
+				{
+					vfloat px = VSet((float)x) + ramp;
+					vmask inside = px < right;
+
+					for (int edge = 0; edge < 3; edge++)
+					{
+						vfloat e = VSet(triangle.edgeA[edge]) * px + VSet(rowEdge[edge]);
+						inside = inside & (triangle.topLeft[edge] ? e >= VSet(0.0f) : e > VSet(0.0f));
+					}
+					if (!VAny(inside))
+						continue;
+
+					// GL_LESS against the tile's depth
+					float *depthSpan = &depth[(size_t)y * pitch + x];
+					vfloat z = VSet(rowPlane[PLANE_DEPTH]) + VSet(slopeX[PLANE_DEPTH]) * px;
+					vfloat stored = VLoad(depthSpan);
+					inside = inside & (z < stored);
+					if (!VAny(inside))
+						continue;
+					VStore(depthSpan, VSelect(inside, z, stored));
+
+					vint shaded = white; // the lamp shader
+					if (draw.texture)
+					{
+						vfloat plane[SOFT_PLANES];
+						for (int p = 0; p < SOFT_PLANES; p++)
+							plane[p] = VSet(rowPlane[p]) + VSet(slopeX[p]) * px;
+						shaded = UShadeObject(frame, draw, plane, slopeX, slopeY, inside);
+					}
+
+					uint32_t *colorSpan = &color[(size_t)y * pitch + x];
+					VStoreInt(colorSpan, VSelect(inside, shaded, VLoadInt(colorSpan)));
+				}
+			}
+		}
+	}
+}
+
+void SoftRasterizer::readPixels(vector<unsigned char> &rgb) const
+{
+	rgb.resize((size_t)frameWidth * frameHeight * 3);
+	unsigned char *out = rgb.data();
+
+	for (int y = frameHeight - 1; y >= 0; y--)
+	{
+		const uint32_t *row = &color[(size_t)y * pitch];
+		for (int x = 0; x < frameWidth; x++)
+		{
+			*out++ = (unsigned char)(row[x]);
+			*out++ = (unsigned char)(row[x] >> 8);
+			*out++ = (unsigned char)(row[x] >> 16);
+		}
+	}
+}
+
+/* Same binary PPM as UWritePPM writes for the GL path */
+bool SoftRasterizer::writePPM(const string &path) const
+{
+	ofstream file(path, ios::binary);
+	if (!file)
+	{
+		cout << "Cannot write " << path << endl;
+		return false;
+	}
+
+	file << "P6\n"
+		 << frameWidth << " " << frameHeight << "\n255\n";
+
+	vector<unsigned char> row((size_t)frameWidth * 3);
+	for (int y = 0; y < frameHeight; y++)
+	{
+		for (int x = 0; x < frameWidth; x++)
+		{
+			uint32_t texel = color[(size_t)y * pitch + x];
+			row[x * 3 + 0] = (unsigned char)(texel);
+			row[x * 3 + 1] = (unsigned char)(texel >> 8);
+			row[x * 3 + 2] = (unsigned char)(texel >> 16);
+		}
+		file.write((const char *)row.data(), (streamsize)row.size());
+	}
+
+	return true;
+}
+
+/* Parses --soft-raster, --soft-compare, --soft-bench and --tile-size N */
+bool UParseSoftRasterArgs(int argc, char *argv[], SoftRasterOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--soft-raster")
+		{
+			options.enabled = true;
+		}
+		else if (arg == "--soft-compare")
+		{
+			options.compare = true;
+		}
+		else if (arg == "--soft-bench")
+		{
+			options.benchmark = true;
+		}
+		else if (arg == "--tile-size")
+		{
+			options.tileSize = i + 1 < argc ? atoi(argv[++i]) : 0;
+			if (options.tileSize <= 0)
+			{
+				cout << "--tile-size expects a positive number of pixels" << endl;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/* Position, normal and texture coordinate of a float layout; false for the compressed layouts */
+bool UCreateSoftMesh(const MeshData &mesh, SoftMesh &soft)
+{
+	const MeshAttribute *attributes[3] = {nullptr, nullptr, nullptr};
+	for (const MeshAttribute &attribute : mesh.attributes)
+	{
+		if (attribute.location < 3 && attribute.type == GL_FLOAT && attribute.components >= (attribute.location == 2 ? 2u : 3u))
+			attributes[attribute.location] = &attribute;
+	}
+
+	if (!attributes[0] || !attributes[1] || !attributes[2] || mesh.vertexStride == 0)
+		return false;
+
+	size_t count = mesh.vertices.size() / mesh.vertexStride;
+	soft.vertices.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const unsigned char *vertex = &mesh.vertices[i * mesh.vertexStride];
+		memcpy(&soft.vertices[i].position, vertex + attributes[0]->offset, sizeof(glm::vec3));
+		memcpy(&soft.vertices[i].normal, vertex + attributes[1]->offset, sizeof(glm::vec3));
+		memcpy(&soft.vertices[i].uv, vertex + attributes[2]->offset, sizeof(glm::vec2));
+	}
+
+	soft.indices = mesh.indices;
+	soft.indices.resize(soft.indices.size() / 3 * 3);
+	for (uint32_t &index : soft.indices)
+	{
+		if (index >= count)
+			return false;
+	}
+
+	return true;
+}
+
+/* Level 0 as given, then 2x2 box-filtered levels down to 1x1, as glGenerateMipmap builds them */
+void UCreateSoftTexture(const unsigned char *rgba, uint32_t width, uint32_t height, SoftTexture &texture)
+{
+	texture.texels.assign((const uint32_t *)rgba, (const uint32_t *)rgba + (size_t)width * height);
+	texture.levelOffset.assign(1, 0);
+	texture.levelWidth.assign(1, (float)width);
+	texture.levelHeight.assign(1, (float)height);
+
+	while (width > 1 || height > 1)
+	{
+		uint32_t nextWidth = max(1u, width / 2), nextHeight = max(1u, height / 2);
+		size_t source = texture.levelOffset.back();
+		size_t offset = texture.texels.size();
+		texture.texels.resize(offset + (size_t)nextWidth * nextHeight);
+
+		for (uint32_t y = 0; y < nextHeight; y++)
+		{
+			for (uint32_t x = 0; x < nextWidth; x++)
+			{
+				uint32_t x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1);
+				uint32_t y0 = min(2 * y, height - 1), y1 = min(2 * y + 1, height - 1);
+				uint32_t corners[4] = {texture.texels[source + (size_t)y0 * width + x0], texture.texels[source + (size_t)y0 * width + x1],
+									   texture.texels[source + (size_t)y1 * width + x0], texture.texels[source + (size_t)y1 * width + x1]};
+
+				uint32_t texel = 0;
+				for (int c = 0; c < 4; c++)
+				{
+					uint32_t sum = 2;
+					for (uint32_t corner : corners)
+						sum += (corner >> (8 * c)) & 255;
+					texel |= (sum / 4) << (8 * c);
+				}
+				texture.texels[offset + (size_t)y * nextWidth + x] = texel;
+			}
+		}
+
+		texture.levelOffset.push_back((int32_t)offset);
+		texture.levelWidth.push_back((float)nextWidth);
+		texture.levelHeight.push_back((float)nextHeight);
+		width = nextWidth;
+		height = nextHeight;
+	}
+}
+
+SoftImageDiff UCompareImages(const vector<unsigned char> &a, const vector<unsigned char> &b, int threshold)
+{
+	SoftImageDiff diff;
+	size_t pixels = min(a.size(), b.size()) / 3;
+	if (pixels == 0)
+		return diff;
+
+	uint64_t total = 0, differing = 0;
+	for (size_t i = 0; i < pixels; i++)
+	{
+		int worst = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			int error = abs((int)a[i * 3 + c] - (int)b[i * 3 + c]);
+			total += error;
+			worst = max(worst, error);
+		}
+		diff.maxError = max(diff.maxError, worst);
+		if (worst > threshold)
+			differing++;
+	}
+
+	diff.meanError = (double)total / (pixels * 3);
+	diff.differingPercent = 100.0 * differing / pixels;
+	return diff;
+}
+
+const char *USoftSimdName(void)
+{
+#if SOFT_RASTER_SIMD == 2
+	return "AVX2";
+#elif SOFT_RASTER_SIMD == 1
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
@@ -0,0 +1,143 @@
+/*
+ * SoftRaster.h
+ *
+ *  CPU rendering backend for machines without a GPU: the chair scene is transformed,
+ *  clipped and binned into screen tiles, and the tiles are rasterized and Phong shaded
+ *  in parallel with SIMD kernels (AVX2, SSE2 or plain C++), no GL context involved
+ */
+
+#ifndef SOFTRASTER_H
+#define SOFTRASTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <GL/glm/glm.hpp>
+
+#include "MeshFile.h"
+#include "TaskPool.h"
+
+// interpolated per pixel: depth, 1/w, world position, normal and texture coordinate (the last 8 divided by w)
+#define SOFT_PLANES 10
+
+/* Command line options of the software backend */
+struct SoftRasterOptions
+{
+	bool enabled = false;	// --soft-raster renders the headless run on the CPU, no GL context is created
+	bool compare = false;	// --soft-compare renders the headless frames both ways and reports the pixel difference
+	bool benchmark = false; // --soft-bench times the headless path at 1, 2, 4 ... threads
+	int tileSize = 64;		// --tile-size N pixels square, rounded up to a multiple of the SIMD width
+};
+
+/* The chair in the float layout, as the object vertex shader sees it after dequantization */
+struct SoftVertex
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 uv;
+};
+
+struct SoftMesh
+{
+	std::vector<SoftVertex> vertices;
+	std::vector<uint32_t> indices;
+};
+
+/* RGBA8 texels of every mip level in one array, so a SIMD gather can reach any of them */
+struct SoftTexture
+{
+	std::vector<uint32_t> texels;
+	std::vector<int32_t> levelOffset;
+	std::vector<float> levelWidth, levelHeight;
+};
+
+/* One instance of a mesh: textured and lit like the object shader, or flat white like the lamp shader */
+struct SoftDraw
+{
+	const SoftMesh *mesh;
+	const SoftTexture *texture; // nullptr draws with the lamp shader
+	glm::mat4 model;
+	glm::vec4 material; // rgb finish tint, a specular intensity
+};
+
+/* Everything one frame needs, the uniforms of the GL path included */
+struct SoftFrame
+{
+	glm::mat4 view, projection;
+	glm::vec3 viewPosition;
+	glm::vec3 lightColor[2];
+	glm::vec3 lightPosition[2];
+	glm::vec4 clearColor;
+	std::vector<SoftDraw> draws;
+};
+
+/* Difference between two RGB images of the same size */
+struct SoftImageDiff
+{
+	double meanError = 0.0;		   // average absolute difference per channel, in 8-bit levels
+	int maxError = 0;			   // largest difference of any channel
+	double differingPercent = 0.0; // pixels with a channel off by more than the threshold
+};
+
+class SoftRasterizer
+{
+public:
+	SoftRasterizer(TaskPool &pool, int width, int height, int tileSize = 64);
+
+	void render(const SoftFrame &frame);
+
+	void readPixels(std::vector<unsigned char> &rgb) const; // bottom-up RGB rows, as glReadPixels returns them
+	bool writePPM(const std::string &path) const;
+
+	int width() const { return frameWidth; }
+	int height() const { return frameHeight; }
+
+private:
+	struct ClipVertex
+	{
+		glm::vec4 clip;
+		glm::vec3 world;
+		glm::vec3 normal;
+		glm::vec2 uv; // t already flipped as the vertex shader does
+	};
+
+	/* Screen-space setup: edge functions, and planes for depth, 1/w and every varying divided by w */
+	struct Triangle
+	{
+		float edgeA[3], edgeB[3], edgeC[3]; // E(x, y) = A x + B y + C, inside where all three are positive
+		bool topLeft[3];					// edges that own the pixels exactly on them
+		float originX, originY;				// planes are relative to the first vertex
+		float plane[SOFT_PLANES][3];		// value at the origin, d/dx, d/dy
+		int minX, maxX, minY, maxY;			// pixel bounds, inclusive
+		uint32_t draw;
+	};
+
+	void shadeVertices(const SoftFrame &frame);
+	void setupTriangles(const SoftFrame &frame);
+	void setupTriangle(const ClipVertex *corners[3], uint32_t draw, std::vector<Triangle> &triangles, std::vector<std::vector<uint32_t>> &bins) const;
+	void rasterizeTile(const SoftFrame &frame, int tile);
+	static int clipNear(const ClipVertex &a, const ClipVertex &b, const ClipVertex &c, ClipVertex polygon[4]);
+
+	TaskPool &pool;
+	int frameWidth, frameHeight, pitch; // pitch: pixels per row, padded to the SIMD width
+	int tileSize, tilesX, tilesY;
+	std::vector<uint32_t> color; // RGBA8, top row first
+	std::vector<float> depth;	 // window depth, 1 is the far plane
+
+	std::vector<ClipVertex> vertices;
+	std::vector<size_t> drawVertexBase, drawTriangleBase;
+
+	// setup runs in chunks; each chunk keeps its own triangles and per-tile bins so
+	// tiles replay them in submission order without any locking
+	std::vector<std::vector<Triangle>> chunkTriangles;
+	std::vector<std::vector<std::vector<uint32_t>>> chunkBins;
+	size_t activeChunks = 0;
+};
+
+bool UParseSoftRasterArgs(int argc, char *argv[], SoftRasterOptions &options);
+bool UCreateSoftMesh(const MeshData &mesh, SoftMesh &soft); // float layouts only
+void UCreateSoftTexture(const unsigned char *rgba, uint32_t width, uint32_t height, SoftTexture &texture);
+SoftImageDiff UCompareImages(const std::vector<unsigned char> &a, const std::vector<unsigned char> &b, int threshold);
+const char *USoftSimdName(void);
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * TaskPool.cpp
+ *
+ *  Work-stealing thread pool shared by the CPU-side render stages
+ */
+
+/* Header Inclusions */
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+using namespace std; // standard namespace
+
+static thread_local unsigned workerIndex = 0; // deque owned by the calling thread
+
+void (*taskPoolThreadStarted)(const char *name) = nullptr;
+
+TaskPool::TaskPool(unsigned threadCount)
+{
+	if (threadCount == 0)
+		threadCount = max(1u, thread::hardware_concurrency());
+
+	for (unsigned i = 0; i < threadCount; i++)
+		queues.push_back(unique_ptr<Queue>(new Queue));
+
+	// the owning thread counts as worker 0 and helps out while it waits
+	for (unsigned i = 1; i < threadCount; i++)
+		threads.emplace_back(&TaskPool::workerLoop, this, i);
+}
+
+TaskPool::~TaskPool()
+{
+	{
+		lock_guard<mutex> guard(sleepLock);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (thread &worker : threads)
+		worker.join();
+}
+
+unsigned TaskPool::currentWorker()
+{
+	return workerIndex;
+}
+
+/* Queues a task on the calling worker's own deque */
+void TaskPool::submit(TaskGroup &group, function<void()> task)
+{
+	group.pending++;
+
+	Queue &queue = *queues[workerIndex < queues.size() ? workerIndex : 0];
+	{
+		lock_guard<mutex> guard(queue.lock);
+		queue.tasks.push_back(Task{move(task), &group});
+	}
+
+	{
+		lock_guard<mutex> guard(sleepLock);
+		queued++;
+	}
+	wake.notify_one();
+}
+
+/* Newest task from our own deque first (cache warm), otherwise the oldest task of another worker */
+bool TaskPool::popOrSteal(unsigned self, Task &task)
+{
+	{
+		Queue &own = *queues[self];
+		lock_guard<mutex> guard(own.lock);
+		if (!own.tasks.empty())
+		{
+			task = move(own.tasks.back());
+			own.tasks.pop_back();
+			queued--;
+			return true;
+		}
+	}
+
+	for (size_t offset = 1; offset < queues.size(); offset++)
+	{
+		Queue &victim = *queues[(self + offset) % queues.size()];
+		lock_guard<mutex> guard(victim.lock);
+		if (!victim.tasks.empty())
+		{
+			task = move(victim.tasks.front());
+			victim.tasks.pop_front();
+			queued--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void TaskPool::execute(Task &task)
+{
+	task.run();
+	task.group->pending--;
+}
+
+void TaskPool::workerLoop(unsigned self)
+{
+	workerIndex = self;
+	if (taskPoolThreadStarted)
+		taskPoolThreadStarted("worker");
+
+	while (true)
+	{
+		Task task;
+		if (popOrSteal(self, task))
+		{
+			execute(task);
+			continue;
+		}
+
+		unique_lock<mutex> guard(sleepLock);
+		wake.wait(guard, [this]
+				  { return stopping || queued > 0; });
+		if (stopping)
+			return;
+	}
+}
+
+void TaskPool::wait(TaskGroup &group)
+{
+	unsigned self = workerIndex < queues.size() ? workerIndex : 0;
+
+	while (group.pending > 0)
+	{
+		Task task;
+		if (popOrSteal(self, task))
+			execute(task);
+		else
+			this_thread::yield(); // remaining tasks are running on other workers
+	}
+}
+
+void TaskPool::parallelFor(size_t count, size_t grain, const function<void(size_t, size_t, unsigned)> &body)
+{
+	if (count == 0)
+		return;
+
+	grain = max<size_t>(grain, 1);
+
+	// a single chunk or a single worker is cheaper to run inline
+	if (count <= grain || queues.size() == 1)
+	{
+		body(0, count, currentWorker());
+		return;
+	}
+
+	TaskGroup group;
+	for (size_t begin = 0; begin < count; begin += grain)
+	{
+		size_t end = min(count, begin + grain);
+		submit(group, [&body, begin, end]
+			   { body(begin, end, TaskPool::currentWorker()); });
+	}
+	wait(group);
+}
+
+/* Parses --threads N, 0 (the default) uses every hardware thread */
+unsigned UParseThreadArgs(int argc, char *argv[])
+{
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (string(argv[i]) == "--threads")
+			return (unsigned)max(0, atoi(argv[i + 1]));
+	}
+
+	return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * TaskPool.h
+ *
+ *  Work-stealing thread pool shared by the CPU-side render stages
+ */
+
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Counts the outstanding tasks of one batch so the submitter can wait for them */
+struct TaskGroup
+{
+	std::atomic<int> pending{0};
+};
+
+/* Each worker owns a deque: it pushes and pops at the back, idle workers steal from the front */
+class TaskPool
+{
+public:
+	explicit TaskPool(unsigned threadCount = 0); // 0 uses every hardware thread
+	~TaskPool();
+
+	TaskPool(const TaskPool &) = delete;
+	TaskPool &operator=(const TaskPool &) = delete;
+
+	unsigned size() const { return (unsigned)queues.size(); } // worker count including the calling thread
+
+	void submit(TaskGroup &group, std::function<void()> task);
+	void wait(TaskGroup &group); // runs queued tasks on the calling thread until the group is done
+
+	// splits [0, count) into chunks of at most 'grain' items and runs body(begin, end, worker) on the pool
+	void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t, unsigned)> &body);
+
+	static unsigned currentWorker(); // index of the calling thread's deque, 0 for threads outside the pool
+
+private:
+	struct Task
+	{
+		std::function<void()> run;
+		TaskGroup *group;
+	};
+
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	bool popOrSteal(unsigned self, Task &task);
+	void execute(Task &task);
+	void workerLoop(unsigned self);
+
+	std::vector<std::unique_ptr<Queue>> queues; // queue 0 belongs to the thread that owns the pool
+	std::vector<std::thread> threads;
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::atomic<int> queued{0};
+	std::atomic<bool> stopping{false};
+};
+
+unsigned UParseThreadArgs(int argc, char *argv[]);
+
+// each worker calls it as it starts; the profiler installs it to name the workers, so the pool links without the profiler
+extern void (*taskPoolThreadStarted)(const char *name);
+
+#endif
@@ -0,0 +1,428 @@
+/*
+ * TextureConvert.cpp
+ *
+ *  Offline converter from JPG / PNG to precompressed, pre-mipmapped DDS or KTX2 textures
+ *
+ *  Usage: TextureConvert input.jpg output.dds|output.ktx2 [--format bc1|bc7|rgba8] [--threads N]
+ */
+
+/* Header Inclusions */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* Soil Image Loader inclusion */
+#include "SOIL2/SOIL2.h"
+
+#include "TaskPool.h"
+#include "TextureFile.h"
+
+using namespace std; // standard namespace
+
+/* 2x2 box filter down to the next level, edge texels repeat on odd sizes */
+static void UDownsample(const vector<unsigned char> &source, uint32_t width, uint32_t height, vector<unsigned char> &destination)
+{
+	uint32_t nextWidth = max(1u, width / 2), nextHeight = max(1u, height / 2);
+	destination.resize((size_t)nextWidth * nextHeight * 4);
+
+	for (uint32_t y = 0; y < nextHeight; y++)
+	{
+		uint32_t y0 = min(y * 2, height - 1), y1 = min(y * 2 + 1, height - 1);
+		for (uint32_t x = 0; x < nextWidth; x++)
+		{
+			uint32_t x0 = min(x * 2, width - 1), x1 = min(x * 2 + 1, width - 1);
+			for (int c = 0; c < 4; c++)
+			{
+				uint32_t sum = source[((size_t)y0 * width + x0) * 4 + c] + source[((size_t)y0 * width + x1) * 4 + c] +
+							   source[((size_t)y1 * width + x0) * 4 + c] + source[((size_t)y1 * width + x1) * 4 + c];
+				destination[((size_t)y * nextWidth + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+/* Principal axis of the block's colours (power iteration on the covariance), 'channels' is 3 or 4 */
+static void UPrincipalAxis(const float pixels[16][4], int channels, float mean[4], float axis[4])
+{
+	float covariance[4][4] = {};
+	for (int c = 0; c < 4; c++)
+	{
+		mean[c] = 0.0f;
+		for (int i = 0; i < 16; i++)
+			mean[c] += pixels[i][c] / 16.0f;
+	}
+
+	for (int i = 0; i < 16; i++)
+		for (int a = 0; a < channels; a++)
+			for (int b = 0; b < channels; b++)
+				covariance[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+
+	for (int c = 0; c < 4; c++)
+		axis[c] = c < channels ? 1.0f : 0.0f;
+
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[4] = {0, 0, 0, 0}, length = 0.0f;
+		for (int a = 0; a < channels; a++)
+		{
+			for (int b = 0; b < channels; b++)
+				next[a] += covariance[a][b] * axis[b];
+			length = max(length, fabsf(next[a]));
+		}
+		if (length == 0.0f)
+			break; // flat block, any axis will do
+		for (int a = 0; a < channels; a++)
+			axis[a] = next[a] / length;
+	}
+
+	float length = 0.0f;
+	for (int a = 0; a < channels; a++)
+		length += axis[a] * axis[a];
+	length = sqrtf(length);
+	for (int a = 0; a < channels && length > 0.0f; a++)
+		axis[a] /= length;
+}
+
+/* Extremes of the block along the axis */
+static void UAxisEndpoints(const float pixels[16][4], int channels, float e0[4], float e1[4])
+{
+	float mean[4], axis[4];
+	UPrincipalAxis(pixels, channels, mean, axis);
+
+	float low = 1e30f, high = -1e30f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < channels; c++)
+			t += (pixels[i][c] - mean[c]) * axis[c];
+		low = min(low, t);
+		high = max(high, t);
+	}
+
+	for (int c = 0; c < 4; c++)
+	{
+		e0[c] = min(max(mean[c] + low * axis[c], 0.0f), 255.0f);
+		e1[c] = min(max(mean[c] + high * axis[c], 0.0f), 255.0f);
+	}
+}
+
+/* Nearest palette entry of every texel, returns the total squared error */
+static float UPickIndices(const float pixels[16][4], int channels, const float palette[][4], int paletteSize, int indices[16])
+{
+	float total = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float best = 1e30f;
+		for (int p = 0; p < paletteSize; p++)
+		{
+			float error = 0.0f;
+			for (int c = 0; c < channels; c++)
+				error += (pixels[i][c] - palette[p][c]) * (pixels[i][c] - palette[p][c]);
+			if (error < best)
+			{
+				best = error;
+				indices[i] = p;
+			}
+		}
+		total += best;
+	}
+	return total;
+}
+
+/*--- BC1 ---*/
+
+static uint16_t UTo565(const float color[4])
+{
+	int r = (int)lroundf(color[0] * 31.0f / 255.0f), g = (int)lroundf(color[1] * 63.0f / 255.0f), b = (int)lroundf(color[2] * 31.0f / 255.0f);
+	return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+static void UFrom565(uint16_t packed, float color[4])
+{
+	int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+	color[0] = (float)(r << 3 | r >> 2);
+	color[1] = (float)(g << 2 | g >> 4);
+	color[2] = (float)(b << 3 | b >> 2);
+	color[3] = 255.0f;
+}
+
+/* Opaque four-colour BC1 block from endpoints on the principal axis */
+static void UEncodeBC1(const float pixels[16][4], unsigned char block[8])
+{
+	float e0[4], e1[4];
+	UAxisEndpoints(pixels, 3, e0, e1);
+
+	uint16_t c0 = UTo565(e1), c1 = UTo565(e0);
+	if (c0 < c1)
+		swap(c0, c1);
+
+	uint32_t bits = 0;
+	if (c0 != c1) // equal endpoints would switch to the three-colour mode, index 0 covers the block instead
+	{
+		float palette[4][4];
+		UFrom565(c0, palette[0]);
+		UFrom565(c1, palette[1]);
+		for (int c = 0; c < 4; c++)
+		{
+			palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+			palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+		}
+
+		int indices[16];
+		UPickIndices(pixels, 3, palette, 4, indices);
+		for (int i = 0; i < 16; i++)
+			bits |= (uint32_t)indices[i] << (i * 2);
+	}
+
+	memcpy(block, &c0, 2);
+	memcpy(block + 2, &c1, 2);
+	memcpy(block + 4, &bits, 4);
+}
+
+/*--- BC7 (mode 6: one subset, RGBA 7.7.7.7 endpoints with a p-bit each, 4-bit indices) ---*/
+
+static const int bc7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+/* Quantizes an endpoint to 7 bits per channel plus the shared p-bit that fits it best */
+static void UQuantizeBC7(const float endpoint[4], int quantized[4], int &pbit)
+{
+	float bestError = 1e30f;
+	for (int p = 0; p < 2; p++)
+	{
+		int candidate[4];
+		float error = 0.0f;
+		for (int c = 0; c < 4; c++)
+		{
+			candidate[c] = min(127, max(0, (int)lroundf((endpoint[c] - p) / 2.0f)));
+			float value = (float)(candidate[c] * 2 + p);
+			error += (value - endpoint[c]) * (value - endpoint[c]);
+		}
+		if (error < bestError)
+		{
+			bestError = error;
+			pbit = p;
+			memcpy(quantized, candidate, sizeof(candidate));
+		}
+	}
+}
+
+/* Quantizes both endpoints, picks indices and returns the error */
+static float UFitBC7(const float pixels[16][4], const float e0[4], const float e1[4], int q[2][4], int pbits[2], int indices[16])
+{
+	UQuantizeBC7(e0, q[0], pbits[0]);
+	UQuantizeBC7(e1, q[1], pbits[1]);
+
+	float palette[16][4];
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			int a = q[0][c] * 2 + pbits[0], b = q[1][c] * 2 + pbits[1];
+			palette[i][c] = (float)(((64 - bc7Weights[i]) * a + bc7Weights[i] * b + 32) >> 6);
+		}
+	}
+	return UPickIndices(pixels, 4, palette, 16, indices);
+}
+
+/* Little-endian bit stream into a 16 byte block */
+struct BitWriter
+{
+	unsigned char *block;
+	int position;
+
+	void write(uint32_t value, int count)
+	{
+		for (int i = 0; i < count; i++, position++)
+			if (value >> i & 1)
+				block[position >> 3] |= (unsigned char)(1 << (position & 7));
+	}
+};
+
+static void UEncodeBC7(const float pixels[16][4], unsigned char block[16])
+{
+	float e0[4], e1[4];
+	UAxisEndpoints(pixels, 4, e0, e1);
+
+	int q[2][4], pbits[2], indices[16];
+	float error = UFitBC7(pixels, e0, e1, q, pbits, indices);
+
+	// one least-squares refit of the endpoints for the chosen indices
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[4] = {0, 0, 0, 0}, bx[4] = {0, 0, 0, 0};
+	for (int i = 0; i < 16; i++)
+	{
+		float w = bc7Weights[indices[i]] / 64.0f;
+		aa += (1.0f - w) * (1.0f - w);
+		ab += (1.0f - w) * w;
+		bb += w * w;
+		for (int c = 0; c < 4; c++)
+		{
+			ax[c] += (1.0f - w) * pixels[i][c];
+			bx[c] += w * pixels[i][c];
+		}
+	}
+
+	float determinant = aa * bb - ab * ab;
+	if (fabsf(determinant) > 1e-6f)
+	{
+		float r0[4], r1[4];
+		for (int c = 0; c < 4; c++)
+		{
+			r0[c] = min(max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+			r1[c] = min(max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+		}
+
+		int rq[2][4], rpbits[2], rindices[16];
+		if (UFitBC7(pixels, r0, r1, rq, rpbits, rindices) < error)
+		{
+			memcpy(q, rq, sizeof(rq));
+			memcpy(pbits, rpbits, sizeof(rpbits));
+			memcpy(indices, rindices, sizeof(rindices));
+		}
+	}
+
+	// the first texel's index is stored without its top bit, so it must be below 8
+	if (indices[0] >= 8)
+	{
+		for (int c = 0; c < 4; c++)
+			swap(q[0][c], q[1][c]);
+		swap(pbits[0], pbits[1]);
+		for (int i = 0; i < 16; i++)
+			indices[i] = 15 - indices[i];
+	}
+
+	memset(block, 0, 16);
+	BitWriter writer = {block, 0};
+	writer.write(1 << 6, 7); // mode 6
+	for (int c = 0; c < 4; c++)
+	{
+		writer.write(q[0][c], 7);
+		writer.write(q[1][c], 7);
+	}
+	writer.write(pbits[0], 1);
+	writer.write(pbits[1], 1);
+	writer.write(indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		writer.write(indices[i], 4);
+}
+
+/* Compresses one level block by block, rows of blocks spread over the pool */
+static void UCompressLevel(TaskPool &pool, TextureFormat format, const vector<unsigned char> &rgba, uint32_t width, uint32_t height, vector<unsigned char> &out)
+{
+	if (format == TEXTURE_RGBA8)
+	{
+		out = rgba;
+		return;
+	}
+
+	uint32_t blocksX = max(1u, (width + 3) / 4), blocksY = max(1u, (height + 3) / 4);
+	size_t blockBytes = format == TEXTURE_BC1 ? 8 : 16;
+	out.assign((size_t)blocksX * blocksY * blockBytes, 0);
+
+	pool.parallelFor(blocksY, 1, [&](size_t begin, size_t end, unsigned) {
+		for (size_t by = begin; by < end; by++)
+		{
+			for (uint32_t bx = 0; bx < blocksX; bx++)
+			{
+				float pixels[16][4];
+				for (int i = 0; i < 16; i++)
+				{
+					uint32_t x = min(bx * 4 + i % 4, width - 1), y = min((uint32_t)by * 4 + i / 4, height - 1);
+					for (int c = 0; c < 4; c++)
+						pixels[i][c] = rgba[((size_t)y * width + x) * 4 + c];
+				}
+
+				unsigned char *block = &out[(by * blocksX + bx) * blockBytes];
+				if (format == TEXTURE_BC1)
+					UEncodeBC1(pixels, block);
+				else
+					UEncodeBC7(pixels, block);
+			}
+		}
+	});
+}
+
+/* Main Program */
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		cout << "Usage: TextureConvert input.jpg output.dds|output.ktx2 [--format bc1|bc7|rgba8] [--threads N]" << endl;
+		return -1;
+	}
+
+	string input = argv[1], output = argv[2];
+	TextureFormat format = TEXTURE_BC1;
+	for (int i = 3; i + 1 < argc; i++)
+	{
+		if (string(argv[i]) != "--format")
+			continue;
+
+		string name = argv[++i];
+		if (name == "bc1")
+			format = TEXTURE_BC1;
+		else if (name == "bc7")
+			format = TEXTURE_BC7;
+		else if (name == "rgba8")
+			format = TEXTURE_RGBA8;
+		else
+		{
+			cout << "Unknown format " << name << " (bc1, bc7, rgba8)" << endl;
+			return -1;
+		}
+	}
+
+	auto start = chrono::steady_clock::now();
+
+	int width, height;
+	unsigned char *image = SOIL_load_image(input.c_str(), &width, &height, 0, SOIL_LOAD_RGBA);
+	if (!image)
+	{
+		cout << "Cannot load " << input << endl;
+		return -1;
+	}
+
+	TaskPool pool(UParseThreadArgs(argc, argv));
+	TextureImage texture;
+	texture.format = format;
+	texture.width = width;
+	texture.height = height;
+
+	// full mip chain down to 1x1, each level filtered from the one above
+	vector<unsigned char> level(image, image + (size_t)width * height * 4), next;
+	SOIL_free_image_data(image);
+
+	uint32_t levelWidth = width, levelHeight = height;
+	size_t uncompressedBytes = 0;
+	while (true)
+	{
+		texture.levels.push_back(vector<unsigned char>());
+		UCompressLevel(pool, format, level, levelWidth, levelHeight, texture.levels.back());
+		uncompressedBytes += level.size();
+
+		if (levelWidth == 1 && levelHeight == 1)
+			break;
+
+		UDownsample(level, levelWidth, levelHeight, next);
+		level.swap(next);
+		levelWidth = max(1u, levelWidth / 2);
+		levelHeight = max(1u, levelHeight / 2);
+	}
+
+	if (!UWriteTexture(output, texture))
+		return -1;
+
+	size_t bytes = 0;
+	for (const vector<unsigned char> &data : texture.levels)
+		bytes += data.size();
+
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+	cout << "Converted " << input << " -> " << output << endl;
+	cout << "  " << width << "x" << height << " " << UTextureFormatName(format) << ", " << texture.levels.size() << " levels, " << bytes / 1024.0
+		 << " KB (RGBA8 chain " << uncompressedBytes / 1024.0 << " KB) in " << elapsed.count() << " s" << endl;
+
+	return 0;
+}
@@ -0,0 +1,486 @@
+/*
+ * TextureFile.cpp
+ *
+ *  Precompressed, pre-mipmapped textures in DDS and KTX2 containers, read through a memory mapping
+ */
+
+/* Header Inclusions */
+#include "TextureFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace std; // standard namespace
+
+/*--- DDS ---*/
+
+#define DDS_MAGIC 0x20534444u // "DDS "
+#define DDS_FOURCC(a, b, c, d) ((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | (uint32_t)(d) << 24)
+#define DDPF_FOURCC 0x4u
+#define DDPF_RGB 0x40u
+#define DXGI_FORMAT_R8G8B8A8_UNORM 28u
+#define DXGI_FORMAT_BC1_UNORM 71u
+#define DXGI_FORMAT_BC3_UNORM 77u
+#define DXGI_FORMAT_BC7_UNORM 98u
+
+struct DdsPixelFormat
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourCC;
+	uint32_t rgbBitCount;
+	uint32_t redMask, greenMask, blueMask, alphaMask;
+};
+
+struct DdsHeader
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitchOrLinearSize;
+	uint32_t depth;
+	uint32_t mipMapCount;
+	uint32_t reserved1[11];
+	DdsPixelFormat pixelFormat;
+	uint32_t caps, caps2, caps3, caps4;
+	uint32_t reserved2;
+};
+
+struct DdsHeaderDx10
+{
+	uint32_t dxgiFormat;
+	uint32_t resourceDimension;
+	uint32_t miscFlag;
+	uint32_t arraySize;
+	uint32_t miscFlags2;
+};
+
+/*--- KTX2 ---*/
+
+static const unsigned char ktx2Identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+#define VK_FORMAT_R8G8B8A8_UNORM 37u
+#define VK_FORMAT_BC1_RGB_UNORM_BLOCK 131u
+#define VK_FORMAT_BC1_RGBA_UNORM_BLOCK 133u
+#define VK_FORMAT_BC3_UNORM_BLOCK 137u
+#define VK_FORMAT_BC7_UNORM_BLOCK 145u
+#define VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK 147u
+
+struct Ktx2Header
+{
+	unsigned char identifier[12];
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+};
+
+struct Ktx2Level
+{
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+/*--- Formats ---*/
+
+const char *UTextureFormatName(TextureFormat format)
+{
+	switch (format)
+	{
+	case TEXTURE_BC1:
+		return "BC1";
+	case TEXTURE_BC3:
+		return "BC3";
+	case TEXTURE_BC7:
+		return "BC7";
+	case TEXTURE_ETC2_RGB:
+		return "ETC2";
+	default:
+		return "RGBA8";
+	}
+}
+
+/* Bytes of one 4x4 block, or of one texel for the uncompressed format */
+static uint32_t UBlockBytes(TextureFormat format)
+{
+	return format == TEXTURE_RGBA8 ? 4 : (format == TEXTURE_BC1 || format == TEXTURE_ETC2_RGB) ? 8 : 16;
+}
+
+size_t UTextureLevelSize(TextureFormat format, uint32_t width, uint32_t height)
+{
+	if (format == TEXTURE_RGBA8)
+		return (size_t)width * height * 4;
+
+	return (size_t)max(1u, (width + 3) / 4) * max(1u, (height + 3) / 4) * UBlockBytes(format);
+}
+
+GLenum UTextureInternalFormat(TextureFormat format)
+{
+	switch (format)
+	{
+	case TEXTURE_BC1:
+		return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case TEXTURE_BC3:
+		return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case TEXTURE_BC7:
+		return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	case TEXTURE_ETC2_RGB:
+		return GL_COMPRESSED_RGB8_ETC2;
+	default:
+		return GL_RGBA8;
+	}
+}
+
+/*--- Reading ---*/
+
+/* Level pointers for a chain stored largest first with no padding (DDS) */
+static bool UCollectLevels(TextureView &texture, size_t offset, uint32_t levelCount)
+{
+	uint32_t width = texture.width, height = texture.height;
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		size_t size = UTextureLevelSize(texture.format, width, height);
+		if (offset + size > texture.file.size)
+			return false;
+
+		texture.levels.push_back({width, height, texture.file.data + offset, size});
+		offset += size;
+		width = max(1u, width / 2);
+		height = max(1u, height / 2);
+	}
+	return true;
+}
+
+static const char *UParseDds(TextureView &texture)
+{
+	if (texture.file.size < 4 + sizeof(DdsHeader))
+		return "truncated header";
+
+	const DdsHeader &header = *(const DdsHeader *)(texture.file.data + 4);
+	if (header.size != sizeof(DdsHeader) || header.pixelFormat.size != sizeof(DdsPixelFormat))
+		return "bad header size";
+	if (header.depth > 1 || header.caps2 != 0)
+		return "volume and cube textures are not supported";
+
+	size_t offset = 4 + sizeof(DdsHeader);
+	const DdsPixelFormat &pixelFormat = header.pixelFormat;
+
+	if ((pixelFormat.flags & DDPF_FOURCC) && pixelFormat.fourCC == DDS_FOURCC('D', 'X', '1', '0'))
+	{
+		if (texture.file.size < offset + sizeof(DdsHeaderDx10))
+			return "truncated DX10 header";
+
+		const DdsHeaderDx10 &dx10 = *(const DdsHeaderDx10 *)(texture.file.data + offset);
+		offset += sizeof(DdsHeaderDx10);
+		if (dx10.arraySize > 1)
+			return "texture arrays are not supported";
+
+		switch (dx10.dxgiFormat)
+		{
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+			texture.format = TEXTURE_RGBA8;
+			break;
+		case DXGI_FORMAT_BC1_UNORM:
+			texture.format = TEXTURE_BC1;
+			break;
+		case DXGI_FORMAT_BC3_UNORM:
+			texture.format = TEXTURE_BC3;
+			break;
+		case DXGI_FORMAT_BC7_UNORM:
+			texture.format = TEXTURE_BC7;
+			break;
+		default:
+			return "unsupported DXGI format";
+		}
+	}
+	else if (pixelFormat.flags & DDPF_FOURCC)
+	{
+		if (pixelFormat.fourCC == DDS_FOURCC('D', 'X', 'T', '1'))
+			texture.format = TEXTURE_BC1;
+		else if (pixelFormat.fourCC == DDS_FOURCC('D', 'X', 'T', '5'))
+			texture.format = TEXTURE_BC3;
+		else
+			return "unsupported FourCC";
+	}
+	else if ((pixelFormat.flags & DDPF_RGB) && pixelFormat.rgbBitCount == 32 && pixelFormat.redMask == 0xFFu && pixelFormat.greenMask == 0xFF00u &&
+			 pixelFormat.blueMask == 0xFF0000u)
+	{
+		texture.format = TEXTURE_RGBA8;
+	}
+	else
+	{
+		return "unsupported pixel format";
+	}
+
+	texture.width = header.width;
+	texture.height = header.height;
+	if (!UCollectLevels(texture, offset, max(1u, header.mipMapCount)))
+		return "truncated mip chain";
+	return NULL;
+}
+
+static const char *UParseKtx2(TextureView &texture)
+{
+	if (texture.file.size < sizeof(Ktx2Header))
+		return "truncated header";
+
+	const Ktx2Header &header = *(const Ktx2Header *)texture.file.data;
+	if (header.supercompressionScheme != 0)
+		return "supercompressed files are not supported";
+	if (header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1)
+		return "only single 2D images are supported";
+
+	switch (header.vkFormat)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM:
+		texture.format = TEXTURE_RGBA8;
+		break;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		texture.format = TEXTURE_BC1;
+		break;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+		texture.format = TEXTURE_BC3;
+		break;
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+		texture.format = TEXTURE_BC7;
+		break;
+	case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+		texture.format = TEXTURE_ETC2_RGB;
+		break;
+	default:
+		return "unsupported VkFormat";
+	}
+
+	texture.width = header.pixelWidth;
+	texture.height = header.pixelHeight;
+
+	// levelCount 0 asks the loader to build the chain, so there is exactly one stored level
+	uint32_t levelCount = max(1u, header.levelCount);
+	if (texture.file.size < sizeof(Ktx2Header) + levelCount * sizeof(Ktx2Level))
+		return "truncated level index";
+
+	const Ktx2Level *index = (const Ktx2Level *)(texture.file.data + sizeof(Ktx2Header));
+	uint32_t width = texture.width, height = texture.height;
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		size_t size = UTextureLevelSize(texture.format, width, height);
+		if (index[level].byteLength != size || index[level].byteOffset + size > texture.file.size)
+			return "bad level index";
+
+		texture.levels.push_back({width, height, texture.file.data + index[level].byteOffset, size});
+		width = max(1u, width / 2);
+		height = max(1u, height / 2);
+	}
+	return NULL;
+}
+
+/* Maps a DDS or KTX2 file and checks that every level lies inside it */
+bool UOpenTexture(const string &path, TextureView &texture)
+{
+	if (!UMapFile(path, texture.file))
+		return false; // a missing precompressed file is normal, the caller falls back quietly
+
+	const char *problem;
+	if (texture.file.size >= 4 && *(const uint32_t *)texture.file.data == DDS_MAGIC)
+		problem = UParseDds(texture);
+	else if (texture.file.size >= 12 && memcmp(texture.file.data, ktx2Identifier, 12) == 0)
+		problem = UParseKtx2(texture);
+	else
+		problem = "neither DDS nor KTX2";
+
+	if (!problem && (texture.width == 0 || texture.height == 0))
+		problem = "empty image";
+
+	if (problem)
+	{
+		cout << "Cannot load texture " << path << ": " << problem << endl;
+		UCloseTexture(texture);
+		return false;
+	}
+	return true;
+}
+
+void UCloseTexture(TextureView &texture)
+{
+	UUnmapFile(texture.file);
+	texture.levels.clear();
+}
+
+/*--- Writing ---*/
+
+static bool UWriteDds(ofstream &file, const TextureImage &texture)
+{
+	DdsHeader header;
+	memset(&header, 0, sizeof(header));
+	header.size = sizeof(DdsHeader);
+	header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; // caps, height, width, pixel format, mip count, linear size
+	header.height = texture.height;
+	header.width = texture.width;
+	header.pitchOrLinearSize = (uint32_t)UTextureLevelSize(texture.format, texture.width, texture.height);
+	header.mipMapCount = (uint32_t)texture.levels.size();
+	header.pixelFormat.size = sizeof(DdsPixelFormat);
+	header.pixelFormat.flags = DDPF_FOURCC;
+	header.caps = 0x1000 | 0x400000 | 0x8; // texture, mipmap, complex
+
+	DdsHeaderDx10 dx10 = {0, 3, 0, 1, 0}; // 2D texture
+	bool extended = false;
+
+	switch (texture.format)
+	{
+	case TEXTURE_BC1:
+		header.pixelFormat.fourCC = DDS_FOURCC('D', 'X', 'T', '1');
+		break;
+	case TEXTURE_BC3:
+		header.pixelFormat.fourCC = DDS_FOURCC('D', 'X', 'T', '5');
+		break;
+	case TEXTURE_BC7:
+		header.pixelFormat.fourCC = DDS_FOURCC('D', 'X', '1', '0');
+		dx10.dxgiFormat = DXGI_FORMAT_BC7_UNORM;
+		extended = true;
+		break;
+	case TEXTURE_RGBA8:
+		header.pixelFormat.fourCC = DDS_FOURCC('D', 'X', '1', '0');
+		dx10.dxgiFormat = DXGI_FORMAT_R8G8B8A8_UNORM;
+		extended = true;
+		break;
+	default:
+		cout << "DDS has no " << UTextureFormatName(texture.format) << " format, write a .ktx2 file instead" << endl;
+		return false;
+	}
+
+	uint32_t magic = DDS_MAGIC;
+	file.write((const char *)&magic, sizeof(magic));
+	file.write((const char *)&header, sizeof(header));
+	if (extended)
+		file.write((const char *)&dx10, sizeof(dx10));
+
+	for (const vector<unsigned char> &level : texture.levels)
+		file.write((const char *)level.data(), level.size());
+	return true;
+}
+
+/* Basic data format descriptor: one sample covering the block for compressed formats, RGBA channels otherwise */
+static vector<uint32_t> UKtx2Descriptor(TextureFormat format)
+{
+	const uint32_t colorModel = format == TEXTURE_BC1 ? 128 : format == TEXTURE_BC3 ? 130 : format == TEXTURE_BC7 ? 135 : format == TEXTURE_ETC2_RGB ? 161 : 1;
+	const uint32_t blockDimension = format == TEXTURE_RGBA8 ? 0 : 3 | 3 << 8; // stored as size - 1
+	const uint32_t sampleCount = format == TEXTURE_RGBA8 ? 4 : format == TEXTURE_BC3 ? 2 : 1;
+
+	vector<uint32_t> words;
+	words.push_back(0);								  // total size, filled in below
+	words.push_back(0);								  // vendor 0 (Khronos), descriptor type 0 (basic)
+	words.push_back(2 | (24 + 16 * sampleCount) << 16); // version 2, block size
+	words.push_back(colorModel | 1 << 8 | 1 << 16);	  // BT.709 primaries, linear transfer, straight alpha
+	words.push_back(blockDimension);
+	words.push_back(UBlockBytes(format)); // bytesPlane0
+	words.push_back(0);
+
+	if (format == TEXTURE_RGBA8)
+	{
+		const uint32_t channels[4] = {0, 1, 2, 15}; // R, G, B, A
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			words.push_back(c * 8 | 7 << 16 | channels[c] << 24);
+			words.push_back(0);
+			words.push_back(0);
+			words.push_back(255);
+		}
+	}
+	else if (format == TEXTURE_BC3)
+	{
+		words.push_back(0 | 63 << 16 | 15u << 24); // alpha half of the block
+		words.push_back(0);
+		words.push_back(0);
+		words.push_back(0xFFFFFFFFu);
+		words.push_back(64 | 63 << 16 | 0 << 24); // colour half
+		words.push_back(0);
+		words.push_back(0);
+		words.push_back(0xFFFFFFFFu);
+	}
+	else
+	{
+		words.push_back(0 | (UBlockBytes(format) * 8 - 1) << 16);
+		words.push_back(0);
+		words.push_back(0);
+		words.push_back(0xFFFFFFFFu);
+	}
+
+	words[0] = (uint32_t)(words.size() * sizeof(uint32_t));
+	return words;
+}
+
+static bool UWriteKtx2(ofstream &file, const TextureImage &texture)
+{
+	static const uint32_t vkFormats[] = {VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_FORMAT_BC3_UNORM_BLOCK, VK_FORMAT_BC7_UNORM_BLOCK,
+										 VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK};
+
+	Ktx2Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.identifier, ktx2Identifier, sizeof(ktx2Identifier));
+	header.vkFormat = vkFormats[texture.format];
+	header.typeSize = 1;
+	header.pixelWidth = texture.width;
+	header.pixelHeight = texture.height;
+	header.faceCount = 1;
+	header.levelCount = (uint32_t)texture.levels.size();
+
+	vector<uint32_t> descriptor = UKtx2Descriptor(texture.format);
+	header.dfdByteOffset = (uint32_t)(sizeof(Ktx2Header) + texture.levels.size() * sizeof(Ktx2Level));
+	header.dfdByteLength = (uint32_t)(descriptor.size() * sizeof(uint32_t));
+
+	// levels are stored smallest first, each aligned to the block size (a multiple of 4)
+	vector<Ktx2Level> index(texture.levels.size());
+	uint64_t offset = header.dfdByteOffset + header.dfdByteLength;
+	uint64_t alignment = UBlockBytes(texture.format);
+	for (size_t level = texture.levels.size(); level-- > 0;)
+	{
+		offset = (offset + alignment - 1) / alignment * alignment;
+		index[level] = {offset, texture.levels[level].size(), texture.levels[level].size()};
+		offset += texture.levels[level].size();
+	}
+
+	file.write((const char *)&header, sizeof(header));
+	file.write((const char *)index.data(), index.size() * sizeof(Ktx2Level));
+	file.write((const char *)descriptor.data(), header.dfdByteLength);
+
+	static const char padding[16] = {0};
+	for (size_t level = texture.levels.size(); level-- > 0;)
+	{
+		file.write(padding, index[level].byteOffset - (uint64_t)file.tellp());
+		file.write((const char *)texture.levels[level].data(), texture.levels[level].size());
+	}
+	return true;
+}
+
+/* Writes a texture as DDS or KTX2, picked by the file extension */
+bool UWriteTexture(const string &path, const TextureImage &texture)
+{
+	bool ktx2 = path.size() >= 5 && path.compare(path.size() - 5, 5, ".ktx2") == 0;
+
+	ofstream file(path, ios::binary);
+	if (!file)
+	{
+		cout << "Cannot write " << path << endl;
+		return false;
+	}
+
+	if (!(ktx2 ? UWriteKtx2(file, texture) : UWriteDds(file, texture)))
+		return false;
+	return (bool)file;
+}
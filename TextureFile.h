@@ -0,0 +1,62 @@
+/*
+ * TextureFile.h
+ *
+ *  Precompressed, pre-mipmapped textures in DDS and KTX2 containers, read through a memory mapping
+ */
+
+#ifndef TEXTUREFILE_H
+#define TEXTUREFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "MeshFile.h"
+
+/* Pixel formats the loader understands */
+enum TextureFormat
+{
+	TEXTURE_RGBA8,	  // uncompressed fallback, 4 bytes per texel
+	TEXTURE_BC1,	  // DXT1, 8 bytes per 4x4 block
+	TEXTURE_BC3,	  // DXT5, 16 bytes per 4x4 block
+	TEXTURE_BC7,	  // BPTC, 16 bytes per 4x4 block
+	TEXTURE_ETC2_RGB, // ETC2 RGB8, 8 bytes per 4x4 block
+};
+
+/* One mip level, pointing into the mapping or into a TextureImage */
+struct TextureLevel
+{
+	uint32_t width;
+	uint32_t height;
+	const unsigned char *data;
+	size_t size;
+};
+
+/* A validated texture file: level pointers into the mapping, nothing is copied */
+struct TextureView
+{
+	MappedFile file;
+	TextureFormat format = TEXTURE_RGBA8;
+	uint32_t width = 0, height = 0;
+	std::vector<TextureLevel> levels; // level 0 is the full size image
+};
+
+/* In-memory texture used by the writer (the offline converter) */
+struct TextureImage
+{
+	TextureFormat format = TEXTURE_RGBA8;
+	uint32_t width = 0, height = 0;
+	std::vector<std::vector<unsigned char>> levels;
+};
+
+const char *UTextureFormatName(TextureFormat format);
+size_t UTextureLevelSize(TextureFormat format, uint32_t width, uint32_t height);
+GLenum UTextureInternalFormat(TextureFormat format);
+
+bool UOpenTexture(const std::string &path, TextureView &texture);
+void UCloseTexture(TextureView &texture);
+bool UWriteTexture(const std::string &path, const TextureImage &texture); // .dds or .ktx2 by extension
+
+#endif
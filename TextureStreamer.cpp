@@ -0,0 +1,397 @@
+/*
+ * TextureStreamer.cpp
+ *
+ *  Texture streaming under a memory budget: each texture's finest needed mip level follows its
+ *  on-screen size, levels are produced on a loader thread and uploaded a budgeted number of
+ *  bytes per frame, and the least recently used levels make room once the budget is reached.
+ *  Levels live in sparse textures where the driver has them and are specified and released
+ *  level by level in ordinary textures otherwise
+ */
+
+/* Header Inclusions */
+#include "TextureStreamer.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std; // standard namespace
+
+/* Parses --texture-stream, --stream-size N, --texture-budget MB, --stream-upload-kb KB and --no-sparse */
+bool UParseStreamArgs(int argc, char *argv[], StreamOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--texture-stream")
+		{
+			options.enabled = true;
+		}
+		else if (arg == "--stream-size")
+		{
+			options.size = i + 1 < argc ? atoi(argv[++i]) : 0;
+			if (options.size < STREAM_TAIL_SIZE || options.size > 16384 || (options.size & (options.size - 1)) != 0)
+			{
+				cout << "--stream-size expects a power of two from " << STREAM_TAIL_SIZE << " to 16384" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--texture-budget")
+		{
+			int megabytes = i + 1 < argc ? atoi(argv[++i]) : 0;
+			if (megabytes <= 0)
+			{
+				cout << "--texture-budget expects a positive number of MB" << endl;
+				return false;
+			}
+			options.budgetMb = (size_t)megabytes;
+		}
+		else if (arg == "--stream-upload-kb")
+		{
+			int kilobytes = i + 1 < argc ? atoi(argv[++i]) : 0;
+			if (kilobytes <= 0)
+			{
+				cout << "--stream-upload-kb expects a positive number of KB" << endl;
+				return false;
+			}
+			options.uploadKb = (size_t)kilobytes;
+		}
+		else if (arg == "--no-sparse")
+		{
+			options.sparse = false;
+		}
+	}
+
+	return true;
+}
+
+TextureStreamer::TextureStreamer(const StreamOptions &options, int count, UStreamSourceFunc source)
+	: options(options), source(source)
+{
+	// worker 0 is the GL thread, which never waits on it; the other produces the levels
+	pool.reset(new TaskPool(2));
+
+	for (int side = options.size; side > 1; side /= 2)
+		levels++;
+	levels++;
+	tailLevel = 0;
+	while ((options.size >> tailLevel) > STREAM_TAIL_SIZE)
+		tailLevel++;
+
+	// sparse levels are whole pages, so the finest level has to be at least a page wide
+	sparseStorage = options.sparse && GLEW_ARB_sparse_texture && GLEW_ARB_texture_storage;
+	if (sparseStorage)
+	{
+		GLint pageWidth = 0, pageHeight = 0;
+		glGetInternalformativ(GL_TEXTURE_2D, GL_RGBA8, GL_VIRTUAL_PAGE_SIZE_X_ARB, 1, &pageWidth);
+		glGetInternalformativ(GL_TEXTURE_2D, GL_RGBA8, GL_VIRTUAL_PAGE_SIZE_Y_ARB, 1, &pageHeight);
+		sparseStorage = pageWidth > 0 && pageHeight > 0 && options.size % pageWidth == 0 && options.size % pageHeight == 0;
+	}
+	sparseLevels = levels;
+
+	// a texture starts as its tail in the placeholder wood colour, until the first use asks for the real one
+	const unsigned char placeholder[4] = {150, 111, 74, 255};
+	vector<unsigned char> fill;
+
+	textures.resize(count);
+	for (Texture &texture : textures)
+	{
+		glGenTextures(1, &texture.name);
+		glBindTexture(GL_TEXTURE_2D, texture.name);
+
+		if (sparseStorage)
+		{
+			// the whole chain is reserved, pages are committed level by level; the levels below the page size share the tail
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SPARSE_ARB, GL_TRUE);
+			glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8, options.size, options.size);
+			glGetTexParameteriv(GL_TEXTURE_2D, GL_NUM_SPARSE_LEVELS_ARB, &sparseLevels);
+			tailLevel = min(tailLevel, sparseLevels);
+
+			for (int level = tailLevel; level < min(sparseLevels + 1, levels); level++)
+			{
+				int side = options.size >> level;
+				glTexPageCommitmentARB(GL_TEXTURE_2D, level, 0, 0, 0, side, side, 1, GL_TRUE);
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, tailLevel);
+		}
+		else
+		{
+			// mutable storage holding only the levels from the base level down, each at its own index, so the name never changes
+			for (int level = tailLevel; level < levels; level++)
+			{
+				int side = options.size >> level;
+				glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, side, side, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, tailLevel);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		}
+
+		// large pages can make the sparse tail start above STREAM_TAIL_SIZE
+		if (fill.size() < levelBytes(tailLevel))
+		{
+			fill.resize(levelBytes(tailLevel));
+			for (size_t i = 0; i < fill.size(); i += 4)
+				copy(placeholder, placeholder + 4, &fill[i]);
+		}
+		for (int level = tailLevel; level < levels; level++)
+		{
+			int side = options.size >> level;
+			glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, side, side, GL_RGBA, GL_UNSIGNED_BYTE, fill.data());
+		}
+
+		texture.base = tailLevel;
+		texture.required = levels;
+		resident += residentBytes(texture);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (resident > options.budgetMb * 1024 * 1024)
+		cout << "Texture streaming: the " << count << " tails alone take " << resident / (1024.0 * 1024.0) << " MB, over the --texture-budget" << endl;
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	pool->wait(group); // a request may still be writing its texels
+
+	for (Texture &texture : textures)
+		glDeleteTextures(1, &texture.name);
+}
+
+void TextureStreamer::use(int index, float pixels)
+{
+	Texture &texture = textures[index];
+
+	// the finest level still has a texel per pixel or more
+	int level = pixels > 1.0f ? (int)floor(log2(options.size / pixels)) : levels - 1;
+	level = max(0, min(level, levels - 1));
+
+	texture.required = min(texture.required, level);
+	texture.pixels = max(texture.pixels, pixels);
+	texture.lastUsed = frame;
+}
+
+void TextureStreamer::update()
+{
+	UPROFILE_SCOPE("TextureStreamer::update");
+	auto start = chrono::steady_clock::now();
+
+	lastStats.uploadedBytes = 0;
+	lastStats.evictions = 0;
+	size_t uploadBudget = options.uploadKb * 1024;
+
+	glActiveTexture(GL_TEXTURE0);
+
+	// finished levels, the largest on screen first, within the frame's upload budget
+	stable_sort(requests.begin(), requests.end(), [&](const unique_ptr<Request> &a, const unique_ptr<Request> &b)
+				{ return textures[a->texture].pixels > textures[b->texture].pixels; });
+
+	for (size_t i = 0; i < requests.size();)
+	{
+		Request &request = *requests[i];
+		Texture &texture = textures[request.texture];
+		int state = request.state;
+		if (state == 0)
+		{
+			i++;
+			continue;
+		}
+
+		if (state < 0)
+		{
+			texture.failed = true; // the source has nothing for it, it keeps what it has
+		}
+		else if (!texture.tailReal)
+		{
+			uploadTail(texture, request);
+		}
+		else if (texture.required <= request.level)
+		{
+			// one level at a time, so it is always the next finer one; it waits a frame when the upload budget is spent
+			size_t bytes = levelBytes(request.level);
+			if (lastStats.uploadedBytes > 0 && lastStats.uploadedBytes + bytes > uploadBudget)
+			{
+				i++;
+				continue;
+			}
+			if (makeRoom(bytes, texture))
+			{
+				setBase(texture, request.level, &request);
+				lastStats.uploadedBytes += bytes;
+			}
+		}
+		// failed, no longer needed or no room even after evicting: dropped, a later use asks again
+
+		texture.request = nullptr;
+		requests.erase(requests.begin() + i);
+	}
+
+	// what last frame's uses asked for, the largest on screen first
+	vector<int> wanted;
+	vector<size_t> evictable(textures.size(), 0); // bytes of the levels finer than any use asked for
+	size_t totalEvictable = 0;
+	for (int index = 0; index < (int)textures.size(); index++)
+	{
+		const Texture &texture = textures[index];
+		if (!texture.request && !texture.failed && texture.required < levels && (!texture.tailReal || texture.required < texture.base))
+			wanted.push_back(index);
+
+		for (int level = texture.base; level < min(texture.required, tailLevel); level++)
+			evictable[index] += levelBytes(level);
+		totalEvictable += evictable[index];
+	}
+	stable_sort(wanted.begin(), wanted.end(), [&](int a, int b)
+				{ return textures[a].pixels > textures[b].pixels; });
+
+	for (int index : wanted)
+	{
+		if (requests.size() >= STREAM_MAX_REQUESTS)
+			break;
+
+		Texture &texture = textures[index];
+		int first = texture.tailReal ? texture.base - 1 : tailLevel;
+		int last = texture.tailReal ? first : levels - 1;
+
+		// a level that cannot fit even after evicting everything evictable is not produced
+		if (texture.tailReal && resident + levelBytes(first) > options.budgetMb * 1024 * 1024 + totalEvictable - evictable[index])
+			continue;
+
+		requests.push_back(unique_ptr<Request>(new Request));
+		Request *request = requests.back().get();
+		request->texture = index;
+		request->level = first;
+		request->texels.resize(last - first + 1);
+		texture.request = request;
+
+		UStreamSourceFunc produce = source;
+		int size = options.size;
+		pool->submit(group, [request, produce, first, last, size]
+					 {
+						 bool produced = true;
+						 for (int level = first; level <= last && produced; level++)
+						 {
+							 vector<unsigned char> &texels = request->texels[level - first];
+							 size_t side = (size_t)max(1, size >> level);
+							 produced = produce(request->texture, level, texels) && texels.size() == side * side * 4;
+						 }
+						 request->state = produced ? 1 : -1; });
+	}
+
+	// what this frame draws against what last frame's uses asked for
+	lastStats.misses = 0;
+	for (Texture &texture : textures)
+	{
+		if (texture.required < levels && (!texture.tailReal || texture.base > texture.required))
+			lastStats.misses++;
+		texture.required = levels;
+		texture.pixels = 0.0f;
+	}
+	frame++;
+
+	lastStats.residentBytes = resident;
+	lastStats.pending = (int)requests.size();
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	lastStats.ms = elapsed.count();
+}
+
+size_t TextureStreamer::levelBytes(int level) const
+{
+	size_t side = (size_t)max(1, options.size >> level);
+	return side * side * 4;
+}
+
+size_t TextureStreamer::residentBytes(const Texture &texture) const
+{
+	size_t bytes = 0;
+	for (int level = texture.base; level < levels; level++)
+		bytes += levelBytes(level);
+	return bytes;
+}
+
+/* Evicts the least recently used levels nothing drawn last frame needed until 'bytes' more fit the budget */
+bool TextureStreamer::makeRoom(size_t bytes, const Texture &keep)
+{
+	size_t budget = options.budgetMb * 1024 * 1024;
+	while (resident + bytes > budget)
+	{
+		Texture *victim = nullptr;
+		for (Texture &texture : textures)
+		{
+			bool evictable = texture.base < min(texture.required, tailLevel);
+			if (&texture != &keep && evictable && (!victim || texture.lastUsed < victim->lastUsed))
+				victim = &texture;
+		}
+		if (!victim)
+			return false;
+
+		setBase(*victim, victim->base + 1, nullptr);
+		lastStats.evictions++;
+	}
+	return true;
+}
+
+void TextureStreamer::setBase(Texture &texture, int base, const Request *request)
+{
+	resident -= residentBytes(texture);
+	glBindTexture(GL_TEXTURE_2D, texture.name);
+
+	if (sparseStorage)
+	{
+		// the base level keeps sampling away from uncommitted pages; it moves before pages go and after they come
+		if (base < texture.base)
+		{
+			int side = options.size >> base;
+			glTexPageCommitmentARB(GL_TEXTURE_2D, base, 0, 0, 0, side, side, 1, GL_TRUE);
+			glTexSubImage2D(GL_TEXTURE_2D, base, 0, 0, side, side, GL_RGBA, GL_UNSIGNED_BYTE, request->texels[0].data());
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+		}
+		else
+		{
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+			for (int level = texture.base; level < base; level++)
+			{
+				int side = options.size >> level;
+				glTexPageCommitmentARB(GL_TEXTURE_2D, level, 0, 0, 0, side, side, 1, GL_FALSE);
+			}
+		}
+	}
+	else
+	{
+		// without sparse storage a level is specified or released in place, the base level moving the same way
+		if (base < texture.base)
+		{
+			int side = options.size >> base;
+			glTexImage2D(GL_TEXTURE_2D, base, GL_RGBA8, side, side, 0, GL_RGBA, GL_UNSIGNED_BYTE, request->texels[0].data());
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+		}
+		else
+		{
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+			for (int level = texture.base; level < base; level++)
+				glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL); // an empty image frees the level
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	texture.base = base;
+	resident += residentBytes(texture);
+}
+
+/* Replaces the placeholder tail with the texture's own, whose bytes the tail already counts */
+void TextureStreamer::uploadTail(Texture &texture, const Request &request)
+{
+	glBindTexture(GL_TEXTURE_2D, texture.name);
+	for (int level = tailLevel; level < levels; level++)
+	{
+		int side = options.size >> level;
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, side, side, GL_RGBA, GL_UNSIGNED_BYTE, request.texels[level - tailLevel].data());
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	texture.tailReal = true;
+	lastStats.uploadedBytes += residentBytes(texture);
+}
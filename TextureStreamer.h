@@ -0,0 +1,117 @@
+/*
+ * TextureStreamer.h
+ *
+ *  Texture streaming under a memory budget: each texture's finest needed mip level follows its
+ *  on-screen size, levels are produced on a loader thread and uploaded a budgeted number of
+ *  bytes per frame, and the least recently used levels make room once the budget is reached.
+ *  Levels live in sparse textures where the driver has them and are specified and released
+ *  level by level in ordinary textures otherwise
+ */
+
+#ifndef TEXTURESTREAMER_H
+#define TEXTURESTREAMER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <GL/glew.h>
+
+#include "TaskPool.h"
+
+#define STREAM_TAIL_SIZE 64	   // levels this wide and smaller are always resident, so every texture has something to sample
+#define STREAM_MAX_REQUESTS 16 // levels being produced or waiting for upload at once
+
+/* Command line options of the streamer */
+struct StreamOptions
+{
+	bool enabled = false;	// --texture-stream streams the finish textures' mip levels (with --materials N)
+	int size = 1024;		// --stream-size N side of each texture's finest level, a power of two
+	size_t budgetMb = 64;	// --texture-budget MB of resident levels
+	size_t uploadKb = 2048; // --stream-upload-kb KB uploaded per frame
+	bool sparse = true;		// --no-sparse specifies levels in ordinary textures even where sparse textures are supported
+};
+
+/* What the streamer did in the last update() */
+struct StreamStats
+{
+	size_t residentBytes = 0;
+	size_t uploadedBytes = 0;
+	int pending = 0;   // requests being produced or waiting for upload
+	int misses = 0;	   // textures drawn coarser than their on-screen size asks for
+	int evictions = 0; // levels dropped to stay within the budget
+	double ms = 0.0;
+};
+
+// loader thread: the RGBA8 texels of level 'level' of texture 'texture', (size >> level) squared
+typedef std::function<bool(int texture, int level, std::vector<unsigned char> &texels)> UStreamSourceFunc;
+
+class TextureStreamer
+{
+public:
+	TextureStreamer(const StreamOptions &options, int count, UStreamSourceFunc source); // every texture starts with a placeholder tail
+	~TextureStreamer();
+
+	TextureStreamer(const TextureStreamer &) = delete;
+	TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+	// the texture is drawn this frame, its whole image covering about 'pixels' on screen
+	void use(int texture, float pixels);
+
+	// GL thread, before drawing: uploads finished levels, evicts to fit and requests what last frame's uses asked for
+	void update();
+
+	GLuint texture(int texture) const { return textures[texture].name; } // the same name for the streamer's lifetime
+	int residentLevel(int texture) const { return textures[texture].base; }
+	bool sparse() const { return sparseStorage; }
+	const StreamStats &stats() const { return lastStats; }
+
+private:
+	struct Request
+	{
+		int texture;
+		int level;									 // the finest level it brings, with the whole tail for the tail's request
+		std::vector<std::vector<unsigned char>> texels; // level after level
+		std::atomic<int> state{0};					 // 0 producing, 1 done, -1 failed
+	};
+
+	struct Texture
+	{
+		GLuint name = 0;
+		int base = 0;		   // finest resident level
+		bool tailReal = false; // the tail holds the texture rather than the placeholder
+		bool failed = false;   // the source had no level for it, it is not asked again
+		int required = 0;	   // finest level a use() asked for since the last update, 'levels' without one
+		float pixels = 0.0f;   // largest on-screen size of those uses, orders the requests
+		uint64_t lastUsed = 0; // frame of the last use(), for the eviction order
+		Request *request = nullptr;
+	};
+
+	size_t levelBytes(int level) const;
+	size_t residentBytes(const Texture &texture) const;
+	bool makeRoom(size_t bytes, const Texture &keep);
+	void setBase(Texture &texture, int base, const Request *request); // streams in or evicts down to 'base'
+	void uploadTail(Texture &texture, const Request &request);
+
+	StreamOptions options;
+	UStreamSourceFunc source;
+	int levels = 0;		// in a full chain
+	int tailLevel = 0;	// first always resident level
+	int sparseLevels = 0; // levels committed page by page, the rest form the sparse tail
+	bool sparseStorage = false;
+
+	std::vector<Texture> textures;
+	std::vector<std::unique_ptr<Request>> requests;
+	std::unique_ptr<TaskPool> pool; // its own pool, like the asset loader's: the render thread never waits on it
+	TaskGroup group;
+
+	uint64_t frame = 1;
+	size_t resident = 0;
+	StreamStats lastStats;
+};
+
+bool UParseStreamArgs(int argc, char *argv[], StreamOptions &options);
+
+#endif
@@ -0,0 +1,295 @@
+/*
+ * UniformBuffers.cpp
+ *
+ *  Uniform blocks instead of loose uniforms: the camera, lights and vertex decoding of a frame
+ *  go in one std140 block every program shares, per-object data is sub-allocated from a
+ *  triple-buffered ring fenced with glFenceSync, and each program's locations and block
+ *  bindings are resolved once after linking
+ */
+
+/* Header Inclusions */
+#include "UniformBuffers.h"
+#include "FrameTrace.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std; // standard namespace
+
+/* std140 offsets the Frame block must have, as laid out by FrameUniforms */
+static const struct
+{
+	const char *name;
+	size_t offset;
+} frameMembers[] = {
+	{"view", offsetof(FrameUniforms, view)},
+	{"projection", offsetof(FrameUniforms, projection)},
+	{"viewPosition", offsetof(FrameUniforms, viewPosition)},
+	{"light0Pos", offsetof(FrameUniforms, light0Position)},
+	{"light0Color", offsetof(FrameUniforms, light0Color)},
+	{"light1Pos", offsetof(FrameUniforms, light1Position)},
+	{"light1Color", offsetof(FrameUniforms, light1Color)},
+	{"positionScale", offsetof(FrameUniforms, positionScale)},
+	{"positionOffset", offsetof(FrameUniforms, positionOffset)},
+	{"uvScale", offsetof(FrameUniforms, uvScale)},
+	{"uvOffset", offsetof(FrameUniforms, uvOffset)},
+	{"octNormals", offsetof(FrameUniforms, octNormals)},
+};
+
+GLint ProgramUniforms::location(const char *name) const
+{
+	auto found = locations.find(name);
+	return found == locations.end() ? -1 : found->second;
+}
+
+UniformRing::UniformRing(const UniformOptions &options)
+	: options(options)
+{
+	GLint offsetAlignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+	alignment = max<size_t>(offsetAlignment, 16);
+
+	// persistent mapping needs GL 4.4 or ARB_buffer_storage; without it each region is mapped unsynchronized, the fences still guard it
+	persistentMap = options.persistent && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage);
+
+	create((size_t)max(options.regionKb, 1) * 1024);
+}
+
+UniformRing::~UniformRing()
+{
+	release();
+}
+
+size_t UniformRing::aligned(size_t bytes) const
+{
+	return (bytes + alignment - 1) / alignment * alignment;
+}
+
+void UniformRing::create(size_t regionBytes)
+{
+	regionSize = aligned(regionBytes);
+	size_t total = regionSize * UNIFORM_RING_FRAMES;
+
+	glGenBuffers(1, &name);
+	glBindBuffer(GL_UNIFORM_BUFFER, name);
+	if (persistentMap)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_UNIFORM_BUFFER, total, NULL, flags);
+		mapped = (unsigned char *)glMapBufferRange(GL_UNIFORM_BUFFER, 0, total, flags);
+	}
+	else
+	{
+		glBufferData(GL_UNIFORM_BUFFER, total, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	region = UNIFORM_RING_FRAMES - 1;
+}
+
+void UniformRing::release()
+{
+	// deleting a buffer the GPU still reads is safe, GL keeps it alive until those draws finish
+	for (GLsync &fence : fences)
+	{
+		if (fence)
+			glDeleteSync(fence);
+		fence = 0;
+	}
+
+	if (name)
+		glDeleteBuffers(1, &name); // unmaps a persistent mapping too
+	name = 0;
+	mapped = write = nullptr;
+}
+
+void UniformRing::begin(size_t bytes)
+{
+	UPROFILE_SCOPE("UniformRing::begin");
+	frameStats = UniformRingStats();
+
+	if (bytes > regionSize)
+	{
+		// a frame that outgrows its region gets a new ring, twice the size so growing stays rare
+		release();
+		create(max(bytes, 2 * regionSize));
+	}
+
+	region = (region + 1) % UNIFORM_RING_FRAMES;
+	cursor = 0;
+
+	// the region was last written three frames ago; only wait when the GPU is that far behind
+	GLsync &fence = fences[region];
+	if (fence)
+	{
+		auto start = chrono::steady_clock::now();
+		GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (result == GL_TIMEOUT_EXPIRED)
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms at a time
+
+		chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+		frameStats.waitMs = elapsed.count();
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	if (persistentMap)
+	{
+		write = mapped + region * regionSize;
+	}
+	else
+	{
+		// the fence already serializes the reuse, so the driver need not
+		glBindBuffer(GL_UNIFORM_BUFFER, name);
+		write = (unsigned char *)glMapBufferRange(GL_UNIFORM_BUFFER, region * regionSize, regionSize,
+												  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+}
+
+GLintptr UniformRing::push(const void *data, size_t size)
+{
+	if (!write || cursor + size > regionSize)
+		return -1;
+
+	memcpy(write + cursor, data, size);
+	GLintptr offset = (GLintptr)(region * regionSize + cursor);
+	cursor += aligned(size);
+	frameStats.bytes = cursor;
+	return offset;
+}
+
+void UniformRing::flush()
+{
+	if (write)
+		UTraceUpload(GL_UNIFORM_BUFFER, name, (GLintptr)(region * regionSize), (GLsizeiptr)cursor, write, 0);
+
+	// coherent persistent writes are visible to the next draw as they are
+	if (!persistentMap && write)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, name);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	write = nullptr;
+}
+
+void UniformRing::end()
+{
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/* Parses --no-persistent-map and --uniform-ring-kb N */
+bool UParseUniformArgs(int argc, char *argv[], UniformOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--no-persistent-map")
+		{
+			options.persistent = false;
+		}
+		else if (arg == "--uniform-ring-kb")
+		{
+			options.regionKb = i + 1 < argc ? atoi(argv[++i]) : 0;
+			if (options.regionKb <= 0)
+			{
+				cout << "--uniform-ring-kb expects a size in kilobytes" << endl;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool UReflectProgram(GLuint program, ProgramUniforms &uniforms)
+{
+	uniforms.program = program;
+	uniforms.locations.clear();
+
+	// every active uniform outside a block, so no draw ever looks a name up again
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	vector<GLchar> buffer(max(maxLength, 1));
+	for (GLint i = 0; i < count; i++)
+	{
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(program, (GLuint)i, (GLsizei)buffer.size(), NULL, &size, &type, buffer.data());
+
+		GLint location = glGetUniformLocation(program, buffer.data());
+		if (location < 0)
+			continue; // a block member
+
+		string name = buffer.data();
+		if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+			name.resize(name.size() - 3);
+		uniforms.locations[name] = location;
+	}
+
+	// GLSL 3.30 has no binding layout qualifier, so the blocks are bound here
+	GLuint frame = glGetUniformBlockIndex(program, "Frame");
+	if (frame != GL_INVALID_INDEX)
+	{
+		glUniformBlockBinding(program, frame, FRAME_BLOCK_BINDING);
+
+		GLint dataSize = 0;
+		glGetActiveUniformBlockiv(program, frame, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+		if ((size_t)dataSize > sizeof(FrameUniforms))
+		{
+			cout << "Frame block of program " << program << " is " << dataSize << " bytes, FrameUniforms only " << sizeof(FrameUniforms) << endl;
+			return false;
+		}
+
+		const size_t memberCount = sizeof(frameMembers) / sizeof(frameMembers[0]);
+		const GLchar *names[memberCount];
+		GLuint indices[memberCount];
+		GLint offsets[memberCount];
+		for (size_t i = 0; i < memberCount; i++)
+			names[i] = frameMembers[i].name;
+
+		glGetUniformIndices(program, (GLsizei)memberCount, names, indices);
+		for (size_t i = 0; i < memberCount; i++)
+		{
+			if (indices[i] == GL_INVALID_INDEX)
+			{
+				cout << "Frame block of program " << program << " has no member " << names[i] << endl;
+				return false;
+			}
+		}
+
+		glGetActiveUniformsiv(program, (GLsizei)memberCount, indices, GL_UNIFORM_OFFSET, offsets);
+		for (size_t i = 0; i < memberCount; i++)
+		{
+			if ((size_t)offsets[i] != frameMembers[i].offset)
+			{
+				cout << "Frame block member " << names[i] << " is at " << offsets[i] << ", FrameUniforms has it at " << frameMembers[i].offset << endl;
+				return false;
+			}
+		}
+	}
+
+	GLuint object = glGetUniformBlockIndex(program, "Object");
+	if (object != GL_INVALID_INDEX)
+	{
+		glUniformBlockBinding(program, object, OBJECT_BLOCK_BINDING);
+
+		GLint dataSize = 0;
+		glGetActiveUniformBlockiv(program, object, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+		if ((size_t)dataSize > sizeof(ObjectUniforms))
+		{
+			cout << "Object block of program " << program << " is " << dataSize << " bytes, ObjectUniforms only " << sizeof(ObjectUniforms) << endl;
+			return false;
+		}
+	}
+
+	return true;
+}
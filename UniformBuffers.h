@@ -0,0 +1,121 @@
+/*
+ * UniformBuffers.h
+ *
+ *  Uniform blocks instead of loose uniforms: the camera, lights and vertex decoding of a frame
+ *  go in one std140 block every program shares, per-object data is sub-allocated from a
+ *  triple-buffered ring fenced with glFenceSync, and each program's locations and block
+ *  bindings are resolved once after linking
+ */
+
+#ifndef UNIFORMBUFFERS_H
+#define UNIFORMBUFFERS_H
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <GL/glew.h>
+#include <GL/glm/glm.hpp>
+
+#define FRAME_BLOCK_BINDING 0  // binding point of the Frame block
+#define OBJECT_BLOCK_BINDING 1 // binding point of the Object block
+#define UNIFORM_RING_FRAMES 3  // regions in the ring: one written while two may still be read by the GPU
+
+/* Command line options of the uniform ring */
+struct UniformOptions
+{
+	bool persistent = true; // --no-persistent-map maps each frame's region instead, to compare
+	int regionKb = 64;		// --uniform-ring-kb N starting size of a frame's region, grows when a frame needs more
+};
+
+/* Mirror of the shaders' std140 Frame block; a vec3 takes 16 bytes, checked against the compiler at link time */
+struct FrameUniforms
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec3 viewPosition;
+	float padding0;
+	glm::vec3 light0Position;
+	float padding1;
+	glm::vec3 light0Color;
+	float padding2;
+	glm::vec3 light1Position;
+	float padding3;
+	glm::vec3 light1Color;
+	float padding4;
+	glm::vec3 positionScale; // dequantization of the compressed vertex layouts
+	float padding5;
+	glm::vec3 positionOffset;
+	float padding6;
+	glm::vec2 uvScale;
+	glm::vec2 uvOffset;
+	GLint octNormals; // std140 bool
+	GLint padding7[3];
+};
+
+/* Mirror of the shaders' std140 Object block */
+struct ObjectUniforms
+{
+	glm::mat4 model;
+	float layer; // material array layer of the draw
+	float fade;	 // dithered share of a level of detail cross-fade, see LodSelection
+	float padding0[2];
+};
+
+/* A program's uniforms outside blocks, found by reflection after linking */
+struct ProgramUniforms
+{
+	GLuint program = 0;
+	std::unordered_map<std::string, GLint> locations; // active uniforms by name, arrays without "[0]"
+
+	GLint location(const char *name) const; // -1, which glUniform* ignores, when the program has no such uniform
+};
+
+/* What the ring did during one frame */
+struct UniformRingStats
+{
+	size_t bytes = 0;	 // written this frame, alignment included
+	double waitMs = 0.0; // blocked on the fence of the region being reused
+};
+
+/* Per-frame uniform data, written straight into mapped memory; a region is reused only after its fence signals */
+class UniformRing
+{
+public:
+	explicit UniformRing(const UniformOptions &options);
+	~UniformRing();
+
+	UniformRing(const UniformRing &) = delete;
+	UniformRing &operator=(const UniformRing &) = delete;
+
+	size_t aligned(size_t bytes) const; // rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+
+	void begin(size_t bytes);						  // moves to the next region, waiting for the GPU if it still reads it; 'bytes' of aligned() sizes are reserved
+	GLintptr push(const void *data, size_t size);	  // copies into the region, returns the buffer offset to bind; -1 past the reservation
+	void flush();									  // makes the writes visible before the draws that read them
+	void end();										  // fences the region after the frame's draws
+
+	GLuint buffer() const { return name; }
+	bool persistent() const { return persistentMap; }
+	const UniformRingStats &stats() const { return frameStats; }
+
+private:
+	void create(size_t regionBytes);
+	void release();
+
+	UniformOptions options;
+	bool persistentMap = false;
+	GLuint name = 0;
+	size_t alignment = 256, regionSize = 0, cursor = 0;
+	int region = UNIFORM_RING_FRAMES - 1; // the first begin() moves to region 0
+	unsigned char *mapped = nullptr;	  // the whole ring when persistent
+	unsigned char *write = nullptr;		  // the current region between begin() and flush()
+	GLsync fences[UNIFORM_RING_FRAMES] = {};
+	UniformRingStats frameStats;
+};
+
+bool UParseUniformArgs(int argc, char *argv[], UniformOptions &options);
+
+// collects the locations of 'program', binds its Frame and Object blocks and checks them against the C++ mirrors
+bool UReflectProgram(GLuint program, ProgramUniforms &uniforms);
+
+#endif
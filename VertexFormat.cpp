@@ -0,0 +1,381 @@
+/*
+ * VertexFormat.cpp
+ *
+ *  Compressed vertex layouts: quantized positions, packed normals and half / unorm16 texture coordinates
+ */
+
+/* Header Inclusions */
+#include "VertexFormat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+using namespace std; // standard namespace
+
+/* Parses the vertex layout options, returns false on an unknown format name */
+bool UParseVertexFormatArgs(int argc, char *argv[], VertexFormatOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--position-format" && hasValue)
+		{
+			string value = argv[++i];
+			if (value == "float")
+				options.position = POSITION_FLOAT;
+			else if (value == "unorm16")
+				options.position = POSITION_UNORM16;
+			else
+			{
+				cout << "Unknown position format " << value << " (float, unorm16)" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--normal-format" && hasValue)
+		{
+			string value = argv[++i];
+			if (value == "float")
+				options.normal = NORMAL_FLOAT;
+			else if (value == "oct")
+				options.normal = NORMAL_OCT16;
+			else if (value == "2_10_10_10")
+				options.normal = NORMAL_2_10_10_10;
+			else
+			{
+				cout << "Unknown normal format " << value << " (float, oct, 2_10_10_10)" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--uv-format" && hasValue)
+		{
+			string value = argv[++i];
+			if (value == "float")
+				options.uv = UV_FLOAT;
+			else if (value == "half")
+				options.uv = UV_HALF;
+			else if (value == "unorm16")
+				options.uv = UV_UNORM16;
+			else
+			{
+				cout << "Unknown texture coordinate format " << value << " (float, half, unorm16)" << endl;
+				return false;
+			}
+		}
+		else if (arg == "--vertex-benchmark")
+		{
+			options.benchmark = true;
+		}
+	}
+	return true;
+}
+
+/* Short name of a layout, e.g. "unorm16/oct/half" */
+string UVertexFormatName(const VertexFormatOptions &options)
+{
+	static const char *positionNames[] = {"float", "unorm16"};
+	static const char *normalNames[] = {"float", "oct", "2_10_10_10"};
+	static const char *uvNames[] = {"float", "half", "unorm16"};
+
+	return string(positionNames[options.position]) + "/" + normalNames[options.normal] + "/" + uvNames[options.uv];
+}
+
+/* Finds the attribute at 'location', NULL when the mesh has none */
+static const MeshAttribute *UFindAttribute(const MeshData &mesh, uint32_t location)
+{
+	for (const MeshAttribute &attribute : mesh.attributes)
+		if (attribute.location == location)
+			return &attribute;
+	return NULL;
+}
+
+/* Whether every attribute is plain float, the only layout the packer reads */
+bool UIsFloatLayout(const MeshData &mesh)
+{
+	const MeshAttribute *position = UFindAttribute(mesh, 0);
+	if (!position || position->components < 3)
+		return false;
+
+	for (const MeshAttribute &attribute : mesh.attributes)
+		if (attribute.type != GL_FLOAT)
+			return false;
+	return true;
+}
+
+/* Whether the layout is already the one UPackVertices writes for the float formats: position, normal, uv, then the rest, tightly packed */
+bool UIsPackedFloatLayout(const MeshData &mesh)
+{
+	if (!UIsFloatLayout(mesh))
+		return false;
+
+	const uint32_t components[3] = {3, 3, 2};
+	vector<MeshAttribute> expected;
+	uint32_t offset = 0;
+	for (uint32_t location = 0; location <= 2; location++)
+	{
+		if (!UFindAttribute(mesh, location))
+			continue;
+		expected.push_back({location, components[location], GL_FLOAT, GL_FALSE, offset, 0});
+		offset += components[location] * sizeof(float);
+	}
+	for (const MeshAttribute &attribute : mesh.attributes)
+	{
+		if (attribute.location <= 2)
+			continue;
+		expected.push_back({attribute.location, attribute.components, GL_FLOAT, GL_FALSE, offset, 0});
+		offset += attribute.components * sizeof(float);
+	}
+
+	if (offset != mesh.vertexStride || expected.size() != mesh.attributes.size())
+		return false;
+	for (size_t i = 0; i < expected.size(); i++)
+	{
+		const MeshAttribute &a = expected[i], &b = mesh.attributes[i];
+		if (a.location != b.location || a.components != b.components || a.normalized != b.normalized || a.offset != b.offset)
+			return false;
+	}
+	return true;
+}
+
+/* IEEE 754 binary16 with round to nearest, flushing values below the half range to zero */
+static uint16_t UFloatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, 4);
+
+	uint32_t sign = (bits >> 16) & 0x8000u;
+	int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFFu;
+
+	if (exponent <= 0)
+		return (uint16_t)sign;
+	if (exponent >= 31)
+		return (uint16_t)(sign | 0x7C00u); // overflow and infinity; NaN is never a texture coordinate
+
+	uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000u)
+		half++; // carries into the exponent correctly when the mantissa is all ones
+	return (uint16_t)half;
+}
+
+static int16_t USnorm16(float value)
+{
+	return (int16_t)lround(min(max(value, -1.0f), 1.0f) * 32767.0f);
+}
+
+static uint16_t UUnorm16(float value)
+{
+	return (uint16_t)lround(min(max(value, 0.0f), 1.0f) * 65535.0f);
+}
+
+/* Octahedral mapping of a direction onto the [-1, 1] square */
+static glm::vec2 UOctEncode(glm::vec3 n)
+{
+	n /= (fabs(n.x) + fabs(n.y) + fabs(n.z));
+	if (n.z >= 0.0f)
+		return glm::vec2(n.x, n.y);
+
+	return glm::vec2((1.0f - fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+}
+
+/* Signed 10-bit x, y, z packed little end first, w left at 0 */
+static uint32_t UPack2101010(glm::vec3 n)
+{
+	uint32_t packed = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		int value = (int)lround(min(max(n[axis], -1.0f), 1.0f) * 511.0f);
+		packed |= ((uint32_t)value & 0x3FFu) << (axis * 10);
+	}
+	return packed;
+}
+
+/* Repacks a float mesh into the selected layout and returns the constants the shaders need */
+bool UPackVertices(const MeshData &source, const VertexFormatOptions &options, MeshData &packed, VertexDecode &decode)
+{
+	if (!UIsFloatLayout(source))
+	{
+		cout << "Vertex compression needs a float vertex layout" << endl;
+		return false;
+	}
+
+	const MeshAttribute *positionIn = UFindAttribute(source, 0);
+	const MeshAttribute *normalIn = UFindAttribute(source, 1);
+	const MeshAttribute *uvIn = UFindAttribute(source, 2);
+	size_t vertexCount = source.vertices.size() / source.vertexStride;
+
+	auto read = [&](const MeshAttribute *attribute, size_t vertex, int component) {
+		float value;
+		memcpy(&value, &source.vertices[vertex * source.vertexStride + attribute->offset + component * sizeof(float)], sizeof(float));
+		return value;
+	};
+
+	// ranges the quantized attributes are stored relative to
+	glm::vec3 positionMin(1e30f), positionMax(-1e30f);
+	glm::vec2 uvMin(1e30f), uvMax(-1e30f);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			positionMin[axis] = min(positionMin[axis], read(positionIn, v, axis));
+			positionMax[axis] = max(positionMax[axis], read(positionIn, v, axis));
+		}
+		for (int axis = 0; uvIn && axis < 2; axis++)
+		{
+			uvMin[axis] = min(uvMin[axis], read(uvIn, v, axis));
+			uvMax[axis] = max(uvMax[axis], read(uvIn, v, axis));
+		}
+	}
+
+	decode = VertexDecode();
+	packed.attributes.clear();
+	uint32_t offset = 0;
+
+	if (options.position == POSITION_UNORM16)
+	{
+		packed.attributes.push_back({0, 3, GL_UNSIGNED_SHORT, GL_TRUE, offset, 0});
+		offset += 4 * sizeof(uint16_t); // fourth short pads the position to 8 bytes
+		decode.positionOffset = positionMin;
+		decode.positionScale = positionMax - positionMin;
+	}
+	else
+	{
+		packed.attributes.push_back({0, 3, GL_FLOAT, GL_FALSE, offset, 0});
+		offset += 3 * sizeof(float);
+	}
+
+	if (normalIn)
+	{
+		if (options.normal == NORMAL_OCT16)
+		{
+			packed.attributes.push_back({1, 2, GL_SHORT, GL_TRUE, offset, 0});
+			offset += 2 * sizeof(int16_t);
+			decode.octNormals = 1;
+		}
+		else if (options.normal == NORMAL_2_10_10_10)
+		{
+			packed.attributes.push_back({1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, offset, 0});
+			offset += sizeof(uint32_t);
+		}
+		else
+		{
+			packed.attributes.push_back({1, 3, GL_FLOAT, GL_FALSE, offset, 0});
+			offset += 3 * sizeof(float);
+		}
+	}
+
+	size_t uvIndex = packed.attributes.size();
+	if (uvIn)
+	{
+		if (options.uv == UV_HALF)
+		{
+			packed.attributes.push_back({2, 2, GL_HALF_FLOAT, GL_FALSE, offset, 0});
+			offset += 2 * sizeof(uint16_t);
+		}
+		else if (options.uv == UV_UNORM16)
+		{
+			packed.attributes.push_back({2, 2, GL_UNSIGNED_SHORT, GL_TRUE, offset, 0});
+			offset += 2 * sizeof(uint16_t);
+			decode.uvOffset = uvMin;
+			decode.uvScale = uvMax - uvMin;
+		}
+		else
+		{
+			packed.attributes.push_back({2, 2, GL_FLOAT, GL_FALSE, offset, 0});
+			offset += 2 * sizeof(float);
+		}
+	}
+
+	// anything past the texture coordinate (the lightmap coordinate) is kept as stored
+	vector<const MeshAttribute *> extraIn;
+	for (const MeshAttribute &attribute : source.attributes)
+	{
+		if (attribute.location <= 2)
+			continue;
+		extraIn.push_back(&attribute);
+		packed.attributes.push_back({attribute.location, attribute.components, GL_FLOAT, GL_FALSE, offset, 0});
+		offset += attribute.components * sizeof(float);
+	}
+	size_t extraIndex = packed.attributes.size() - extraIn.size();
+
+	packed.vertexStride = offset;
+	packed.vertices.assign(vertexCount * packed.vertexStride, 0);
+	packed.indices = source.indices;
+	packed.submeshes = source.submeshes;
+	memcpy(packed.boundsMin, source.boundsMin, sizeof(packed.boundsMin));
+	memcpy(packed.boundsMax, source.boundsMax, sizeof(packed.boundsMax));
+
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		unsigned char *out = &packed.vertices[v * packed.vertexStride];
+		glm::vec3 position(read(positionIn, v, 0), read(positionIn, v, 1), read(positionIn, v, 2));
+
+		if (options.position == POSITION_UNORM16)
+		{
+			uint16_t q[4] = {0, 0, 0, 0};
+			for (int axis = 0; axis < 3; axis++)
+				q[axis] = decode.positionScale[axis] > 0.0f ? UUnorm16((position[axis] - positionMin[axis]) / decode.positionScale[axis]) : 0;
+			memcpy(out + packed.attributes[0].offset, q, sizeof(q));
+		}
+		else
+		{
+			memcpy(out + packed.attributes[0].offset, &position[0], 3 * sizeof(float));
+		}
+
+		if (normalIn)
+		{
+			const MeshAttribute &attribute = packed.attributes[1];
+			glm::vec3 normal(read(normalIn, v, 0), read(normalIn, v, 1), read(normalIn, v, 2));
+			float length = glm::length(normal);
+			if (attribute.type != GL_FLOAT)
+				normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f); // only the direction survives packing
+
+			if (options.normal == NORMAL_OCT16)
+			{
+				glm::vec2 oct = UOctEncode(normal);
+				int16_t q[2] = {USnorm16(oct.x), USnorm16(oct.y)};
+				memcpy(out + attribute.offset, q, sizeof(q));
+			}
+			else if (options.normal == NORMAL_2_10_10_10)
+			{
+				uint32_t q = UPack2101010(normal);
+				memcpy(out + attribute.offset, &q, sizeof(q));
+			}
+			else
+			{
+				memcpy(out + attribute.offset, &normal[0], 3 * sizeof(float));
+			}
+		}
+
+		if (uvIn)
+		{
+			const MeshAttribute &attribute = packed.attributes[uvIndex];
+			glm::vec2 uv(read(uvIn, v, 0), read(uvIn, v, 1));
+
+			if (options.uv == UV_HALF)
+			{
+				uint16_t q[2] = {UFloatToHalf(uv.x), UFloatToHalf(uv.y)};
+				memcpy(out + attribute.offset, q, sizeof(q));
+			}
+			else if (options.uv == UV_UNORM16)
+			{
+				uint16_t q[2];
+				for (int axis = 0; axis < 2; axis++)
+					q[axis] = decode.uvScale[axis] > 0.0f ? UUnorm16((uv[axis] - uvMin[axis]) / decode.uvScale[axis]) : 0;
+				memcpy(out + attribute.offset, q, sizeof(q));
+			}
+			else
+			{
+				memcpy(out + attribute.offset, &uv[0], 2 * sizeof(float));
+			}
+		}
+
+		for (size_t i = 0; i < extraIn.size(); i++)
+			memcpy(out + packed.attributes[extraIndex + i].offset, &source.vertices[v * source.vertexStride + extraIn[i]->offset], extraIn[i]->components * sizeof(float));
+	}
+
+	return true;
+}
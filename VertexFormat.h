@@ -0,0 +1,62 @@
+/*
+ * VertexFormat.h
+ *
+ *  Compressed vertex layouts: quantized positions, packed normals and half / unorm16 texture coordinates
+ */
+
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <string>
+#include <GL/glew.h>
+#include <GL/glm/glm.hpp>
+
+#include "MeshFile.h"
+
+/* Storage of each vertex attribute */
+enum PositionFormat
+{
+	POSITION_FLOAT,	  // 3 x float, 12 bytes
+	POSITION_UNORM16, // 3 x unorm16 relative to the mesh bounds, 8 bytes with padding
+};
+
+enum NormalFormat
+{
+	NORMAL_FLOAT,		// 3 x float, 12 bytes
+	NORMAL_OCT16,		// octahedral mapping in 2 x snorm16, 4 bytes
+	NORMAL_2_10_10_10,	// GL_INT_2_10_10_10_REV, 4 bytes
+};
+
+enum UvFormat
+{
+	UV_FLOAT,	// 2 x float, 8 bytes
+	UV_HALF,	// 2 x half float, 4 bytes
+	UV_UNORM16, // 2 x unorm16 relative to the texture coordinate range, 4 bytes
+};
+
+/* Command line options selecting the chair's vertex layout */
+struct VertexFormatOptions
+{
+	PositionFormat position = POSITION_FLOAT; // --position-format float|unorm16
+	NormalFormat normal = NORMAL_FLOAT;		  // --normal-format float|oct|2_10_10_10
+	UvFormat uv = UV_FLOAT;					  // --uv-format float|half|unorm16
+	bool benchmark = false;					  // --vertex-benchmark runs the headless path once per layout
+};
+
+/* Constants the object and lamp vertex shaders use to undo the quantization, passed in the Frame uniform block */
+struct VertexDecode
+{
+	glm::vec3 positionScale = glm::vec3(1.0f); // position = positionOffset + stored * positionScale
+	glm::vec3 positionOffset = glm::vec3(0.0f);
+	glm::vec2 uvScale = glm::vec2(1.0f); // uv = uvOffset + stored * uvScale
+	glm::vec2 uvOffset = glm::vec2(0.0f);
+	GLint octNormals = 0; // normals are stored octahedral and need unfolding
+};
+
+bool UParseVertexFormatArgs(int argc, char *argv[], VertexFormatOptions &options);
+std::string UVertexFormatName(const VertexFormatOptions &options);
+bool UIsFloatLayout(const MeshData &mesh);
+bool UIsPackedFloatLayout(const MeshData &mesh); // packing it with the float formats would only copy it
+bool UPackVertices(const MeshData &source, const VertexFormatOptions &options, MeshData &packed, VertexDecode &decode);
+
+#endif